@@ -48,9 +48,12 @@ namespace BuiltIns {
 	extern void _f_fopen(Context* context);
 	extern void _f_fread(Context* context);
 	extern void _f_fwrite(Context* context);
+	extern void _f_fwritev(Context* context);
 	extern void _f_fseek(Context* context);
 	extern void _f_feof(Context* context);
 	extern void _f_fclose(Context* context);
+	extern void _f_mmap_open(Context* context);
+	extern void _f_mmap_advise(Context* context);
 
 	// Filesystem utilities
 	extern void _f_file_exists(Context* context);
@@ -79,9 +82,45 @@ namespace BuiltIns {
 	extern void _f_socket_accept(Context* context);
 	extern void _f_socket_read(Context* context);
 	extern void _f_socket_readline(Context* context);
+	extern void _f_socket_read_until(Context* context);
 	extern void _f_socket_write(Context* context);
+	extern void _f_socket_sendfile(Context* context);
+	extern void _f_socket_send_range(Context* context);
 	extern void _f_socket_eof(Context* context);
 	extern void _f_socket_close(Context* context);
+	extern void _f_socket_open_timeout(Context* context);
+	extern void _f_socket_set_timeout(Context* context);
+	extern void _f_socket_writev(Context* context);
+	extern void _f_socket_pool_get(Context* context);
+	extern void _f_socket_pool_release(Context* context);
+	extern void _f_socket_pool_options(Context* context);
+	extern void _f_socket_listen_prefork(Context* context);
+	extern void _f_poll_handles(Context* context);
+	extern void _f_unix_listen(Context* context);
+	extern void _f_unix_connect(Context* context);
+	extern void _f_socketpair(Context* context);
+	extern void _f_socket_send_handle(Context* context);
+	extern void _f_socket_recv_handle(Context* context);
+	extern void _f_udp_open(Context* context);
+	extern void _f_udp_bind(Context* context);
+	extern void _f_udp_send(Context* context);
+	extern void _f_udp_send_many(Context* context);
+	extern void _f_udp_recv(Context* context);
+	extern void _f_udp_recv_many(Context* context);
+	extern void _f_udp_close(Context* context);
+	extern void _f_socket_accept_async(Context* context);
+	extern void _f_socket_read_async(Context* context);
+	extern void _f_socket_write_async(Context* context);
+	extern void _f_timer_after(Context* context);
+	extern void _f_event_loop_run(Context* context);
+
+	// HTTP server
+	extern void _f_http_serve(Context* context);
+
+	// HTTP client
+	extern void _f_http_request(Context* context);
+	extern void _f_http_body_read(Context* context);
+	extern void _f_http_body_close(Context* context);
 
 	// Memory functions
 	extern void _f_length(Context* Context);
@@ -121,6 +160,33 @@ namespace BuiltIns {
 	extern void _f_dictionary_new(Context* Context);
 	extern void _f_dictionary_get(Context* Context);
 	extern void _f_dictionary_set(Context* Context);
+	extern void _f_dictionary_has(Context* context);
+	extern void _f_dictionary_delete(Context* context);
+	extern void _f_dictionary_keys(Context* context);
+	extern void _f_dictionary_values(Context* context);
+	extern void _f_dictionary_size_hint(Context* context);
+	extern void _f_dictionary_merge(Context* context);
+
+	// Shared dictionary functions
+	extern void _f_shared_dictionary_new(Context* context);
+	extern void _f_shared_dictionary_get(Context* context);
+	extern void _f_shared_dictionary_set(Context* context);
+	extern void _f_shared_dictionary_has(Context* context);
+	extern void _f_shared_dictionary_delete(Context* context);
+	extern void _f_shared_dictionary_increment(Context* context);
+	extern void _f_shared_dictionary_compare_and_set(Context* context);
+	extern void _f_shared_dictionary_get_or_insert(Context* context);
+	extern void _f_shared_dictionary_snapshot(Context* context);
+	extern void _f_shared_dictionary_free(Context* context);
+
+	// Set functions
+	extern void _f_set_new(Context* context);
+	extern void _f_set_add(Context* context);
+	extern void _f_set_has(Context* context);
+	extern void _f_set_remove(Context* context);
+	extern void _f_set_union(Context* context);
+	extern void _f_set_intersect(Context* context);
+	extern void _f_set_difference(Context* context);
 
 	// Array manipulation 
 	extern void _f_array_append(Context* Context);
@@ -131,7 +197,28 @@ namespace BuiltIns {
 	extern void _f_array_find(Context* Context);
 	extern void _f_array_perform(Context* Context);
 	extern void _f_array_sort(Context* Context);
+	extern void _f_array_sort_strings(Context* Context);
 	extern void _f_array_custom_sort(Context* Context);
+	extern void _f_array_custom_sort_stable(Context* Context);
+	extern void _f_array_sort_by(Context* Context);
+
+	// Parallel array functions
+	extern void _f_array_parallel_map(Context* context);
+	extern void _f_array_parallel_filter(Context* context);
+	extern void _f_array_parallel_reduce(Context* context);
+
+	// Workers and channels
+	extern void _f_spawn(Context* context);
+	extern void _f_channel_new(Context* context);
+	extern void _f_channel_send(Context* context);
+	extern void _f_channel_recv(Context* context);
+	extern void _f_channel_try_recv(Context* context);
+	extern void _f_channel_close(Context* context);
+
+	// Green threads
+	extern void _f_go(Context* context);
+	extern void _f_yield(Context* context);
+	extern void _f_join(Context* context);
 
 	// Array manipulation (stacks, queues)
 	extern void _f_array_pop(Context* Context);
@@ -141,6 +228,16 @@ namespace BuiltIns {
 	extern void _f_array_push_front(Context* Context);
 	extern void _f_array_peek_front(Context* Context);	
 
+	// Vectorized numeric array functions
+	extern void _f_array_sum(Context* context);
+	extern void _f_array_min(Context* context);
+	extern void _f_array_max(Context* context);
+	extern void _f_array_dot(Context* context);
+	extern void _f_array_add(Context* context);
+	extern void _f_array_mul(Context* context);
+	extern void _f_array_scale(Context* context);
+	extern void _f_array_mask(Context* context);
+
 	// Stack manipulation
 	extern void _f_swp(Context* context);
 	extern void _f_dmp(Context* context);
@@ -160,7 +257,9 @@ namespace BuiltIns {
 	extern void _f_eval(Context* Context);
 	extern void _f_uneval(Context* Context);	
 	extern void _f_fork(Context* Context);
+	extern void _f_parallel_do(Context* context);
 	extern void _f_sleep(Context* context);
+	extern void _f_with_deadline(Context* context);
 	extern void _f_system(Context* context);
 	extern void _f_exec(Context* context);
 	extern void _f_exec_readline(Context* context);
@@ -238,19 +337,4 @@ namespace BuiltIns {
 	extern void _f_random_float(Context* context);
 };
 
-class RandomNumber
-{
-    public:
-		boost::random::mt11213b generator;
-        static RandomNumber& getInstance()
-        {
-            static RandomNumber instance;
-            return instance;
-        }
-    private:
-		RandomNumber() {generator.seed(time(NULL));  }
-        RandomNumber(RandomNumber const&);   // Don't Implement.
-        void operator=(RandomNumber const&); // Don't implement
- };
-
 #endif
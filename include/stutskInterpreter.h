@@ -44,7 +44,7 @@ typedef long long  stutskInteger;
 
 enum stutskTokenType {
 	T_EMPTY, T_OPERATOR, T_FUNCCALL, T_VARIABLE, T_INTEGER, T_BOOL, T_FLOAT,
-	T_STRING, T_CODEBLOCK, T_ARRAY, T_DICTIONARY, T_HANDLE
+	T_STRING, T_CODEBLOCK, T_ARRAY, T_DICTIONARY, T_HANDLE, T_SET, T_STRING_VIEW
 };
 
 enum OperatorType {
@@ -114,6 +114,13 @@ typedef boost::shared_ptr<std::string> StringPtr;
 typedef boost::shared_ptr<TokenList> TokenListPtr;
 typedef boost::shared_ptr<TokenMap> TokenMapPtr;
 
+class TokenDictionary;
+typedef boost::shared_ptr<TokenDictionary> TokenDictionaryPtr;
+class TokenSet;
+typedef boost::shared_ptr<TokenSet> TokenSetPtr;
+class MappedFile;
+typedef boost::shared_ptr<MappedFile> MappedFilePtr;
+
 class ParseContext;
 
 struct DebugInfo {
@@ -124,8 +131,7 @@ struct DebugInfo {
 	long relativePos;
 };
 
-extern DebugInfo errorToken;
-extern vector<ParseContext> parseContexts;
+class Interpreter;
 
 class StutskException {
 
@@ -135,9 +141,15 @@ public:
 		  int line_number, ParseContext* context);
 
 	  string getMessage() const;
+	  ExceptionType getType() const;
 	  long getLineNumber() const;
 	  string getFileName() const;
+	  const ParseContext* getParseContext() const;
 	  string getFormattedMessage() const;
+
+	  // Exceptions thrown by builtins are located at the token being executed by Context::run
+	  bool hasLocation() const;
+	  void setLocation(int line_number, const ParseContext* context);
 private:
 	string msg_;
 	ExceptionType type_;
@@ -148,26 +160,14 @@ private:
 class ParseContext {
 private:
 	size_t id_;
+	friend class Interpreter;
 public:
-	size_t id()
+	size_t id() const
 	{
 		return id_;
 	};
 	string SourceCode;
 	string FileName;
-	static ParseContext* newContext()
-	{
-		parseContexts.push_back(ParseContext());
-		parseContexts.back().id_ = parseContexts.size()-1;
-		return &parseContexts.back();
-	};
-
-	static const ParseContext& get_by_id(size_t id)
-	{
-		if (id >= parseContexts.size())
-			throw StutskException(ET_CUSTOM, "Invalid parser context ID");
-		return parseContexts.at(id);
-	}
 };
 
 
@@ -177,7 +177,9 @@ struct Token {
 
 	StringPtr asString;
 	TokenListPtr asTokenList;
-	TokenMapPtr asDictionary;
+	TokenDictionaryPtr asDictionary;
+	TokenSetPtr asSet;
+	MappedFilePtr asMapping; // T_STRING_VIEW, the range is in data.asView
 
 	union _un_TokenData {
 		OperatorType operatorType;
@@ -197,6 +199,13 @@ struct Token {
 
 		asHandle;
 
+		struct _un_View {
+			size_t offset;
+			size_t length;
+		}
+
+		asView;
+
 		stutskInteger asInteger;
 		bool asBool;
 		stutskFloat asFloat;
@@ -211,6 +220,150 @@ struct Token {
 	Token(stutskTokenType ttype = T_EMPTY) : tokenType (ttype) {};
 };
 
+/* DictionaryKey - a dictionary or set key in its canonical form. Keys are soft-typed like the
+     rest of the language, so `1` and "1" (or TRUE and "TRUE") address the same dictionary slot.
+	 Strings that are the canonical representation of an integer are thus stored as integers and
+	 "TRUE"/"FALSE" as booleans, so that integer keys can be hashed and compared without
+	 formatting them. Sets follow `==` instead, so their members are canonicalized by numeric
+	 value where possible (see TokenSet). */
+struct DictionaryKey {
+	enum KeyType { KT_INTEGER, KT_BOOL, KT_FLOAT, KT_STRING };
+
+	KeyType type;
+	union {
+		stutskInteger asInteger; // also holds booleans
+		stutskFloat asFloat;
+	};
+	string asString;
+
+	Token toToken() const;
+	string toString() const;
+};
+
+struct HashKeyRef;
+
+/* OrderedHashTable - an insertion-ordered open addressing hash table of DictionaryKeys.
+     Entries are stored densely in insertion order and the slot table only holds their indices,
+	 so iteration order is stable. Hashes are cached in entries, so keys are never rehashed
+	 when the table grows and most failed comparisons don't touch the key at all. 
+	 It is only instantiated for DictionaryEntry and SetEntry (in tokenDictionary.cpp). */
+template <class EntryType>
+class OrderedHashTable {
+public:
+	typedef EntryType Entry;
+
+	/* Iterators hold an index rather than a pointer, so they stay valid (if not exact)
+	     when the table is modified while it is being iterated. */
+	class const_iterator {
+	private:
+		const OrderedHashTable* table_;
+		size_t index_;
+		void skipDeleted()
+		{
+			while (index_ < table_->entries_.size() && table_->entries_[index_].deleted)
+				++index_;
+		}
+	public:
+		const_iterator(const OrderedHashTable* table, size_t index) : table_(table), index_(index)
+		{ skipDeleted(); }
+		const Entry& operator*() const { return table_->entries_[index_]; }
+		const Entry* operator->() const { return &table_->entries_[index_]; }
+		const_iterator& operator++() { ++index_; skipDeleted(); return *this; }
+		bool operator==(const const_iterator& other) const
+		{ return index_ >= table_->entries_.size() ? other.index_ >= table_->entries_.size() : index_ == other.index_; }
+		bool operator!=(const const_iterator& other) const { return !(*this == other); }
+	};
+
+	OrderedHashTable() : size_(0), used_(0) {}
+
+	size_t size() const { return size_; }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, entries_.size()); }
+
+	void reserve(size_t count);
+
+protected:
+	vector<Entry> entries_;
+	vector<size_t> slots_;
+	size_t size_;  // live entries
+	size_t used_;  // slots that are not empty (live entries and tombstones)
+
+	Entry* findEntry(const HashKeyRef& key);
+	Entry& insert(const HashKeyRef& key, bool& inserted);
+	bool erase(const HashKeyRef& key);
+
+private:
+	size_t findSlot(const HashKeyRef& key) const;
+	void rebuild(size_t capacity);
+};
+
+struct DictionaryEntry {
+	size_t hash;
+	bool deleted;
+	DictionaryKey key;
+	Token value;
+};
+
+struct SetEntry {
+	size_t hash;
+	bool deleted;
+	DictionaryKey key;
+};
+
+/* TokenDictionary - the hash table backing T_DICTIONARY */
+class TokenDictionary : public OrderedHashTable<DictionaryEntry> {
+	friend class SharedDictionary;
+public:
+	Token* find(const Token& key);
+	Token& operator[](const Token& key);
+	Token& operator[](const DictionaryKey& key);
+	bool erase(const Token& key);
+};
+
+/* TokenSet - the hash table backing T_SET. Membership follows the soft-typed `==`: numbers are
+     members by value whatever their type (1, 1.0, "1" and TRUE are the same member), other
+	 strings by their contents. Members are stored (and enumerated) in this canonical form. */
+class TokenSet : public OrderedHashTable<SetEntry> {
+public:
+	bool contains(const Token& value);
+	bool contains(const DictionaryKey& value);
+	bool insert(const Token& value);
+	bool insert(const DictionaryKey& value);
+	bool erase(const Token& value);
+};
+
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+/* SharedDictionary - a dictionary that can be used by several interpreters at once (the handle
+     behind shared_dictionary_new). Keys are spread over independently locked shards by their
+	 hash, so updates of different keys rarely contend. Every operation is atomic; values are
+	 stored and returned as independent copies, so no mutable object is ever shared. */
+class SharedDictionary : boost::noncopyable {
+public:
+	static const size_t SHARD_BITS = 6;
+
+	bool get(const Token& key, Token& value);
+	void set(const Token& key, const Token& value);
+	bool erase(const Token& key);
+	// Adds `delta` to the value of `key` (a missing key counts as 0) and returns the sum
+	Token increment(const Token& key, const Token& delta);
+	bool compareAndSet(const Token& key, const Token& expected, const Token& value);
+	// Returns the value of `key`, first setting it to `value` if it is missing
+	Token getOrInsert(const Token& key, const Token& value);
+	TokenDictionaryPtr snapshot();
+
+private:
+	struct Shard {
+		boost::mutex mutex;
+		TokenDictionary dictionary;
+	};
+
+	Shard shards_[1 << SHARD_BITS];
+
+	Shard& shardFor(const HashKeyRef& key);
+};
+
 // Filename and number of the last OPERATOR or FUNCTION executed - used for debugging
 
 class Parser {
@@ -246,12 +399,15 @@ public:
 
 namespace BuiltIns {
 	extern BuiltinFunctionsMap populateFunctions();
+	// Waits for the workers started with spawn to finish, after closing all channels if asked to
+	extern void joinSpawnedWorkers(bool closeChannels = false);
 	// Debugging functions
 	extern string dumpTokens(TokenList& tokens, int niveau = 0);
 	extern string dumpTokens(TokenStack& tokens, int niveau = 0);
 	extern string dumpValue(Token& token, int niveau = 0, int i = 0);
 	extern string dumpVariables(Context &context);
-	extern string dumpDictionary(TokenMap& tokenMap, int niveau = 0);
+	extern string dumpDictionary(TokenDictionary& dictionary, int niveau = 0);
+	extern string dumpSet(TokenSet& set, int niveau = 0);
 	extern string dumpValue(Token& token, int niveau, string i); 
 	extern string tokenType(stutskTokenType type);
 };
@@ -266,13 +422,18 @@ namespace Operators {
 
 class Context : boost::noncopyable {
 public:
+	Interpreter& interpreter;
+	TokenStack& stack; // interpreter.stack
 	string functionName; // __main for a main
 	TokenMap variables;    
 	// functions should copy their definition to the context for anonymous recursion
 	Context *parentContext;
 	const TokenList& sourceCode;
 	VariableScopeMap variableScopeMap;
-	Context(const TokenList& source, Context *parent) : parentContext(parent), sourceCode(source) { } 
+	Context(const TokenList& source, Context *parent) : interpreter(parent->interpreter),
+		stack(parent->stack), parentContext(parent), sourceCode(source) { } 
+	Context(const TokenList& source, Interpreter& owner);
+	Context(const TokenList& source, Interpreter& owner, TokenStack& ownStack);
 	VariableScope findVariableScope(string variableName);
 	void run();
 	void run(const TokenList& source, string blockFunction);
@@ -295,6 +456,36 @@ bool toString(const T& input, string &output) {
 	}
 }
 
+/* MappedFile - a file mapped read-only into memory by mmap_open. T_STRING_VIEW tokens are 
+     ranges of it that share it through asMapping, so it is unmapped when the last one goes away. */
+class MappedFile : boost::noncopyable {
+public:
+	explicit MappedFile(const string& fileName);
+	~MappedFile();
+
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	char* data_;
+	size_t size_;
+};
+
+/* StringRef - the characters of a string-like token. Strings and string views are referenced
+     in place, so large ones are not copied, other tokens are converted with giveString. The 
+	 reference keeps the characters alive. */
+struct StringRef {
+	const char* data;
+	size_t size;
+
+	explicit StringRef(const Token& token);
+	string str() const { return string(data, size); }
+
+private:
+	StringPtr holder_;
+	MappedFilePtr mapping_;
+};
+
 extern string extractFileName(const string& fn);
 
 extern void getNth(Token &newToken, stutskInteger i);
@@ -308,63 +499,73 @@ extern stutskFloat   giveFloat(const Token& token);
 extern bool          giveBool(const Token& token);
 extern void          giveStringCopy(const Token& token, string& str);
 extern StringPtr     giveString(const Token& token);
+extern Token         stringToken(const string& value);
+extern Token         headerDictionary(const vector<pair<string, string> >& headers);
 
 // ------------------------- GLOBAL VARIABLES ------------------------------ //
 
+// Everything else is per-interpreter state (see Interpreter). These are shared, as they are either
+// immutable or only set up at startup.
 extern StringMapCI environmentVars;
-extern UserFunctionsMap userFunctions;
 extern BuiltinFunctionsMap builtinFunctions;
 extern OperatorMap stutskOperators;
-extern TokenStack stutskStack;
-extern Context *mainContext;
-extern OperatorType exitVar;
 extern vector<string> includePaths;
 extern vector<string> customArguments;
+// Number of worker threads of parallel functions (--threads)
+extern unsigned int workerThreads;
 extern Token copy_token(Token token);
 
 // ------------------------- STACK SHORTHANDS ------------------------------ //
 
-inline Token stack_back_safe()
+inline Token stack_back_safe(Context* context)
 {
-	if (stutskStack.empty()) throw StutskException(ET_ERROR, "Stack is empty");
-	return stutskStack.back();
+	if (context->stack.empty()) throw StutskException(ET_ERROR, "Stack is empty");
+	return context->stack.back();
 }
 
-inline void pushFloat(stutskFloat a) {
+inline void pushFloat(Context* context, stutskFloat a) {
 	Token newToken(T_FLOAT);
 	newToken.data.asFloat = a;
-	stutskStack.push_back(newToken);
+	context->stack.push_back(newToken);
 }
 
-inline void pushInteger(stutskInteger a) {
+inline void pushInteger(Context* context, stutskInteger a) {
 	Token newToken(T_INTEGER);
 	newToken.data.asInteger = a;
-	stutskStack.push_back(newToken);
+	context->stack.push_back(newToken);
 }
 
-inline void pushBool(bool a) {
+inline void pushBool(Context* context, bool a) {
 	Token newToken(T_BOOL);
 	newToken.data.asBool = a;
-	stutskStack.push_back(newToken);
+	context->stack.push_back(newToken);
 }
 
-inline StringPtr pushString() {
+inline StringPtr pushString(Context* context) {
 	Token newToken(T_STRING);
 	newToken.asString = StringPtr(new string);
-	stutskStack.push_back(newToken);
+	context->stack.push_back(newToken);
 	return newToken.asString;
 }
 
+inline void pushStringView(Context* context, const MappedFilePtr& mapping, size_t offset, size_t length) {
+	Token newToken(T_STRING_VIEW);
+	newToken.asMapping = mapping;
+	newToken.data.asView.offset = offset;
+	newToken.data.asView.length = length;
+	context->stack.push_back(newToken);
+}
+
 // --------------------------------------------------------
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/integer.hpp>
-
-extern boost::asio::io_service io_service;
+#include <boost/random/mersenne_twister.hpp>
 
 class Debugger : boost::noncopyable {
 private:
+	Interpreter& interpreter_;
 	string debugger_hostname;
 	deque<Context*> contextStack;
 	int debugger_port;
@@ -378,17 +579,12 @@ private:
 	void read_message(void* data, size_t length);
 	template<typename T> void read_message(T& data);
 	template<class T> void dump_list(const T& tokens);
-	void dump_dictionary(const TokenMap& tokens);
+	void dump_dictionary(const TokenDictionary& tokens);
+	void dump_set(const TokenSet& tokens);
 	void dump_token(const Token& token);
 	void message_loop();
 	bool parse_message(boost::uint16_t message_id);
 public:
-	static Debugger& get_instance() 
-	{
-		static Debugger instance;
-		return instance;
-	};
-
 	bool is_debugging();
 	void connect(string hostname, int port);
 	void step();
@@ -396,8 +592,91 @@ public:
 	void step_out();
 	void disconnect();
 	
-	Debugger() : debugging(false) {};
+	Debugger(Interpreter& interpreter) : interpreter_(interpreter), debugging(false) {};
 	~Debugger();
 };
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/chrono.hpp>
+
+struct GreenThread;
+
+/* Scheduler - the cooperative green threads of an interpreter (see go). While there are several,
+     blocking builtins wait through the scheduler, which runs the other green threads in the
+	 meantime and multiplexes the descriptors they wait for with epoll. */
+class Scheduler : boost::noncopyable {
+public:
+	explicit Scheduler(Interpreter& interpreter);
+	~Scheduler();
+
+	// True while green threads are running, i.e. if waiting should go through the scheduler
+	bool active() const;
+
+	GreenThread* start(const TokenListPtr& codeblock, const TokenList& arguments);
+	void yield();
+	// Waits for `thread` to finish and frees it. Returns its result or rethrows its exception.
+	Token join(GreenThread* thread);
+	// Waits for all green threads, called when the main program finishes
+	void joinAll();
+
+	/* Waits until `fd` is readable or writable, but no longer than `timeout` milliseconds
+	     (negative for no limit) and never past the deadline. Returns false if time ran out.
+		 Other green threads run in the meantime. */
+	bool waitReady(int fd, bool write, stutskInteger timeout = -1);
+	// True if blocking I/O has to go through waitReady, i.e. if green threads are running or
+	// there is a timeout or deadline, rather than simply block
+	bool limited(stutskInteger timeout = -1) const;
+	void sleep(stutskInteger milliseconds);
+
+	// The deadline of the innermost with_deadline block of the current green thread
+	boost::chrono::steady_clock::time_point deadline() const;
+	void setDeadline(boost::chrono::steady_clock::time_point deadline);
+	// Throws if the deadline has passed
+	void checkDeadline() const;
+
+private:
+	struct Impl;
+	boost::scoped_ptr<Impl> impl_;
+};
+
+class ConnectionPool;
+class WorkerPool;
+
+/* Interpreter - the state of a running Stutsk program. Every Context references the interpreter it
+     runs in, so several interpreters can exist in one process, each used by one thread at a time.
+	 Builtin functions and operators are shared between them. */
+class Interpreter : boost::noncopyable {
+public:
+	TokenStack stack;
+	UserFunctionsMap userFunctions;
+	// Changed whenever a user function is defined or removed, so that copies can be refreshed
+	unsigned long functionsGeneration;
+	Context *mainContext;
+	OperatorType exitVar;
+	DebugInfo errorToken;
+	// A deque, so that pointers to parse contexts stay valid as new ones are added
+	deque<ParseContext> parseContexts;
+	boost::asio::io_service io_service;
+	// The context event_loop_run was called from - callbacks of asynchronous operations run in it
+	Context *eventLoopContext;
+	// Idle connections and cached DNS results of socket_pool_get, created on first use
+	boost::shared_ptr<ConnectionPool> connectionPool;
+	// The worker threads and interpreters of the parallel array functions, started on first use
+	boost::shared_ptr<WorkerPool> workerPool;
+	boost::random::mt11213b randomGenerator;
+	Debugger debugger;
+	Scheduler scheduler; // last, so that green threads are unwound before everything else
+
+	Interpreter();
+	// A worker interpreter for another thread, starting with copies of the user functions and
+	// parse contexts of `parent` and with its random generator seeded from the parent's
+	explicit Interpreter(Interpreter& parent);
+
+	ParseContext* newParseContext();
+	const ParseContext& parseContext(size_t id) const;
+
+	// Runs `sourceCode` in a new main context
+	void execute(const TokenList& sourceCode);
+};
+
 #endif
@@ -228,6 +228,7 @@ public:
     virtual ~exec_stream_buffer_t();
 
     void clear();
+    bool buffered();
 
 protected:
     virtual int_type underflow();
@@ -266,6 +267,11 @@ void exec_stream_buffer_t::clear()
     }
 }
 
+bool exec_stream_buffer_t::buffered()
+{
+    return m_kind!=exec_stream_t::s_in && gptr()!=egptr();
+}
+
 exec_stream_buffer_t::int_type exec_stream_buffer_t::underflow()
 {
     if( gptr()==egptr() ) {
@@ -67,6 +67,9 @@ public:
     std::istream & out();
     std::istream & err();
 
+    // true if reading from out() or err(), or writing to in(), would not have to wait
+    bool ready( stream_kind_t kind );
+
     typedef unsigned long error_code_t;
     
     class error_t : public std::exception {
@@ -516,6 +516,22 @@ void thread_buffer_t::get( exec_stream_t::stream_kind_t kind, char * dst, std::s
     }
 }
 
+bool thread_buffer_t::ready( exec_stream_t::stream_kind_t kind )
+{
+    if( !m_thread_started ) {
+        return false;
+    }
+    // the same events get() and put() wait for, but without waiting
+    int bits=kind|exec_stream_t::s_child;
+    if( kind==exec_stream_t::s_out ) {
+        bits|=s_out_eof;
+    }else if( kind==exec_stream_t::s_err ) {
+        bits|=s_err_eof;
+    }
+    wait_result_t wait_result=m_thread_responce.wait( bits, 0, 0 );
+    return wait_result.ok() && wait_result.is_signaled( bits );
+}
+
 void thread_buffer_t::put( char * src, std::size_t & size, bool & no_more )
 {
     if( !m_thread_started ) {
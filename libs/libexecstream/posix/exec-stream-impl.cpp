@@ -171,6 +171,17 @@ void exec_stream_t::set_wait_timeout( int stream_kind, timeout_t milliseconds )
     }
 }
 
+bool exec_stream_t::ready( stream_kind_t kind )
+{
+    if( kind==s_out && m_impl->m_out_buffer.buffered() ) {
+        return true;
+    }
+    if( kind==s_err && m_impl->m_err_buffer.buffered() ) {
+        return true;
+    }
+    return m_impl->m_thread.ready( kind );
+}
+
 void exec_stream_t::start( std::string const & program, std::string const & arguments )
 {
     if( !close() ) {
@@ -435,6 +435,21 @@ bool thread_buffer_t::abort_thread()
     return true;
 }
 
+bool thread_buffer_t::ready()
+{
+    if( m_direction==dir_none ) {
+        return false;
+    }
+    DWORD thread_exit_code;
+    if( !GetExitCodeThread( m_thread, &thread_exit_code ) || thread_exit_code!=STILL_ACTIVE ) {
+        return true;
+    }
+    // the same events get() and put() wait for, but without waiting
+    event_t & event= m_direction==dir_read ? m_got_data : m_want_data;
+    wait_result_t wait_result=wait( event, 0 );
+    return wait_result.ok() && wait_result.is_signaled( event );
+}
+
 void thread_buffer_t::get( exec_stream_t::stream_kind_t, char * dst, std::size_t & size, bool & no_more )
 {
     if( m_direction!=dir_read ) {
@@ -80,6 +80,18 @@ void exec_stream_t::set_buffer_limit( int stream_kind, std::size_t size )
     }
 }
 
+bool exec_stream_t::ready( stream_kind_t kind )
+{
+    if( kind==s_in ) {
+        return m_impl->m_in_thread.ready();
+    }else if( kind==s_out ) {
+        return m_impl->m_out_buffer.buffered() || m_impl->m_out_thread.ready();
+    }else if( kind==s_err ) {
+        return m_impl->m_err_buffer.buffered() || m_impl->m_err_thread.ready();
+    }
+    return false;
+}
+
 void exec_stream_t::set_wait_timeout( int stream_kind, exec_stream_t::timeout_t milliseconds )
 {
     if( stream_kind&s_in ) {
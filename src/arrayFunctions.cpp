@@ -18,11 +18,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <builtinFunctions.h>
 #include <algorithm>
+#include <functional>
 #include <boost/random.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 
 namespace BuiltIns {
 
-	void _f_array_append(Context* Context)
+	void _f_array_append(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> <T_ARRAY array2> array_append
 		   arguments: <T_VARIABLE array1> <T_ARRAY array2> array_append
@@ -32,10 +36,10 @@ namespace BuiltIns {
 		     otherwise it returns a concatenated array.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token2.tokenType == T_VARIABLE;
 
@@ -52,10 +56,10 @@ namespace BuiltIns {
 		token2.asTokenList->insert( token2.asTokenList->end(), token1.asTokenList->begin(), token1.asTokenList->end() );
 
 		if (!isVariable)
-			stutskStack.push_back(token2);
+			context->stack.push_back(token2);
 	}
 
-	void _f_array_insert(Context* Context)
+	void _f_array_insert(Context* context)
 	{
 		/* arguments: <T_ARRAY array2> <T_INTEGER pos> <T_ARRAY array1> array_append
 		   arguments: <T_ARRAY array2> <T_INTEGER pos> <T_VARIABLE array1> array_append
@@ -65,12 +69,12 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns the new array.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token3 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token3 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -84,10 +88,10 @@ namespace BuiltIns {
 		token1.asTokenList->insert(token1.asTokenList->begin()+pos,token3);
 
 		if (!isVariable)
-			stutskStack.push_back(token1); 
+			context->stack.push_back(token1); 
 	}
 
-	void _f_array_delete(Context* Context)
+	void _f_array_delete(Context* context)
 	{
 		/* arguments: <T_INTEGER pos> <T_ARRAY array1> array_append
 		   arguments: <T_INTEGER pos> <T_VARIABLE array1> array_append
@@ -97,10 +101,10 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -114,16 +118,380 @@ namespace BuiltIns {
 		token1.asTokenList->erase(token1.asTokenList->begin()+pos);
 
 		if (!isVariable)
-			stutskStack.push_back(token1); 
+			context->stack.push_back(token1); 
 	}
 
-	// Standard comparison function for array_sort
-	bool __tokenCompare (Token t1, Token t2)
-	{
-		return (tokenNumericCompare(t1,t2) == CN_LARGER);
+	namespace {
+		/* array_sort and array_sort_strings extract a sort key from every element once and sort
+		     (key, index) pairs, which are then used to permute the tokens. Comparisons never
+			 touch tokens, and ties are broken by index, so both sorts are stable. */
+
+		// Arrays shorter than this are always sorted on the calling thread
+		const size_t PARALLEL_SORT_THRESHOLD = 1 << 17;
+
+		// Buckets smaller than this are insertion sorted by the MSD string sort
+		const size_t STRING_SORT_CUTOFF = 32;
+		// Deeper buckets are sorted by comparison, so long common prefixes can't exhaust the stack
+		const size_t STRING_SORT_MAX_DEPTH = 64;
+
+		// Integer key with the sign bit flipped, so that it sorts correctly as unsigned
+		struct IntegerKey {
+			boost::uint64_t key;
+			size_t index;
+		};
+
+		struct NumericKey {
+			bool isFloat;
+			stutskInteger asInteger;
+			stutskFloat asFloat;
+			size_t index;
+		};
+
+		struct StringKey {
+			const string* value;
+			size_t index;
+		};
+
+		struct IntegerKeyLess {
+			bool operator() (const IntegerKey& a, const IntegerKey& b) const
+			{ return a.key < b.key || (a.key == b.key && a.index < b.index); }
+		};
+
+		// Compares like tokenNumericCompare. NaNs are ordered after all numbers.
+		struct NumericKeyLess {
+			bool operator() (const NumericKey& a, const NumericKey& b) const
+			{
+				if (!a.isFloat && !b.isFloat) {
+					if (a.asInteger != b.asInteger)
+						return a.asInteger < b.asInteger;
+				}
+				else {
+					stutskFloat fa = a.isFloat ? a.asFloat : (stutskFloat)a.asInteger;
+					stutskFloat fb = b.isFloat ? b.asFloat : (stutskFloat)b.asInteger;
+					bool aNaN = fa != fa, bNaN = fb != fb;
+					if (aNaN != bNaN)
+						return bNaN;
+					if (!aNaN && fa != fb)
+						return fa < fb;
+				}
+				return a.index < b.index;
+			}
+		};
+
+		struct StringKeyLess {
+			bool operator() (const StringKey& a, const StringKey& b) const
+			{
+				int result = a.value->compare(*b.value);
+				return result < 0 || (result == 0 && a.index < b.index);
+			}
+		};
+
+		inline boost::uint64_t integerSortKey(stutskInteger value)
+		{
+			return (boost::uint64_t)value ^ ((boost::uint64_t)1 << 63);
+		}
+
+		inline stutskInteger integerFromSortKey(boost::uint64_t key)
+		{
+			return (stutskInteger)(key ^ ((boost::uint64_t)1 << 63));
+		}
+
+		inline boost::uint64_t radixKey(const IntegerKey& item) { return item.key; }
+		inline boost::uint64_t radixKey(boost::uint64_t item) { return item; }
+
+		/* radixSort - LSD radix sort of integer keys, 11 bits per pass. Passes in which all keys
+		     have the same digit (common for small ranges) are skipped. */
+		template <class Item>
+		void radixSort(Item* items, Item* scratch, size_t count)
+		{
+			const int DIGIT_BITS = 11;
+			const int DIGITS = (64 + DIGIT_BITS - 1) / DIGIT_BITS;
+			const size_t BUCKETS = 1 << DIGIT_BITS;
+
+			if (count < 2)
+				return;
+
+			vector<size_t> histogram(DIGITS * BUCKETS, 0);
+			for (size_t i = 0; i < count; ++i) {
+				boost::uint64_t key = radixKey(items[i]);
+				for (int digit = 0; digit < DIGITS; ++digit)
+					++histogram[digit * BUCKETS + ((key >> (digit * DIGIT_BITS)) & (BUCKETS - 1))];
+			}
+
+			Item* source = items;
+			Item* destination = scratch;
+			for (int digit = 0; digit < DIGITS; ++digit) {
+				size_t* counts = &histogram[digit * BUCKETS];
+				int shift = digit * DIGIT_BITS;
+				if (counts[(radixKey(source[0]) >> shift) & (BUCKETS - 1)] == count)
+					continue;
+
+				size_t offset = 0;
+				for (size_t i = 0; i < BUCKETS; ++i) {
+					size_t bucket = counts[i];
+					counts[i] = offset;
+					offset += bucket;
+				}
+				for (size_t i = 0; i < count; ++i)
+					destination[counts[(radixKey(source[i]) >> shift) & (BUCKETS - 1)]++] = source[i];
+				std::swap(source, destination);
+			}
+
+			if (source != items)
+				std::copy(source, source + count, items);
+		}
+
+		// The scratch buffer is only there for the signature sortKeys expects, std::sort needs none
+		void numericSort(NumericKey* items, NumericKey* /* scratch */, size_t count)
+		{
+			std::sort(items, items + count, NumericKeyLess());
+		}
+
+		// Character at `depth` plus one, or zero if the string ends before it
+		inline int characterAt(const StringKey& item, size_t depth)
+		{
+			return depth < item.value->size() ? (unsigned char)(*item.value)[depth] + 1 : 0;
+		}
+
+		// Compares two strings with a common prefix of `depth` characters
+		inline bool suffixLess(const StringKey& a, const StringKey& b, size_t depth)
+		{
+			int result = a.value->compare(depth, string::npos, *b.value, depth, string::npos);
+			return result < 0 || (result == 0 && a.index < b.index);
+		}
+
+		/* msdStringSort - MSD radix sort of strings that share the first `depth` characters. Strings
+		     that end at `depth` go first, so the result is in lexicographic (byte) order. */
+		void msdStringSort(StringKey* items, StringKey* scratch, size_t count, size_t depth)
+		{
+			while (count >= STRING_SORT_CUTOFF && depth < STRING_SORT_MAX_DEPTH) {
+				size_t counts[258] = {0};
+				for (size_t i = 0; i < count; ++i)
+					++counts[characterAt(items[i], depth) + 1];
+
+				// Skip characters common to all strings without recursing
+				if (counts[characterAt(items[0], depth) + 1] == count) {
+					if (characterAt(items[0], depth) == 0)
+						return;
+					++depth;
+					continue;
+				}
+
+				for (int i = 1; i < 258; ++i)
+					counts[i] += counts[i - 1];
+				for (size_t i = 0; i < count; ++i)
+					scratch[counts[characterAt(items[i], depth)]++] = items[i];
+				std::copy(scratch, scratch + count, items);
+
+				// counts[c] is now the end of bucket c. Bucket 0 holds equal strings already in order.
+				for (int c = 1; c < 257; ++c) {
+					size_t begin = counts[c - 1];
+					if (counts[c] - begin > 1)
+						msdStringSort(items + begin, scratch + begin, counts[c] - begin, depth + 1);
+				}
+				return;
+			}
+
+			if (count < STRING_SORT_CUTOFF) {
+				for (size_t i = 1; i < count; ++i) {
+					StringKey item = items[i];
+					size_t j = i;
+					for (; j > 0 && suffixLess(item, items[j - 1], depth); --j)
+						items[j] = items[j - 1];
+					items[j] = item;
+				}
+			}
+			else
+				std::sort(items, items + count, StringKeyLess());
+		}
+
+		void stringSort(StringKey* items, StringKey* scratch, size_t count)
+		{
+			msdStringSort(items, scratch, count, 0);
+		}
+
+		template <class Key, class Less>
+		void mergeRuns(Key* first, Key* middle, Key* last, Key* output, Less less)
+		{
+			std::merge(first, middle, middle, last, output, less);
+		}
+
+		/* sortKeys - sorts `keys` with `sortRun`. Large arrays are split into a run per worker thread
+		     (see --threads), runs are sorted in parallel and then merged pairwise, each round of merges
+			 also in parallel. */
+		template <class Key, class Less>
+		void sortKeys(vector<Key>& keys, void (*sortRun)(Key*, Key*, size_t), Less less)
+		{
+			size_t count = keys.size();
+			vector<Key> scratch(count);
+
+			size_t runs = 1;
+			if (count >= PARALLEL_SORT_THRESHOLD)
+				runs = std::min<size_t>(workerThreads,
+					count / (PARALLEL_SORT_THRESHOLD / 2));
+
+			if (runs <= 1) {
+				sortRun(keys.data(), scratch.data(), count);
+				return;
+			}
+
+			vector<size_t> bounds(runs + 1);
+			for (size_t run = 0; run <= runs; ++run)
+				bounds[run] = count * run / runs;
+
+			boost::thread_group sorters;
+			for (size_t run = 0; run < runs; ++run)
+				sorters.create_thread(boost::bind(sortRun, &keys[bounds[run]], &scratch[bounds[run]],
+					bounds[run + 1] - bounds[run]));
+			sorters.join_all();
+
+			Key* source = keys.data();
+			Key* destination = scratch.data();
+			while (bounds.size() > 2) {
+				vector<size_t> merged;
+				boost::thread_group mergers;
+				for (size_t run = 0; run + 1 < bounds.size(); run += 2) {
+					merged.push_back(bounds[run]);
+					if (run + 2 < bounds.size())
+						mergers.create_thread(boost::bind(&mergeRuns<Key, Less>, source + bounds[run],
+							source + bounds[run + 1], source + bounds[run + 2], destination + bounds[run], less));
+					else
+						std::copy(source + bounds[run], source + bounds[run + 1], destination + bounds[run]);
+				}
+				merged.push_back(count);
+				mergers.join_all();
+
+				std::swap(source, destination);
+				bounds.swap(merged);
+			}
+
+			if (source != keys.data())
+				std::copy(source, source + count, keys.data());
+		}
+
+		// Reorders `tokens` so that the token at keys[i].index ends up at position i
+		template <class Key>
+		void applyOrder(TokenList& tokens, const vector<Key>& keys)
+		{
+			TokenList sorted;
+			sorted.reserve(tokens.size());
+			for (typename vector<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+				sorted.push_back(std::move(tokens[it->index]));
+			tokens.swap(sorted);
+		}
+
+		bool sortByNumericKeys(TokenList& tokens, const TokenList& keys, bool strict);
+
+		/* sortNumeric - sorts tokens by numeric value. Integer arrays (the common case) are radix
+		     sorted, anything with floats falls back to a comparison sort on pre-parsed keys. */
+		void sortNumeric(TokenList& tokens)
+		{
+			size_t count = tokens.size();
+
+			// Plain T_INTEGER tokens only differ in value, so there is no need to track where
+			// each of them came from. The sorted values are simply written back.
+			bool plainIntegers = true;
+			for (TokenList::const_iterator it = tokens.begin(); it != tokens.end(); ++it)
+				if (it->tokenType != T_INTEGER) {
+					plainIntegers = false;
+					break;
+				}
+
+			if (plainIntegers) {
+				vector<boost::uint64_t> values(count);
+				for (size_t i = 0; i < count; ++i)
+					values[i] = integerSortKey(tokens[i].data.asInteger);
+				sortKeys(values, &radixSort<boost::uint64_t>, std::less<boost::uint64_t>());
+				for (size_t i = 0; i < count; ++i)
+					tokens[i].data.asInteger = integerFromSortKey(values[i]);
+				return;
+			}
+
+			sortByNumericKeys(tokens, tokens, true);
+		}
+
+		/* sortByNumericKeys - sorts `tokens` by the numeric value of the corresponding tokens in `keys`.
+		     If a key is not numeric, it either throws or returns false without changing anything. */
+		bool sortByNumericKeys(TokenList& tokens, const TokenList& keys, bool strict)
+		{
+			size_t count = keys.size();
+			vector<IntegerKey> integerKeys;
+			vector<NumericKey> numericKeys;
+			integerKeys.reserve(count);
+
+			stutskInteger intV = 0;
+			stutskFloat floatV = 0;
+			string stringV;
+			bool hasFloats = false;
+
+			for (size_t i = 0; i < count; ++i) {
+				const Token& token = keys[i];
+				GCDType type;
+
+				// Common types are handled inline, giveGCD is only needed for strings and references
+				switch (token.tokenType) {
+				case T_INTEGER: intV = token.data.asInteger; type = NT_INTEGER; break;
+				case T_BOOL:    intV = token.data.asBool ? 1 : 0; type = NT_INTEGER; break;
+				case T_FLOAT:   floatV = token.data.asFloat; type = NT_FLOAT; break;
+				default:        type = giveGCD(token, floatV, intV, stringV);
+				}
+
+				if (type != NT_INTEGER && type != NT_FLOAT) {
+					if (strict)
+						throw StutskException(ET_ERROR, "Token is not a numeric type");
+					return false;
+				}
+
+				if (type == NT_FLOAT && !hasFloats) {
+					// First float, convert integer keys extracted so far
+					hasFloats = true;
+					numericKeys.reserve(count);
+					for (vector<IntegerKey>::const_iterator it = integerKeys.begin(); it != integerKeys.end(); ++it) {
+						NumericKey key = { false, integerFromSortKey(it->key), 0, it->index };
+						numericKeys.push_back(key);
+					}
+					vector<IntegerKey>().swap(integerKeys);
+				}
+
+				if (!hasFloats) {
+					IntegerKey key = { integerSortKey(intV), i };
+					integerKeys.push_back(key);
+				}
+				else {
+					NumericKey key = { type == NT_FLOAT, intV, floatV, i };
+					numericKeys.push_back(key);
+				}
+			}
+
+			if (!hasFloats) {
+				sortKeys(integerKeys, &radixSort<IntegerKey>, IntegerKeyLess());
+				applyOrder(tokens, integerKeys);
+			}
+			else {
+				sortKeys(numericKeys, &numericSort, NumericKeyLess());
+				applyOrder(tokens, numericKeys);
+			}
+			return true;
+		}
+
+		// sortByStringKeys - sorts `tokens` by the string value of the corresponding tokens in `keys`
+		void sortByStringKeys(TokenList& tokens, const TokenList& keys)
+		{
+			// Holds strings converted from other types for the duration of the sort
+			vector<StringPtr> strings(keys.size());
+			vector<StringKey> stringKeys(keys.size());
+			for (size_t i = 0; i < keys.size(); ++i) {
+				strings[i] = giveString(keys[i]);
+				stringKeys[i].value = strings[i].get();
+				stringKeys[i].index = i;
+			}
+
+			sortKeys(stringKeys, &stringSort, StringKeyLess());
+			applyOrder(tokens, stringKeys);
+		}
 	}
 
-	void _f_array_sort(Context* Context)
+	void _f_array_sort(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_sort
 		   arguments: <T_VARIABLE array1> array_sort
@@ -131,10 +499,10 @@ namespace BuiltIns {
 		   returnvalue:
 		   description: Sorts `array1` by numeric value from low to high.
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
-		   notes: 
+		   notes: The sort is stable. Large arrays are sorted in parallel.
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -143,33 +511,90 @@ namespace BuiltIns {
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		std::sort(token1.asTokenList->begin(),token1.asTokenList->end(), __tokenCompare);
+		sortNumeric(*token1.asTokenList);
 
 		if (!isVariable)
-			stutskStack.push_back(token1);        
+			context->stack.push_back(token1);        
+	}
+
+	void _f_array_sort_strings(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> array_sort_strings
+		   arguments: <T_VARIABLE array1> array_sort_strings
+		   returnvalue: <T_ARRAY>
+		   returnvalue:
+		   description: Sorts `array1` by string value in lexicographic (byte) order.
+		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
+		   notes: The sort is stable. Large arrays are sorted in parallel.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		bool isVariable = token1.tokenType == T_VARIABLE;
+
+		recurseVariables(token1);   
+
+		if (token1.tokenType != T_ARRAY)
+			throw StutskException(ET_ERROR, "Token is not an array");
+
+		sortByStringKeys(*token1.asTokenList, *token1.asTokenList);
+
+		if (!isVariable)
+			context->stack.push_back(token1);        
 	}
 	
-	// Standard comparison class for array_custom_sort
+	// Standard comparison class for array_custom_sort. It is copied by the sort algorithms, so it
+	// only holds a reference to the codeblock.
 	class TokenCompare {
 	private:
-		TokenList compare;
+		const TokenList& compare;
 		Context* context;
 	public:
-		TokenCompare(TokenList & codeblock, Context* ctx)
-		{ compare = codeblock;
-		context = ctx; }
-		bool operator() (Token i,Token j) 
+		TokenCompare(const TokenList& codeblock, Context* ctx) : compare(codeblock), context(ctx) {}
+		bool operator() (const Token& i, const Token& j) 
 		{ 
-			stutskStack.push_back(i);
-			stutskStack.push_back(j);
+			context->stack.push_back(i);
+			context->stack.push_back(j);
 			context->run(compare, "<__token_compare>");
-			Token token1 = stack_back_safe();
-			stutskStack.pop_back();
+			Token token1 = stack_back_safe(context);
+			context->stack.pop_back();
 			return giveBool(token1);
 		}
 	};
 
-	void _f_array_custom_sort(Context* Context)
+	void customSort(Context* context, bool stable)
+	{
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token1);  
+
+		if (token1.tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not an codeblock");
+
+		bool isVariable = token2.tokenType == T_VARIABLE;
+
+		recurseVariables(token2);   
+
+		if (token2.tokenType != T_ARRAY)
+			throw StutskException(ET_ERROR, "Token is not an array");
+
+		// Keep the codeblock alive even if it redefines the variable it came from
+		TokenListPtr codeblock = token1.asTokenList;
+		TokenCompare comparator(*codeblock, context);
+		if (stable)
+			std::stable_sort(token2.asTokenList->begin(),token2.asTokenList->end(), comparator);
+		else
+			std::sort(token2.asTokenList->begin(),token2.asTokenList->end(), comparator);
+
+		if (!isVariable)
+			context->stack.push_back(token2);        
+	}
+
+	void _f_array_custom_sort(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> <T_CODEBLOCK compare> array_custom_sort
 		   arguments: <T_VARIABLE array1> <T_CODEBLOCK compare> array_custom_sort
@@ -180,13 +605,45 @@ namespace BuiltIns {
 			 TRUE if the topmost token goes before the one below in the specific strict weak ordering 
 			 it defines, FALSE otherwise.
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
-		   notes: `{ < } array_custom_sort` is equivalent to array_sort
+		   notes: `{ < } array_custom_sort` is equivalent to array_sort. The comparison function is
+		     executed O(n log n) times, use array_sort_by when elements can be sorted by a key.
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		customSort(context, false);
+	}
 
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+	void _f_array_custom_sort_stable(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> <T_CODEBLOCK compare> array_custom_sort_stable
+		   arguments: <T_VARIABLE array1> <T_CODEBLOCK compare> array_custom_sort_stable
+		   returnvalue: <T_ARRAY>
+		   returnvalue:
+		   description: Same as array_custom_sort, but elements that are equivalent in the ordering
+		     keep their relative order.
+		   notes: 
+		*/
+		customSort(context, true);
+	}
+
+	void _f_array_sort_by(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> <T_CODEBLOCK key> array_sort_by
+		   arguments: <T_VARIABLE array1> <T_CODEBLOCK key> array_sort_by
+		   arguments: <T_ARRAY array1> <T_CODEBLOCK key> array_sort_by_stable
+		   arguments: <T_VARIABLE array1> <T_CODEBLOCK key> array_sort_by_stable
+		   returnvalue: <T_ARRAY>
+		   returnvalue:
+		   description: Sorts `array1` by a key computed by function `key`. The function is executed
+		     once per element, with the element pushed on stack, and returns its key. If all keys are
+			 numeric, elements are sorted by numeric value of their keys, otherwise by their string 
+			 value in lexicographic order.
+		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
+		   notes: The sort is always stable, array_sort_by_stable is an alias.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		recurseVariables(token1);  
 
@@ -200,34 +657,55 @@ namespace BuiltIns {
 		if (token2.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		TokenCompare comparator(*token1.asTokenList, Context);
-		std::sort(token2.asTokenList->begin(),token2.asTokenList->end(), comparator);
+		TokenListPtr codeblock = token1.asTokenList;
+		TokenListPtr tokens = token2.asTokenList;
+
+		// The key codeblock could change the array, which is checked before every element
+		const size_t count = tokens->size();
+		TokenList keys;
+		keys.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			if (tokens->size() != count)
+				throw StutskException(ET_ERROR, "Array was modified while it was being sorted");
+			context->stack.push_back((*tokens)[i]);
+			context->run(*codeblock, "<__sort_key>");
+			Token key = stack_back_safe(context);
+			context->stack.pop_back();
+			// Variables are resolved now, as the codeblock may reassign them for the next element
+			recurseVariables(key);
+			keys.push_back(key);
+		}
+
+		if (tokens->size() != count)
+			throw StutskException(ET_ERROR, "Array was modified while it was being sorted");
+
+		if (!sortByNumericKeys(*tokens, keys, false))
+			sortByStringKeys(*tokens, keys);
 
 		if (!isVariable)
-			stutskStack.push_back(token2);        
+			context->stack.push_back(token2);        
 	}
 
-
-	void _f_array_pop(Context* Context)
+	void _f_array_pop(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_pop
 		   returnvalue: <token>
 		   description: Removes the last element of array and pushes it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		recurseVariables(token1);   
 
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		stutskStack.push_back(token1.asTokenList->back()); 
+		context->stack.push_back(token1.asTokenList->back()); 
 		token1.asTokenList->pop_back();
 	}
 
-	void _f_array_push(Context* Context)
+	void _f_array_push(Context* context)
 	{
 		/* arguments: <token> <T_ARRAY array1> array_push
 		   arguments: <token> <T_VARIABLE array1> array_push
@@ -237,10 +715,10 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -251,47 +729,47 @@ namespace BuiltIns {
 
 		token1.asTokenList->push_back(token2);
 		if (!isVariable)
-			stutskStack.push_back(token1);        
+			context->stack.push_back(token1);        
 	}
 
-	void _f_array_peek(Context* Context)
+	void _f_array_peek(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_peek
 		   returnvalue: <token>
 		   description: Returns the last element of array but does not remove it.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		recurseVariables(token1);   
 
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		stutskStack.push_back(token1.asTokenList->back()); 
+		context->stack.push_back(token1.asTokenList->back()); 
 	}
 
-	void _f_array_pop_front(Context* Context)
+	void _f_array_pop_front(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_pop_front
 		   returnvalue: <token>
 		   description: Removes the first element of array and pushes it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		recurseVariables(token1);   
 
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		stutskStack.push_back(token1.asTokenList->front()); 
+		context->stack.push_back(token1.asTokenList->front()); 
 		token1.asTokenList->erase(token1.asTokenList->begin());
 	}
 
-	void _f_array_push_front(Context* Context)
+	void _f_array_push_front(Context* context)
 	{
 		/* arguments: <token> <T_ARRAY array1> array_push_front
 		   arguments: <token> <T_VARIABLE array1> array_push_front
@@ -301,10 +779,10 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -315,26 +793,26 @@ namespace BuiltIns {
 
 		token1.asTokenList->insert(token1.asTokenList->begin(), token2);
 		if (!isVariable)
-			stutskStack.push_back(token1);        
+			context->stack.push_back(token1);        
 	}
 
 
-	void _f_array_peek_front(Context* Context)
+	void _f_array_peek_front(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_peek_front
 		   returnvalue: <token>
 		   description: Returns the first element of array but does not remove it.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		recurseVariables(token1);   
 
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		stutskStack.push_back(token1.asTokenList->front()); 
+		context->stack.push_back(token1.asTokenList->front()); 
 	}
 
 	struct RandomShuffler : std::unary_function<stutskInteger, stutskInteger> {
@@ -346,7 +824,7 @@ namespace BuiltIns {
       RandomShuffler(boost::mt11213b &state) : _state(state) {}
     };
 
-	void _f_array_shuffle(Context* Context)
+	void _f_array_shuffle(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_shuffle
 		   arguments: <T_VARIABLE array1> array_shuffle
@@ -356,8 +834,8 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -366,24 +844,24 @@ namespace BuiltIns {
 		if (token1.tokenType != T_ARRAY)
 			throw StutskException(ET_ERROR, "Token is not an array");
 
-		RandomShuffler randShuffler(RandomNumber::getInstance().generator);
+		RandomShuffler randShuffler(context->interpreter.randomGenerator);
 		std::random_shuffle(token1.asTokenList->begin(), token1.asTokenList->end(), randShuffler);
 
 		if (!isVariable)
-			stutskStack.push_back(token1);   
+			context->stack.push_back(token1);   
 	}
 
-	void _f_array_find(Context* Context) {
+	void _f_array_find(Context* context) {
 		/* arguments: <token> <T_ARRAY array1> array_find
 		   returnvalue: <T_INTEGER>  
 		   description: Finds the element in the array and returns its index (-1 if not found).
 		   notes: Comparison is done using == operator
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -393,16 +871,16 @@ namespace BuiltIns {
 		{
 			if (tokenEqual(token2, (*token1.asTokenList)[i]))
 			{
-				pushInteger(i);
+				pushInteger(context, i);
 				return;
 			}
 		}
 
-		pushInteger(-1);
+		pushInteger(context, -1);
 		return;
 	} 
 
-	void _f_array_perform(Context* Context)
+	void _f_array_perform(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> <T_CODEBLOCK func> array_perform
 		   arguments: <T_VARIABLE array1> <T_CODEBLOCK func> array_perform
@@ -413,10 +891,10 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: Do not use `continue`.
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		Token token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token1);
 		if (token1.tokenType != T_CODEBLOCK)
@@ -431,19 +909,19 @@ namespace BuiltIns {
 
 		for (TokenList::iterator it = token2.asTokenList->begin();
 			it != token2.asTokenList->end(); ++it) {
-				stutskStack.push_back(*it);
-				Context->run(*token1.asTokenList, "array_perform");
-				*it = stack_back_safe();
-				stutskStack.pop_back();
-				if (exitVar != OP_INVALID)
+				context->stack.push_back(*it);
+				context->run(*token1.asTokenList, "array_perform");
+				*it = stack_back_safe(context);
+				context->stack.pop_back();
+				if (context->interpreter.exitVar != OP_INVALID)
 					break;
 		}
 
 		if (!isVariable)
-			stutskStack.push_back(token2); 
+			context->stack.push_back(token2); 
 	}
 
-	void _f_array_reverse(Context* Context)
+	void _f_array_reverse(Context* context)
 	{
 		/* arguments: <T_ARRAY array1> array_reverse
 		   arguments: <T_VARIABLE array1> array_reverse
@@ -453,8 +931,8 @@ namespace BuiltIns {
 		     If `array1` is a variable, it returns nothing, otherwise it returns it on stack.
 		   notes: 
 		*/
-		Token token1 = stack_back_safe();
-		stutskStack.pop_back();
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		bool isVariable = token1.tokenType == T_VARIABLE;
 
@@ -466,7 +944,7 @@ namespace BuiltIns {
 		reverse(token1.asTokenList->begin(),token1.asTokenList->end());
 
 		if (!isVariable)
-			stutskStack.push_back(token1);   
+			context->stack.push_back(token1);   
 	}
 
 }
\ No newline at end of file
@@ -37,9 +37,12 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["fopen"] = &BuiltIns::_f_fopen;
 	funcMap["fread"] = &BuiltIns::_f_fread;
 	funcMap["fwrite"] = &BuiltIns::_f_fwrite;
+	funcMap["fwritev"] = &BuiltIns::_f_fwritev;
 	funcMap["fseek"] = &BuiltIns::_f_fseek;
 	funcMap["feof"] = &BuiltIns::_f_feof;
 	funcMap["fclose"] = &BuiltIns::_f_fclose;
+	funcMap["mmap_open"] = &BuiltIns::_f_mmap_open;
+	funcMap["mmap_advise"] = &BuiltIns::_f_mmap_advise;
 
 	// Filesystem utilities
 	funcMap["file_exists"] = &BuiltIns::_f_file_exists;
@@ -68,9 +71,42 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["socket_accept"] = &BuiltIns::_f_socket_accept;
 	funcMap["socket_read"] = &BuiltIns::_f_socket_read;
 	funcMap["socket_readline"] = &BuiltIns::_f_socket_readline;
+	funcMap["socket_read_until"] = &BuiltIns::_f_socket_read_until;
 	funcMap["socket_write"] = &BuiltIns::_f_socket_write;
+	funcMap["socket_sendfile"] = &BuiltIns::_f_socket_sendfile;
+	funcMap["socket_send_range"] = &BuiltIns::_f_socket_send_range;
 	funcMap["socket_eof"] = &BuiltIns::_f_socket_eof;
 	funcMap["socket_close"] = &BuiltIns::_f_socket_close;
+	funcMap["socket_open_timeout"] = &BuiltIns::_f_socket_open_timeout;
+	funcMap["socket_set_timeout"] = &BuiltIns::_f_socket_set_timeout;
+	funcMap["socket_writev"] = &BuiltIns::_f_socket_writev;
+	funcMap["socket_pool_get"] = &BuiltIns::_f_socket_pool_get;
+	funcMap["socket_pool_release"] = &BuiltIns::_f_socket_pool_release;
+	funcMap["socket_pool_options"] = &BuiltIns::_f_socket_pool_options;
+	funcMap["socket_listen_prefork"] = &BuiltIns::_f_socket_listen_prefork;
+	funcMap["poll_handles"] = &BuiltIns::_f_poll_handles;
+	funcMap["unix_listen"] = &BuiltIns::_f_unix_listen;
+	funcMap["unix_connect"] = &BuiltIns::_f_unix_connect;
+	funcMap["socketpair"] = &BuiltIns::_f_socketpair;
+	funcMap["socket_send_handle"] = &BuiltIns::_f_socket_send_handle;
+	funcMap["socket_recv_handle"] = &BuiltIns::_f_socket_recv_handle;
+	funcMap["udp_open"] = &BuiltIns::_f_udp_open;
+	funcMap["udp_bind"] = &BuiltIns::_f_udp_bind;
+	funcMap["udp_send"] = &BuiltIns::_f_udp_send;
+	funcMap["udp_send_many"] = &BuiltIns::_f_udp_send_many;
+	funcMap["udp_recv"] = &BuiltIns::_f_udp_recv;
+	funcMap["udp_recv_many"] = &BuiltIns::_f_udp_recv_many;
+	funcMap["udp_close"] = &BuiltIns::_f_udp_close;
+	funcMap["socket_accept_async"] = &BuiltIns::_f_socket_accept_async;
+	funcMap["socket_read_async"] = &BuiltIns::_f_socket_read_async;
+	funcMap["socket_write_async"] = &BuiltIns::_f_socket_write_async;
+	funcMap["timer_after"] = &BuiltIns::_f_timer_after;
+	funcMap["event_loop_run"] = &BuiltIns::_f_event_loop_run;
+
+	funcMap["http_serve"] = &BuiltIns::_f_http_serve;
+	funcMap["http_request"] = &BuiltIns::_f_http_request;
+	funcMap["http_body_read"] = &BuiltIns::_f_http_body_read;
+	funcMap["http_body_close"] = &BuiltIns::_f_http_body_close;
 
 	// Memory functions
 	funcMap["length"] = &BuiltIns::_f_length;
@@ -110,6 +146,30 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["dictionary_new"] = &BuiltIns::_f_dictionary_new;
 	funcMap["dictionary_get"] = &BuiltIns::_f_dictionary_get;
 	funcMap["dictionary_set"] = &BuiltIns::_f_dictionary_set;
+	funcMap["dictionary_has"] = &BuiltIns::_f_dictionary_has;
+	funcMap["dictionary_delete"] = &BuiltIns::_f_dictionary_delete;
+	funcMap["dictionary_keys"] = &BuiltIns::_f_dictionary_keys;
+	funcMap["dictionary_values"] = &BuiltIns::_f_dictionary_values;
+	funcMap["dictionary_size_hint"] = &BuiltIns::_f_dictionary_size_hint;
+	funcMap["dictionary_merge"] = &BuiltIns::_f_dictionary_merge;
+
+	funcMap["shared_dictionary_new"] = &BuiltIns::_f_shared_dictionary_new;
+	funcMap["shared_dictionary_get"] = &BuiltIns::_f_shared_dictionary_get;
+	funcMap["shared_dictionary_set"] = &BuiltIns::_f_shared_dictionary_set;
+	funcMap["shared_dictionary_has"] = &BuiltIns::_f_shared_dictionary_has;
+	funcMap["shared_dictionary_delete"] = &BuiltIns::_f_shared_dictionary_delete;
+	funcMap["shared_dictionary_increment"] = &BuiltIns::_f_shared_dictionary_increment;
+	funcMap["shared_dictionary_compare_and_set"] = &BuiltIns::_f_shared_dictionary_compare_and_set;
+	funcMap["shared_dictionary_get_or_insert"] = &BuiltIns::_f_shared_dictionary_get_or_insert;
+	funcMap["shared_dictionary_snapshot"] = &BuiltIns::_f_shared_dictionary_snapshot;
+	funcMap["shared_dictionary_free"] = &BuiltIns::_f_shared_dictionary_free;
+	funcMap["set_new"] = &BuiltIns::_f_set_new;
+	funcMap["set_add"] = &BuiltIns::_f_set_add;
+	funcMap["set_has"] = &BuiltIns::_f_set_has;
+	funcMap["set_remove"] = &BuiltIns::_f_set_remove;
+	funcMap["set_union"] = &BuiltIns::_f_set_union;
+	funcMap["set_intersect"] = &BuiltIns::_f_set_intersect;
+	funcMap["set_difference"] = &BuiltIns::_f_set_difference;
 
 	// Array manipulation 
 	funcMap["array_append"] = &BuiltIns::_f_array_append;
@@ -120,7 +180,26 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["array_find"] = &BuiltIns::_f_array_find;
 	funcMap["array_perform"] = &BuiltIns::_f_array_perform;
 	funcMap["array_sort"] = &BuiltIns::_f_array_sort;
+	funcMap["array_sort_strings"] = &BuiltIns::_f_array_sort_strings;
 	funcMap["array_custom_sort"] = &BuiltIns::_f_array_custom_sort;
+	funcMap["array_custom_sort_stable"] = &BuiltIns::_f_array_custom_sort_stable;
+	funcMap["array_sort_by"] = &BuiltIns::_f_array_sort_by;
+	funcMap["array_sort_by_stable"] = &BuiltIns::_f_array_sort_by;
+
+	funcMap["array_parallel_map"] = &BuiltIns::_f_array_parallel_map;
+	funcMap["array_parallel_filter"] = &BuiltIns::_f_array_parallel_filter;
+	funcMap["array_parallel_reduce"] = &BuiltIns::_f_array_parallel_reduce;
+
+	funcMap["spawn"] = &BuiltIns::_f_spawn;
+	funcMap["channel_new"] = &BuiltIns::_f_channel_new;
+	funcMap["channel_send"] = &BuiltIns::_f_channel_send;
+	funcMap["channel_recv"] = &BuiltIns::_f_channel_recv;
+	funcMap["channel_try_recv"] = &BuiltIns::_f_channel_try_recv;
+	funcMap["channel_close"] = &BuiltIns::_f_channel_close;
+
+	funcMap["go"] = &BuiltIns::_f_go;
+	funcMap["yield"] = &BuiltIns::_f_yield;
+	funcMap["join"] = &BuiltIns::_f_join;
 
 	// Array manipulation (stacks, queues)
 	funcMap["array_pop"] = &BuiltIns::_f_array_pop;
@@ -130,6 +209,16 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["array_push_front"] = &BuiltIns::_f_array_push_front;
 	funcMap["array_peek_front"] = &BuiltIns::_f_array_peek_front;	
 
+	// Vectorized numeric array functions
+	funcMap["array_sum"] = &BuiltIns::_f_array_sum;
+	funcMap["array_min"] = &BuiltIns::_f_array_min;
+	funcMap["array_max"] = &BuiltIns::_f_array_max;
+	funcMap["array_dot"] = &BuiltIns::_f_array_dot;
+	funcMap["array_add"] = &BuiltIns::_f_array_add;
+	funcMap["array_mul"] = &BuiltIns::_f_array_mul;
+	funcMap["array_scale"] = &BuiltIns::_f_array_scale;
+	funcMap["array_mask"] = &BuiltIns::_f_array_mask;
+
 	// Stack manipulation
 	funcMap["swp"] = &BuiltIns::_f_swp;
 	funcMap["dmp"] = &BuiltIns::_f_dmp;
@@ -149,7 +238,9 @@ BuiltinFunctionsMap BuiltIns::populateFunctions() {
 	funcMap["eval"] = &BuiltIns::_f_eval;
 	funcMap["uneval"] = &BuiltIns::_f_uneval;	
 	funcMap["fork"] = &BuiltIns::_f_fork;
+	funcMap["parallel_do"] = &BuiltIns::_f_parallel_do;
 	funcMap["sleep"] = &BuiltIns::_f_sleep;
+	funcMap["with_deadline"] = &BuiltIns::_f_with_deadline;
 	funcMap["system"] = &BuiltIns::_f_system;
 	funcMap["exec"] = &BuiltIns::_f_exec;
 	funcMap["exec_readline"] = &BuiltIns::_f_exec_readline;
@@ -22,18 +22,47 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #ifdef FORK_CAPABLE
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/wait.h>
 #endif
 
 #include "exec-stream.h"
 
+namespace {
+	// Exec handles have no descriptor to wait for, as the pipes are read by a thread of their own
+	const stutskInteger EXEC_POLL_INTERVAL = 10;
+
+	/* Waits until the output of `stream` can be read without blocking, checking it regularly so
+	     that other green threads keep running and the deadline of with_deadline is kept. */
+	void waitForOutput(Interpreter& interpreter, exec_stream_t* stream)
+	{
+		typedef boost::chrono::steady_clock Clock;
+
+		while (!stream->ready(exec_stream_t::s_out)) {
+			interpreter.scheduler.checkDeadline();
+
+			stutskInteger wait = EXEC_POLL_INTERVAL;
+			if (interpreter.scheduler.deadline() != Clock::time_point::max())
+				wait = std::min<stutskInteger>(wait, boost::chrono::ceil<boost::chrono::milliseconds>(
+					interpreter.scheduler.deadline() - Clock::now()).count());
+
+			if (interpreter.scheduler.active())
+				interpreter.scheduler.sleep(wait);
+			else
+				boost::this_thread::sleep(boost::posix_time::milliseconds((long)wait));
+		}
+	}
+}
+
 void BuiltIns::_f_do(Context* context) {
 	/* arguments: <T_CODEBLOCK c1> do
 	returnvalue: 
 	description: Executes c1.
 	notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back(); // Name
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back(); // Name
 
 	recurseVariables(token1);
 	if (token1.tokenType != T_CODEBLOCK) {
@@ -50,8 +79,8 @@ void BuiltIns::_f_inherit(Context* context) {
 	description: Executes c1 in the parent context of the calling function.
 	notes: Useful for creating own control structures.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back(); // Name
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back(); // Name
 
 	recurseVariables(token1);
 	if (token1.tokenType != T_CODEBLOCK) {
@@ -72,8 +101,8 @@ void BuiltIns::_f_lambda(Context* context) {
 	description: Creates a new anonymous context and executes `c1` in it.
 	notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back(); 
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back(); 
 
 	recurseVariables(token1);
 	if (token1.tokenType != T_CODEBLOCK) {
@@ -83,8 +112,8 @@ void BuiltIns::_f_lambda(Context* context) {
 		Context newCtx(*token1.asTokenList, context);
 		newCtx.functionName = "<anonymous function>";
 		newCtx.run(*token1.asTokenList, "lambda");
-		if (exitVar == OP_EXIT) {
-			exitVar = OP_INVALID;
+		if (context->interpreter.exitVar == OP_EXIT) {
+			context->interpreter.exitVar = OP_INVALID;
 		}
 	}
 }
@@ -98,8 +127,8 @@ void BuiltIns::_f_recurse(Context* context) {
 	*/
 	Context newCtx(context->sourceCode, context);
 	newCtx.run(context->sourceCode, "recurse");
-	if (exitVar == OP_EXIT) {
-		exitVar = OP_INVALID;
+	if (context->interpreter.exitVar == OP_EXIT) {
+		context->interpreter.exitVar = OP_INVALID;
 	}
 }
 
@@ -110,10 +139,10 @@ void BuiltIns::_f_fork(Context* context) {
 	the newly spawned one.
 	notes: Only available on POSIX platforms. 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back(); // Name
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back(); // Name
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back(); // Name
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back(); // Name
 #ifdef FORK_CAPABLE
 	recurseVariables(token1);
 	if (token1.tokenType != T_CODEBLOCK || token2.tokenType != T_CODEBLOCK) {
@@ -134,14 +163,394 @@ void BuiltIns::_f_fork(Context* context) {
 #endif
 }
 
+#ifdef FORK_CAPABLE
+namespace {
+	/* Results of parallel_do are sent from the child processes in a compact binary form: a type
+	     byte followed by the value, with integers and lengths as variable-length integers. */
+	void writeVarint(string& output, unsigned long long value)
+	{
+		while (value >= 0x80) {
+			output.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		output.push_back((char)value);
+	}
+
+	unsigned long long readVarint(const string& input, size_t& position)
+	{
+		unsigned long long value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (position >= input.size())
+				break;
+			unsigned char byte = input[position++];
+			value |= (unsigned long long)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		throw StutskException(ET_ERROR, "Invalid result from child process");
+	}
+
+	void writeString(string& output, const string& value)
+	{
+		writeVarint(output, value.size());
+		output.append(value);
+	}
+
+	string readString(const string& input, size_t& position)
+	{
+		size_t length = (size_t)readVarint(input, position);
+		if (length > input.size() - position)
+			throw StutskException(ET_ERROR, "Invalid result from child process");
+		position += length;
+		return input.substr(position - length, length);
+	}
+
+	void writeToken(string& output, const Token& token)
+	{
+		// Variables can be nested in arrays and dictionaries, their values are sent instead
+		if (token.tokenType == T_VARIABLE) {
+			Token value = token;
+			recurseVariables(value);
+			writeToken(output, value);
+			return;
+		}
+
+		// Mapped files are not shared with the parent, so views are sent as strings
+		if (token.tokenType == T_STRING_VIEW) {
+			output.push_back((char)T_STRING);
+			writeString(output, *giveString(token));
+			return;
+		}
+
+		output.push_back((char)token.tokenType);
+		switch (token.tokenType) {
+		case T_EMPTY:
+			break;
+		case T_INTEGER:
+			// Zigzag encoding, so that small negative numbers are short as well
+			writeVarint(output, ((unsigned long long)token.data.asInteger << 1) ^ 
+				(unsigned long long)(token.data.asInteger >> 63));
+			break;
+		case T_BOOL:
+			output.push_back(token.data.asBool ? 1 : 0);
+			break;
+		case T_FLOAT:
+			output.append((const char*)&token.data.asFloat, sizeof(stutskFloat));
+			break;
+		case T_STRING:
+			writeString(output, *token.asString);
+			break;
+		case T_ARRAY:
+			writeVarint(output, token.asTokenList->size());
+			for (TokenList::const_iterator it = token.asTokenList->begin(); it != token.asTokenList->end(); ++it)
+				writeToken(output, *it);
+			break;
+		case T_DICTIONARY:
+			writeVarint(output, token.asDictionary->size());
+			for (TokenDictionary::const_iterator it = token.asDictionary->begin(); 
+				it != token.asDictionary->end(); ++it) {
+					writeToken(output, it->key.toToken());
+					writeToken(output, it->value);
+			}
+			break;
+		case T_SET:
+			writeVarint(output, token.asSet->size());
+			for (TokenSet::const_iterator it = token.asSet->begin(); it != token.asSet->end(); ++it)
+				writeToken(output, it->key.toToken());
+			break;
+		default:
+			throw StutskException(ET_ERROR, "Token cannot be returned from a child process");
+		}
+	}
+
+	Token readToken(const string& input, size_t& position)
+	{
+		if (position >= input.size())
+			throw StutskException(ET_ERROR, "Invalid result from child process");
+
+		Token token((stutskTokenType)input[position++]);
+		size_t count;
+		unsigned long long zigzag;
+
+		switch (token.tokenType) {
+		case T_EMPTY:
+			break;
+		case T_INTEGER:
+			zigzag = readVarint(input, position);
+			token.data.asInteger = (stutskInteger)(zigzag >> 1) ^ -(stutskInteger)(zigzag & 1);
+			break;
+		case T_BOOL:
+			if (position >= input.size())
+				throw StutskException(ET_ERROR, "Invalid result from child process");
+			token.data.asBool = input[position++] != 0;
+			break;
+		case T_FLOAT:
+			if (input.size() - position < sizeof(stutskFloat))
+				throw StutskException(ET_ERROR, "Invalid result from child process");
+			memcpy(&token.data.asFloat, input.data() + position, sizeof(stutskFloat));
+			position += sizeof(stutskFloat);
+			break;
+		case T_STRING:
+			token.asString = StringPtr(new string(readString(input, position)));
+			break;
+		case T_ARRAY:
+			count = (size_t)readVarint(input, position);
+			token.asTokenList = TokenListPtr(new TokenList());
+			token.asTokenList->reserve(std::min(count, input.size() - position));
+			for (size_t i = 0; i < count; ++i)
+				token.asTokenList->push_back(readToken(input, position));
+			break;
+		case T_DICTIONARY:
+			count = (size_t)readVarint(input, position);
+			token.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+			token.asDictionary->reserve(std::min(count, input.size() - position));
+			for (size_t i = 0; i < count; ++i) {
+				Token key = readToken(input, position);
+				(*token.asDictionary)[key] = readToken(input, position);
+			}
+			break;
+		case T_SET:
+			count = (size_t)readVarint(input, position);
+			token.asSet = TokenSetPtr(new TokenSet());
+			for (size_t i = 0; i < count; ++i)
+				token.asSet->insert(readToken(input, position));
+			break;
+		default:
+			throw StutskException(ET_ERROR, "Invalid result from child process");
+		}
+		return token;
+	}
+
+	enum ChildStatus { CS_RESULT, CS_EXCEPTION };
+
+	/* runChild - runs a codeblock of parallel_do in the forked child and returns what is to be
+	     sent back to the parent: the token on top of the stack or the exception that was thrown. */
+	string runChild(Context* context, const TokenList& codeblock)
+	{
+		string output;
+		try {
+			TokenStack::size_type depth = context->stack.size();
+			context->run(codeblock, "parallel_do");
+			
+			output.push_back(CS_RESULT);
+			if (context->stack.size() > depth) {
+				Token result = context->stack.back();
+				recurseVariables(result);
+				writeToken(output, result);
+			}
+			else
+				writeToken(output, Token(T_EMPTY));
+		}
+		catch (const StutskException& e) {
+			// Parse contexts are inherited from the parent, so the location is sent as an ID
+			output.clear();
+			output.push_back(CS_EXCEPTION);
+			writeVarint(output, e.getType());
+			writeVarint(output, e.hasLocation() ? e.getParseContext()->id() + 1 : 0);
+			writeVarint(output, e.getLineNumber());
+			writeString(output, e.getMessage());
+		}
+		catch (const std::exception& e) {
+			output.clear();
+			output.push_back(CS_EXCEPTION);
+			writeVarint(output, ET_SYSTEM);
+			writeVarint(output, 0);
+			writeVarint(output, 0);
+			writeString(output, e.what());
+		}
+		return output;
+	}
+
+	StutskException readChildException(Context* context, const string& input, size_t& position)
+	{
+		ExceptionType type = (ExceptionType)readVarint(input, position);
+		size_t parseContext = (size_t)readVarint(input, position);
+		int lineNumber = (int)readVarint(input, position);
+
+		StutskException e(type, readString(input, position));
+		if (parseContext != 0 && parseContext <= context->interpreter.parseContexts.size())
+			e.setLocation(lineNumber, &context->interpreter.parseContext(parseContext - 1));
+		return e;
+	}
+
+	struct ChildProcess {
+		pid_t pid;
+		int fd;
+		size_t index;
+		string output;
+	};
+
+	/* Closes the pipes of the children that are still running and waits for them. A child 
+	     blocked writing a large result gets EPIPE (or SIGPIPE) and exits. */
+	void abandonChildren(vector<ChildProcess>& running)
+	{
+		for (size_t i = 0; i < running.size(); ++i)
+			close(running[i].fd);
+		for (size_t i = 0; i < running.size(); ++i) {
+			int status;
+			while (waitpid(running[i].pid, &status, 0) < 0 && errno == EINTR);
+		}
+		running.clear();
+	}
+}
+#endif
+
+void BuiltIns::_f_parallel_do(Context* context) {
+	/* arguments: <T_ARRAY codeblocks> parallel_do
+	returnvalue: <T_ARRAY results>
+	description: Runs every codeblock in `codeblocks` in a separate child process and returns an
+	array with the value each of them left on top of the stack (or an empty token), in order.
+	At most --threads children run at once. Each child starts with a copy of the interpreter, so
+	the codeblocks can use variables and functions, but their changes are not visible to the
+	parent or to each other. If a codeblock throws an exception, it is rethrown in the parent.
+	notes: Only available on POSIX platforms. Results can be numbers, booleans, strings, arrays,
+	dictionaries or sets.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+#ifdef FORK_CAPABLE
+	recurseVariables(token1);
+	if (token1.tokenType != T_ARRAY)
+		throw StutskException(ET_ERROR, "Token is not an array");
+
+	TokenList codeblocks(*token1.asTokenList);
+	for (TokenList::iterator it = codeblocks.begin(); it != codeblocks.end(); ++it) {
+		recurseVariables(*it);
+		if (it->tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not a codeblock");
+	}
+
+	Token results(T_ARRAY);
+	results.asTokenList = TokenListPtr(new TokenList(codeblocks.size()));
+
+	// Otherwise buffered output would be written by the children as well
+	cout.flush();
+	fflush(stdout);
+
+	vector<ChildProcess> running;
+	size_t next = 0;
+	bool failed = false;
+	size_t failedIndex = 0;
+	StutskException error(ET_ERROR, "");
+
+	while ((next < codeblocks.size() && !failed) || !running.empty()) {
+		while (next < codeblocks.size() && !failed && running.size() < workerThreads) {
+			int fds[2];
+			if (pipe(fds) != 0) {
+				abandonChildren(running);
+				throw StutskException(ET_SYSTEM, "Cannot create a pipe");
+			}
+
+			pid_t pid = fork();
+			if (pid == -1) {
+				close(fds[0]);
+				close(fds[1]);
+				abandonChildren(running);
+				throw StutskException(ET_SYSTEM, "Cannot fork");
+			}
+
+			if (pid == 0) {
+				// Nothing may unwind out of the child, it would carry on with the parent's code
+				string output;
+				try {
+					close(fds[0]);
+					output = runChild(context, *codeblocks[next].asTokenList);
+					cout.flush();
+					fflush(stdout);
+				}
+				catch (...) {
+					_exit(EXIT_FAILURE);
+				}
+
+				for (size_t written = 0; written < output.size(); ) {
+					ssize_t count = write(fds[1], output.data() + written, output.size() - written);
+					if (count < 0 && errno != EINTR)
+						_exit(EXIT_FAILURE);
+					if (count > 0)
+						written += count;
+				}
+				_exit(EXIT_SUCCESS);
+			}
+
+			close(fds[1]);
+			ChildProcess child;
+			child.pid = pid;
+			child.fd = fds[0];
+			child.index = next++;
+			running.push_back(child);
+		}
+
+		vector<pollfd> pollfds(running.size());
+		for (size_t i = 0; i < running.size(); ++i) {
+			pollfds[i].fd = running[i].fd;
+			pollfds[i].events = POLLIN;
+			pollfds[i].revents = 0;
+		}
+
+		if (poll(&pollfds[0], pollfds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			abandonChildren(running);
+			throw StutskException(ET_SYSTEM, "Cannot wait for child processes");
+		}
+
+		// Iterating backwards, so that finished children can be removed
+		for (size_t i = running.size(); i-- > 0; ) {
+			if (pollfds[i].revents == 0)
+				continue;
+
+			ChildProcess& child = running[i];
+			char buffer[65536];
+			ssize_t count = read(child.fd, buffer, sizeof(buffer));
+			if (count > 0) {
+				child.output.append(buffer, count);
+				continue;
+			}
+			if (count < 0 && errno == EINTR)
+				continue;
+
+			close(child.fd);
+			int status;
+			while (waitpid(child.pid, &status, 0) < 0 && errno == EINTR);
+
+			// Errors are reported for the first failing codeblock, like they would be sequentially
+			if (!failed || child.index < failedIndex) {
+				size_t position = 1;
+				if (child.output.empty() || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+					failed = true;
+					failedIndex = child.index;
+					error = StutskException(ET_ERROR, "Child process terminated abnormally");
+				}
+				else if (child.output[0] == CS_EXCEPTION) {
+					failed = true;
+					failedIndex = child.index;
+					error = readChildException(context, child.output, position);
+				}
+				else
+					(*results.asTokenList)[child.index] = readToken(child.output, position);
+			}
+
+			running.erase(running.begin() + i);
+		}
+	}
+
+	if (failed)
+		throw error;
+
+	context->stack.push_back(results);
+#else
+	throw StutskException(ET_ERROR, "fork() is not available on non-POSIX operating systems");
+#endif
+}
+
 void BuiltIns::_f_include(Context* context) {
 	/* arguments: <T_STRING filename> include
 	returnvalue: 
 	description: Parses and executes Stutsk source code contained in file filename.
 	notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string filename = *giveString(token);
 
@@ -156,7 +565,7 @@ void BuiltIns::_f_include(Context* context) {
 
 	// LEAK!
 	// Context must persist past inclusion for objects left on stack (yeah, I know)
-	ParseContext* parseContext = ParseContext::newContext();
+	ParseContext* parseContext = context->interpreter.newParseContext();
 
 	parseContext->SourceCode = sourceCodeStream.str();
 	parseContext->FileName = filename;
@@ -175,10 +584,10 @@ void BuiltIns::_f_eval(Context* context) {
 	description: Parses and executes source as Stutsk source code.
 	notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 
-	ParseContext* parseContext = ParseContext::newContext();
+	ParseContext* parseContext = context->interpreter.newParseContext();
 
 	parseContext->SourceCode = *giveString(token);
 	parseContext->FileName = "<eval>";
@@ -198,27 +607,68 @@ void BuiltIns::_f_swap(Context* context) {
 	description: Reverses the order of n topmost tokens on the stack.
 	notes: 
 	*/
-	Token indexToken = stack_back_safe();
-	stutskStack.pop_back();
+	Token indexToken = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger number = giveInteger(indexToken);
-	if (stutskStack.size() < number)
+	if (context->stack.size() < number)
 		throw StutskException(ET_ERROR, "Not enough tokens on stack.");
 	if (number < 0)
 		throw StutskException(ET_ERROR, "Number must not be negative");
 
-	reverse(stutskStack.end() - number, stutskStack.end());
+	reverse(context->stack.end() - number, context->stack.end());
 }
 
 void BuiltIns::_f_sleep(Context* context) {
 	/* arguments: <T_FLOAT sleeptime> sleep
 	returnvalue: 
 	description: Pauses execution for a number of seconds given in sleeptime.
-	notes: 
+	notes: Only the current green thread is paused, the others keep running (see go).
 	*/
-	Token timeSleepToken = stack_back_safe();
+	Token timeSleepToken = stack_back_safe(context);
 	stutskFloat timeSleep = giveFloat(timeSleepToken);
-	stutskStack.pop_back();
-	boost::this_thread::sleep(boost::posix_time::milliseconds((long)(timeSleep*1000)));
+	context->stack.pop_back();
+	if (context->interpreter.scheduler.active())
+		context->interpreter.scheduler.sleep((stutskInteger)(timeSleep*1000));
+	else
+		boost::this_thread::sleep(boost::posix_time::milliseconds((long)(timeSleep*1000)));
+}
+
+void BuiltIns::_f_with_deadline(Context* context) {
+	/* arguments: <T_CODEBLOCK c1> <T_INTEGER milliseconds> with_deadline
+	returnvalue: 
+	description: Executes c1, but lets blocking I/O in it (reading and writing sockets, accepting
+	  and opening connections, readline, exec_readline and poll_handles) wait only until 
+	  `milliseconds` from now. An operation that would wait longer throws "Deadline exceeded",
+	  which can be caught with try.
+	notes: Nested deadlines cannot extend the enclosing one. Each green thread has its own
+	  deadline. Combine with socket_set_timeout for limits on individual operations.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	typedef boost::chrono::steady_clock Clock;
+
+	stutskInteger milliseconds = giveInteger(token1);
+	if (milliseconds < 0)
+		throw StutskException(ET_ERROR, "Number must not be negative");
+
+	recurseVariables(token2);
+	if (token2.tokenType != T_CODEBLOCK)
+		throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+	Scheduler& scheduler = context->interpreter.scheduler;
+	Clock::time_point previous = scheduler.deadline();
+	scheduler.setDeadline(std::min(previous, Clock::now() + boost::chrono::milliseconds(milliseconds)));
+	try {
+		context->run(*token2.asTokenList, "with_deadline");
+	}
+	catch (...) {
+		scheduler.setDeadline(previous);
+		throw;
+	}
+	scheduler.setDeadline(previous);
 }
 
 void BuiltIns::_f_roll(Context* context) {
@@ -227,12 +677,12 @@ void BuiltIns::_f_roll(Context* context) {
 	description: Brings the n-th topmost token to the top of the stack.
 	notes: 
 	*/
-	Token indexToken = stack_back_safe();
-	stutskStack.pop_back();
+	Token indexToken = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger index = giveInteger(indexToken);
-	Token repToken = *(stutskStack.end() - index);
-	stutskStack.erase(stutskStack.end() - index);
-	stutskStack.push_back(repToken);
+	Token repToken = *(context->stack.end() - index);
+	context->stack.erase(context->stack.end() - index);
+	context->stack.push_back(repToken);
 }
 
 void BuiltIns::_f_swp(Context* context) {
@@ -241,12 +691,12 @@ void BuiltIns::_f_swp(Context* context) {
 	description: Swaps the two topmost tokens on the stack.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
-	Token lower = stack_back_safe();
-	stutskStack.pop_back();
-	stutskStack.push_back(upper);
-	stutskStack.push_back(lower);
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
+	Token lower = stack_back_safe(context);
+	context->stack.pop_back();
+	context->stack.push_back(upper);
+	context->stack.push_back(lower);
 }
 
 void BuiltIns::_f_dup(Context* context) {
@@ -255,8 +705,8 @@ void BuiltIns::_f_dup(Context* context) {
 	description: Duplicates the topmost token on the stack.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.push_back(copy_token(upper));
+	Token upper = stack_back_safe(context);
+	context->stack.push_back(copy_token(upper));
 }
 
 void BuiltIns::_f_dmp(Context* context) {
@@ -265,7 +715,7 @@ void BuiltIns::_f_dmp(Context* context) {
 	description: Discards the topmost token on the stack.
 	notes: 
 	*/
-	stutskStack.pop_back();
+	context->stack.pop_back();
 }
 
 void BuiltIns::_f_uneval(Context* context) {
@@ -274,9 +724,9 @@ void BuiltIns::_f_uneval(Context* context) {
 	description: Serializes a token into a textual representation that is valid Stutsk source.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
-	*pushString() = Parser::serializeToken(upper);
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
+	*pushString(context) = Parser::serializeToken(upper);
 }
 
 void BuiltIns::_f_is_def(Context* context) {
@@ -287,25 +737,25 @@ void BuiltIns::_f_is_def(Context* context) {
 	If token is a variable, it returns true if it has been initialized.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	if (upper.tokenType == T_STRING) { // Zadeva je funkcija
 		BuiltinFunctionsMap::iterator bIter =
 			builtinFunctions.find(*upper.asString);
 		if (bIter != builtinFunctions.end())
-			pushBool(true);
+			pushBool(context, true);
 		else {
 			UserFunctionsMap::iterator uIter =
-				userFunctions.find(*upper.asString);
-			pushBool(uIter != userFunctions.end());
+				context->interpreter.userFunctions.find(*upper.asString);
+			pushBool(context, uIter != context->interpreter.userFunctions.end());
 		}
 
 	}
 	else if (upper.tokenType == T_VARIABLE) { // Zadeva je variabla
 		TokenMap::iterator iter = upper.data.asVariable.context->variables.find
 			(upper.data.asVariable.name);
-		pushBool(iter != upper.data.asVariable.context->variables.end());
+		pushBool(context, iter != upper.data.asVariable.context->variables.end());
 	}
 	else
 		throw StutskException(ET_ERROR, "Invalid argument");
@@ -317,8 +767,8 @@ void BuiltIns::_f_system(Context* context) {
 	description: Executes an executable given by filename.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	system(giveString(upper)->c_str());
 }
 
@@ -328,8 +778,8 @@ void BuiltIns::_f_exec(Context* context) {
 	description: Executes an executable given by filename.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	exec_stream_t *exec_stream = new exec_stream_t();
 	exec_stream->set_wait_timeout(exec_stream_t::stream_kind_t::s_all, -1);
@@ -337,7 +787,7 @@ void BuiltIns::_f_exec(Context* context) {
 	Token new_token(T_HANDLE);
 	new_token.data.asHandle.ptr = exec_stream;
 	new_token.data.asHandle.size = sizeof(exec_stream_t);
-	stutskStack.push_back(new_token);
+	context->stack.push_back(new_token);
 }
 
 
@@ -347,8 +797,8 @@ void BuiltIns::_f_exec_readline(Context* context) {
 	description: Reads a line from standard input.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(upper);
 
@@ -357,7 +807,28 @@ void BuiltIns::_f_exec_readline(Context* context) {
 
 	exec_stream_t *exec_stream = static_cast<exec_stream_t*>(upper.data.asHandle.ptr);
 
-	getline(exec_stream->out(), *pushString());
+	if (!context->interpreter.scheduler.limited()) {
+		getline(exec_stream->out(), *pushString(context));
+		return;
+	}
+
+	// The line is taken as it arrives, so that waiting for its rest does not block
+	std::streambuf* buffer = exec_stream->out().rdbuf();
+	string line;
+	for (;;) {
+		if (buffer->in_avail() <= 0) {
+			waitForOutput(context->interpreter, exec_stream);
+			if (buffer->sgetc() == std::char_traits<char>::eof()) {
+				exec_stream->out().setstate(std::ios::eofbit);
+				break;
+			}
+		}
+		int c = buffer->sbumpc();
+		if (c == '\n')
+			break;
+		line += (char)c;
+	}
+	pushString(context)->swap(line);
 }
 
 void BuiltIns::_f_exec_read(Context* context) {
@@ -366,8 +837,8 @@ void BuiltIns::_f_exec_read(Context* context) {
 	description: Reads count characters from standard input.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(upper);
 
@@ -376,8 +847,8 @@ void BuiltIns::_f_exec_read(Context* context) {
 
 	exec_stream_t *exec_stream = static_cast<exec_stream_t*>(upper.data.asHandle.ptr);
 
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	stutskInteger length = giveInteger(token2);
 	auto_ptr<char> buf = auto_ptr<char>(new char[length]);
@@ -390,7 +861,7 @@ void BuiltIns::_f_exec_read(Context* context) {
 
 	Token newString(T_STRING);
 	newString.asString = StringPtr(new string(buf.get(), exec_stream->out().gcount()));
-	stutskStack.push_back(newString);
+	context->stack.push_back(newString);
 }
 
 
@@ -400,8 +871,8 @@ void BuiltIns::_f_exec_readchar(Context* context) {
 	description: Reads a single character from standard input.
 	notes: Equivalent to `1 read`
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(upper);
 
@@ -420,7 +891,7 @@ void BuiltIns::_f_exec_readchar(Context* context) {
 	Token newString(T_STRING);
 	// Returns either "<char>" or ""
 	newString.asString = StringPtr(new string (&buf, exec_stream->out().gcount()));
-	stutskStack.push_back(newString);
+	context->stack.push_back(newString);
 }
 
 void BuiltIns::_f_exec_eof(Context* context) {
@@ -429,8 +900,8 @@ void BuiltIns::_f_exec_eof(Context* context) {
 	description: Returns true if standard input pipe is closed.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(upper);
 
@@ -439,7 +910,7 @@ void BuiltIns::_f_exec_eof(Context* context) {
 
 	exec_stream_t *exec_stream = static_cast<exec_stream_t*>(upper.data.asHandle.ptr);
 
-	pushBool(exec_stream->out().eof());
+	pushBool(context, exec_stream->out().eof());
 }
 
 void BuiltIns::_f_exec_print(Context* context) {
@@ -448,8 +919,8 @@ void BuiltIns::_f_exec_print(Context* context) {
 	description: Returns true if standard input pipe is closed.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(upper);
 
@@ -458,22 +929,22 @@ void BuiltIns::_f_exec_print(Context* context) {
 
 	exec_stream_t *exec_stream = static_cast<exec_stream_t*>(upper.data.asHandle.ptr);
 
-	Token tokenToPrint = stack_back_safe();
+	Token tokenToPrint = stack_back_safe(context);
 	exec_stream->in() << *giveString(tokenToPrint);
 
-	stutskStack.pop_back();
+	context->stack.pop_back();
 }
 
 void BuiltIns::_f_is_string(Context* context) {
 	/* arguments: <value> is_string
 	returnvalue: <T_BOOL>
-	description: Returns true if value is of type T_STRING.
+	description: Returns true if value is of type T_STRING (or a T_STRING_VIEW of a mapped file).
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_STRING);
+	pushBool(context, upper.tokenType == T_STRING || upper.tokenType == T_STRING_VIEW);
 }
 
 void BuiltIns::_f_is_integer(Context* context) {
@@ -482,10 +953,10 @@ void BuiltIns::_f_is_integer(Context* context) {
 	description: Returns true if value is of type T_INTEGER.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_INTEGER);
+	pushBool(context, upper.tokenType == T_INTEGER);
 }
 
 void BuiltIns::_f_is_float(Context* context) {
@@ -494,10 +965,10 @@ void BuiltIns::_f_is_float(Context* context) {
 	description: Returns true if value is of type T_FLOAT.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_FLOAT);
+	pushBool(context, upper.tokenType == T_FLOAT);
 }
 
 void BuiltIns::_f_is_array(Context* context) {
@@ -506,10 +977,10 @@ void BuiltIns::_f_is_array(Context* context) {
 	description: Returns true if value is of type T_ARRAY.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_ARRAY);
+	pushBool(context, upper.tokenType == T_ARRAY);
 }
 
 void BuiltIns::_f_is_handle(Context* context) {
@@ -518,10 +989,10 @@ void BuiltIns::_f_is_handle(Context* context) {
 	description: Returns true if value is of type T_HANDLE.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_HANDLE);
+	pushBool(context, upper.tokenType == T_HANDLE);
 }
 
 void BuiltIns::_f_is_bool(Context* context) {
@@ -530,10 +1001,10 @@ void BuiltIns::_f_is_bool(Context* context) {
 	description: Returns true if value is of type T_BOOL.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_BOOL);
+	pushBool(context, upper.tokenType == T_BOOL);
 }
 
 void BuiltIns::_f_is_numeric(Context* context) {
@@ -542,17 +1013,17 @@ void BuiltIns::_f_is_numeric(Context* context) {
 	description: Returns true if value is numeric (regardless of its actual type).
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	string s1; stutskInteger i1; stutskFloat f1;
 	switch (giveGCD(upper, f1, i1, s1))
 	{
 	case NT_FLOAT:
 	case NT_INTEGER:
-		pushBool(true);
+		pushBool(context, true);
 		break;
 	default:
-		pushBool(false);
+		pushBool(context, false);
 	}
 }
 
@@ -562,10 +1033,10 @@ void BuiltIns::_f_is_codeblock(Context* context) {
 	description: Returns true if value is of type T_CODEBLOCK.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_CODEBLOCK);
+	pushBool(context, upper.tokenType == T_CODEBLOCK);
 }
 
 void BuiltIns::_f_is_variable(Context* context) {
@@ -574,9 +1045,9 @@ void BuiltIns::_f_is_variable(Context* context) {
 	description: Returns true if the token is a reference.
 	notes: 
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
-	pushBool(upper.tokenType == T_VARIABLE);
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
+	pushBool(context, upper.tokenType == T_VARIABLE);
 }
 
 void BuiltIns::_f_is_null(Context* context) {
@@ -585,10 +1056,10 @@ void BuiltIns::_f_is_null(Context* context) {
 	description: Returns true if value is of type T_BOOL.
 	notes: Recurses variables.
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(upper);
-	pushBool(upper.tokenType == T_EMPTY);
+	pushBool(context, upper.tokenType == T_EMPTY);
 }
 
 
@@ -599,7 +1070,7 @@ void BuiltIns::_f___dumpglobalvariables(Context* context)
 	description: Prints global variables on standard output in a human-readable format.
 	notes: 
 	*/	
-	cout << dumpVariables(*mainContext);
+	cout << dumpVariables(*context->interpreter.mainContext);
 }
 
 void BuiltIns::_f___dumpvariables(Context* context)
@@ -618,7 +1089,7 @@ void BuiltIns::_f___dumpstack(Context* context) {
 	description: Prints the whole stack on standard output in a human-readable format.
 	notes: 
 	*/
-	cout << BuiltIns::dumpTokens(stutskStack, 0);
+	cout << BuiltIns::dumpTokens(context->stack, 0);
 }
 
 void BuiltIns::_f___debug(Context* context) {
@@ -627,7 +1098,7 @@ void BuiltIns::_f___debug(Context* context) {
 	description: Does various things during the debuging of Stutsk interpreter.
 	notes: Internal use only.
 	*/
-	pushInteger(sizeof(Token));
+	pushInteger(context, sizeof(Token));
 }
 
 void BuiltIns::_f___type(Context* context) {
@@ -636,9 +1107,9 @@ void BuiltIns::_f___type(Context* context) {
 	description: Returns a string representing token's type ("T_EMPTY", "T_INTEGER", ...)
 	notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
-	*pushString() = tokenType(token.tokenType);
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
+	*pushString(context) = tokenType(token.tokenType);
 }
 
 void BuiltIns::_f_time(Context* context) 
@@ -650,8 +1121,8 @@ void BuiltIns::_f_time(Context* context)
 	*/
 	using namespace boost::chrono;
 
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	if (token1.tokenType != T_CODEBLOCK) {
 		throw StutskException(ET_ERROR, "Token is not a codeblock");
@@ -663,7 +1134,7 @@ void BuiltIns::_f_time(Context* context)
 	auto t2 = high_resolution_clock::now();
 	auto tt = duration_cast<nanoseconds>(t2-t1);
 
-	pushFloat( (stutskFloat)tt.count() / 1000000000 );
+	pushFloat(context,  (stutskFloat)tt.count() / 1000000000 );
 }
 
 void BuiltIns::_f_stack_count(Context* context)
@@ -673,7 +1144,7 @@ void BuiltIns::_f_stack_count(Context* context)
 	description: Returns the number of elements on stack.
 	notes:
 	*/
-	pushInteger(stutskStack.size());
+	pushInteger(context, context->stack.size());
 }
 
 void BuiltIns::_f_stack_purge(Context* context)
@@ -683,7 +1154,7 @@ void BuiltIns::_f_stack_purge(Context* context)
 	description: Clears the main stack.
 	notes: Use sparingly.
 	*/
-	stutskStack.clear();
+	context->stack.clear();
 }
 
 void BuiltIns::_f_stack_empty(Context* context)
@@ -693,7 +1164,7 @@ void BuiltIns::_f_stack_empty(Context* context)
 	description: Returns true if the main stack is empty.
 	notes:
 	*/
-	pushBool(stutskStack.size() == 0);
+	pushBool(context, context->stack.size() == 0);
 }
 
 void BuiltIns::_f_definition(Context* context)
@@ -703,15 +1174,15 @@ void BuiltIns::_f_definition(Context* context)
 	description: Returns a codeblock that is executed when function with name func is called.
 	notes:
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	string functionName = *giveString(token1);
 	Token codeBlock(T_CODEBLOCK);
 
-	UserFunctionsMap::iterator uIter = userFunctions.find(functionName);
-	if (uIter != userFunctions.end()) {
+	UserFunctionsMap::iterator uIter = context->interpreter.userFunctions.find(functionName);
+	if (uIter != context->interpreter.userFunctions.end()) {
 		codeBlock.asTokenList = TokenListPtr(new TokenList(uIter->second));
-		stutskStack.push_back(codeBlock);
+		context->stack.push_back(codeBlock);
 	}
 	else {
 		BuiltinFunctionsMap::iterator bIter = builtinFunctions.find(functionName);
@@ -722,7 +1193,7 @@ void BuiltIns::_f_definition(Context* context)
 			strcpy(functionToken.data.asFunctionName, functionName.c_str());
 			codeBlock.asTokenList = TokenListPtr(new TokenList());
 			codeBlock.asTokenList->push_back(functionToken);
-			stutskStack.push_back(codeBlock);
+			context->stack.push_back(codeBlock);
 		}
 		else {
 			stringstream ExceptionText;
@@ -754,7 +1225,7 @@ void BuiltIns::_f_env_list(Context* context)
 		kvPair.asTokenList->push_back(value);
 		envVars.asTokenList->push_back(kvPair);
 	}
-	stutskStack.push_back(envVars);
+	context->stack.push_back(envVars);
 }
 
 void BuiltIns::_f_env_get(Context* context)
@@ -764,12 +1235,12 @@ void BuiltIns::_f_env_get(Context* context)
 	description: Returns a value of an environment string `name`
 	notes: If env-var is nonexistent, it returns NULL.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	string varName = *giveString(token1);
 	StringMapCI::const_iterator iter = environmentVars.find(varName);
 	if (iter != environmentVars.end())
-		*pushString() = iter->second;	
+		*pushString(context) = iter->second;	
 	else
-		stutskStack.push_back(Token(T_EMPTY));
+		context->stack.push_back(Token(T_EMPTY));
 }
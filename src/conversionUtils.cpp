@@ -34,6 +34,13 @@ void getNth(Token &newToken, stutskInteger i)
 		newToken.asString = StringPtr(new string);
 		*newToken.asString = (*tempToken.asString)[i];
 	} 
+	else if ((tempToken.tokenType == T_STRING_VIEW) && (i >= 0)) {
+		if (i >= (signed)tempToken.data.asView.length)
+			throw StutskException(ET_ERROR, "String index overflow");
+		newToken.tokenType = T_STRING;
+		newToken.asString = StringPtr(new string(1, 
+			tempToken.asMapping->data()[tempToken.data.asView.offset + i]));
+	}
 	else if ((tempToken.tokenType == T_ARRAY) && (i >= 0)) {
 		if (i < 0)
 			throw StutskException(ET_ERROR, "Array index underflow");
@@ -117,7 +124,15 @@ CompareNumeric tokenNumericCompare(const Token& token1, const Token& token2)
 // tokenSame - checks whether tokens are strictly equal ( 1 != 1. != "1" != TRUE , ... )
 bool tokenSame(const Token& token1, const Token& token2)
 {
-	if (token1.tokenType != token1.tokenType)
+	// A string view is the same as a string with the same characters
+	bool string1 = token1.tokenType == T_STRING || token1.tokenType == T_STRING_VIEW;
+	bool string2 = token2.tokenType == T_STRING || token2.tokenType == T_STRING_VIEW;
+	if (string1 && string2) {
+		StringRef s1(token1), s2(token2);
+		return s1.size == s2.size && memcmp(s1.data, s2.data, s1.size) == 0;
+	}
+
+	if (token1.tokenType != token2.tokenType)
 		return false;
 	else
 	{
@@ -126,13 +141,12 @@ bool tokenSame(const Token& token1, const Token& token2)
 			case T_EMPTY:     return true;
 			case T_OPERATOR:  return token1.data.operatorType == token2.data.operatorType; 
 			case T_FUNCCALL:  return strcmp(token1.data.asFunctionName, token2.data.asFunctionName) == 0;  
-			case T_VARIABLE:  return strcmp(token1.data.asVariable.name, token1.data.asVariable.name) == 0 &&
+			case T_VARIABLE:  return strcmp(token1.data.asVariable.name, token2.data.asVariable.name) == 0 &&
 										    token1.data.asVariable.context == token2.data.asVariable.context &&
 							 			    token1.index == token2.index; 
 			case T_INTEGER:   return token1.data.asInteger == token2.data.asInteger;
 			case T_BOOL:      return token1.data.asInteger == token2.data.asInteger;
 			case T_FLOAT:     return token1.data.asFloat == token2.data.asFloat;
-			case T_STRING:    return *token1.asString == *token2.asString;
 			case T_CODEBLOCK:
 			case T_ARRAY:     if (token1.asTokenList->size() != token2.asTokenList->size())
 							    return false;
@@ -197,6 +211,13 @@ bool tokenEqual(const Token& token1, const Token& token2)
 							                 t2.asTokenList->begin(), tokenEqual);
 			  case T_HANDLE:    return t1.data.asHandle.ptr == t2.data.asHandle.ptr &&
 							           t1.data.asHandle.size == t2.data.asHandle.size;
+			  // Sets are equal if they have the same members, in whatever order
+			  case T_SET:       if (t1.asSet->size() != t2.asSet->size())
+								  return false;
+								for (TokenSet::const_iterator it = t1.asSet->begin(); it != t1.asSet->end(); ++it)
+								  if (!t2.asSet->contains(it->key))
+									return false;
+								return true;
 			  default: throw StutskException(ET_ERROR, "Token cannot be compared");
 			}
 	}
@@ -227,6 +248,10 @@ GCDType giveGCD(const Token& token, stutskFloat &floatV, stutskInteger &intV,
 				stringV = *token.asString;
 				return NT_STRING;
 			}
+		case T_STRING_VIEW:
+			newToken.tokenType = T_STRING;
+			newToken.asString = giveString(token);
+			return giveGCD(newToken, floatV, intV, stringV);
 		case T_BOOL:
 			intV = token.data.asBool ? 1 : 0;
 			return NT_INTEGER;
@@ -263,6 +288,10 @@ stutskInteger giveInteger(const Token& token) {
 				"' to integer";
 			throw StutskException(ET_ERROR, ExceptionText.str());
 		}
+	case T_STRING_VIEW:
+		newToken.tokenType = T_STRING;
+		newToken.asString = giveString(token);
+		return giveInteger(newToken);
 	case T_BOOL:
 		return token.data.asBool ? 1 : 0;
 	case T_FLOAT:
@@ -297,6 +326,10 @@ stutskFloat giveFloat(const Token& token) {
 				"' to float";
 			throw StutskException(ET_ERROR, ExceptionText.str());
 		}
+	case T_STRING_VIEW:
+		newToken.tokenType = T_STRING;
+		newToken.asString = giveString(token);
+		return giveFloat(newToken);
 	case T_BOOL:
 		return token.data.asBool ? 1. : 0.;
 	case T_FLOAT:
@@ -329,6 +362,10 @@ StringPtr giveString(const Token& token) {
 	case T_STRING:
 		return token.asString;
 		break;
+	case T_STRING_VIEW:
+		return StringPtr(new string(token.asMapping->data() + token.data.asView.offset,
+			token.data.asView.length));
+		break;
 	case T_EMPTY:
 		return StringPtr(new string("")); 
 		break;
@@ -366,6 +403,8 @@ bool giveBool(const Token& token) {
 		return (token.data.asInteger != 0);
 	case T_STRING:
 		return (token.asString->length() != 0);
+	case T_STRING_VIEW:
+		return (token.data.asView.length != 0);
 	case T_BOOL:
 		return token.data.asBool;
 	case T_FLOAT:
@@ -375,4 +414,52 @@ bool giveBool(const Token& token) {
 		ExceptionText << "Cannot convert token to boolean";
 		throw StutskException(ET_ERROR, ExceptionText.str());
 	}
-}
\ No newline at end of file
+}
+
+StringRef::StringRef(const Token& token)
+{
+	switch (token.tokenType) {
+	case T_VARIABLE: {
+		Token value = token;
+		recurseVariables(value);
+		*this = StringRef(value);
+		break; }
+	case T_STRING:
+		holder_ = token.asString;
+		data = holder_->data();
+		size = holder_->size();
+		break;
+	case T_STRING_VIEW:
+		mapping_ = token.asMapping;
+		data = mapping_->data() + token.data.asView.offset;
+		size = token.data.asView.length;
+		break;
+	default:
+		holder_ = giveString(token);
+		data = holder_->data();
+		size = holder_->size();
+	}
+}
+
+Token stringToken(const string& value)
+{
+	Token token(T_STRING);
+	token.asString = StringPtr(new string(value));
+	return token;
+}
+
+/* headerDictionary - returns a dictionary of HTTP header values by name. Repeated headers are 
+     joined like in a single comma-separated header. */
+Token headerDictionary(const vector<pair<string, string> >& headers)
+{
+	Token result(T_DICTIONARY);
+	result.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+	for (size_t i = 0; i < headers.size(); ++i) {
+		Token& value = (*result.asDictionary)[stringToken(headers[i].first)];
+		if (value.tokenType == T_STRING)
+			value.asString->append(", " + headers[i].second);
+		else
+			value = stringToken(headers[i].second);
+	}
+	return result;
+}
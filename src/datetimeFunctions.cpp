@@ -51,7 +51,7 @@ void BuiltIns::_f_now(Context* context) {
 	   description: Returns current time as UNIX timestamp.
 	   notes: 
 	*/	
-	pushInteger(to_unix(second_clock().universal_time()));
+	pushInteger(context, to_unix(second_clock().universal_time()));
 }
 
 void BuiltIns::_f_utc_difference(Context* context) {
@@ -61,7 +61,7 @@ void BuiltIns::_f_utc_difference(Context* context) {
 	     (timezone and DST-adjusted) in seconds. (UTC + difference = localtime)
 	   notes: May be negative.
 	*/	
-	pushInteger(TZoffset.total_seconds());
+	pushInteger(context, TZoffset.total_seconds());
 }
 
 void BuiltIns::_f_make_time(Context* context) {
@@ -71,8 +71,8 @@ void BuiltIns::_f_make_time(Context* context) {
 	     Syntax of the array: ( <second> <minute> <hour> <day> <month> <year> )
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token);
 	if (token.tokenType != T_ARRAY)
 		throw StutskException(ET_ERROR, "Token is not an array");
@@ -85,7 +85,7 @@ void BuiltIns::_f_make_time(Context* context) {
 		                      time_duration(giveInteger((*token.asTokenList)[2]), 
 				                            giveInteger((*token.asTokenList)[1]), 
 		                                    giveInteger((*token.asTokenList)[0]), 0));
-	pushInteger(to_unix(timeRecord-TZoffset));
+	pushInteger(context, to_unix(timeRecord-TZoffset));
 }
 
 void BuiltIns::_f_time_array(Context* context) {
@@ -95,8 +95,8 @@ void BuiltIns::_f_time_array(Context* context) {
 	     Syntax of the array: ( <second> <minute> <hour> <day> <month> <year> )
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;
 	TokenListPtr dateArray = TokenListPtr(new TokenList());
 	Token addToken(T_INTEGER);
@@ -115,7 +115,7 @@ void BuiltIns::_f_time_array(Context* context) {
 	}
 	Token addArray(T_ARRAY);
 	addArray.asTokenList = dateArray;
-	stutskStack.push_back(addArray);
+	context->stack.push_back(addArray);
 }
 
 void BuiltIns::_f_day_of(Context* context) {
@@ -124,10 +124,10 @@ void BuiltIns::_f_day_of(Context* context) {
 	   description: Returns the day number of `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.date().day());
+	pushInteger(context, timeRecord.date().day());
 }
 
 void BuiltIns::_f_day_of_week(Context* context) {
@@ -136,10 +136,10 @@ void BuiltIns::_f_day_of_week(Context* context) {
 	   description: Returns the day of the week number of `timestamp`.
 	   notes: Monday-0, Tuesday-1, ..., Sunday-6
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger((timeRecord.date().day_of_week() + 6) % 7);
+	pushInteger(context, (timeRecord.date().day_of_week() + 6) % 7);
 }
 
 void BuiltIns::_f_month_of(Context* context) {
@@ -148,10 +148,10 @@ void BuiltIns::_f_month_of(Context* context) {
 	   description: Returns the month number of `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.date().month());
+	pushInteger(context, timeRecord.date().month());
 }
 
 void BuiltIns::_f_year_of(Context* context) {
@@ -160,10 +160,10 @@ void BuiltIns::_f_year_of(Context* context) {
 	   description: Returns the year number of `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.date().year());
+	pushInteger(context, timeRecord.date().year());
 }
 
 void BuiltIns::_f_second_of(Context* context) {
@@ -172,10 +172,10 @@ void BuiltIns::_f_second_of(Context* context) {
 	   description: Returns the seconds number `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.time_of_day().seconds());
+	pushInteger(context, timeRecord.time_of_day().seconds());
 }
 
 void BuiltIns::_f_minute_of(Context* context) {
@@ -184,10 +184,10 @@ void BuiltIns::_f_minute_of(Context* context) {
 	   description: Returns the minutes number `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.time_of_day().minutes());
+	pushInteger(context, timeRecord.time_of_day().minutes());
 }
 
 void BuiltIns::_f_hour_of(Context* context) {
@@ -196,10 +196,10 @@ void BuiltIns::_f_hour_of(Context* context) {
 	   description: Returns the hour number `timestamp`.
 	   notes: 
 	*/	
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	ptime timeRecord = from_unix(giveInteger(token)) + TZoffset;	
-	pushInteger(timeRecord.time_of_day().hours());
+	pushInteger(context, timeRecord.time_of_day().hours());
 }
 
 void BuiltIns::_f_format_time(Context* context) {
@@ -208,10 +208,10 @@ void BuiltIns::_f_format_time(Context* context) {
 	   description: Formats the date according to format string `format`.
 	   notes: See http://www.boost.org/doc/libs/1_49_0/doc/html/date_time/date_time_io.html#date%5Ftime.format%5Fflags
 	*/	
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	time_t time = giveInteger(token2);
 
 	string formatString = *giveString(token1);
@@ -224,7 +224,7 @@ void BuiltIns::_f_format_time(Context* context) {
 
 	ss << from_unix(time) + TZoffset;
 
-	*pushString() = ss.str();
+	*pushString(context) = ss.str();
 }
 
 void BuiltIns::_f_parse_time(Context* context) {
@@ -233,10 +233,10 @@ void BuiltIns::_f_parse_time(Context* context) {
 	   description: Formats the date according to format string `format`.
 	   notes: See http://www.boost.org/doc/libs/1_49_0/doc/html/date_time/date_time_io.html#date%5Ftime.format%5Fflags
 	*/	
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string formatString = *giveString(token1);
 	string dateTime = *giveString(token2);
@@ -249,5 +249,5 @@ void BuiltIns::_f_parse_time(Context* context) {
 	ss.imbue(std::locale(ss.getloc(), facet));
 	ss >> timeObject;
 
-	pushInteger(to_unix(timeObject-TZoffset));
+	pushInteger(context, to_unix(timeObject-TZoffset));
 }
\ No newline at end of file
@@ -62,22 +62,42 @@ void Debugger::dump_list(const T& tokens)
 	}
 }
 
-void Debugger::dump_dictionary(const TokenMap& tokens)
+void Debugger::dump_dictionary(const TokenDictionary& tokens)
 {
 	send_message<boost::int64_t>(tokens.size());
-	for (auto iter=tokens.cbegin();
-		iter != tokens.cend();
+	for (auto iter=tokens.begin();
+		iter != tokens.end();
+		++iter)
+	{
+		string key = iter->key.toString();
+		send_message<boost::int64_t>(key.size());
+		send_message(key.data(),
+			key.size());
+		dump_token(iter->value);
+	}
+}
+
+void Debugger::dump_set(const TokenSet& tokens)
+{
+	send_message<boost::int64_t>(tokens.size());
+	for (auto iter=tokens.begin();
+		iter != tokens.end();
 		++iter)
 	{
-		send_message<boost::int64_t>(iter->first.size());
-		send_message(iter->first.data(),
-			iter->first.size());
-		dump_token(iter->second);
+		dump_token(iter->key.toToken());
 	}
 }
 
 void Debugger::dump_token(const Token& token)
 {
+	// The debugger knows string views as strings
+	if (token.tokenType == T_STRING_VIEW) {
+		Token value(T_STRING);
+		value.asString = giveString(token);
+		dump_token(value);
+		return;
+	}
+
 	send_message<boost::uint8_t>(
 		static_cast<unsigned char>(token.tokenType));
 	switch (token.tokenType)
@@ -142,6 +162,9 @@ void Debugger::dump_token(const Token& token)
 	case T_DICTIONARY: 
 		dump_dictionary(*token.asDictionary);
 		break;
+	case T_SET:
+		dump_set(*token.asSet);
+		break;
 	default: ;
 	}
 };
@@ -163,7 +186,7 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 	if (message_id == 0x0001) // DI_STACK_DUMP
 	{
 		send_message<boost::uint16_t>(0x1000);
-		dump_list<TokenStack>(stutskStack);
+		dump_list<TokenStack>(interpreter_.stack);
 	}
 
 	if (message_id == 0x0002) // DI_DETACH
@@ -176,7 +199,7 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 	if (message_id == 0x0003) // DI_TERMINATE
 	{
 		send_message<boost::uint16_t>(0x0003);
-		exitVar = OP_HALT;
+		interpreter_.exitVar = OP_HALT;
 		debugging = false;
 		return false;
 	}
@@ -184,11 +207,11 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 	if (message_id == 0x0004) // DI_LOCATION
 	{
 		send_message<boost::uint16_t>(0x1001);
-		send_message<boost::uint32_t>(errorToken.context_id);
-		send_message<boost::uint32_t>(errorToken.lineNum);
-		send_message<boost::uint32_t>(errorToken.columnNum);
-		send_message<boost::uint32_t>(errorToken.tokenLength);
-		send_message<boost::uint32_t>(errorToken.relativePos);
+		send_message<boost::uint32_t>(interpreter_.errorToken.context_id);
+		send_message<boost::uint32_t>(interpreter_.errorToken.lineNum);
+		send_message<boost::uint32_t>(interpreter_.errorToken.columnNum);
+		send_message<boost::uint32_t>(interpreter_.errorToken.tokenLength);
+		send_message<boost::uint32_t>(interpreter_.errorToken.relativePos);
 	}
 
 	if (message_id == 0x0005) // DI_SOURCE_CODE
@@ -198,7 +221,7 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 
 		send_message<boost::uint16_t>(0x1002);
 
-		const ParseContext& ctx = ParseContext::get_by_id(source_context_id);
+		const ParseContext& ctx = interpreter_.parseContext(source_context_id);
 
 		send_message<boost::uint32_t>(ctx.FileName.length());
 		send_message(ctx.FileName.data(), ctx.FileName.size());
@@ -211,10 +234,10 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 		boost::uint32_t source_code_length;	
 		read_message<boost::uint32_t>(source_code_length);
 
-		ParseContext* newContext = ParseContext::newContext();
+		ParseContext* newContext = interpreter_.newParseContext();
 		newContext->FileName = "<debugger>";
 
-		DebugInfo old_errorToken = errorToken;
+		DebugInfo old_errorToken = interpreter_.errorToken;
 
 		std::vector<char> buffer(source_code_length);
 		read_message(&buffer[0], source_code_length);
@@ -225,7 +248,7 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 		newParser.parse(parsed);
 		contextStack.back()->run(parsed,"<debugger>");
 
-		errorToken = old_errorToken;
+		interpreter_.errorToken = old_errorToken;
 
 		send_message<boost::uint16_t>(0x0000);
 	}
@@ -233,10 +256,10 @@ bool Debugger::parse_message(boost::uint16_t message_id)
 	if (message_id == 0x0007) // DI_STACK_DUMP
 	{
 		send_message<boost::uint16_t>(0x1003);
-		send_message<boost::uint32_t>(mainContext->variables.size());
+		send_message<boost::uint32_t>(interpreter_.mainContext->variables.size());
 
-		for (TokenMap::const_iterator iter = mainContext->variables.begin(); 
-			iter != mainContext->variables.end(); ++iter)
+		for (TokenMap::const_iterator iter = interpreter_.mainContext->variables.begin(); 
+			iter != interpreter_.mainContext->variables.end(); ++iter)
 		{
 			send_message<boost::uint8_t>(iter->first.length());
 			send_message(iter->first.data(), iter->first.size());				
@@ -272,14 +295,14 @@ void Debugger::connect(string hostname, int port)
 	debugger_hostname = hostname; 
 	debugger_port = port;
 
-	boost::asio::ip::tcp::resolver resolver(io_service);
+	boost::asio::ip::tcp::resolver resolver(interpreter_.io_service);
 	string port_string; toString<int>(debugger_port, port_string);
 	boost::asio::ip::tcp::resolver::query query(debugger_hostname, port_string);
 	boost::asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
 	boost::asio::ip::tcp::resolver::iterator end;
 
 	socket = boost::shared_ptr<boost::asio::ip::tcp::socket>
-		(new boost::asio::ip::tcp::socket(io_service)); 
+		(new boost::asio::ip::tcp::socket(interpreter_.io_service)); 
 
 	boost::system::error_code error = boost::asio::error::host_not_found;
 
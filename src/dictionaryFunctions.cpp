@@ -25,8 +25,8 @@ void BuiltIns::_f_dictionary_new(Context* context) {
 	   notes: 
 	*/
 	Token newDictionary(T_DICTIONARY);
-	newDictionary.asDictionary = TokenMapPtr(new TokenMap());
-	stutskStack.push_back(newDictionary);
+	newDictionary.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+	context->stack.push_back(newDictionary);
 }
 
 void BuiltIns::_f_dictionary_get(Context* context) {
@@ -35,26 +35,24 @@ void BuiltIns::_f_dictionary_get(Context* context) {
 	   description: Returns value referenced by key `key` in dictionary `dict`.
 	   notes: 
 	*/
-	Token dict_token = stack_back_safe();
-	stutskStack.pop_back();
-	Token index_token = stack_back_safe();
-	stutskStack.pop_back();
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(dict_token);
-	
-	StringPtr index = giveString(index_token);
 
 	if (dict_token.tokenType != T_DICTIONARY)
 	{
 		throw StutskException(ET_ERROR, "Token is not a dictionary.");
 	}
 
-	TokenMap::const_iterator it = dict_token.asDictionary->find(*index);
+	Token* value = dict_token.asDictionary->find(index_token);
   
-	if ( it == dict_token.asDictionary->end() )
-	    stutskStack.push_back(Token(T_EMPTY));
+	if (value == NULL)
+	    context->stack.push_back(Token(T_EMPTY));
     else 
-		stutskStack.push_back(copy_token(it->second));
+		context->stack.push_back(copy_token(*value));
 }
 
 
@@ -64,21 +62,385 @@ void BuiltIns::_f_dictionary_set(Context* context) {
 	   description: Sets `key` in dictionary `dict` to `value`.
 	   notes: 
 	*/
-	Token dict_token = stack_back_safe();
-	stutskStack.pop_back();
-	Token index_token = stack_back_safe();
-	stutskStack.pop_back();
-	Token value_token = stack_back_safe();
-	stutskStack.pop_back();
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+	
+	if (dict_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	(*dict_token.asDictionary)[index_token] = copy_token(value_token);
+}
+
+void BuiltIns::_f_dictionary_has(Context* context) {
+	/* arguments: <key> <T_DICTIONARY dict> dictionary_has
+	   returnvalue: <T_BOOL> 
+	   description: Returns true if `key` is present in dictionary `dict`.
+	   notes: 
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(dict_token);
-		
-	StringPtr index = giveString(index_token);
 
 	if (dict_token.tokenType != T_DICTIONARY)
 	{
 		throw StutskException(ET_ERROR, "Token is not a dictionary.");
 	}
 
-	(*dict_token.asDictionary)[*index] = copy_token(value_token);
-}
\ No newline at end of file
+	pushBool(context, dict_token.asDictionary->find(index_token) != NULL);
+}
+
+void BuiltIns::_f_dictionary_delete(Context* context) {
+	/* arguments: <key> <T_DICTIONARY dict> dictionary_delete
+	   returnvalue: 
+	   description: Removes `key` and the value it references from dictionary `dict`.
+	   notes: Deleting a key that is not present does nothing.
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+
+	if (dict_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	dict_token.asDictionary->erase(index_token);
+}
+
+void BuiltIns::_f_dictionary_keys(Context* context) {
+	/* arguments: <T_DICTIONARY dict> dictionary_keys
+	   returnvalue: <T_ARRAY> 
+	   description: Returns an array of keys of dictionary `dict` in insertion order.
+	   notes: Integer and boolean keys are returned as T_INTEGER and T_BOOL tokens.
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+
+	if (dict_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	Token keys(T_ARRAY);
+	keys.asTokenList = TokenListPtr(new TokenList());
+	keys.asTokenList->reserve(dict_token.asDictionary->size());
+
+	for (TokenDictionary::const_iterator it = dict_token.asDictionary->begin();
+		it != dict_token.asDictionary->end(); ++it)
+	{
+		keys.asTokenList->push_back(it->key.toToken());
+	}
+
+	context->stack.push_back(keys);
+}
+
+void BuiltIns::_f_dictionary_values(Context* context) {
+	/* arguments: <T_DICTIONARY dict> dictionary_values
+	   returnvalue: <T_ARRAY> 
+	   description: Returns an array of values of dictionary `dict` in insertion order.
+	   notes: 
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+
+	if (dict_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	Token values(T_ARRAY);
+	values.asTokenList = TokenListPtr(new TokenList());
+	values.asTokenList->reserve(dict_token.asDictionary->size());
+
+	for (TokenDictionary::const_iterator it = dict_token.asDictionary->begin();
+		it != dict_token.asDictionary->end(); ++it)
+	{
+		values.asTokenList->push_back(copy_token(it->value));
+	}
+
+	context->stack.push_back(values);
+}
+
+void BuiltIns::_f_dictionary_size_hint(Context* context) {
+	/* arguments: <T_INTEGER count> <T_DICTIONARY dict> dictionary_size_hint
+	   returnvalue: 
+	   description: Preallocates dictionary `dict`, so that it can hold `count` keys without
+	     growing.
+	   notes: Useful before filling a dictionary with a known (large) number of keys.
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token count_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+
+	stutskInteger count = giveInteger(count_token);
+
+	if (dict_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	if (count < 0) 
+		throw StutskException(ET_ERROR, "Length cannot be negative");
+
+	dict_token.asDictionary->reserve(count);
+}
+
+void BuiltIns::_f_dictionary_merge(Context* context) {
+	/* arguments: <T_DICTIONARY source> <T_DICTIONARY dict> dictionary_merge
+	   returnvalue: 
+	   description: Copies all keys and values from dictionary `source` into dictionary `dict`.
+	     Existing keys in `dict` are overwritten.
+	   notes: 
+	*/
+	Token dict_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token source_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(dict_token);
+	recurseVariables(source_token);
+
+	if (dict_token.tokenType != T_DICTIONARY || source_token.tokenType != T_DICTIONARY)
+	{
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	}
+
+	TokenDictionary& dict = *dict_token.asDictionary;
+	const TokenDictionary& source = *source_token.asDictionary;
+
+	if (&dict == &source)
+		return;
+
+	dict.reserve(dict.size() + source.size());
+
+	for (TokenDictionary::const_iterator it = source.begin(); it != source.end(); ++it)
+	{
+		dict[it->key] = copy_token(it->value);
+	}
+}
+
+namespace {
+	SharedDictionary* popSharedDictionary(Context* context)
+	{
+		Token dict_token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(dict_token);
+
+		if (dict_token.tokenType != T_HANDLE)
+			throw StutskException(ET_ERROR, "Token is not a handle");
+		if (dict_token.data.asHandle.size != sizeof(SharedDictionary))
+			throw StutskException(ET_ERROR, "Invalid shared dictionary handle");
+
+		return static_cast<SharedDictionary*>(dict_token.data.asHandle.ptr);
+	}
+
+	/* sharedValue - only values that can be copied can be stored in a shared dictionary:
+	     numbers, booleans, strings, handles and arrays of these. String views are stored as 
+		 strings, so that they do not keep their file mapped. */
+	Token sharedValue(const Token& value)
+	{
+		switch (value.tokenType) {
+		case T_INTEGER: case T_BOOL: case T_FLOAT: case T_STRING: case T_HANDLE:
+			return value;
+		case T_STRING_VIEW: {
+			Token result(T_STRING);
+			result.asString = giveString(value);
+			return result; }
+		case T_ARRAY: {
+			// The array is only copied if any of its members has to be converted
+			Token result = value;
+			const TokenList& list = *value.asTokenList;
+			for (size_t i = 0; i < list.size(); ++i) {
+				Token member = sharedValue(list[i]);
+				if (member.tokenType == list[i].tokenType && member.asTokenList == list[i].asTokenList)
+					continue;
+				if (result.asTokenList == value.asTokenList)
+					result.asTokenList = TokenListPtr(new TokenList(list));
+				(*result.asTokenList)[i] = member;
+			}
+			return result; }
+		default:
+			throw StutskException(ET_ERROR, "Token cannot be stored in a shared dictionary");
+		}
+	}
+
+	Token popSharedValue(Context* context)
+	{
+		Token value_token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(value_token);
+		return sharedValue(value_token);
+	}
+}
+
+void BuiltIns::_f_shared_dictionary_new(Context* context) {
+	/* arguments: shared_dictionary_new
+	   returnvalue: <T_HANDLE dict> 
+	   description: Creates a new dictionary that can be used by several workers at once (see
+	     spawn and array_parallel_map), e.g. for counters or an index built in parallel.
+	   notes: Keys follow the rules of ordinary dictionaries. Values are limited to numbers,
+	     booleans, strings, handles and arrays of these, and they are always copied on the way
+		 in and out. Shared dictionaries must be released with shared_dictionary_free.
+	*/
+	Token newHandle(T_HANDLE);
+	newHandle.data.asHandle.ptr = new SharedDictionary();
+	newHandle.data.asHandle.size = sizeof(SharedDictionary);
+	context->stack.push_back(newHandle);
+}
+
+void BuiltIns::_f_shared_dictionary_get(Context* context) {
+	/* arguments: <key> <T_HANDLE dict> shared_dictionary_get
+	   returnvalue: <value> 
+	   description: Returns value referenced by key `key` in shared dictionary `dict`.
+	   notes: 
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	Token value;
+	if (!dict->get(index_token, value))
+		context->stack.push_back(Token(T_EMPTY));
+	else
+		context->stack.push_back(value);
+}
+
+void BuiltIns::_f_shared_dictionary_set(Context* context) {
+	/* arguments: <value> <key> <T_HANDLE dict> shared_dictionary_set
+	   returnvalue: 
+	   description: Sets `key` in shared dictionary `dict` to `value`.
+	   notes: 
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = popSharedValue(context);
+
+	dict->set(index_token, value_token);
+}
+
+void BuiltIns::_f_shared_dictionary_has(Context* context) {
+	/* arguments: <key> <T_HANDLE dict> shared_dictionary_has
+	   returnvalue: <T_BOOL> 
+	   description: Returns true if `key` is present in shared dictionary `dict`.
+	   notes: 
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	Token value;
+	pushBool(context, dict->get(index_token, value));
+}
+
+void BuiltIns::_f_shared_dictionary_delete(Context* context) {
+	/* arguments: <key> <T_HANDLE dict> shared_dictionary_delete
+	   returnvalue: 
+	   description: Removes `key` and the value it references from shared dictionary `dict`.
+	   notes: Deleting a key that is not present does nothing.
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	dict->erase(index_token);
+}
+
+void BuiltIns::_f_shared_dictionary_increment(Context* context) {
+	/* arguments: <delta> <key> <T_HANDLE dict> shared_dictionary_increment
+	   returnvalue: <result> 
+	   description: Atomically adds `delta` to the value of `key` in shared dictionary `dict` 
+	     and returns the new value. A missing key is treated as 0.
+	   notes: The result is an integer if both the old value and `delta` are integers.
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token delta_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(delta_token);
+
+	context->stack.push_back(dict->increment(index_token, delta_token));
+}
+
+void BuiltIns::_f_shared_dictionary_compare_and_set(Context* context) {
+	/* arguments: <expected> <value> <key> <T_HANDLE dict> shared_dictionary_compare_and_set
+	   returnvalue: <T_BOOL> 
+	   description: Atomically sets `key` in shared dictionary `dict` to `value`, but only if
+	     its current value equals (==) `expected`. Returns true if the value was set.
+	   notes: Fails if `key` is not present - use shared_dictionary_get_or_insert to create it.
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = popSharedValue(context);
+	Token expected_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(expected_token);
+
+	pushBool(context, dict->compareAndSet(index_token, expected_token, value_token));
+}
+
+void BuiltIns::_f_shared_dictionary_get_or_insert(Context* context) {
+	/* arguments: <value> <key> <T_HANDLE dict> shared_dictionary_get_or_insert
+	   returnvalue: <value> 
+	   description: Returns value referenced by key `key` in shared dictionary `dict`. If `key`
+	     is not present, it is first atomically set to `value`.
+	   notes: 
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+	Token index_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = popSharedValue(context);
+
+	context->stack.push_back(dict->getOrInsert(index_token, value_token));
+}
+
+void BuiltIns::_f_shared_dictionary_snapshot(Context* context) {
+	/* arguments: <T_HANDLE dict> shared_dictionary_snapshot
+	   returnvalue: <T_DICTIONARY> 
+	   description: Returns a copy of shared dictionary `dict` as an ordinary dictionary.
+	   notes: The copy is taken one shard at a time, so it is not atomic if other workers are
+	     updating `dict` at the same time. Keys are not in insertion order.
+	*/
+	SharedDictionary* dict = popSharedDictionary(context);
+
+	Token newDictionary(T_DICTIONARY);
+	newDictionary.asDictionary = dict->snapshot();
+	context->stack.push_back(newDictionary);
+}
+
+void BuiltIns::_f_shared_dictionary_free(Context* context) {
+	/* arguments: <T_HANDLE dict> shared_dictionary_free
+	   returnvalue: 
+	   description: Frees shared dictionary `dict`.
+	   notes: No worker may use `dict` afterwards, so it should be freed once the workers that
+	     share it have finished.
+	*/
+	delete popSharedDictionary(context);
+}
@@ -19,14 +19,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <builtinFunctions.h>
 #include <boost/filesystem.hpp>
 
+#ifdef __unix__
+#include <sys/uio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 void BuiltIns::_f_readfile(Context* context) {
 	/* arguments: <T_STRING filename> readfile
 	   returnvalue: <T_STRING>
 	   description: Reads the contents of a file `filename` into a string.
 	   notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string filename = *giveString(token);
 
@@ -38,7 +48,7 @@ void BuiltIns::_f_readfile(Context* context) {
 
 	filebuf << readfile.rdbuf();	
 
-	*pushString() = filebuf.str();
+	*pushString(context) = filebuf.str();
 }
 
 
@@ -48,10 +58,10 @@ void BuiltIns::_f_writefile(Context* context) {
 	   description: Writes `data` into the file `filename` overwriting the existing data.
 	   notes: If file does not exist, it is created.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	string filename = *giveString(token1);
 	StringPtr contents = giveString(token2);
 
@@ -73,10 +83,10 @@ void BuiltIns::_f_appendfile(Context* context) {
 	   description: Appends `data` into the file `filename`.
 	   notes: If file does not exist, it is created.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	string filename = *giveString(token1);
 	StringPtr contents = giveString(token2);
 
@@ -99,8 +109,8 @@ void BuiltIns::_f_file_array(Context* context) {
 	   description: Returns the lines of a file `filename` in an array.
 	   notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string filename = *giveString(token);
 
@@ -121,7 +131,7 @@ void BuiltIns::_f_file_array(Context* context) {
 
 	Token addToken(T_ARRAY);
 	addToken.asTokenList = matches;
-	stutskStack.push_back(addToken);
+	context->stack.push_back(addToken);
 }
 
 void BuiltIns::_f_fopen(Context* context) {
@@ -130,10 +140,10 @@ void BuiltIns::_f_fopen(Context* context) {
 	   description: Opens a file `filename` with mode `mode` and returns a handle to it.
 	   notes: See libc fopen() reference for mode options.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	string mode = *giveString(token1);
 	string filename = *giveString(token2);
 
@@ -142,7 +152,7 @@ void BuiltIns::_f_fopen(Context* context) {
 	fileToken.data.asHandle.ptr = fopen(filename.c_str(), mode.c_str());
 	if (fileToken.data.asHandle.ptr == NULL)
 		throw StutskException(ET_ERROR, "File operation failed");
-	stutskStack.push_back(fileToken);
+	context->stack.push_back(fileToken);
 }
 
 void BuiltIns::_f_fseek(Context* context) {
@@ -151,10 +161,10 @@ void BuiltIns::_f_fseek(Context* context) {
 	   description: Jumps to a position `pos` in file referenced by `handle`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token1);
 	if (token1.tokenType != T_HANDLE) {
 		throw StutskException(ET_ERROR, "Invalid file handle");
@@ -174,10 +184,10 @@ void BuiltIns::_f_fread(Context* context) {
 	   description: Reads `count` bytes from current position in file referenced by `handle`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token1);
 	if (token1.tokenType != T_HANDLE) {
 		throw StutskException(ET_ERROR, "Invalid file handle");
@@ -193,7 +203,7 @@ void BuiltIns::_f_fread(Context* context) {
 
 	Token newString(T_STRING);
 	newString.asString = StringPtr(new string (buf, bytesRead));
-	stutskStack.push_back(newString);
+	context->stack.push_back(newString);
 
 	delete buf;
 }
@@ -205,10 +215,10 @@ void BuiltIns::_f_fwrite(Context* context) {
 	   description: Writes `data` to a current position in file referenced by `handle`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token1);
 	StringPtr data = giveString(token2);
 
@@ -222,6 +232,83 @@ void BuiltIns::_f_fwrite(Context* context) {
 	}
 }
 
+void BuiltIns::_f_fwritev(Context* context) {
+	/* arguments: <T_ARRAY strings> <T_HANDLE handle> fwritev
+	   returnvalue: 
+	   description: Writes all strings of the array, one after another, to a current position in
+	     file referenced by `handle`.
+	   notes: On POSIX systems, the strings are not joined or copied to the buffer of the handle
+	     first, but written together with writev (up to IOV_MAX at a time).
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	recurseVariables(token1);
+	recurseVariables(token2);
+
+	if (token1.tokenType != T_HANDLE) {
+		throw StutskException(ET_ERROR, "Invalid file handle");
+	}
+	if (token2.tokenType != T_ARRAY) {
+		throw StutskException(ET_ERROR, "Token is not an array");
+	}
+
+	FILE* file = (FILE*)token1.data.asHandle.ptr;
+	TokenList& list = *token2.asTokenList;
+	vector<StringPtr> strings(list.size());
+	for (size_t i = 0; i < list.size(); ++i)
+		strings[i] = giveString(list[i]);
+
+#ifdef __unix__
+	vector<iovec> vectors(strings.size());
+	for (size_t i = 0; i < strings.size(); ++i) {
+		vectors[i].iov_base = (void*)strings[i]->data();
+		vectors[i].iov_len = strings[i]->size();
+	}
+
+	// What was written through the handle before has to come first
+	if (fflush(file) != 0) {
+		throw StutskException(ET_ERROR, "File operation failed");
+	}
+
+	int fd = fileno(file);
+	size_t index = 0;
+	while (index < vectors.size()) {
+		ssize_t written = writev(fd, &vectors[index], (int)std::min<size_t>(vectors.size() - index, IOV_MAX));
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN)
+				context->interpreter.scheduler.waitReady(fd, true);
+			else
+				throw StutskException(ET_ERROR, "File operation failed");
+			continue;
+		}
+
+		// Skips what has been written, which may end in the middle of a string
+		while (index < vectors.size() && (size_t)written >= vectors[index].iov_len) {
+			written -= vectors[index].iov_len;
+			++index;
+		}
+		if (written > 0) {
+			vectors[index].iov_base = (char*)vectors[index].iov_base + written;
+			vectors[index].iov_len -= written;
+		}
+	}
+
+	// The position of the handle is brought in line with that of the descriptor
+	fseek(file, 0, SEEK_CUR);
+#else
+	for (size_t i = 0; i < strings.size(); ++i) {
+		fwrite((void*)strings[i]->data(), 1, strings[i]->length(), file);
+	}
+	if (ferror(file)) {
+		throw StutskException(ET_ERROR, "File operation failed");
+	}
+#endif
+}
+
 
 void BuiltIns::_f_feof(Context* context) {
 	/* arguments: <T_HANDLE handle> feof
@@ -229,8 +316,8 @@ void BuiltIns::_f_feof(Context* context) {
 	   description: Returns true if the end of the file referenced by `handle`is reached.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(token1);
 	if (token1.tokenType != T_HANDLE) {
@@ -240,7 +327,7 @@ void BuiltIns::_f_feof(Context* context) {
 	if (ferror((FILE*)token1.data.asHandle.ptr)) {
 		throw StutskException(ET_ERROR, "File operation failed");
 	}
-	pushBool(eof);
+	pushBool(context, eof);
 }
 
 void BuiltIns::_f_fclose(Context* context) {
@@ -249,8 +336,8 @@ void BuiltIns::_f_fclose(Context* context) {
 	   description: Closes the file.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	recurseVariables(token1);
 	if (token1.tokenType != T_HANDLE) {
@@ -259,31 +346,152 @@ void BuiltIns::_f_fclose(Context* context) {
 	fclose((FILE*)token1.data.asHandle.ptr);
 }
 
+// --------------------------- MEMORY-MAPPED FILES ---------------------------- //
+
+MappedFile::MappedFile(const string& fileName) : data_(NULL), size_(0)
+{
+#ifdef __unix__
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw StutskException(ET_ERROR, "Cannot open file \"" + fileName + "\"");
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw StutskException(ET_ERROR, "Cannot open file \"" + fileName + "\"");
+	}
+
+	// Empty files cannot be mapped, they are simply empty views
+	size_ = (size_t)info.st_size;
+	if (size_ > 0) {
+		void* mapping = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			throw StutskException(ET_ERROR, "Cannot map file \"" + fileName + "\"");
+		}
+		data_ = (char*)mapping;
+	}
+	close(fd);
+#else
+	// Without mmap the file is read into memory, which is still shared by all the views
+	ifstream file(fileName.c_str(), ios::in | ios::binary);
+	if (!file)
+		throw StutskException(ET_ERROR, "Cannot open file \"" + fileName + "\"");
+	file.seekg(0, ios::end);
+	size_ = (size_t)file.tellg();
+	file.seekg(0, ios::beg);
+	if (size_ > 0) {
+		data_ = new char[size_];
+		file.read(data_, size_);
+	}
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_ == NULL)
+		return;
+#ifdef __unix__
+	munmap(data_, size_);
+#else
+	delete[] data_;
+#endif
+}
+
+void BuiltIns::_f_mmap_open(Context* context) {
+	/* arguments: <T_STRING filename> mmap_open
+	   returnvalue: <T_STRING_VIEW>
+	   description: Maps the file `filename` into memory read-only and returns its contents as a
+	     string view, which can be used as a string without the contents being read or copied.
+	   notes: pos, slice, [], length, the regex and hashing functions work on the mapping in 
+	     place, slices of a view are views as well. Other functions make a copy of it. The file is
+		 unmapped when the last view of it is gone. The mapping is advised for sequential 
+		 reading, see mmap_advise. Changes to the file while it is mapped may or may not be seen.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	MappedFilePtr mapping(new MappedFile(*giveString(token1)));
+#if defined(__unix__) && defined(MADV_SEQUENTIAL)
+	if (mapping->size() > 0)
+		madvise((void*)mapping->data(), mapping->size(), MADV_SEQUENTIAL);
+#endif
+	pushStringView(context, mapping, 0, mapping->size());
+}
+
+void BuiltIns::_f_mmap_advise(Context* context) {
+	/* arguments: <T_STRING_VIEW view> <T_STRING advice> mmap_advise
+	   returnvalue: 
+	   description: Tells the kernel how the pages of the mapped file in `view` will be accessed. 
+	     `advice` is one of "normal", "sequential", "random", "willneed" and "dontneed".
+	   notes: Only the pages that `view` covers are affected. Does nothing on platforms without
+	     madvise.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	string advice = *giveString(token1);
+	recurseVariables(token2);
+	if (token2.tokenType != T_STRING_VIEW)
+		throw StutskException(ET_ERROR, "Token is not a string view");
+
+#if defined(__unix__) && defined(MADV_SEQUENTIAL)
+	int flag;
+	if (advice == "normal")
+		flag = MADV_NORMAL;
+	else if (advice == "sequential")
+		flag = MADV_SEQUENTIAL;
+	else if (advice == "random")
+		flag = MADV_RANDOM;
+	else if (advice == "willneed")
+		flag = MADV_WILLNEED;
+	else if (advice == "dontneed")
+		flag = MADV_DONTNEED;
+	else
+		throw StutskException(ET_ERROR, "Invalid advice \"" + advice + "\"");
+
+	if (token2.data.asView.length == 0)
+		return;
+
+	// madvise requires the start of the range to be page-aligned
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = token2.data.asView.offset / pageSize * pageSize;
+	size_t end = token2.data.asView.offset + token2.data.asView.length;
+	madvise((void*)(token2.asMapping->data() + start), end - start, flag);
+#else
+	if (advice != "normal" && advice != "sequential" && advice != "random" && 
+		advice != "willneed" && advice != "dontneed")
+		throw StutskException(ET_ERROR, "Invalid advice \"" + advice + "\"");
+#endif
+}
+
 
-void BuiltIns::_f_file_exists(Context* Context)
+void BuiltIns::_f_file_exists(Context* context)
 {
 	/* arguments: <T_STRING filename> file_exists
 	   returnvalue: <T_BOOL>
 	   description: Returns true if file `filename` exists.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	pushBool(boost::filesystem::exists(*giveString(token1)));
+	pushBool(context, boost::filesystem::exists(*giveString(token1)));
 }
 
-void BuiltIns::_f_file_size(Context* Context)
+void BuiltIns::_f_file_size(Context* context)
 {
 	/* arguments: <T_STRING filename> file_size
 	   returnvalue: <T_INTEGER>
 	   description: Returns the file size of `filename in bytes.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	pushInteger(boost::filesystem::file_size(*giveString(token1)));
+	pushInteger(context, boost::filesystem::file_size(*giveString(token1)));
 }
 
 
@@ -294,8 +502,8 @@ void BuiltIns::_f_file_delete(Context* context)
 	   description: Deletes the file `filename`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	boost::system::error_code er;
 
 	boost::filesystem::remove(*giveString(token1), er);
@@ -311,10 +519,10 @@ void BuiltIns::_f_file_copy(Context* context)
 	   description: Copies file `src_filename` to `dst_filename`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	boost::system::error_code er;
 	boost::filesystem::copy_file(*giveString(token2),*giveString(token1),er);
@@ -331,10 +539,10 @@ void BuiltIns::_f_file_move(Context* context)
 	   description: Moves/renames file `src_filename` to `dst_filename`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	boost::system::error_code er;
 	boost::filesystem::rename(*giveString(token2),*giveString(token1),er);
@@ -350,8 +558,8 @@ void BuiltIns::_f_mkdir(Context* context)
 	   description: Creates directory `dirname`
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	boost::system::error_code er;
 
 	boost::filesystem::create_directory(*giveString(token1), er);
@@ -367,8 +575,8 @@ void BuiltIns::_f_rmdir(Context* context)
 	   description: Deletes the empty directory `dirname`
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	boost::system::error_code er;
 
 	boost::filesystem::remove(*giveString(token1), er);
@@ -385,7 +593,7 @@ void BuiltIns::_f_pwd(Context* context)
 	   notes: 
 	*/
 	boost::filesystem::path path = boost::filesystem::current_path();
-	*pushString() = path.string();
+	*pushString(context) = path.string();
 }
 
 void BuiltIns::_f_cwd(Context* context) 
@@ -395,22 +603,22 @@ void BuiltIns::_f_cwd(Context* context)
 	   description: Changes working directory to `dirname`.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	boost::filesystem::current_path(*giveString(token1));
 }
 
-void BuiltIns::_f_is_directory(Context* Context)
+void BuiltIns::_f_is_directory(Context* context)
 {
 	/* arguments: <T_STRING filname> file_copy
 	   returnvalue: <T_BOOL>
 	   description: Returns true if `filename` is a directory.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	pushBool(boost::filesystem::is_directory(*giveString(token1)));
+	pushBool(context, boost::filesystem::is_directory(*giveString(token1)));
 }
 
 void BuiltIns::_f_readdir(Context* context) {
@@ -420,8 +628,8 @@ void BuiltIns::_f_readdir(Context* context) {
 	   notes: Full paths are returned.
 	*/
 	using namespace boost::filesystem;	
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	path current_dir(*giveString(token1));
 	TokenListPtr fArray = TokenListPtr(new TokenList()); 
@@ -437,5 +645,5 @@ void BuiltIns::_f_readdir(Context* context) {
 
 	Token newArray(T_ARRAY);
 	newArray.asTokenList = fArray;
-	stutskStack.push_back(newArray);
+	context->stack.push_back(newArray);
 }
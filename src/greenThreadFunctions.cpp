@@ -0,0 +1,620 @@
+/*
+greenThreadFunctions.cpp - Cooperative green threads and their scheduler are implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <builtinFunctions.h>
+#include <boost/context/fiber.hpp>
+#include <boost/context/protected_fixedsize_stack.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <list>
+#include <map>
+
+#ifdef __unix__
+#include <poll.h>
+#include <errno.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+using boost::context::fiber;
+
+namespace {
+	// Stack pages are only committed when touched, so this mostly reserves address space
+	const size_t GREEN_THREAD_STACK_SIZE = 1 << 20;
+	const int MAX_EPOLL_EVENTS = 64;
+}
+
+/* GreenThread - a codeblock started with go, running on its own fiber and its own stack of
+     tokens. The root thread (the one the interpreter was started on) has no codeblock. */
+struct GreenThread {
+	TokenStack stack;
+	TokenListPtr codeblock;
+	DebugInfo errorToken;
+	bool finished;
+	bool failed;
+	StutskException error;
+	Token result;
+	vector<GreenThread*> joiners;
+	boost::chrono::steady_clock::time_point deadline;
+	// The pending timer and the descriptor waited for, if the thread is waiting for either
+	unsigned long timer;
+	int waitFd;
+	bool timedOut;
+	// Where to resume the thread while it is suspended. It is declared last, so that a suspended
+	// fiber is unwound while the stack and the codeblock its Context refers to still exist.
+	fiber continuation;
+
+	GreenThread() : finished(false), failed(false), error(ET_ERROR, ""),
+		deadline(boost::chrono::steady_clock::time_point::max()), timer(0), waitFd(-1), timedOut(false) { }
+};
+
+struct Scheduler::Impl {
+	typedef boost::chrono::steady_clock Clock;
+	// Timers are looked up by id when they expire, so that cancelled ones can stay queued
+	typedef std::pair<Clock::time_point, unsigned long> Sleeper;
+
+	struct FdWaiters {
+		GreenThread* reader;
+		GreenThread* writer;
+		FdWaiters() : reader(NULL), writer(NULL) { }
+	};
+
+	// Runs on the fiber of a new green thread
+	struct ThreadMain {
+		Impl* impl;
+		GreenThread* thread;
+		ThreadMain(Impl* owner, GreenThread* newThread) : impl(owner), thread(newThread) { }
+		fiber operator()(fiber&& caller);
+	};
+
+	// Stores the continuation of the thread that is switched away from
+	struct StoreContinuation {
+		GreenThread* thread;
+		explicit StoreContinuation(GreenThread* previous) : thread(previous) { }
+		fiber operator()(fiber&& from)
+		{
+			thread->continuation = std::move(from);
+			return fiber();
+		}
+	};
+
+	Interpreter& interpreter;
+	GreenThread root;
+	GreenThread* current;
+	list<GreenThread*> threads;  // Started and not yet joined
+	size_t running;              // Started and not yet finished
+	deque<GreenThread*> ready;
+	priority_queue<Sleeper, vector<Sleeper>, std::greater<Sleeper> > sleepers;
+	map<unsigned long, GreenThread*> timers;
+	unsigned long lastTimer;
+	map<int, FdWaiters> fdWaiters;
+	size_t fdWaitCount;
+	int epollFd;
+	// Set when a finishing thread has nothing left to switch to but the root thread
+	bool rootFailed;
+	StutskException rootError;
+
+	Impl(Interpreter& owner) : interpreter(owner), current(&root), running(0), lastTimer(0),
+		fdWaitCount(0), epollFd(-1), rootFailed(false), rootError(ET_ERROR, "") { }
+	~Impl();
+
+	GreenThread* pickNext();
+	bool waitForEvents(bool wait);
+	void wake(int fd, unsigned int events);
+	bool arm(int fd, const FdWaiters& waiters);
+	bool waitFor(int fd, bool write, Clock::time_point until);
+	void startTimer(Clock::time_point when);
+	void cancelTimer(GreenThread* thread);
+	void cancelFdWait(GreenThread* thread);
+	void switchTo(GreenThread* next);
+	void block();
+	fiber finish(GreenThread* thread);
+	GreenThread* findThread(GreenThread* thread);
+};
+
+Scheduler::Impl::~Impl()
+{
+	// Destroying a suspended fiber unwinds its stack, so threads that were never joined
+	// release their tokens here
+	for (list<GreenThread*>::iterator it = threads.begin(); it != threads.end(); ++it)
+		delete *it;
+#ifdef __linux__
+	if (epollFd >= 0)
+		close(epollFd);
+#endif
+}
+
+fiber Scheduler::Impl::ThreadMain::operator()(fiber&& caller)
+{
+	try {
+		Context threadContext(*thread->codeblock, impl->interpreter, thread->stack);
+		threadContext.run(*thread->codeblock, "go");
+		if (!thread->stack.empty()) {
+			thread->result = thread->stack.back();
+			recurseVariables(thread->result);
+		}
+	}
+	catch (const StutskException& e) {
+		thread->failed = true;
+		thread->error = e;
+	}
+	catch (const boost::context::detail::forced_unwind&) {
+		throw;
+	}
+	catch (const std::exception& e) {
+		thread->failed = true;
+		thread->error = StutskException(ET_SYSTEM, e.what());
+	}
+
+	// A return from the codeblock ends only this thread, but halt ends the program
+	if (impl->interpreter.exitVar != OP_HALT)
+		impl->interpreter.exitVar = OP_INVALID;
+	thread->stack.clear();
+	return impl->finish(thread);
+}
+
+fiber Scheduler::Impl::finish(GreenThread* thread)
+{
+	thread->finished = true;
+	--running;
+	ready.insert(ready.end(), thread->joiners.begin(), thread->joiners.end());
+	thread->joiners.clear();
+
+	GreenThread* next;
+	try {
+		next = pickNext();
+		if (next == NULL) {
+			rootError = StutskException(ET_ERROR, "Deadlock - all green threads are waiting");
+			rootFailed = true;
+			next = &root;
+		}
+	}
+	catch (const StutskException& e) {
+		rootError = e;
+		rootFailed = true;
+		next = &root;
+	}
+
+	current = next;
+	interpreter.errorToken = next->errorToken;
+	return std::move(next->continuation);
+}
+
+GreenThread* Scheduler::Impl::pickNext()
+{
+	for (;;) {
+		if (!ready.empty()) {
+			GreenThread* next = ready.front();
+			ready.pop_front();
+			return next;
+		}
+		if (!waitForEvents(true))
+			return NULL;
+	}
+}
+
+bool Scheduler::Impl::waitForEvents(bool wait)
+{
+	if (fdWaitCount == 0 && sleepers.empty())
+		return false;
+
+	int timeout = -1;
+	if (!wait)
+		timeout = 0;
+	else if (!sleepers.empty()) {
+		Clock::duration remaining = sleepers.top().first - Clock::now();
+		timeout = (int)std::max<boost::int_least64_t>(0,
+			boost::chrono::ceil<boost::chrono::milliseconds>(remaining).count());
+	}
+
+#ifdef __linux__
+	if (fdWaitCount > 0) {
+		epoll_event events[MAX_EPOLL_EVENTS];
+		int count = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, timeout);
+		if (count < 0 && errno != EINTR)
+			throw StutskException(ET_SYSTEM, "Cannot wait for descriptors");
+		for (int i = 0; i < count; ++i)
+			wake(events[i].data.fd, events[i].events);
+	}
+	else
+#endif
+	if (timeout > 0)
+		boost::this_thread::sleep_for(boost::chrono::milliseconds(timeout));
+
+	Clock::time_point now = Clock::now();
+	while (!sleepers.empty() && sleepers.top().first <= now) {
+		map<unsigned long, GreenThread*>::iterator it = timers.find(sleepers.top().second);
+		sleepers.pop();
+		if (it == timers.end())
+			continue;
+
+		GreenThread* thread = it->second;
+		timers.erase(it);
+		thread->timer = 0;
+		if (thread->waitFd >= 0) {
+			cancelFdWait(thread);
+			thread->timedOut = true;
+		}
+		ready.push_back(thread);
+	}
+	return true;
+}
+
+void Scheduler::Impl::startTimer(Clock::time_point when)
+{
+	current->timer = ++lastTimer;
+	timers[current->timer] = current;
+	sleepers.push(Sleeper(when, current->timer));
+}
+
+void Scheduler::Impl::cancelTimer(GreenThread* thread)
+{
+	if (thread->timer != 0) {
+		timers.erase(thread->timer);
+		thread->timer = 0;
+	}
+}
+
+void Scheduler::Impl::cancelFdWait(GreenThread* thread)
+{
+	map<int, FdWaiters>::iterator it = fdWaiters.find(thread->waitFd);
+	thread->waitFd = -1;
+	if (it == fdWaiters.end())
+		return;
+
+	FdWaiters& waiters = it->second;
+	if (waiters.reader == thread)
+		waiters.reader = NULL;
+	else if (waiters.writer == thread)
+		waiters.writer = NULL;
+	else
+		return;
+
+	--fdWaitCount;
+	// The one-shot registration may still fire, which is ignored for descriptors nobody waits for
+	if (waiters.reader == NULL && waiters.writer == NULL)
+		fdWaiters.erase(it);
+	else
+		arm(it->first, waiters);
+}
+
+void Scheduler::Impl::wake(int fd, unsigned int events)
+{
+#ifdef __linux__
+	map<int, FdWaiters>::iterator it = fdWaiters.find(fd);
+	if (it == fdWaiters.end())
+		return;
+
+	// Errors and hangups wake both sides, so that the following read or write reports them
+	bool failed = (events & (EPOLLERR | EPOLLHUP)) != 0;
+	FdWaiters& waiters = it->second;
+	GreenThread* woken[2] = { NULL, NULL };
+	if (waiters.reader != NULL && (failed || (events & EPOLLIN))) {
+		woken[0] = waiters.reader;
+		waiters.reader = NULL;
+	}
+	if (waiters.writer != NULL && (failed || (events & EPOLLOUT))) {
+		woken[1] = waiters.writer;
+		waiters.writer = NULL;
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (woken[i] != NULL) {
+			woken[i]->waitFd = -1;
+			cancelTimer(woken[i]);
+			ready.push_back(woken[i]);
+			--fdWaitCount;
+		}
+	}
+
+	if (waiters.reader == NULL && waiters.writer == NULL)
+		fdWaiters.erase(it);
+	else
+		arm(fd, waiters);
+#endif
+}
+
+bool Scheduler::Impl::arm(int fd, const FdWaiters& waiters)
+{
+#ifdef __linux__
+	// Registrations are one-shot and modified in place, so descriptors closed in the meantime
+	// need not be removed
+	epoll_event event;
+	event.events = EPOLLONESHOT | (waiters.reader ? EPOLLIN : 0) | (waiters.writer ? EPOLLOUT : 0);
+	event.data.u64 = 0;
+	event.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0)
+		return true;
+	return errno == ENOENT && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+#else
+	return true;
+#endif
+}
+
+bool Scheduler::Impl::waitFor(int fd, bool write, Clock::time_point until)
+{
+#ifdef __linux__
+	if (epollFd < 0) {
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (epollFd < 0)
+			throw StutskException(ET_SYSTEM, "Cannot create an epoll instance");
+	}
+
+	FdWaiters& waiters = fdWaiters[fd];
+	GreenThread*& slot = write ? waiters.writer : waiters.reader;
+	if (slot != NULL)
+		throw StutskException(ET_ERROR, "Another green thread is already waiting for this handle");
+
+	slot = current;
+	if (!arm(fd, waiters)) {
+		slot = NULL;
+		if (waiters.reader == NULL && waiters.writer == NULL)
+			fdWaiters.erase(fd);
+		throw StutskException(ET_SYSTEM, "Cannot wait for descriptor");
+	}
+	++fdWaitCount;
+	current->waitFd = fd;
+	current->timedOut = false;
+	if (until != Clock::time_point::max())
+		startTimer(until);
+
+	try {
+		block();
+	}
+	catch (...) {
+		cancelTimer(current);
+		if (current->waitFd >= 0)
+			cancelFdWait(current);
+		throw;
+	}
+	return !current->timedOut;
+#else
+	return true;
+#endif
+}
+
+void Scheduler::Impl::switchTo(GreenThread* next)
+{
+	GreenThread* previous = current;
+	previous->errorToken = interpreter.errorToken;
+	current = next;
+	interpreter.errorToken = next->errorToken;
+	std::move(next->continuation).resume_with(StoreContinuation(previous));
+}
+
+void Scheduler::Impl::block()
+{
+	GreenThread* next = pickNext();
+	if (next == NULL)
+		throw StutskException(ET_ERROR, "Deadlock - all green threads are waiting");
+	if (next != current)
+		switchTo(next);
+
+	if (current == &root && rootFailed) {
+		rootFailed = false;
+		throw rootError;
+	}
+}
+
+GreenThread* Scheduler::Impl::findThread(GreenThread* thread)
+{
+	if (std::find(threads.begin(), threads.end(), thread) == threads.end())
+		throw StutskException(ET_ERROR, "Invalid green thread handle");
+	return thread;
+}
+
+Scheduler::Scheduler(Interpreter& interpreter) : impl_(new Impl(interpreter)) { }
+
+Scheduler::~Scheduler() { }
+
+bool Scheduler::active() const
+{
+	return impl_->running > 0;
+}
+
+GreenThread* Scheduler::start(const TokenListPtr& codeblock, const TokenList& arguments)
+{
+	GreenThread* thread = new GreenThread();
+	thread->codeblock = codeblock;
+	// Arguments may refer to variables of contexts that end before the thread runs
+	thread->stack.insert(thread->stack.end(), arguments.begin(), arguments.end());
+	for (TokenStack::iterator it = thread->stack.begin(); it != thread->stack.end(); ++it)
+		recurseVariables(*it);
+	thread->errorToken = impl_->interpreter.errorToken;
+	thread->continuation = fiber(std::allocator_arg,
+		boost::context::protected_fixedsize_stack(GREEN_THREAD_STACK_SIZE),
+		Impl::ThreadMain(impl_.get(), thread));
+
+	impl_->threads.push_back(thread);
+	++impl_->running;
+	impl_->ready.push_back(thread);
+	return thread;
+}
+
+void Scheduler::yield()
+{
+	// Threads whose descriptors or timers are ready get their turn before the current one
+	impl_->waitForEvents(false);
+	if (impl_->ready.empty())
+		return;
+	impl_->ready.push_back(impl_->current);
+	impl_->block();
+}
+
+Token Scheduler::join(GreenThread* thread)
+{
+	impl_->findThread(thread);
+	if (thread == impl_->current)
+		throw StutskException(ET_ERROR, "A green thread cannot join itself");
+
+	while (!thread->finished) {
+		thread->joiners.push_back(impl_->current);
+		impl_->block();
+	}
+
+	impl_->threads.remove(thread);
+	Token result = thread->result;
+	bool failed = thread->failed;
+	StutskException error = thread->error;
+	delete thread;
+
+	if (failed)
+		throw error;
+	return result;
+}
+
+void Scheduler::joinAll()
+{
+	while (!impl_->threads.empty())
+		join(impl_->threads.front());
+}
+
+bool Scheduler::waitReady(int fd, bool write, stutskInteger timeout)
+{
+	Impl::Clock::time_point until = impl_->current->deadline;
+	if (timeout >= 0)
+		until = std::min(until, Impl::Clock::now() + boost::chrono::milliseconds(timeout));
+
+	if (active())
+		return impl_->waitFor(fd, write, until);
+
+#ifdef __unix__
+	pollfd request = { fd, (short)(write ? POLLOUT : POLLIN), 0 };
+	for (;;) {
+		int wait = -1;
+		if (until != Impl::Clock::time_point::max()) {
+			Impl::Clock::duration remaining = until - Impl::Clock::now();
+			wait = (int)std::max<boost::int_least64_t>(0,
+				boost::chrono::ceil<boost::chrono::milliseconds>(remaining).count());
+		}
+
+		int count = poll(&request, 1, wait);
+		if (count > 0)
+			return true;
+		else if (count == 0)
+			return false;
+		else if (errno != EINTR)
+			throw StutskException(ET_SYSTEM, "Cannot wait for descriptor");
+	}
+#else
+	return true;
+#endif
+}
+
+bool Scheduler::limited(stutskInteger timeout) const
+{
+	return active() || timeout >= 0 || impl_->current->deadline != Impl::Clock::time_point::max();
+}
+
+void Scheduler::sleep(stutskInteger milliseconds)
+{
+	impl_->startTimer(Impl::Clock::now() + boost::chrono::milliseconds(milliseconds));
+	impl_->block();
+}
+
+boost::chrono::steady_clock::time_point Scheduler::deadline() const
+{
+	return impl_->current->deadline;
+}
+
+void Scheduler::setDeadline(boost::chrono::steady_clock::time_point deadline)
+{
+	impl_->current->deadline = deadline;
+}
+
+void Scheduler::checkDeadline() const
+{
+	if (Impl::Clock::now() >= impl_->current->deadline)
+		throw StutskException(ET_ERROR, "Deadline exceeded");
+}
+
+namespace BuiltIns {
+
+	namespace {
+		GreenThread* popGreenThread(Context* context)
+		{
+			Token token = stack_back_safe(context);
+			context->stack.pop_back();
+			recurseVariables(token);
+			if (token.tokenType != T_HANDLE)
+				throw StutskException(ET_ERROR, "Token is not a handle");
+			return static_cast<GreenThread*>(token.data.asHandle.ptr);
+		}
+	}
+
+	void _f_go(Context* context)
+	{
+		/* arguments: <T_ARRAY arguments> <T_CODEBLOCK func> go
+		   returnvalue: <T_HANDLE thread>
+		   description: Starts `func` as a green thread with the elements of `arguments` on its
+		     own stack. Green threads run one at a time in the current interpreter and switch only
+			 when they yield, join, sleep or wait for a socket or the standard input.
+		   notes: The thread first runs when the current one waits. Its result is the top of
+		     its stack when it finishes (see join). The program does not exit until all green
+			 threads have finished; an error in a thread that was never joined stops the program.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token1);
+		if (token1.tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+		recurseVariables(token2);
+		if (token2.tokenType != T_ARRAY)
+			throw StutskException(ET_ERROR, "Token is not an array");
+
+		Token newHandle(T_HANDLE);
+		newHandle.data.asHandle.ptr = context->interpreter.scheduler.start(token1.asTokenList,
+			*token2.asTokenList);
+		newHandle.data.asHandle.size = sizeof(GreenThread);
+		context->stack.push_back(newHandle);
+	}
+
+	void _f_yield(Context* context)
+	{
+		/* arguments: yield
+		   returnvalue:
+		   description: Lets the other green threads that are ready run before continuing.
+		   notes:
+		*/
+		context->interpreter.scheduler.yield();
+	}
+
+	void _f_join(Context* context)
+	{
+		/* arguments: <T_HANDLE thread> join
+		   returnvalue: <result>
+		   description: Waits for the green `thread` to finish and returns the value left on top
+		     of its stack, or nothing if its stack was empty.
+		   notes: If the thread ended with an error, the error is raised again by join. A thread
+		     can only be joined once.
+		*/
+		GreenThread* thread = popGreenThread(context);
+		Token result = context->interpreter.scheduler.join(thread);
+		if (result.tokenType != T_EMPTY)
+			context->stack.push_back(result);
+	}
+}
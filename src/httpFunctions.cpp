@@ -0,0 +1,969 @@
+/*
+httpFunctions.cpp - The built-in HTTP/1.1 server is implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <builtinFunctions.h>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/algorithm/string.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <set>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+namespace BuiltIns {
+
+	namespace {
+		using boost::asio::ip::tcp;
+
+		const size_t HTTP_READ_SIZE = 16 * 1024;
+		const size_t HTTP_MAX_HEADER_SIZE = 64 * 1024;
+		// Reading from a connection pauses while more than this of its responses is unwritten
+		const size_t HTTP_MAX_QUEUED_SIZE = 1024 * 1024;
+		// How long accepting pauses after it failed, e.g. because descriptors ran out
+		const int HTTP_ACCEPT_RETRY_DELAY = 100;
+
+		struct HttpOptions {
+			unsigned short port;
+			unsigned int workers;
+			stutskInteger keepAliveTimeout; // seconds
+			size_t maxBodySize;
+			// An acceptor to serve from instead of listening on `port`
+			tcp::acceptor* listener;
+
+			HttpOptions() : port(0), workers(1), keepAliveTimeout(15), maxBodySize(16 << 20),
+				listener(NULL) { }
+		};
+
+		struct HttpRequest {
+			string method;
+			string target;
+			string version;
+			vector<pair<string, string> > headers;
+			string body;
+			bool keepAlive;
+		};
+
+		/* HttpParser - an incremental HTTP/1.1 request parser. Data is appended as it arrives and
+		     complete requests are taken off the front, so pipelined requests are parsed without
+			 waiting for the responses to the earlier ones. Where the previous call left off is
+			 remembered, so no byte is scanned twice however the request is split. */
+		class HttpParser {
+		public:
+			enum Result { PR_INCOMPLETE, PR_COMPLETE, PR_ERROR };
+
+			explicit HttpParser(size_t maxBodySize) : maxBodySize_(maxBodySize), begin_(0),
+				scanned_(0), headersParsed_(false), expectContinue_(false) { }
+
+			void append(const char* data, size_t length)
+			{
+				// Requests that have already been taken are only dropped when more data arrives
+				if (begin_ > 0) {
+					buffer_.erase(0, begin_);
+					scanned_ -= begin_;
+					bodyOffset_ -= headersParsed_ ? begin_ : 0;
+					begin_ = 0;
+				}
+				buffer_.append(data, length);
+			}
+
+			Result next(HttpRequest& request);
+			const string& error() const { return error_; }
+			int errorStatus() const { return errorStatus_; }
+
+			// True (once) if the client waits for 100 Continue before sending the body
+			bool takeExpectContinue()
+			{
+				bool result = expectContinue_;
+				expectContinue_ = false;
+				return result;
+			}
+
+		private:
+			Result fail(int status, const string& message)
+			{
+				errorStatus_ = status;
+				error_ = message;
+				return PR_ERROR;
+			}
+
+			Result parseHeaders(size_t end);
+			Result parseChunks();
+			void finish(HttpRequest& request, size_t end);
+
+			size_t maxBodySize_;
+			string buffer_;
+			size_t begin_;       // start of the request being parsed
+			size_t scanned_;     // how far the headers (or chunks) have been scanned
+			bool headersParsed_;
+			size_t bodyOffset_;
+			size_t contentLength_;
+			bool chunked_;
+			bool lastChunk_;
+			size_t trailerSize_;
+			bool expectContinue_;
+			HttpRequest current_;
+			int errorStatus_;
+			string error_;
+		};
+
+		HttpParser::Result HttpParser::next(HttpRequest& request)
+		{
+			if (!headersParsed_) {
+				size_t end = buffer_.find("\r\n\r\n", scanned_ > begin_ + 3 ? scanned_ - 3 : begin_);
+				if (end == string::npos) {
+					scanned_ = buffer_.size();
+					if (buffer_.size() - begin_ > HTTP_MAX_HEADER_SIZE)
+						return fail(431, "Request Header Fields Too Large");
+					return PR_INCOMPLETE;
+				}
+
+				Result result = parseHeaders(end);
+				if (result != PR_COMPLETE)
+					return result;
+			}
+
+			if (chunked_) {
+				Result result = parseChunks();
+				if (result != PR_COMPLETE)
+					return result;
+				finish(request, scanned_);
+			}
+			else {
+				if (buffer_.size() - bodyOffset_ < contentLength_)
+					return PR_INCOMPLETE;
+				current_.body.assign(buffer_, bodyOffset_, contentLength_);
+				finish(request, bodyOffset_ + contentLength_);
+			}
+			return PR_COMPLETE;
+		}
+
+		HttpParser::Result HttpParser::parseHeaders(size_t end)
+		{
+			current_ = HttpRequest();
+
+			size_t lineEnd = buffer_.find("\r\n", begin_);
+			size_t methodEnd = buffer_.find(' ', begin_);
+			size_t targetEnd = methodEnd < lineEnd ? buffer_.find(' ', methodEnd + 1) : string::npos;
+			if (targetEnd >= lineEnd || methodEnd == begin_ || targetEnd == methodEnd + 1)
+				return fail(400, "Bad Request");
+
+			current_.method.assign(buffer_, begin_, methodEnd - begin_);
+			current_.target.assign(buffer_, methodEnd + 1, targetEnd - methodEnd - 1);
+			current_.version.assign(buffer_, targetEnd + 1, lineEnd - targetEnd - 1);
+			if (current_.version != "HTTP/1.1" && current_.version != "HTTP/1.0")
+				return fail(505, "HTTP Version Not Supported");
+
+			bool http11 = current_.version == "HTTP/1.1";
+			current_.keepAlive = http11;
+			contentLength_ = 0;
+			chunked_ = false;
+			bool hasContentLength = false, hasTransferEncoding = false;
+
+			for (size_t position = lineEnd + 2; position < end + 2; ) {
+				lineEnd = buffer_.find("\r\n", position);
+				size_t colon = buffer_.find(':', position);
+				if (colon >= lineEnd || colon == position)
+					return fail(400, "Bad Request");
+
+				string name(buffer_, position, colon - position);
+				string value(buffer_, colon + 1, lineEnd - colon - 1);
+				boost::algorithm::to_lower(name);
+				boost::algorithm::trim(value);
+
+				if (name == "content-length") {
+					char* valueEnd;
+					unsigned long long length = strtoull(value.c_str(), &valueEnd, 10);
+					if (value.empty() || *valueEnd != '\0')
+						return fail(400, "Bad Request");
+					if (hasContentLength && length != contentLength_)
+						return fail(400, "Bad Request");
+					if (length > maxBodySize_)
+						return fail(413, "Payload Too Large");
+					contentLength_ = (size_t)length;
+					hasContentLength = true;
+				}
+				else if (name == "transfer-encoding") {
+					chunked_ = boost::algorithm::iends_with(value, "chunked");
+					hasTransferEncoding = true;
+				}
+				else if (name == "expect")
+					expectContinue_ = boost::algorithm::iequals(value, "100-continue");
+				else if (name == "connection") {
+					if (boost::algorithm::iequals(value, "close"))
+						current_.keepAlive = false;
+					else if (boost::algorithm::iequals(value, "keep-alive"))
+						current_.keepAlive = true;
+				}
+
+				current_.headers.push_back(make_pair(name, value));
+				position = lineEnd + 2;
+			}
+
+			// Proxies could frame such a request differently than we do, which allows smuggling
+			if (hasContentLength && hasTransferEncoding)
+				return fail(400, "Bad Request");
+
+			headersParsed_ = true;
+			bodyOffset_ = end + 4;
+			scanned_ = bodyOffset_;
+			lastChunk_ = false;
+			return PR_COMPLETE;
+		}
+
+		// Decodes as many complete chunks of a chunked body as have arrived
+		HttpParser::Result HttpParser::parseChunks()
+		{
+			for (;;) {
+				// Chunk size lines and trailers are limited like the headers, as a peer that never
+				// ends a line would otherwise make the buffer grow without bound
+				size_t lineEnd = buffer_.find("\r\n", scanned_);
+				size_t lineLength = (lineEnd == string::npos ? buffer_.size() : lineEnd) - scanned_;
+				if (lastChunk_ && trailerSize_ + lineLength > HTTP_MAX_HEADER_SIZE)
+					return fail(431, "Request Header Fields Too Large");
+				if (!lastChunk_ && lineLength > HTTP_MAX_HEADER_SIZE)
+					return fail(400, "Bad Request");
+				if (lineEnd == string::npos)
+					return PR_INCOMPLETE;
+
+				if (lastChunk_) {
+					// Trailers are skipped up to the empty line that ends the request
+					bool emptyLine = lineEnd == scanned_;
+					scanned_ = lineEnd + 2;
+					trailerSize_ += lineLength + 2;
+					if (emptyLine)
+						return PR_COMPLETE;
+					continue;
+				}
+
+				const char* line = buffer_.c_str() + scanned_;
+				char* sizeEnd;
+				errno = 0;
+				unsigned long size = strtoul(line, &sizeEnd, 16);
+				if (sizeEnd == line || !isxdigit((unsigned char)*line) || 
+					(*sizeEnd != '\r' && *sizeEnd != ';' && *sizeEnd != ' ' && *sizeEnd != '\t'))
+					return fail(400, "Bad Request");
+				// The body never exceeds the limit, so this cannot overflow
+				if (errno == ERANGE || size > maxBodySize_ - current_.body.size())
+					return fail(413, "Payload Too Large");
+
+				if (size == 0) {
+					lastChunk_ = true;
+					trailerSize_ = 0;
+					scanned_ = lineEnd + 2;
+					continue;
+				}
+
+				if (buffer_.size() - (lineEnd + 2) < size + 2)
+					return PR_INCOMPLETE;
+				if (buffer_.compare(lineEnd + 2 + size, 2, "\r\n") != 0)
+					return fail(400, "Bad Request");
+				current_.body.append(buffer_, lineEnd + 2, size);
+				scanned_ = lineEnd + 2 + size + 2;
+			}
+		}
+
+		void HttpParser::finish(HttpRequest& request, size_t end)
+		{
+			std::swap(request, current_);
+			begin_ = end;
+			scanned_ = end;
+			headersParsed_ = false;
+			expectContinue_ = false;
+		}
+
+		const char* reasonPhrase(int status)
+		{
+			switch (status) {
+			case 100: return "Continue";
+			case 200: return "OK";
+			case 201: return "Created";
+			case 202: return "Accepted";
+			case 204: return "No Content";
+			case 206: return "Partial Content";
+			case 301: return "Moved Permanently";
+			case 302: return "Found";
+			case 303: return "See Other";
+			case 304: return "Not Modified";
+			case 307: return "Temporary Redirect";
+			case 308: return "Permanent Redirect";
+			case 400: return "Bad Request";
+			case 401: return "Unauthorized";
+			case 403: return "Forbidden";
+			case 404: return "Not Found";
+			case 405: return "Method Not Allowed";
+			case 409: return "Conflict";
+			case 413: return "Payload Too Large";
+			case 416: return "Range Not Satisfiable";
+			case 429: return "Too Many Requests";
+			case 431: return "Request Header Fields Too Large";
+			case 500: return "Internal Server Error";
+			case 501: return "Not Implemented";
+			case 502: return "Bad Gateway";
+			case 503: return "Service Unavailable";
+			case 505: return "HTTP Version Not Supported";
+			default: return "Unknown";
+			}
+		}
+
+		// Variables in a response refer to the handler's context, so they are resolved before it ends
+		void resolveResponse(Token& token, int depth)
+		{
+			recurseVariables(token);
+			if (depth == 0)
+				return;
+
+			if (token.tokenType == T_ARRAY) {
+				token.asTokenList = TokenListPtr(new TokenList(*token.asTokenList));
+				for (TokenList::iterator it = token.asTokenList->begin(); it != token.asTokenList->end(); ++it)
+					resolveResponse(*it, depth - 1);
+			}
+			else if (token.tokenType == T_DICTIONARY) {
+				TokenDictionaryPtr dictionary(new TokenDictionary());
+				for (TokenDictionary::const_iterator it = token.asDictionary->begin();
+					it != token.asDictionary->end(); ++it) {
+						Token value = it->value;
+						resolveResponse(value, depth - 1);
+						(*dictionary)[it->key] = value;
+				}
+				token.asDictionary = dictionary;
+			}
+		}
+
+		class HttpWorker;
+
+		/* HttpServer - what the workers of one http_serve call share. Any of them can stop the
+		     server (when a handler calls halt). */
+		class HttpServer {
+		public:
+			HttpServer(const TokenListPtr& handler, const HttpOptions& options) :
+				handler(handler), options(options), halted(false) { }
+
+			void stop();
+
+			TokenListPtr handler;
+			HttpOptions options;
+			bool halted;
+			boost::mutex mutex;
+			vector<boost::asio::io_service*> services;
+		};
+
+		void HttpServer::stop()
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			halted = true;
+			for (size_t i = 0; i < services.size(); ++i)
+				services[i]->stop();
+		}
+
+		class HttpConnection;
+		typedef boost::shared_ptr<HttpConnection> HttpConnectionPtr;
+
+		/* HttpWorker - accepts connections and runs the handler in one interpreter. With several
+		     workers, each runs on its own thread and accepts from its own duplicate of the
+			 listening socket. */
+		class HttpWorker {
+		public:
+			HttpWorker(HttpServer& server, Context* context, tcp::acceptor::native_handle_type listener);
+			~HttpWorker();
+
+			void run();
+			Token handle(HttpRequest& request, const string& remote);
+
+			HttpServer& server;
+			Context* context;
+			std::set<HttpConnection*> connections;
+
+		private:
+			void accept();
+			void shutdown();
+			void acceptCompleted(HttpConnectionPtr connection, const boost::system::error_code& error);
+			void acceptTimerExpired(const boost::system::error_code& error);
+
+			tcp::acceptor acceptor_;
+			boost::asio::steady_timer acceptTimer_;
+			bool stopping_;
+		};
+
+		/* HttpConnection - a keep-alive connection. Everything that arrives is fed to the parser
+		     and every complete request is answered in order. The responses are queued as a list
+			 of buffers and written with a single gathered write, so a batch of pipelined requests
+			 is answered with one system call where possible. */
+		class HttpConnection : public boost::enable_shared_from_this<HttpConnection> {
+		public:
+			HttpConnection(HttpWorker& worker) : socket(worker.context->interpreter.io_service),
+				worker_(worker), timer_(worker.context->interpreter.io_service),
+				parser_(worker.server.options.maxBodySize), readBuffer_(HTTP_READ_SIZE),
+				writing_(false), closing_(false), paused_(false)
+			{
+				worker_.connections.insert(this);
+			}
+
+			~HttpConnection()
+			{
+				worker_.connections.erase(this);
+			}
+
+			void start();
+			void close();
+
+			tcp::socket socket;
+
+		private:
+			void read();
+			void readCompleted(const boost::system::error_code& error, size_t bytesRead);
+			void timerExpired(const boost::system::error_code& error);
+			void respond(HttpRequest& request);
+			void queueResponse(HttpRequest& request, const Token& response);
+			void respondError(int status, const string& message);
+			void queue(const StringPtr& data) { pending_.push_back(data); }
+			void queue(const string& data) { pending_.push_back(StringPtr(new string(data))); }
+			void write();
+			void writeCompleted(const boost::system::error_code& error, size_t);
+			size_t queuedSize() const;
+
+			HttpWorker& worker_;
+			boost::asio::steady_timer timer_;
+			HttpParser parser_;
+			vector<char> readBuffer_;
+			vector<StringPtr> pending_;   // queued while a write is in progress
+			vector<StringPtr> inFlight_;  // kept alive until the write completes
+			bool writing_;
+			bool closing_;
+			bool paused_;                 // not reading until the queued responses are written
+			string remote_;
+		};
+
+		void HttpConnection::start()
+		{
+			boost::system::error_code error;
+			tcp::endpoint endpoint = socket.remote_endpoint(error);
+			if (!error)
+				remote_ = endpoint.address().to_string();
+
+			socket.set_option(tcp::no_delay(true), error);
+			read();
+		}
+
+		void HttpConnection::close()
+		{
+			boost::system::error_code ignored;
+			timer_.cancel(ignored);
+			socket.shutdown(boost::asio::socket_base::shutdown_both, ignored);
+			socket.close(ignored);
+		}
+
+		void HttpConnection::read()
+		{
+			timer_.expires_from_now(boost::asio::chrono::seconds(worker_.server.options.keepAliveTimeout));
+			timer_.async_wait(boost::bind(&HttpConnection::timerExpired, shared_from_this(),
+				boost::asio::placeholders::error));
+
+			socket.async_read_some(boost::asio::buffer(readBuffer_), boost::bind(
+				&HttpConnection::readCompleted, shared_from_this(),
+				boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+		}
+
+		void HttpConnection::timerExpired(const boost::system::error_code& error)
+		{
+			// The timer is also cancelled (and rearmed) whenever a read completes
+			if (!error && timer_.expires_at() <= boost::asio::steady_timer::clock_type::now())
+				close();
+		}
+
+		void HttpConnection::readCompleted(const boost::system::error_code& error, size_t bytesRead)
+		{
+			boost::system::error_code ignored;
+			timer_.cancel(ignored);
+			if (error) {
+				// The peer may half-close after its last request, the responses are still written
+				closing_ = true;
+				if (!writing_)
+					close();
+				return;
+			}
+
+			parser_.append(&readBuffer_[0], bytesRead);
+
+			HttpRequest request;
+			while (!closing_) {
+				HttpParser::Result result = parser_.next(request);
+				if (result == HttpParser::PR_INCOMPLETE) {
+					if (parser_.takeExpectContinue())
+						queue(string("HTTP/1.1 100 Continue\r\n\r\n"));
+					break;
+				}
+				if (result == HttpParser::PR_ERROR) {
+					respondError(parser_.errorStatus(), parser_.error());
+					break;
+				}
+				respond(request);
+			}
+
+			if (!writing_ && !pending_.empty())
+				write();
+			// A client pipelining requests without reading the responses is not read from
+			if (closing_)
+				return;
+			if (queuedSize() > HTTP_MAX_QUEUED_SIZE)
+				paused_ = true;
+			else
+				read();
+		}
+
+		void HttpConnection::respondError(int status, const string& message)
+		{
+			std::ostringstream head;
+			head << "HTTP/1.1 " << status << " " << reasonPhrase(status) << "\r\n"
+				<< "Content-Type: text/plain\r\nContent-Length: " << message.size() + 1 << "\r\n"
+				<< "Connection: close\r\n\r\n" << message << "\n";
+			queue(head.str());
+			closing_ = true;
+		}
+
+		// Strings are copied, as the script could modify them in place while they are being written
+		StringPtr bodyString(const Token& token)
+		{
+			return StringPtr(new string(*giveString(token)));
+		}
+
+		void HttpConnection::respond(HttpRequest& request)
+		{
+			Token response = worker_.handle(request, remote_);
+			if (!request.keepAlive)
+				closing_ = true;
+
+			try {
+				queueResponse(request, response);
+			}
+			catch (const StutskException& e) {
+				cerr << e.getFormattedMessage();
+				respondError(500, "Internal Server Error");
+			}
+		}
+
+		void HttpConnection::queueResponse(HttpRequest& request, const Token& response)
+		{
+			int status = 200;
+			Token body;
+			std::ostringstream head;
+			bool hasContentType = false;
+			string headers;
+
+			if (response.tokenType == T_DICTIONARY) {
+				Token* value = response.asDictionary->find(stringToken("status"));
+				if (value != NULL)
+					status = (int)giveInteger(*value);
+
+				value = response.asDictionary->find(stringToken("headers"));
+				if (value != NULL && value->tokenType == T_DICTIONARY)
+					for (TokenDictionary::const_iterator it = value->asDictionary->begin();
+						it != value->asDictionary->end(); ++it) {
+							string name = it->key.toString();
+							if (boost::algorithm::iequals(name, "content-type"))
+								hasContentType = true;
+							headers += name + ": " + *giveString(it->value) + "\r\n";
+					}
+
+				value = response.asDictionary->find(stringToken("body"));
+				if (value != NULL)
+					body = *value;
+			}
+			else
+				body = response;
+
+			head << "HTTP/1.1 " << status << " " << reasonPhrase(status) << "\r\n" << headers;
+			if (!hasContentType)
+				head << "Content-Type: text/html; charset=utf-8\r\n";
+			if (closing_)
+				head << "Connection: close\r\n";
+			else if (request.version == "HTTP/1.0")
+				head << "Connection: keep-alive\r\n";
+
+			bool noBody = request.method == "HEAD" || status == 204 || status == 304 ||
+				(status >= 100 && status < 200);
+
+			// An array body is sent as one chunk per element, HTTP/1.0 clients get it concatenated
+			if (body.tokenType == T_ARRAY && request.version == "HTTP/1.1") {
+				head << "Transfer-Encoding: chunked\r\n\r\n";
+				queue(head.str());
+				if (noBody)
+					return;
+				for (TokenList::const_iterator it = body.asTokenList->begin();
+					it != body.asTokenList->end(); ++it) {
+						StringPtr chunk = bodyString(*it);
+						if (chunk->empty())
+							continue;
+						std::ostringstream size;
+						size << std::hex << chunk->size() << "\r\n";
+						queue(size.str());
+						queue(chunk);
+						queue(string("\r\n"));
+				}
+				queue(string("0\r\n\r\n"));
+				return;
+			}
+
+			vector<StringPtr> parts;
+			size_t length = 0;
+			if (body.tokenType == T_ARRAY)
+				for (TokenList::const_iterator it = body.asTokenList->begin();
+					it != body.asTokenList->end(); ++it) {
+						parts.push_back(bodyString(*it));
+						length += parts.back()->size();
+				}
+			else if (body.tokenType != T_EMPTY) {
+				parts.push_back(bodyString(body));
+				length = parts.back()->size();
+			}
+
+			head << "Content-Length: " << length << "\r\n\r\n";
+			queue(head.str());
+			if (!noBody)
+				pending_.insert(pending_.end(), parts.begin(), parts.end());
+		}
+
+		void HttpConnection::write()
+		{
+			inFlight_.swap(pending_);
+			pending_.clear();
+
+			vector<boost::asio::const_buffer> buffers;
+			buffers.reserve(inFlight_.size());
+			for (size_t i = 0; i < inFlight_.size(); ++i)
+				if (!inFlight_[i]->empty())
+					buffers.push_back(boost::asio::buffer(*inFlight_[i]));
+
+			writing_ = true;
+			boost::asio::async_write(socket, buffers, boost::bind(&HttpConnection::writeCompleted,
+				shared_from_this(), boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
+		}
+
+		void HttpConnection::writeCompleted(const boost::system::error_code& error, size_t)
+		{
+			writing_ = false;
+			inFlight_.clear();
+			if (error) {
+				close();
+				return;
+			}
+			if (!pending_.empty())
+				write();
+			else if (closing_)
+				close();
+
+			if (paused_ && !closing_ && queuedSize() <= HTTP_MAX_QUEUED_SIZE) {
+				paused_ = false;
+				read();
+			}
+		}
+
+		size_t HttpConnection::queuedSize() const
+		{
+			size_t size = 0;
+			for (size_t i = 0; i < pending_.size(); ++i)
+				size += pending_[i]->size();
+			for (size_t i = 0; i < inFlight_.size(); ++i)
+				size += inFlight_[i]->size();
+			return size;
+		}
+
+		HttpWorker::HttpWorker(HttpServer& server, Context* context,
+			tcp::acceptor::native_handle_type listener) : server(server), context(context),
+			acceptor_(context->interpreter.io_service), acceptTimer_(context->interpreter.io_service),
+			stopping_(false)
+		{
+			acceptor_.assign(tcp::v4(), listener);
+			boost::mutex::scoped_lock lock(server.mutex);
+			// A worker that starts after the server was stopped would never be stopped itself
+			if (server.halted)
+				stopping_ = true;
+			else
+				server.services.push_back(&context->interpreter.io_service);
+		}
+
+		HttpWorker::~HttpWorker()
+		{
+			boost::mutex::scoped_lock lock(server.mutex);
+			vector<boost::asio::io_service*>::iterator it = std::find(server.services.begin(),
+				server.services.end(), &context->interpreter.io_service);
+			if (it != server.services.end())
+				server.services.erase(it);
+		}
+
+		void HttpWorker::accept()
+		{
+			HttpConnectionPtr connection(new HttpConnection(*this));
+			acceptor_.async_accept(connection->socket, boost::bind(&HttpWorker::acceptCompleted,
+				this, connection, boost::asio::placeholders::error));
+		}
+
+		void HttpWorker::acceptCompleted(HttpConnectionPtr connection,
+			const boost::system::error_code& error)
+		{
+			if (stopping_)
+				return;
+			if (!error) {
+				connection->start();
+				accept();
+				return;
+			}
+
+			// Accepting again at once would spin while the error lasts (such as EMFILE)
+			acceptTimer_.expires_from_now(boost::asio::chrono::milliseconds(HTTP_ACCEPT_RETRY_DELAY));
+			acceptTimer_.async_wait(boost::bind(&HttpWorker::acceptTimerExpired, this,
+				boost::asio::placeholders::error));
+		}
+
+		void HttpWorker::acceptTimerExpired(const boost::system::error_code& error)
+		{
+			if (!stopping_ && error != boost::asio::error::operation_aborted)
+				accept();
+		}
+
+		// Runs the io_service until a handler calls halt
+		void HttpWorker::run()
+		{
+			if (stopping_)
+				return;
+
+			Context* previousContext = context->interpreter.eventLoopContext;
+			context->interpreter.eventLoopContext = context;
+
+			accept();
+			try {
+				context->interpreter.io_service.run();
+			}
+			catch (...) {
+				shutdown();
+				context->interpreter.eventLoopContext = previousContext;
+				throw;
+			}
+
+			shutdown();
+			context->interpreter.eventLoopContext = previousContext;
+		}
+
+		/* Cancels all pending operations and runs their handlers, so that no connection outlives
+		     the worker */
+		void HttpWorker::shutdown()
+		{
+			boost::asio::io_service& io_service = context->interpreter.io_service;
+			io_service.reset();
+			stopping_ = true;
+
+			boost::system::error_code ignored;
+			acceptTimer_.cancel(ignored);
+			acceptor_.close(ignored);
+			vector<HttpConnection*> open(connections.begin(), connections.end());
+			for (size_t i = 0; i < open.size(); ++i)
+				open[i]->close();
+
+			io_service.poll();
+			io_service.reset();
+		}
+
+		/* Runs the handler with the request dictionary on the stack and returns what it leaves
+		     on top. Errors are printed and answered with 500 rather than stopping the server. */
+		Token HttpWorker::handle(HttpRequest& request, const string& remote)
+		{
+			Token requestToken(T_DICTIONARY);
+			requestToken.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+			TokenDictionary& dictionary = *requestToken.asDictionary;
+
+			size_t query = request.target.find('?');
+			dictionary[stringToken("method")] = stringToken(request.method);
+			dictionary[stringToken("target")] = stringToken(request.target);
+			dictionary[stringToken("path")] = stringToken(request.target.substr(0, query));
+			dictionary[stringToken("query")] = stringToken(query == string::npos ? "" :
+				request.target.substr(query + 1));
+			dictionary[stringToken("version")] = stringToken(request.version);
+			dictionary[stringToken("remote")] = stringToken(remote);
+
+			dictionary[stringToken("headers")] = headerDictionary(request.headers);
+
+			Token body(T_STRING);
+			body.asString = StringPtr(new string);
+			body.asString->swap(request.body);
+			dictionary[stringToken("body")] = body;
+
+			Interpreter& interpreter = context->interpreter;
+			TokenStack::size_type depth = context->stack.size();
+			context->stack.push_back(requestToken);
+
+			Token response;
+			try {
+				Context handlerContext(*server.handler, context);
+				handlerContext.functionName = "<http handler>";
+				handlerContext.run(*server.handler, "http_serve");
+				if (context->stack.size() > depth) {
+					// The response dictionary, its headers and the elements of a chunked body
+					response = context->stack.back();
+					resolveResponse(response, 2);
+				}
+			}
+			catch (const StutskException& e) {
+				cerr << e.getFormattedMessage();
+				response = Token(T_DICTIONARY);
+				response.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+				(*response.asDictionary)[stringToken("status")] = Token(T_INTEGER);
+				(*response.asDictionary)[stringToken("status")].data.asInteger = 500;
+				(*response.asDictionary)[stringToken("body")] = stringToken("Internal Server Error");
+			}
+
+			if (context->stack.size() > depth)
+				context->stack.resize(depth);
+
+			if (interpreter.exitVar == OP_HALT)
+				server.stop();
+			else
+				interpreter.exitVar = OP_INVALID;
+			return response;
+		}
+
+		HttpOptions parseOptions(Token& token)
+		{
+			HttpOptions options;
+			recurseVariables(token);
+			if (token.tokenType != T_DICTIONARY) {
+				options.port = (unsigned short)giveInteger(token);
+				return options;
+			}
+
+			Token* value = token.asDictionary->find(stringToken("listener"));
+			if (value != NULL) {
+				recurseVariables(*value);
+				if (value->tokenType != T_HANDLE || value->data.asHandle.size != sizeof(tcp::acceptor))
+					throw StutskException(ET_ERROR, "Listener is not an acceptor");
+				options.listener = (tcp::acceptor*)value->data.asHandle.ptr;
+			}
+			else if ((value = token.asDictionary->find(stringToken("port"))) != NULL)
+				options.port = (unsigned short)giveInteger(*value);
+			else
+				throw StutskException(ET_ERROR, "Port not given");
+
+			if ((value = token.asDictionary->find(stringToken("workers"))) != NULL) {
+				stutskInteger workers = giveInteger(*value);
+				options.workers = workers > 0 ? (unsigned int)workers : workerThreads;
+			}
+			if ((value = token.asDictionary->find(stringToken("keepalive_timeout"))) != NULL)
+				options.keepAliveTimeout = giveInteger(*value);
+			if ((value = token.asDictionary->find(stringToken("max_body_size"))) != NULL)
+				options.maxBodySize = (size_t)giveInteger(*value);
+			return options;
+		}
+
+		void runWorker(HttpServer* server, boost::shared_ptr<Interpreter> interpreter,
+			tcp::acceptor::native_handle_type listener)
+		{
+			try {
+				TokenList source;
+				Context workerContext(source, *interpreter);
+				HttpWorker worker(*server, &workerContext, listener);
+				worker.run();
+			}
+			catch (const StutskException& e) {
+				cerr << e.getFormattedMessage();
+			}
+			catch (const std::exception& e) {
+				cerr << e.what() << "\n";
+			}
+		}
+	}
+
+	void _f_http_serve(Context* context)
+	{
+		/* arguments: <T_CODEBLOCK handler> <T_INTEGER port | T_DICTIONARY options> http_serve
+		   returnvalue:
+		   description: Serves HTTP/1.1 on `port`, calling `handler` for every request with a
+		     dictionary of its "method", "target", "path", "query", "version", "remote" (address),
+			 "headers" (with lowercase names) and "body" on the stack. What the handler leaves on
+			 top is the response: a string (sent as text/html) or a dictionary with "status",
+			 "headers" and "body". A body given as an array of strings is sent chunked.
+		   notes: Connections are kept alive and pipelined requests are answered in order. A
+		     connection is not read from while more than 1 MB of its responses is unwritten.
+		     Options are "port", "listener" (an acceptor to serve from instead, such as the one of
+			 socket_listen_prefork), "workers" (default 1), "keepalive_timeout" (seconds, default
+			 15) and "max_body_size" (bytes, default 16 MB). With a single worker, handlers run in the
+			 current interpreter like event_loop_run callbacks, so other asynchronous operations
+			 keep running. With more (0 means one per CPU, see --threads), each worker runs on its
+			 own thread and interpreter, starting with copies of the user functions but no
+			 variables - like spawn. Errors in a handler are printed and answered with status 500.
+			 Like with event_loop_run, halt stops the server and then the program.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		HttpOptions options = parseOptions(token1);
+
+		recurseVariables(token2);
+		if (token2.tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+		HttpServer server(token2.asTokenList, options);
+		tcp::acceptor listener(context->interpreter.io_service);
+		if (options.listener != NULL) {
+#ifdef __unix__
+			// The server closes its own descriptor, the acceptor stays usable
+			listener.assign(tcp::v4(), dup(options.listener->native_handle()));
+#else
+			throw StutskException(ET_ERROR, "Listeners are not supported on this platform");
+#endif
+		}
+		else {
+			tcp::endpoint endpoint(tcp::v4(), options.port);
+			listener.open(endpoint.protocol());
+			listener.set_option(tcp::acceptor::reuse_address(true));
+			listener.bind(endpoint);
+			listener.listen();
+		}
+
+		if (options.workers <= 1) {
+			HttpWorker worker(server, context, listener.release());
+			worker.run();
+			return;
+		}
+
+#ifdef __unix__
+		// Every worker accepts from its own descriptor of the same listening socket
+		boost::thread_group threads;
+		for (unsigned int i = 0; i < options.workers; ++i) {
+			boost::shared_ptr<Interpreter> interpreter(new Interpreter(context->interpreter));
+			threads.create_thread(boost::bind(&runWorker, &server, interpreter,
+				dup(listener.native_handle())));
+		}
+		threads.join_all();
+
+		// Like with a single worker, halt stops the program as well
+		if (server.halted)
+			context->interpreter.exitVar = OP_HALT;
+#else
+		throw StutskException(ET_ERROR, "Multiple HTTP workers are not supported on this platform");
+#endif
+	}
+}
@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstring>
 
 #include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
 
 using namespace std;
 
@@ -39,20 +40,12 @@ const string stutskVersion = string("Stutsk Linux v1.1 (") + string(__DATE__) +
 // --------------------- GLOBAL VARIABLES ----------------------------------- //
 
 
-UserFunctionsMap userFunctions;
 StringMapCI environmentVars;
 BuiltinFunctionsMap builtinFunctions = BuiltIns::populateFunctions();
 OperatorMap stutskOperators = Operators::populateOperators();
 
-TokenStack stutskStack;
-Context *mainContext;
-OperatorType exitVar;
-DebugInfo errorToken;
-string sourceCodeText;
-
 vector<string> includePaths, customArguments;
-
-vector<ParseContext> parseContexts;
+unsigned int workerThreads = 1;
 
 // --------------------- IMPLEMENTATION ------------------------------------- //
 
@@ -70,9 +63,7 @@ string extractFileName(const string& fn) {
 }
 
 StutskException::StutskException(ExceptionType type, const string& msg) : 
-msg_(msg), type_(type), line_number_(errorToken.lineNum) {
-		context_ = &parseContexts[errorToken.context_id];
-};
+msg_(msg), type_(type), line_number_(0), context_(NULL) {};
 
 StutskException::StutskException(ExceptionType type, const string& msg, 
 	int line_number, ParseContext* context) : msg_(msg),
@@ -83,24 +74,45 @@ string StutskException::getMessage() const {
 	return msg_;
 }
 
+ExceptionType StutskException::getType() const {
+	return type_;
+}
+
 long StutskException::getLineNumber() const {
 	return line_number_;
 }
 
 string StutskException::getFileName() const {
-	return context_->FileName;
+	return context_ != NULL ? context_->FileName : "";
+}
+
+const ParseContext* StutskException::getParseContext() const {
+	return context_;
+}
+
+bool StutskException::hasLocation() const {
+	return context_ != NULL;
+}
+
+void StutskException::setLocation(int line_number, const ParseContext* context) {
+	line_number_ = line_number;
+	context_ = context;
 }
 
 string StutskException::getFormattedMessage() const {
 	stringstream ss;
+	stringstream location;
+
+	if (context_ != NULL)
+		location << context_->FileName << ":" << line_number_ << ": ";
 
 	switch (type_) {
 	case ET_CUSTOM:
-		ss << context_->FileName << ":" << line_number_ << ": ";
+		ss << location.str();
 		ss << "exception: " << msg_ << "\n";
 		break;
 	case ET_ERROR:
-		ss << context_->FileName << ":" << line_number_ << ": ";
+		ss << location.str();
 		ss << "error: " << msg_ << "\n";
 		break;
 	case ET_SYSTEM:
@@ -110,7 +122,7 @@ string StutskException::getFormattedMessage() const {
 		ss << "warning: " << msg_ << "\n";
 		break;
 	case ET_PARSER:
-		ss << context_->FileName << ":" << line_number_ << ": ";
+		ss << location.str();
 		ss << "parser error: " << msg_ << "\n";
 		break;
 	default:	
@@ -142,6 +154,66 @@ Token copy_token(Token token)
 	return token;
 }
 
+Interpreter::Interpreter() : functionsGeneration(0), mainContext(NULL), exitVar(OP_INVALID), 
+	eventLoopContext(NULL), debugger(*this), scheduler(*this) 
+{
+	errorToken.context_id = -1;
+	errorToken.lineNum = 0;
+	errorToken.columnNum = 0;
+	errorToken.tokenLength = 0;
+	errorToken.relativePos = 0;
+	randomGenerator.seed(time(NULL));
+}
+
+Interpreter::Interpreter(Interpreter& parent) : userFunctions(parent.userFunctions), 
+	functionsGeneration(0), mainContext(NULL), exitVar(OP_INVALID), parseContexts(parent.parseContexts), 
+	eventLoopContext(NULL), debugger(*this), scheduler(*this)
+{
+	errorToken.context_id = -1;
+	errorToken.lineNum = 0;
+	errorToken.columnNum = 0;
+	errorToken.tokenLength = 0;
+	errorToken.relativePos = 0;
+	randomGenerator.seed(parent.randomGenerator());
+}
+
+ParseContext* Interpreter::newParseContext()
+{
+	parseContexts.push_back(ParseContext());
+	parseContexts.back().id_ = parseContexts.size()-1;
+	return &parseContexts.back();
+}
+
+const ParseContext& Interpreter::parseContext(size_t id) const
+{
+	if (id >= parseContexts.size())
+		throw StutskException(ET_CUSTOM, "Invalid parser context ID");
+	return parseContexts[id];
+}
+
+void Interpreter::execute(const TokenList& sourceCode)
+{
+	exitVar = OP_INVALID;
+
+	Context mainCtx(sourceCode, *this);
+	mainContext = &mainCtx;
+	try {
+		mainContext->run(sourceCode, "<main>");
+		scheduler.joinAll();
+	}
+	catch (...) {
+		mainContext = NULL;
+		throw;
+	}
+	mainContext = NULL;
+}
+
+Context::Context(const TokenList& source, Interpreter& owner) : interpreter(owner), 
+	stack(owner.stack), parentContext(NULL), sourceCode(source) { }
+
+Context::Context(const TokenList& source, Interpreter& owner, TokenStack& ownStack) : 
+	interpreter(owner), stack(ownStack), parentContext(NULL), sourceCode(source) { }
+
 VariableScope Context::findVariableScope(string variableName) {
 	VariableScopeMap::iterator iter = variableScopeMap.find(variableName);
 	if (iter != variableScopeMap.end())
@@ -158,104 +230,115 @@ void Context::run(const TokenList& source, string name) {
 	UserFunctionsMap::iterator uIter;
 	Token variable;
 
-	Debugger::get_instance().step_in(this, name);
+	interpreter.debugger.step_in(this, name);
 
-	for (TokenList::const_iterator it = source.begin(); it != source.end(); ++it) {
+	try {
+		for (TokenList::const_iterator it = source.begin(); it != source.end(); ++it) {
 
-		errorToken = *(it->debugInfo);
-		Debugger::get_instance().step();
+			interpreter.errorToken = *(it->debugInfo);
+			interpreter.debugger.step();
 
-		if (exitVar != OP_INVALID)
-			break;
+			if (interpreter.exitVar != OP_INVALID)
+				break;
 
-		switch (it->tokenType) {
-		case T_OPERATOR:
-			Operators::doOperator(this, it->data.operatorType); break;
-			break;
-		case T_FUNCCALL:
-			// Builtin functions may be overriden by user-defined ones, so we check the latter first
-			uIter = userFunctions.find(it->data.asFunctionName);
-
-			if (uIter != userFunctions.end()) {
-				Context functionContext(uIter->second, this);
-				functionContext.functionName = it->data.asFunctionName;
-				functionContext.run(uIter->second, it->data.asFunctionName);					
-				if (exitVar == OP_EXIT) {
-					exitVar = OP_INVALID;
-				}
-			}
-			else {
-				bIter = builtinFunctions.find(it->data.asFunctionName);
-				if (bIter != builtinFunctions.end()) {
-					bIter->second(this);	
+			switch (it->tokenType) {
+			case T_OPERATOR:
+				Operators::doOperator(this, it->data.operatorType); break;
+				break;
+			case T_FUNCCALL:
+				// Builtin functions may be overriden by user-defined ones, so we check the latter first
+				uIter = interpreter.userFunctions.find(it->data.asFunctionName);
+
+				if (uIter != interpreter.userFunctions.end()) {
+					Context functionContext(uIter->second, this);
+					functionContext.functionName = it->data.asFunctionName;
+					functionContext.run(uIter->second, it->data.asFunctionName);					
+					if (interpreter.exitVar == OP_EXIT) {
+						interpreter.exitVar = OP_INVALID;
+					}
 				}
 				else {
-					stringstream ExceptionText;
-					ExceptionText << "Unknown function '" <<
-						it->data.asFunctionName << "'.";
-					throw StutskException(ET_ERROR, ExceptionText.str());
+					bIter = builtinFunctions.find(it->data.asFunctionName);
+					if (bIter != builtinFunctions.end()) {
+						bIter->second(this);	
+					}
+					else {
+						stringstream ExceptionText;
+						ExceptionText << "Unknown function '" <<
+							it->data.asFunctionName << "'.";
+						throw StutskException(ET_ERROR, ExceptionText.str());
+					}
+				}
+				break;
+			case T_ARRAY: {
+				TokenStack::size_type oldSize = stack.size();
+				run(*it->asTokenList, "<array>");
+
+				Token newArray(T_ARRAY);
+				newArray.asTokenList = TokenListPtr(new TokenList());
+
+				// Move tokens from stack to the new array
+				if (oldSize < stack.size())
+				{
+					newArray.asTokenList->insert(
+						newArray.asTokenList->end(),
+						stack.begin() + oldSize,
+						stack.end());
+					stack.erase(
+						stack.begin() + oldSize,
+						stack.end());
 				}
-			}
-			break;
-		case T_ARRAY: {
-			TokenStack::size_type oldSize = stutskStack.size();
-			run(*it->asTokenList, "<array>");
-
-			Token newArray(T_ARRAY);
-			newArray.asTokenList = TokenListPtr(new TokenList());
 
-			// Move tokens from stack to the new array
-			if (oldSize < stutskStack.size())
-			{
-				newArray.asTokenList->insert(
-					newArray.asTokenList->end(),
-					stutskStack.begin() + oldSize,
-					stutskStack.end());
-				stutskStack.erase(
-					stutskStack.begin() + oldSize,
-					stutskStack.end());
-			}
+				stack.push_back(newArray); 
+						  } break;
+			case T_VARIABLE:
+				switch (findVariableScope(it->data.asVariable.name)) {
+				case VS_AUTO:
+					variable = *it;
+					variable.data.asVariable.context = this;
+					break;
+				case VS_GLOBAL:
+					variable = *it;
+					variable.data.asVariable.context = interpreter.mainContext;
+					break;
+				case VS_STATIC:
+					variable = *it;
+					string newName = it->data.asVariable.name;
+					newName += "$" + functionName;
+					strcpy(variable.data.asVariable.name, newName.c_str());
 
-			stutskStack.push_back(newArray); 
-					  } break;
-		case T_VARIABLE:
-			switch (findVariableScope(it->data.asVariable.name)) {
-			case VS_AUTO:
-				variable = *it;
-				variable.data.asVariable.context = this;
+					variable.data.asVariable.context = interpreter.mainContext;
+					break;
+				}
+				stack.push_back(variable);
 				break;
-			case VS_GLOBAL:
-				variable = *it;
-				variable.data.asVariable.context = mainContext;
+				// We copy strigns, because they can be mutable (see . operator) but not codeblock, 
+				// as they are immutable.
+			case T_STRING:
+				stack.push_back(copy_token(*it));
 				break;
-			case VS_STATIC:
-				variable = *it;
-				string newName = it->data.asVariable.name;
-				newName += "$" + functionName;
-				strcpy(variable.data.asVariable.name, newName.c_str());
-
-				variable.data.asVariable.context = mainContext;
+				// If token is an atomic value, we just push it onto a stack
+			default:
+				stack.push_back(*it);
 				break;
 			}
-			stutskStack.push_back(variable);
-			break;
-			// We copy strigns, because they can be mutable (see . operator) but not codeblock, 
-			// as they are immutable.
-		case T_STRING:
-			stutskStack.push_back(copy_token(*it));
-			break;
-			// If token is an atomic value, we just push it onto a stack
-		default:
-			stutskStack.push_back(*it);
-			break;
-		}
 
-		// If exitVar is not unset, we must terminate the execution of the codeblock
-		if (exitVar != OP_INVALID)
-			break;
+			// If exitVar is not unset, we must terminate the execution of the codeblock
+			if (interpreter.exitVar != OP_INVALID)
+				break;
+		}
+	}
+	catch (StutskException& e) {
+		// Builtins don't know where they were called from, so exceptions are located at the
+		// token that was being executed when they reach the innermost Context::run
+		if (!e.hasLocation() && interpreter.errorToken.context_id >= 0 &&
+			(size_t)interpreter.errorToken.context_id < interpreter.parseContexts.size())
+			e.setLocation(interpreter.errorToken.lineNum, 
+				&interpreter.parseContexts[interpreter.errorToken.context_id]);
+		throw;
 	}
 
-	Debugger::get_instance().step_out();
+	interpreter.debugger.step_out();
 }
 
 /* Parser::getOperatorSymbol - returns a textual representation of an operator from its type */
@@ -534,6 +617,9 @@ std::string Parser::serializeToken(const Token &token)
 		ss << "\"" << stringEscape(*token.asString) << "\"";
 		return ss.str()
 			;
+	case T_STRING_VIEW:
+		ss << "\"" << stringEscape(*giveString(token)) << "\"";
+		return ss.str();
 	case T_ARRAY:
 		ss << "( ";
 		for (iter = token.asTokenList->begin();
@@ -658,17 +744,33 @@ string BuiltIns::tokenType(stutskTokenType type)
 	case T_ARRAY: return "T_ARRAY";		
 	case T_HANDLE: return "T_HANDLE";
 	case T_DICTIONARY: return "T_DICTIONARY";
+	case T_SET: return "T_SET";
+	case T_STRING_VIEW: return "T_STRING_VIEW";
 	default: return ""; 
 	}
 }
 
-string BuiltIns::dumpDictionary(TokenMap& tokenMap, int niveau)
+string BuiltIns::dumpDictionary(TokenDictionary& dictionary, int niveau)
 {
 	stringstream result;
 	 
-	for (TokenMap::iterator iter = tokenMap.begin(); 
-		iter != tokenMap.end(); ++iter) {
-			result << BuiltIns::dumpValue(iter->second, niveau, iter->first);
+	for (TokenDictionary::const_iterator iter = dictionary.begin(); 
+		iter != dictionary.end(); ++iter) {
+			Token value = iter->value;
+			result << BuiltIns::dumpValue(value, niveau, iter->key.toString());
+	}
+	return result.str();
+}
+
+string BuiltIns::dumpSet(TokenSet& set, int niveau)
+{
+	stringstream result;
+	int i = 0;
+
+	for (TokenSet::const_iterator iter = set.begin(); 
+		iter != set.end(); ++iter) {
+			Token value = iter->key.toToken();
+			result << BuiltIns::dumpValue(value, niveau, i++);
 	}
 	return result.str();
 }
@@ -771,6 +873,16 @@ string BuiltIns::dumpValue(Token& token, int niveau, string i) {
 			token.data.asHandle.ptr << ", size: " << (long)
 			token.data.asHandle.size << ")\n";
 		break;
+	case T_SET:
+		result << identString << i << ": T_SET[" <<
+			(*token.asSet).size() << "]: \n" << dumpSet
+			(*token.asSet, niveau + 4);
+		break;
+	case T_STRING_VIEW:
+		// Views are usually too large to be dumped
+		result << identString << i << ": T_STRING_VIEW[" <<
+			token.data.asView.length << "] (offset " << token.data.asView.offset << ")\n";
+		break;
 	}
 	return result.str();
 }
@@ -826,6 +938,8 @@ int main(int ac, char* av[], char* envp[]) {
 		("debugger-address", value<string>()->default_value("localhost"), 
 			"IP(v6) adddress or hostname of the debugger")
 		("debugger-port", value<int>()->default_value(8455), "port or the debugger")
+		("threads", value<unsigned int>(), 
+			"number of worker threads for parallel functions (default: number of cores)")
 		;
 
 	variables_map vm;
@@ -872,6 +986,11 @@ int main(int ac, char* av[], char* envp[]) {
 
 	customArguments.swap(additionalParameters);
 
+	if (vm.count("threads"))
+		workerThreads = std::max(1u, vm["threads"].as<unsigned int>());
+	else
+		workerThreads = std::max(1u, boost::thread::hardware_concurrency());
+
 	std::ifstream inputFile(inputFileName);
 
 	if (!inputFile)
@@ -880,15 +999,17 @@ int main(int ac, char* av[], char* envp[]) {
 		return EXIT_FAILURE;
 	}
 
+	Interpreter interpreter;
+
 	try {
 		if (vm.count("debug"))
 		{
-			Debugger::get_instance().connect(
+			interpreter.debugger.connect(
 				vm["debugger-address"].as<string>(),
 				vm["debugger-port"].as<int>());
 		}
 
-		ParseContext* parseContext = ParseContext::newContext();
+		ParseContext* parseContext = interpreter.newParseContext();
 
 		parseContext->SourceCode = string(
 			std::istreambuf_iterator<char>(inputFile),
@@ -898,24 +1019,22 @@ int main(int ac, char* av[], char* envp[]) {
 		// We generate a Parser object
 		Parser parser(parseContext->SourceCode, parseContext);
 
-		// Initialization of global variables8
-		exitVar = OP_INVALID;
-
 		TokenList sourceCode;	
 
 		parser.parse(sourceCode);
 
-		Context mainCtx(sourceCode, NULL);
-		mainContext = &mainCtx;
-		mainContext->run(sourceCode, "<main>");
-		Debugger::get_instance().disconnect();
+		interpreter.execute(sourceCode);
+		BuiltIns::joinSpawnedWorkers();
+		interpreter.debugger.disconnect();
 	}
 	catch (const StutskException &e) {
 		cerr << e.getFormattedMessage();
+		BuiltIns::joinSpawnedWorkers(true);
 		return EXIT_FAILURE;
 	}
 	catch (const std::exception &e) {
 		cerr << e.what();
+		BuiltIns::joinSpawnedWorkers(true);
 	    return EXIT_FAILURE;
 	}
 
@@ -27,10 +27,10 @@ void BuiltIns::_f_round(Context* context) {
 	   description: Returns `value` rounded to the nearest integer.
 	   notes:
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger value = (stutskInteger)(0.5 + giveFloat(upper));
-	pushInteger(value);
+	pushInteger(context, value);
 }
 
 void BuiltIns::_f_floor(Context* context) {
@@ -39,10 +39,10 @@ void BuiltIns::_f_floor(Context* context) {
 	   description: Returns `value` rounded down.
 	   notes:
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger value = (stutskInteger)floor(giveFloat(upper));
-	pushInteger(value);
+	pushInteger(context, value);
 }
 
 void BuiltIns::_f_ceil(Context* context) {
@@ -51,10 +51,10 @@ void BuiltIns::_f_ceil(Context* context) {
 	   description: Returns `value` rounded up.
 	   notes:
 	*/
-	Token upper = stack_back_safe();
-	stutskStack.pop_back();
+	Token upper = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger value = (stutskInteger)ceil(giveFloat(upper));
-	pushInteger(value);
+	pushInteger(context, value);
 }
 
 void BuiltIns::_f_sqrt(Context* context) {
@@ -63,10 +63,10 @@ void BuiltIns::_f_sqrt(Context* context) {
 	   description: Returns the square root of `value`.
 	   notes:
 	*/
-	Token sqrtToken = stack_back_safe();
-	stutskStack.pop_back();
+	Token sqrtToken = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = sqrt(giveFloat(sqrtToken));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_abs(Context* context) {
@@ -75,8 +75,8 @@ void BuiltIns::_f_abs(Context* context) {
 	   description: Returns the absolute value of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger i1;
 	stutskFloat f1;
 	string s1;
@@ -88,11 +88,11 @@ void BuiltIns::_f_abs(Context* context) {
 		break;
 	case NT_FLOAT: 
 		f1 = fabs(f1);
-		pushFloat(f1);
+		pushFloat(context, f1);
 		break;
 	case NT_INTEGER: 
 		i1 = abs(i1);
-		pushInteger(i1);
+		pushInteger(context, i1);
 		break;
 	}
 }
@@ -103,10 +103,10 @@ void BuiltIns::_f_sinh(Context* context) {
 	   description: Returns the hyperbolic sine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = sinh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_cosh(Context* context) {
@@ -115,10 +115,10 @@ void BuiltIns::_f_cosh(Context* context) {
 	   description: Returns the hyperbolic cosine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = cosh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_tanh(Context* context) {
@@ -127,10 +127,10 @@ void BuiltIns::_f_tanh(Context* context) {
 	   description: Returns the hyperbolic tangens of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = tanh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_asinh(Context* context) {
@@ -139,10 +139,10 @@ void BuiltIns::_f_asinh(Context* context) {
 	   description: Returns the inverse hyperbolic sine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = boost::math::asinh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_acosh(Context* context) {
@@ -151,10 +151,10 @@ void BuiltIns::_f_acosh(Context* context) {
 	   description: Returns the hyperbolic cosine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = boost::math::acosh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_atanh(Context* context) {
@@ -163,10 +163,10 @@ void BuiltIns::_f_atanh(Context* context) {
 	   description: Returns the inverse hyperbolic tangens of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = boost::math::atanh(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_sin(Context* context) {
@@ -175,10 +175,10 @@ void BuiltIns::_f_sin(Context* context) {
 	   description: Returns the sine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = sin(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_cos(Context* context) {
@@ -187,10 +187,10 @@ void BuiltIns::_f_cos(Context* context) {
 	   description: Returns the cosine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = cos(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_tan(Context* context) {
@@ -199,10 +199,10 @@ void BuiltIns::_f_tan(Context* context) {
 	   description: Returns the tangens of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = tan(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_asin(Context* context) {
@@ -211,10 +211,10 @@ void BuiltIns::_f_asin(Context* context) {
 	   description: Returns the inverse sine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = asin(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_acos(Context* context) {
@@ -223,10 +223,10 @@ void BuiltIns::_f_acos(Context* context) {
 	   description: Returns the inverse cosine of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = acos(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_atan(Context* context) {
@@ -235,10 +235,10 @@ void BuiltIns::_f_atan(Context* context) {
 	   description: Returns the inverse tangens of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = atan(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_log(Context* context) {
@@ -247,10 +247,10 @@ void BuiltIns::_f_log(Context* context) {
 	   description: Returns the natural logarithm of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = log(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_log10(Context* context) {
@@ -259,10 +259,10 @@ void BuiltIns::_f_log10(Context* context) {
 	   description: Returns the base-10 logarithm of `value`.
 	   notes:
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskFloat value = log10(giveFloat(token));
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_pi(Context* context) {
@@ -272,7 +272,7 @@ void BuiltIns::_f_pi(Context* context) {
 	   notes:
 	*/
 	stutskFloat value = boost::math::constants::pi<stutskFloat>();
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_euler(Context* context) {
@@ -282,7 +282,7 @@ void BuiltIns::_f_euler(Context* context) {
 	   notes:
 	*/
 	stutskFloat value = boost::math::constants::e<stutskFloat>();
-	pushFloat(value);
+	pushFloat(context, value);
 }
 
 void BuiltIns::_f_random(Context* context) {
@@ -293,8 +293,8 @@ void BuiltIns::_f_random(Context* context) {
 	     argument or a random number on interval [min, max] if provided an array.
 	   notes: Uses Mersene Twister that is automatically seeded with system time when the interpreter starts.
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token);
 
 	if (token.tokenType == T_ARRAY)
@@ -307,7 +307,7 @@ void BuiltIns::_f_random(Context* context) {
 			throw StutskException(ET_ERROR, "Upper bound must bi higher than lower bound");
 
 		boost::random::uniform_int_distribution<stutskInteger> distribution(0, max-min); // Max	
-		pushInteger(distribution(RandomNumber::getInstance().generator)+min);
+		pushInteger(context, distribution(context->interpreter.randomGenerator)+min);
 		// Vem, kaj si najbr misli tukaj ampak, ko sem to pisal, je tukaj bil en nasty bug v boostu,
 		// namre e je stutskInteger = long long, potem je -1 vrgel ven kot 2^32, tako da je raji zdaj tako 
 	}
@@ -317,7 +317,7 @@ void BuiltIns::_f_random(Context* context) {
 		if (max < 1)
 			throw StutskException(ET_ERROR, "Number must be positive"); // [sic]
 		boost::random::uniform_int_distribution<stutskInteger> distribution(0, max-1);	
-		pushInteger(distribution(RandomNumber::getInstance().generator));
+		pushInteger(context, distribution(context->interpreter.randomGenerator));
 	}
 }
 
@@ -328,7 +328,7 @@ void BuiltIns::_f_random_float(Context* context) {
 	   notes: Uses Mersene Twister that is automatically seeded with system time when the interpreter starts.
 	*/
 	boost::random::uniform_01<stutskFloat, stutskFloat>	distribution;
-		pushFloat(distribution(RandomNumber::getInstance().generator));
+		pushFloat(context, distribution(context->interpreter.randomGenerator));
 }
 
 const char baseChars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
@@ -348,10 +348,10 @@ void BuiltIns::_f_from_base(Context* context) {
 	   notes: Maximum base is 36 (digits are "0123456789abcdefghijklmnopqrstuvwxyz"). 
 	     Negative numbers are written with '-' in front.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger base = giveInteger(token1);
 	if (base < 2)
 	throw StutskException(ET_ERROR, "Base must be higher than or equal to 2.");
@@ -368,7 +368,7 @@ void BuiltIns::_f_from_base(Context* context) {
 	}
 	for (;i<text->length();i++)
 		result = result * base + getDigit((*text)[i]);  
-	pushInteger(negative ? -result : result);
+	pushInteger(context, negative ? -result : result);
 }
 
 void BuiltIns::_f_to_base(Context* context) {
@@ -378,10 +378,10 @@ void BuiltIns::_f_to_base(Context* context) {
 	   notes: Maximum base is 36 (digits are "0123456789abcdefghijklmnopqrstuvwxyz").
 	     Negative numbers are written with '-' in front.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger base = giveInteger(token1);
 	stutskInteger number = giveInteger(token2);
 	bool negative = (number < 0); number = abs(number);
@@ -389,7 +389,7 @@ void BuiltIns::_f_to_base(Context* context) {
 	throw StutskException(ET_ERROR, "Base must be higher than or equal to 2.");
 	if (base > 36)
 		throw StutskException(ET_ERROR, "Base cannot be higher than 36.");
-	auto result = pushString();
+	auto result = pushString(context);
 	do
 	{
 		*result = baseChars[number % base] + *result;
@@ -404,8 +404,8 @@ void BuiltIns::_f_max(Context* context) {
 	   description: Returns element of array with the highes numerical value.
 	   notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token);
 	
 	if (token.tokenType != T_ARRAY)
@@ -422,7 +422,7 @@ void BuiltIns::_f_max(Context* context) {
 		  maxToken = *it;
 	}
 
-	stutskStack.push_back(maxToken);
+	context->stack.push_back(maxToken);
 }
 
 void BuiltIns::_f_min(Context* context) {
@@ -431,8 +431,8 @@ void BuiltIns::_f_min(Context* context) {
 	   description: Returns element of array with the lowest numerical value.
 	   notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	recurseVariables(token);
 	
 	if (token.tokenType != T_ARRAY)
@@ -449,5 +449,5 @@ void BuiltIns::_f_min(Context* context) {
 		  minToken = *it;
 	}
 
-	stutskStack.push_back(minToken);
+	context->stack.push_back(minToken);
 }
@@ -22,31 +22,38 @@ void BuiltIns::_f_length(Context* context) {
 	/* arguments: <T_ARRAY token> length
 	   arguments: <T_STRING token> length
 	   arguments: <T_DICTIONARY token> length
+	   arguments: <T_SET token> length
 	   returnvalue: <T_INTEGER>
 	   description: Returns the number of elements in token (characters in strings)
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();	
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();	
 
 	recurseVariables(token1);
 
 	switch (token1.tokenType)
 	{
 		case T_ARRAY: 
-			pushInteger(token1.asTokenList->size());
+			pushInteger(context, token1.asTokenList->size());
 			break;
 		case T_DICTIONARY: 
-			pushInteger(token1.asDictionary->size());
+			pushInteger(context, token1.asDictionary->size());
+			break;
+		case T_SET: 
+			pushInteger(context, token1.asSet->size());
+			break;
+		case T_STRING_VIEW: 
+			pushInteger(context, token1.data.asView.length);
 			break;
 		default:
-			pushInteger(giveString(token1)->size());
+			pushInteger(context, giveString(token1)->size());
 			break;
 	}		
 }
 
 
-void BuiltIns::_f_setlength(Context* Context)
+void BuiltIns::_f_setlength(Context* context)
 {
 	/* arguments: <T_ARRAY token> setlength
 	   arguments: <T_STRING token> setlength
@@ -58,11 +65,11 @@ void BuiltIns::_f_setlength(Context* Context)
 	     otherwise returns a resized array/string.
 	   notes: If new length is larger, it fills the string with \0 and array with T_EMPTY tokens 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	stutskInteger newLength = giveInteger(token2);
 
@@ -92,27 +99,29 @@ void BuiltIns::_f_setlength(Context* Context)
 	}	
 
 	if (!isVariable)
-		stutskStack.push_back(token1); 
+		context->stack.push_back(token1); 
 }
 
 
-void BuiltIns::_f_slice(Context* Context) {
+void BuiltIns::_f_slice(Context* context) {
 	/* arguments: <T_ARRAY token> <T_INTEGER start> <T_INTEGER end> slice
 	   arguments: <T_STRING token> <T_INTEGER start> <T_INTEGER end> slice
+	   arguments: <T_STRING_VIEW token> <T_INTEGER start> <T_INTEGER end> slice
 	   returnvalue: <T_ARRAY>
 	   returnvalue: <T_STRING>
+	   returnvalue: <T_STRING_VIEW>
 	   description: Extract elements from array/returns a substring from index start to index end (inclusively)
-	   notes: 
+	   notes: Slices of a string view (see mmap_open) are views of the same file, nothing is copied.
 	*/
-	Token tEnd = stack_back_safe();
-	stutskStack.pop_back();
+	Token tEnd = stack_back_safe(context);
+	context->stack.pop_back();
 
-	Token tStart = stack_back_safe();
-	stutskStack.pop_back();
+	Token tStart = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger startIdx = giveInteger(tStart);
 
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	stutskInteger endIdx = giveInteger(tEnd);
 
 	recurseVariables(token1);  
@@ -136,9 +145,23 @@ void BuiltIns::_f_slice(Context* Context) {
 					TokenList(token1.asTokenList->begin() + startIdx,
 					token1.asTokenList->begin() + endIdx + 1));
 
-				stutskStack.push_back(newArray);
+				context->stack.push_back(newArray);
 				break; 
 			}
+		case T_STRING_VIEW:
+			{
+				if (startIdx < 0 || endIdx < 0)
+					throw StutskException(ET_ERROR, "String index underflow");
+				if (startIdx >= (stutskInteger)token1.data.asView.length || 
+					endIdx   >= (stutskInteger)token1.data.asView.length)
+					throw StutskException(ET_ERROR, "String index overflow");
+				if (startIdx > endIdx)
+					throw StutskException(ET_ERROR, "Index mismatch");
+
+				pushStringView(context, token1.asMapping, token1.data.asView.offset + (size_t)startIdx,
+					(size_t)(endIdx - startIdx + 1));
+				break;
+			}
 		default:
 			{
 				StringPtr hayStack = giveString(token1);
@@ -152,7 +175,7 @@ void BuiltIns::_f_slice(Context* Context) {
 					throw StutskException(ET_ERROR, "Index mismatch");
 
 				stutskInteger start = giveInteger(tStart), end = giveInteger(tEnd); 
-				*pushString() = hayStack->substr(start, end-start+1);
+				*pushString(context) = hayStack->substr(start, end-start+1);
 			}
 			break;
 	}		
@@ -19,8 +19,448 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <builtinFunctions.h>
 
 #include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <exec-stream.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+
+#ifdef __unix__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#endif
+
+#ifdef FORK_CAPABLE
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <dirent.h>
+#endif
+
+namespace {
+	using boost::asio::ip::tcp;
+
+	const size_t SOCKET_BUFFER_SIZE = 64 * 1024;
+
+	/* BufferedSocket - a TCP socket with a receive buffer that all the reading builtins go
+	     through, so that line-oriented reads take one large read_some instead of a read per
+		 character. The buffer is allocated on the first read and reused afterwards. */
+	class BufferedSocket : public tcp::socket {
+	public:
+		explicit BufferedSocket(boost::asio::io_service& io_service) : tcp::socket(io_service),
+			timeout(-1), begin_(0), end_(0) { }
+
+		// The host:port a socket from socket_pool_get is returned to
+		string poolKey;
+		// How long a read or write may wait in milliseconds, negative for no limit
+		stutskInteger timeout;
+		// Why the last read or write that threw failed
+		boost::system::error_code lastError;
+
+		/* Waits until the socket is readable or writable, if waiting has to be done outside of
+		     the blocking call - otherwise the call itself waits. Throws when time runs out. */
+		void wait(Interpreter& interpreter, bool write)
+		{
+			if (!interpreter.scheduler.limited(timeout))
+				return;
+			if (!interpreter.scheduler.waitReady(native_handle(), write, timeout)) {
+				interpreter.scheduler.checkDeadline();
+				throw StutskException(ET_ERROR, "Operation timed out");
+			}
+		}
+
+		void writeAll(Interpreter& interpreter, const char* data, size_t length)
+		{
+			boost::system::error_code error;
+			if (!interpreter.scheduler.limited(timeout)) {
+				boost::asio::write(*this, boost::asio::buffer(data, length), boost::asio::transfer_all(), error);
+				if (error) {
+					lastError = error;
+					throw StutskException(ET_ERROR, error.message());
+				}
+				return;
+			}
+
+			non_blocking(true, error);
+			while (length > 0 && !error) {
+				size_t written = write_some(boost::asio::buffer(data, length), error);
+				data += written;
+				length -= written;
+				if (error == boost::asio::error::would_block) {
+					error = boost::system::error_code();
+					try {
+						wait(interpreter, true);
+					}
+					catch (...) {
+						non_blocking(false, error);
+						throw;
+					}
+				}
+			}
+
+			boost::system::error_code ignored;
+			non_blocking(false, ignored);
+			if (error) {
+				lastError = error;
+				throw StutskException(ET_ERROR, error.message());
+			}
+		}
+
+		size_t buffered() const { return end_ - begin_; }
+
+		// Moves up to `count` buffered characters to the end of `output`
+		void take(string& output, size_t count)
+		{
+			count = std::min(count, buffered());
+			output.append(&buffer_[begin_], count);
+			begin_ += count;
+		}
+
+		size_t take(char* output, size_t count)
+		{
+			count = std::min(count, buffered());
+			memcpy(output, &buffer_[begin_], count);
+			begin_ += count;
+			return count;
+		}
+
+		/* Waits until there is data in the buffer, reading as much as is available. Returns false
+		     when the peer has closed the connection, in which case the socket is closed. */
+		bool fill(Interpreter& interpreter)
+		{
+			if (buffered() > 0)
+				return true;
+			if (buffer_.empty())
+				buffer_.resize(SOCKET_BUFFER_SIZE);
+			begin_ = end_ = 0;
+
+			boost::system::error_code error;
+			if (available(error) == 0)
+				wait(interpreter, false);
+
+			end_ = read_some(boost::asio::buffer(buffer_), error);
+			// Not shut down, as other processes may share the descriptor (see socket_close)
+			if (error == boost::asio::error::eof) {
+				close(error);
+				return false;
+			}
+			else if (error) {
+				lastError = error;
+				throw StutskException(ET_ERROR, error.message());
+			}
+			return true;
+		}
+
+		/* Appends everything up to `delimiter` to `output` and consumes the delimiter. Returns
+		     false if the connection was closed before the delimiter was found. */
+		bool readUntil(Interpreter& interpreter, const string& delimiter, string& output)
+		{
+			while (fill(interpreter)) {
+				const char* data = &buffer_[begin_];
+				size_t length = buffered();
+
+				// The delimiter may start in the data that was already moved to the output
+				size_t overlap = std::min(output.size(), delimiter.size() - 1);
+				if (overlap > 0) {
+					string seam = output.substr(output.size() - overlap) + 
+						string(data, std::min(length, delimiter.size() - 1));
+					size_t position = seam.find(delimiter);
+					if (position != string::npos && position < overlap) {
+						output.resize(output.size() - overlap + position);
+						begin_ += position + delimiter.size() - overlap;
+						return true;
+					}
+				}
+
+				const char* found;
+				if (delimiter.size() == 1)
+					found = (const char*)memchr(data, delimiter[0], length);
+				else {
+					found = std::search(data, data + length, delimiter.begin(), delimiter.end());
+					if (found == data + length)
+						found = NULL;
+				}
+
+				if (found != NULL) {
+					output.append(data, found - data);
+					begin_ += (found - data) + delimiter.size();
+					return true;
+				}
+
+				output.append(data, length);
+				begin_ = end_;
+			}
+			return false;
+		}
+
+	private:
+		vector<char> buffer_;
+		size_t begin_;
+		size_t end_;
+	};
+
+	BufferedSocket* popSocket(Context* context)
+	{
+		Token token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token);
+		if (token.tokenType != T_HANDLE)
+			throw StutskException(ET_ERROR, "Token not a handle");
+		return (BufferedSocket*)token.data.asHandle.ptr;
+	}
+
+	void closeSocket(BufferedSocket* socket)
+	{
+		boost::system::error_code ignored;
+		socket->shutdown(boost::asio::socket_base::shutdown_both, ignored);
+		socket->close(ignored);
+		delete socket;
+	}
+}
+
+/* ConnectionPool - outbound connections returned with socket_pool_release, kept open for reuse
+     by socket_pool_get on the same host:port, and the DNS results all outbound connections of
+	 the interpreter are opened with. */
+class ConnectionPool {
+public:
+	typedef boost::chrono::steady_clock Clock;
+
+	// All in milliseconds, see socket_pool_options
+	stutskInteger idleTimeout;
+	stutskInteger maxIdle;
+	stutskInteger connectTimeout;
+	stutskInteger dnsTtl;
+
+	ConnectionPool() : idleTimeout(30000), maxIdle(16), connectTimeout(5000), dnsTtl(60000) { }
+	~ConnectionPool();
+
+	// Returns a copy, as the cache entry can be dropped while a green thread is connecting
+	vector<tcp::endpoint> resolve(boost::asio::io_service& io_service, 
+		const string& host, const string& port);
+	void forget(const string& host, const string& port);
+
+	BufferedSocket* take(const string& key);
+	void release(BufferedSocket* socket);
+
+private:
+	struct IdleSocket {
+		BufferedSocket* socket;
+		Clock::time_point since;
+	};
+
+	struct CachedAddress {
+		vector<tcp::endpoint> endpoints;
+		Clock::time_point expires;
+	};
+
+	void expire(deque<IdleSocket>& sockets);
+	static bool healthy(BufferedSocket* socket);
+
+	map<string, deque<IdleSocket> > idle_;
+	map<string, CachedAddress> addresses_;
+};
+
+ConnectionPool::~ConnectionPool()
+{
+	for (map<string, deque<IdleSocket> >::iterator it = idle_.begin(); it != idle_.end(); ++it)
+		for (size_t i = 0; i < it->second.size(); ++i)
+			closeSocket(it->second[i].socket);
+}
+
+/* The system resolver does not report TTLs, so results are kept for dnsTtl. Addresses that
+     fail to connect are forgotten right away. */
+vector<tcp::endpoint> ConnectionPool::resolve(boost::asio::io_service& io_service,
+	const string& host, const string& port)
+{
+	string key = host + ":" + port;
+	Clock::time_point now = Clock::now();
+
+	map<string, CachedAddress>::iterator it = addresses_.find(key);
+	if (it != addresses_.end() && it->second.expires > now)
+		return it->second.endpoints;
+
+	tcp::resolver resolver(io_service);
+	tcp::resolver::query query(host, port);
+	tcp::resolver::iterator iter = resolver.resolve(query), end;
+
+	CachedAddress& cached = addresses_[key];
+	cached.endpoints.clear();
+	for (; iter != end; ++iter)
+		cached.endpoints.push_back(iter->endpoint());
+	cached.expires = now + boost::chrono::milliseconds(dnsTtl);
+	return cached.endpoints;
+}
+
+void ConnectionPool::forget(const string& host, const string& port)
+{
+	addresses_.erase(host + ":" + port);
+}
+
+// Returns a healthy idle connection to `key`, the most recently used one first, or NULL
+BufferedSocket* ConnectionPool::take(const string& key)
+{
+	map<string, deque<IdleSocket> >::iterator it = idle_.find(key);
+	if (it == idle_.end())
+		return NULL;
+
+	deque<IdleSocket>& sockets = it->second;
+	expire(sockets);
+	while (!sockets.empty()) {
+		BufferedSocket* socket = sockets.back().socket;
+		sockets.pop_back();
+		if (healthy(socket))
+			return socket;
+		closeSocket(socket);
+	}
+	return NULL;
+}
+
+void ConnectionPool::release(BufferedSocket* socket)
+{
+	// Unread data would be taken for the answer to the next request, so such sockets are closed
+	if (!socket->is_open() || socket->buffered() > 0 || maxIdle <= 0) {
+		closeSocket(socket);
+		return;
+	}
+
+	deque<IdleSocket>& sockets = idle_[socket->poolKey];
+	IdleSocket entry = { socket, Clock::now() };
+	sockets.push_back(entry);
+
+	expire(sockets);
+	while (sockets.size() > (size_t)maxIdle) {
+		closeSocket(sockets.front().socket);
+		sockets.pop_front();
+	}
+}
 
-boost::asio::io_service io_service;
+// Closes the connections that have been idle for longer than idleTimeout (the oldest are first)
+void ConnectionPool::expire(deque<IdleSocket>& sockets)
+{
+	Clock::time_point oldest = Clock::now() - boost::chrono::milliseconds(idleTimeout);
+	while (!sockets.empty() && sockets.front().since < oldest) {
+		closeSocket(sockets.front().socket);
+		sockets.pop_front();
+	}
+}
+
+/* An idle connection is healthy if there is nothing to read from it - the peer may have closed
+     it or sent something unexpected in the meantime. */
+bool ConnectionPool::healthy(BufferedSocket* socket)
+{
+	if (!socket->is_open())
+		return false;
+
+	boost::system::error_code error;
+	char byte;
+	socket->non_blocking(true, error);
+	socket->receive(boost::asio::buffer(&byte, 1), tcp::socket::message_peek, error);
+	bool idle = error == boost::asio::error::would_block;
+	socket->non_blocking(false, error);
+	return idle;
+}
+
+namespace {
+	ConnectionPool& connectionPool(Interpreter& interpreter)
+	{
+		if (!interpreter.connectionPool)
+			interpreter.connectionPool.reset(new ConnectionPool());
+		return *interpreter.connectionPool;
+	}
+
+	/* Connects to `endpoint`, giving up after `timeout` milliseconds unless it is negative.
+	     The timeout needs a non-blocking connect, so it is only available on POSIX systems. */
+	void connectEndpoint(Interpreter& interpreter, BufferedSocket& socket, const tcp::endpoint& endpoint,
+		stutskInteger timeout, boost::system::error_code& error)
+	{
+#ifdef __unix__
+		if (interpreter.scheduler.limited(timeout)) {
+			socket.open(endpoint.protocol(), error);
+			if (error)
+				return;
+			socket.non_blocking(true, error);
+
+			// basic_socket::connect would wait for the connection regardless of non_blocking
+			if (::connect(socket.native_handle(), endpoint.data(), endpoint.size()) == 0)
+				error = boost::system::error_code();
+			else if (errno != EINPROGRESS)
+				error = boost::system::error_code(errno, boost::system::system_category());
+			else {
+				bool ready;
+				try {
+					ready = interpreter.scheduler.waitReady(socket.native_handle(), true, timeout);
+				}
+				catch (...) {
+					socket.close(error);
+					throw;
+				}
+
+				if (!ready)
+					error = boost::asio::error::timed_out;
+				else {
+					int result = 0;
+					socklen_t length = sizeof(result);
+					getsockopt(socket.native_handle(), SOL_SOCKET, SO_ERROR, &result, &length);
+					error = boost::system::error_code(result, boost::system::system_category());
+				}
+			}
+
+			boost::system::error_code ignored;
+			socket.non_blocking(false, ignored);
+			return;
+		}
+#endif
+		socket.connect(endpoint, error);
+	}
+
+	// Opens a connection to the first address of `host` that accepts it within `timeout`
+	BufferedSocket* openSocket(Interpreter& interpreter, const string& host, const string& port,
+		stutskInteger timeout)
+	{
+		ConnectionPool& pool = connectionPool(interpreter);
+		vector<tcp::endpoint> endpoints = pool.resolve(interpreter.io_service, host, port);
+
+		std::unique_ptr<BufferedSocket> socket(new BufferedSocket(interpreter.io_service));
+		boost::system::error_code error = boost::asio::error::host_not_found;
+		for (size_t i = 0; error && i < endpoints.size(); ++i) {
+			boost::system::error_code ignored;
+			socket->close(ignored);
+			connectEndpoint(interpreter, *socket, endpoints[i], timeout, error);
+		}
+
+		if (error) {
+			interpreter.scheduler.checkDeadline();
+			pool.forget(host, port);
+			throw StutskException(ET_ERROR, error.message());
+		}
+		return socket.release();
+	}
+
+	void pushSocket(Context* context, BufferedSocket* socket)
+	{
+		Token outputHandle(T_HANDLE);
+		outputHandle.data.asHandle.ptr = (void*)socket;
+		outputHandle.data.asHandle.size = sizeof(BufferedSocket);
+		context->stack.push_back(outputHandle);
+	}
+}
 
 void BuiltIns::_f_socket_listen(Context* context) {
     /* arguments: <T_STRING port> socket_listen
@@ -30,16 +470,16 @@ void BuiltIns::_f_socket_listen(Context* context) {
 	     Port can either be numeric or a common port name, such as "www".
 		 See boost::asio for further reference.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	using boost::asio::ip::tcp;
 
-	tcp::acceptor* acceptor = new tcp::acceptor(io_service, tcp::endpoint(tcp::v4(), (unsigned short)giveInteger(token1)));
+	tcp::acceptor* acceptor = new tcp::acceptor(context->interpreter.io_service, tcp::endpoint(tcp::v4(), (unsigned short)giveInteger(token1)));
 	Token outputHandle(T_HANDLE);
 	outputHandle.data.asHandle.ptr = (void*)acceptor;
 	outputHandle.data.asHandle.size = sizeof(tcp::acceptor);
-	stutskStack.push_back(outputHandle);
+	context->stack.push_back(outputHandle);
 }
 
 void BuiltIns::_f_socket_open(Context* context) {
@@ -49,39 +489,112 @@ void BuiltIns::_f_socket_open(Context* context) {
 	     a handle to a netowrk socket.
 	   notes: Host can be either a DNS name or a IPv4/IPv6 literal address.
 	     Port can either be numeric or a common port name, such as "www".
-		 See boost::asio for further reference.
+		 See boost::asio for further reference. Resolved addresses are cached (see
+		 socket_pool_options).
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	using boost::asio::ip::tcp;
+	pushSocket(context, openSocket(context->interpreter, *giveString(token2), *giveString(token1), -1));
+}
+
+void BuiltIns::_f_socket_open_timeout(Context* context) {
+    /* arguments: <T_STRING host> <T_STRING port> <T_INTEGER milliseconds> socket_open_timeout
+	   returnvalue: <T_HANDLE> 
+	   description: Opens a TCP connection like socket_open, but gives up on every address of
+	     `host` that does not accept the connection within `milliseconds`.
+	   notes: On systems without non-blocking connect, the timeout is ignored.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token3 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger timeout = giveInteger(token1);
+	if (timeout < 0)
+		throw StutskException(ET_ERROR, "Number must not be negative");
+
+	pushSocket(context, openSocket(context->interpreter, *giveString(token3), *giveString(token2),
+		timeout));
+}
+
+void BuiltIns::_f_socket_pool_get(Context* context) {
+    /* arguments: <T_STRING host> <T_STRING port> socket_pool_get
+	   returnvalue: <T_HANDLE> 
+	   description: Returns an idle connection to `host` on port `port` from the connection pool,
+	     or opens a new one (with the connect timeout of the pool) if there is none.
+	   notes: Give the socket back with socket_pool_release once the response has been read
+	     completely, or close it with socket_close. Idle connections are checked before they are
+		 reused and the ones the peer has closed are discarded.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	string hostname = *giveString(token2);
+	string host = *giveString(token2);
 	string port = *giveString(token1);
+	string key = host + ":" + port;
 
-	tcp::resolver resolver(io_service);
-	tcp::resolver::query query(hostname.c_str(), port.c_str());
-	tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-	tcp::resolver::iterator end;
+	ConnectionPool& pool = connectionPool(context->interpreter);
+	BufferedSocket* socket = pool.take(key);
+	if (socket == NULL) {
+		socket = openSocket(context->interpreter, host, port, pool.connectTimeout);
+		socket->poolKey = key;
+	}
+	pushSocket(context, socket);
+}
 
-	tcp::socket* socket = new tcp::socket(io_service);
+void BuiltIns::_f_socket_pool_release(Context* context) {
+    /* arguments: <T_HANDLE socket> socket_pool_release
+	   returnvalue: 
+	   description: Returns a socket from socket_pool_get to the connection pool. The handle
+	     must not be used afterwards.
+	   notes: Sockets that are closed or still have unread data are closed instead.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	if (socket->poolKey.empty())
+		throw StutskException(ET_ERROR, "Socket is not from a connection pool");
 
-	boost::system::error_code error = boost::asio::error::host_not_found;
+	connectionPool(context->interpreter).release(socket);
+}
 
-	while (error && endpoint_iterator != end)
-	{
-		socket->close();
-		socket->connect(*endpoint_iterator++, error);
-	}
-	if (error)
-		throw StutskException(ET_ERROR, error.message()); // Some other error.
+void BuiltIns::_f_socket_pool_options(Context* context) {
+    /* arguments: <T_DICTIONARY options> socket_pool_options
+	   returnvalue: 
+	   description: Configures the connection pool. Options are "idle_timeout" (how long idle
+	     connections are kept, default 30000), "max_idle" (idle connections kept per host and
+		 port, default 16), "connect_timeout" (for new connections, default 5000) and "dns_ttl"
+		 (how long resolved addresses are cached, default 60000), all in milliseconds.
+	   notes: Negative values are rejected.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	Token outputHandle(T_HANDLE);
-	outputHandle.data.asHandle.ptr = (void*)socket;
-	outputHandle.data.asHandle.size = sizeof(tcp::socket);
-	stutskStack.push_back(outputHandle);
+	recurseVariables(token1);
+	if (token1.tokenType != T_DICTIONARY)
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+
+	ConnectionPool& pool = connectionPool(context->interpreter);
+	const char* names[] = { "idle_timeout", "max_idle", "connect_timeout", "dns_ttl" };
+	stutskInteger* values[] = { &pool.idleTimeout, &pool.maxIdle, &pool.connectTimeout, &pool.dnsTtl };
+
+	// Everything is checked first, so that invalid options change nothing
+	stutskInteger given[4];
+	for (size_t i = 0; i < 4; ++i) {
+		Token name(T_STRING);
+		name.asString = StringPtr(new string(names[i]));
+		Token* value = token1.asDictionary->find(name);
+		given[i] = value != NULL ? giveInteger(*value) : *values[i];
+		if (given[i] < 0)
+			throw StutskException(ET_ERROR, string("Option \"") + names[i] + "\" must not be negative");
+	}
+	for (size_t i = 0; i < 4; ++i)
+		*values[i] = given[i];
 }
 
 void BuiltIns::_f_socket_accept(Context* context) {
@@ -91,8 +604,8 @@ void BuiltIns::_f_socket_accept(Context* context) {
 	     connection.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	using boost::asio::ip::tcp;
 
@@ -103,69 +616,89 @@ void BuiltIns::_f_socket_accept(Context* context) {
 
 	tcp::acceptor *acceptor = (tcp::acceptor*)token1.data.asHandle.ptr;
 
-	tcp::socket* socket = new tcp::socket(io_service);
+	// Other green threads run until a connection is pending
+	if (context->interpreter.scheduler.limited() && 
+		!context->interpreter.scheduler.waitReady(acceptor->native_handle(), false)) {
+			context->interpreter.scheduler.checkDeadline();
+	}
+
+	BufferedSocket* socket = new BufferedSocket(context->interpreter.io_service);
 
 	acceptor->accept(*socket);
 
-	Token outputHandle(T_HANDLE);
-	outputHandle.data.asHandle.ptr = (void*)socket;
-	outputHandle.data.asHandle.size = sizeof(tcp::socket);
-	stutskStack.push_back(outputHandle);
+	pushSocket(context, socket);
 }
 
 void BuiltIns::_f_socket_read(Context* context) {
     /* arguments: <T_INTEGER count> <T_HANDLE socket> socket_read
 	   returnvalue: <T_STRING> 
-	   description: Reads `count` characters from a network socket.
-	   notes: 
+	   description: Reads up to `count` characters from a network socket.
+	   notes: Returns what has been received so far (at least one character) rather than
+	     waiting for all `count`. An empty string is returned once the peer closes the connection.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger count = giveInteger(token1);
+	if (count < 0)
+		throw StutskException(ET_ERROR, "Number must not be negative");
+
+	string data;
+	if (socket->is_open() && socket->fill(context->interpreter))
+		socket->take(data, (size_t)count);
+	pushString(context)->swap(data);
+}
 
-	using boost::asio::ip::tcp;
+void BuiltIns::_f_socket_readline(Context* context) {
+    /* arguments: <T_HANDLE socket> socket_readline
+	   returnvalue: <T_STRING> 
+	   description: Reads a single line from a network socket.
+	   notes: Carriage returns are removed from the line.
+	*/
+	BufferedSocket* socket = popSocket(context);
 
-	stutskInteger bufSize = giveInteger(token2);
+	string line;
+	if (socket->is_open()) {
+		socket->readUntil(context->interpreter, "\n", line);
+		line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+	}
+	pushString(context)->swap(line);
+}
 
-	recurseVariables(token1);
+void BuiltIns::_f_socket_read_until(Context* context) {
+    /* arguments: <T_STRING delimiter> <T_HANDLE socket> socket_read_until
+	   returnvalue: <T_STRING> 
+	   description: Reads from a network socket up to `delimiter`, which is consumed but not
+	     included in the result.
+	   notes: If the peer closes the connection first, everything received until then is
+	     returned.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	if (token1.tokenType != T_HANDLE)
-		throw StutskException(ET_ERROR, "Token not a handle");
+	StringPtr delimiter = giveString(token1);
+	if (delimiter->empty())
+		throw StutskException(ET_ERROR, "Delimiter must not be empty");
 
-	tcp::socket *socket = (tcp::socket*)token1.data.asHandle.ptr;
+	string data;
 	if (socket->is_open())
-	{
-		std::vector<char> buf(bufSize);
-
-		boost::system::error_code error;
-
-		size_t bytesRead = socket->read_some(boost::asio::buffer(buf), error);
-
-		if (error == boost::asio::error::eof)
-		{
-			socket->shutdown(boost::asio::socket_base::shutdown_both);
-			socket->close();
-		}
-		else if (error) 
-			throw StutskException(ET_ERROR, error.message()); // Some other error.
-
-		Token newString(T_STRING);
-		newString.asString = StringPtr(new string (buf.begin(), buf.begin()+bytesRead));
-		stutskStack.push_back(newString);
-	}
-	else
-		pushString();
+		socket->readUntil(context->interpreter, *delimiter, data);
+	pushString(context)->swap(data);
 }
 
-void BuiltIns::_f_socket_readline(Context* context) {
-    /* arguments: <T_HANDLE socket> socket_readline
-	   returnvalue: <T_STRING> 
-	   description: Reads a single line from a network socket.
+void BuiltIns::_f_socket_write(Context* context) {
+    /* arguments: <T_STRING data> <T_HANDLE socket> socket_write
+	   returnvalue:  
+	   description: Writes `data` to a network socket.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();	
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+
 	using boost::asio::ip::tcp;
 
 	recurseVariables(token1);
@@ -173,72 +706,270 @@ void BuiltIns::_f_socket_readline(Context* context) {
 	if (token1.tokenType != T_HANDLE)
 		throw StutskException(ET_ERROR, "Token not a handle");
 
-	tcp::socket *socket = (tcp::socket*)token1.data.asHandle.ptr;
-
+	BufferedSocket *socket = (BufferedSocket*)token1.data.asHandle.ptr;
 
-	if (socket->is_open())
-	{
-		Token newString(T_STRING);
-		newString.asString = StringPtr(new string);
+	StringPtr data = giveString(token2);
+	socket->writeAll(context->interpreter, data->data(), data->size());
+}
 
-		while (true)
-		{
-			std::vector<char> buf(1);
+void BuiltIns::_f_socket_writev(Context* context) {
+    /* arguments: <T_ARRAY strings> <T_HANDLE socket> socket_writev
+	   returnvalue:  
+	   description: Writes all strings of the array to a network socket, one after another.
+	   notes: The strings are not joined first - they are passed to the system together (up to
+	     IOV_MAX at a time), so a header and a large body can be sent without copying.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-			boost::system::error_code error;
+	recurseVariables(token1);
+	if (token1.tokenType != T_ARRAY)
+		throw StutskException(ET_ERROR, "Token is not an array");
+
+	TokenList& list = *token1.asTokenList;
+	vector<StringPtr> strings(list.size());
+	for (size_t i = 0; i < list.size(); ++i)
+		strings[i] = giveString(list[i]);
+
+#ifdef __unix__
+	vector<iovec> vectors(strings.size());
+	for (size_t i = 0; i < strings.size(); ++i) {
+		vectors[i].iov_base = (void*)strings[i]->data();
+		vectors[i].iov_len = strings[i]->size();
+	}
 
-			if (read(*socket,boost::asio::buffer(buf),boost::asio::transfer_all(), error))
-			{
-				if (!(buf[0] == '\r' || buf[0] == '\n'))
-					newString.asString->append(1, buf[0]);				
-				if (buf[0] == '\n') break;
+	Interpreter& interpreter = context->interpreter;
+	bool limited = interpreter.scheduler.limited(socket->timeout);
+	boost::system::error_code ignored;
+	if (limited)
+		socket->non_blocking(true, ignored);
+
+	try {
+		size_t index = 0;
+		while (index < vectors.size()) {
+			// sendmsg rather than writev, so that a closed connection does not raise SIGPIPE
+			msghdr message = msghdr();
+			message.msg_iov = &vectors[index];
+			message.msg_iovlen = std::min<size_t>(vectors.size() - index, IOV_MAX);
+
+			ssize_t written = ::sendmsg(socket->native_handle(), &message, MSG_NOSIGNAL);
+			if (written < 0) {
+				if (errno == EAGAIN) {
+					// Asynchronous operations leave the descriptor non-blocking as well
+					if (limited)
+						socket->wait(interpreter, true);
+					else
+						interpreter.scheduler.waitReady(socket->native_handle(), true);
+				}
+				else if (errno != EINTR)
+					throw StutskException(ET_ERROR, strerror(errno));
+				continue;
 			}
 
-			if (error == boost::asio::error::eof)
-			{
-				socket->shutdown(boost::asio::socket_base::shutdown_both);
-				socket->close();
-				break;
+			// Skips what has been written, which may end in the middle of a string
+			while (index < vectors.size() && (size_t)written >= vectors[index].iov_len) {
+				written -= vectors[index].iov_len;
+				++index;
+			}
+			if (written > 0) {
+				vectors[index].iov_base = (char*)vectors[index].iov_base + written;
+				vectors[index].iov_len -= written;
 			}
-			else if (error) 
-				throw StutskException(ET_ERROR, error.message()); // Some other error.
 		}
-
-		stutskStack.push_back(newString);
 	}
-	else
-		pushString();
+	catch (...) {
+		if (limited)
+			socket->non_blocking(false, ignored);
+		throw;
+	}
+
+	if (limited)
+		socket->non_blocking(false, ignored);
+#else
+	vector<boost::asio::const_buffer> buffers(strings.size());
+	for (size_t i = 0; i < strings.size(); ++i)
+		buffers[i] = boost::asio::buffer(*strings[i]);
+
+	boost::system::error_code error;
+	boost::asio::write(*socket, buffers, boost::asio::transfer_all(), error);
+	if (error)
+		throw StutskException(ET_ERROR, error.message());
+#endif
 }
 
-void BuiltIns::_f_socket_write(Context* context) {
-    /* arguments: <T_STRING data> <T_HANDLE socket> socket_write
-	   returnvalue:  
-	   description: Writes `data` to a network socket.
-	   notes: 
-	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+namespace {
+	const size_t SENDFILE_CHUNK_SIZE = 1 << 20;
 
-	using boost::asio::ip::tcp;
+	/* sendFile - sends up to `length` bytes (everything if negative) of `file` starting at
+	     `offset` over `socket` and returns the number of bytes sent, which is less than `length`
+		 only at the end of the file. On Linux, regular files are sent with sendfile and pipes
+		 with splice, so the data never leaves the kernel. Elsewhere it goes through a buffer. */
+	stutskInteger sendFile(Interpreter& interpreter, BufferedSocket* socket, FILE* file,
+		stutskInteger offset, stutskInteger length)
+	{
+		// Anything written through the handle must reach the file first
+		fflush(file);
+		stutskInteger sent = 0;
+
+#ifdef __linux__
+		int input = fileno(file);
+		int output = socket->native_handle();
+		struct stat status;
+		if (fstat(input, &status) == 0 && (S_ISREG(status.st_mode) || S_ISFIFO(status.st_mode))) {
+			bool pipe = S_ISFIFO(status.st_mode);
+			if (pipe && offset != 0)
+				throw StutskException(ET_ERROR, "Cannot seek in a pipe");
+
+			// Waiting for a timeout or for green threads needs the socket to be non-blocking
+			bool limited = interpreter.scheduler.limited(socket->timeout);
+			boost::system::error_code ignored;
+			if (limited)
+				socket->non_blocking(true, ignored);
+
+			off_t position = (off_t)offset;
+			try {
+				while (length < 0 || sent < length) {
+					size_t chunk = SENDFILE_CHUNK_SIZE;
+					if (length >= 0)
+						chunk = (size_t)std::min<stutskInteger>(length - sent, chunk);
+
+					ssize_t result = pipe ?
+						splice(input, NULL, output, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE) :
+						sendfile(output, input, &position, chunk);
+					if (result > 0)
+						sent += result;
+					else if (result == 0)
+						break;
+					else if (errno == EAGAIN) {
+						// Asynchronous operations leave the descriptor non-blocking as well
+						if (limited)
+							socket->wait(interpreter, true);
+						else
+							interpreter.scheduler.waitReady(output, true);
+					}
+					else if (errno != EINTR)
+						throw StutskException(ET_ERROR, strerror(errno));
+				}
+			}
+			catch (...) {
+				if (limited)
+					socket->non_blocking(false, ignored);
+				throw;
+			}
 
-	recurseVariables(token1);
+			if (limited)
+				socket->non_blocking(false, ignored);
+			return sent;
+		}
+#endif
 
-	if (token1.tokenType != T_HANDLE)
-		throw StutskException(ET_ERROR, "Token not a handle");
+		if (fseek(file, (long)offset, SEEK_SET) != 0)
+			throw StutskException(ET_ERROR, "File operation failed");
 
-	tcp::socket *socket = (tcp::socket*)token1.data.asHandle.ptr;
+		vector<char> buffer(SOCKET_BUFFER_SIZE);
+		while (length < 0 || sent < length) {
+			size_t chunk = buffer.size();
+			if (length >= 0)
+				chunk = (size_t)std::min<stutskInteger>(length - sent, chunk);
 
-	boost::system::error_code error;
+			size_t bytesRead = fread(&buffer[0], 1, chunk, file);
+			if (bytesRead == 0) {
+				if (ferror(file))
+					throw StutskException(ET_ERROR, "File operation failed");
+				break;
+			}
+
+			socket->writeAll(interpreter, &buffer[0], bytesRead);
+			sent += bytesRead;
+		}
+		return sent;
+	}
+
+	// Sends a file given either by name or as a handle from fopen
+	void sendFileToken(Context* context, BufferedSocket* socket, Token& fileToken,
+		stutskInteger offset, stutskInteger length)
+	{
+		recurseVariables(fileToken);
+		if (fileToken.tokenType == T_HANDLE) {
+			pushInteger(context, sendFile(context->interpreter, socket, 
+				(FILE*)fileToken.data.asHandle.ptr, offset, length));
+			return;
+		}
+
+		FILE* file = fopen(giveString(fileToken)->c_str(), "rb");
+		if (file == NULL)
+			throw StutskException(ET_ERROR, "File operation failed");
+
+		stutskInteger sent;
+		try {
+			sent = sendFile(context->interpreter, socket, file, offset, length);
+		}
+		catch (...) {
+			fclose(file);
+			throw;
+		}
+		fclose(file);
+		pushInteger(context, sent);
+	}
+}
+
+void BuiltIns::_f_socket_sendfile(Context* context) {
+    /* arguments: <T_STRING filename | T_HANDLE file> <T_HANDLE socket> socket_sendfile
+	   returnvalue: <T_INTEGER>
+	   description: Sends the contents of a file, given by name or as a handle from fopen, over a
+	     network socket and returns the number of bytes sent.
+	   notes: The file is never read into memory - on Linux the kernel copies it straight from
+	     the page cache to the socket (sendfile, or splice if the file is a pipe).
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
-	boost::asio::write(*socket, boost::asio::buffer(*giveString(token2)),
-		boost::asio::transfer_all(),error);
+	sendFileToken(context, socket, token1, 0, -1);
+}
 
-	if (error) 
-		throw StutskException(ET_ERROR, error.message()); // Some other error.
+void BuiltIns::_f_socket_send_range(Context* context) {
+    /* arguments: <T_STRING filename | T_HANDLE file> <T_INTEGER offset> <T_INTEGER length> 
+	     <T_HANDLE socket> socket_send_range
+	   returnvalue: <T_INTEGER>
+	   description: Sends `length` bytes of a file starting at `offset` over a network socket, 
+	     like socket_sendfile, and returns the number of bytes sent. A negative `length` sends 
+		 everything up to the end of the file.
+	   notes: Meant for HTTP range requests. Fewer bytes than requested are sent if the file
+	     ends first. Pipes can only be sent from offset 0.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token3 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger length = giveInteger(token1);
+	stutskInteger offset = giveInteger(token2);
+	if (offset < 0)
+		throw StutskException(ET_ERROR, "Number must not be negative");
+
+	sendFileToken(context, socket, token3, offset, length);
 }
 
+void BuiltIns::_f_socket_set_timeout(Context* context) {
+    /* arguments: <T_INTEGER milliseconds> <T_HANDLE socket> socket_set_timeout
+	   returnvalue: 
+	   description: Limits how long each read or write on the socket may wait. An operation 
+	     that would wait longer throws "Operation timed out", which can be caught with try. 
+		 A negative value removes the limit.
+	   notes: For a limit on a whole sequence of operations, or on socket_accept and 
+	     socket_open, see with_deadline and socket_open_timeout.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	socket->timeout = std::max<stutskInteger>(giveInteger(token1), -1);
+}
 
 void BuiltIns::_f_socket_eof(Context* context) {
     /* arguments: <T_HANDLE socket> socket_write
@@ -246,8 +977,8 @@ void BuiltIns::_f_socket_eof(Context* context) {
 	   description: Returns true if the socket has been closed.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	using boost::asio::ip::tcp;
 
@@ -258,7 +989,7 @@ void BuiltIns::_f_socket_eof(Context* context) {
 
 	tcp::socket *socket = (tcp::socket*)token1.data.asHandle.ptr;
 
-	pushBool(! socket->is_open());
+	pushBool(context, ! socket->is_open());
 }
 
 
@@ -269,8 +1000,8 @@ void BuiltIns::_f_socket_close(Context* context)
 	   description: Closes the socket.
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	using boost::asio::ip::tcp;
 
@@ -279,11 +1010,1820 @@ void BuiltIns::_f_socket_close(Context* context)
 	if (token1.tokenType != T_HANDLE)
 		throw StutskException(ET_ERROR, "Token not a handle");
 
-	tcp::socket *socket = (tcp::socket*)token1.data.asHandle.ptr;
-
-	socket->shutdown(boost::asio::socket_base::shutdown_both);
+	BufferedSocket *socket = (BufferedSocket*)token1.data.asHandle.ptr;
 
-	socket->close();
+	// The socket may have already been closed by the peer, so errors are ignored. It is not shut
+	// down, as another process may share it (after fork or socket_send_handle) and keep using it.
+	boost::system::error_code error;
+	socket->close(error);
 
 	delete socket;
-}
\ No newline at end of file
+}
+
+// ------------------------- UNIX DOMAIN SOCKETS --------------------------- //
+
+#ifdef __unix__
+namespace {
+	int unixSocket()
+	{
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			throw StutskException(ET_ERROR, strerror(errno));
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		return fd;
+	}
+
+	// Binds or connects `fd` to the socket file `path`, closing `fd` on failure
+	void unixAddress(int fd, const string& path, bool bindAddress)
+	{
+		sockaddr_un address = sockaddr_un();
+		address.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+			::close(fd);
+			throw StutskException(ET_ERROR, "Invalid socket path");
+		}
+		memcpy(address.sun_path, path.data(), path.size());
+
+		int result;
+		do {
+			result = bindAddress ? ::bind(fd, (sockaddr*)&address, sizeof(address)) :
+				::connect(fd, (sockaddr*)&address, sizeof(address));
+		} while (result < 0 && errno == EINTR && !bindAddress);
+
+		if (result < 0) {
+			int error = errno;
+			::close(fd);
+			throw StutskException(ET_ERROR, strerror(error));
+		}
+	}
+
+	/* Unix domain sockets are handed to asio as TCP sockets. Reading, writing and accepting
+	     are the same system calls for both, so all socket_* builtins work with them. */
+	BufferedSocket* adoptSocket(Interpreter& interpreter, int fd)
+	{
+		std::unique_ptr<BufferedSocket> socket(new BufferedSocket(interpreter.io_service));
+		boost::system::error_code error;
+		socket->assign(tcp::v4(), fd, error);
+		if (error) {
+			::close(fd);
+			throw StutskException(ET_ERROR, error.message());
+		}
+		return socket.release();
+	}
+
+	// Waits for a socket that asynchronous operations may have left non-blocking
+	void waitAgain(Interpreter& interpreter, BufferedSocket* socket, bool write)
+	{
+		if (interpreter.scheduler.limited(socket->timeout))
+			socket->wait(interpreter, write);
+		else
+			interpreter.scheduler.waitReady(socket->native_handle(), write);
+	}
+}
+#endif
+
+void BuiltIns::_f_unix_listen(Context* context) {
+    /* arguments: <T_STRING path> unix_listen
+	   returnvalue: <T_HANDLE> 
+	   description: Creates a Unix domain socket file at `path` and returns a listening socket,
+	     from which connections are accepted with socket_accept or socket_accept_async.
+	   notes: The file must not exist yet - delete it with file_delete if it was left over from
+	     a previous run. Not available on Windows.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+#ifdef __unix__
+	int fd = unixSocket();
+	unixAddress(fd, *giveString(token1), true);
+	if (::listen(fd, SOMAXCONN) < 0) {
+		int error = errno;
+		::close(fd);
+		throw StutskException(ET_ERROR, strerror(error));
+	}
+
+	std::unique_ptr<tcp::acceptor> acceptor(new tcp::acceptor(context->interpreter.io_service));
+	boost::system::error_code error;
+	acceptor->assign(tcp::v4(), fd, error);
+	if (error) {
+		::close(fd);
+		throw StutskException(ET_ERROR, error.message());
+	}
+
+	Token outputHandle(T_HANDLE);
+	outputHandle.data.asHandle.ptr = (void*)acceptor.release();
+	outputHandle.data.asHandle.size = sizeof(tcp::acceptor);
+	context->stack.push_back(outputHandle);
+#else
+	throw StutskException(ET_ERROR, "Unix domain sockets are not available on this platform");
+#endif
+}
+
+void BuiltIns::_f_unix_connect(Context* context) {
+    /* arguments: <T_STRING path> unix_connect
+	   returnvalue: <T_HANDLE> 
+	   description: Connects to the Unix domain socket at `path` and returns a socket that the
+	     socket_* functions work with.
+	   notes: Not available on Windows.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+#ifdef __unix__
+	int fd = unixSocket();
+	unixAddress(fd, *giveString(token1), false);
+	pushSocket(context, adoptSocket(context->interpreter, fd));
+#else
+	throw StutskException(ET_ERROR, "Unix domain sockets are not available on this platform");
+#endif
+}
+
+void BuiltIns::_f_socketpair(Context* context) {
+    /* arguments: socketpair
+	   returnvalue: <T_ARRAY>
+	   description: Returns an array of two connected sockets - what is written to one can be
+	     read from the other. 
+	   notes: Both survive fork, so a parent and a child process can talk over them, each closing
+	     the end it does not use. Not available on Windows.
+	*/
+#ifdef __unix__
+	int fds[2];
+#ifdef SOCK_CLOEXEC
+	// Set atomically, so that a process spawned by another thread meanwhile does not inherit them
+	if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+		throw StutskException(ET_ERROR, strerror(errno));
+#else
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		throw StutskException(ET_ERROR, strerror(errno));
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+	// adoptSocket closes the descriptor it fails on, and the adopted socket closes the other
+	std::unique_ptr<BufferedSocket> first;
+	try {
+		first.reset(adoptSocket(context->interpreter, fds[0]));
+	}
+	catch (...) {
+		::close(fds[1]);
+		throw;
+	}
+	std::unique_ptr<BufferedSocket> second(adoptSocket(context->interpreter, fds[1]));
+
+	Token result(T_ARRAY);
+	result.asTokenList = TokenListPtr(new TokenList());
+	pushSocket(context, first.release());
+	result.asTokenList->push_back(context->stack.back());
+	context->stack.pop_back();
+	pushSocket(context, second.release());
+	result.asTokenList->push_back(context->stack.back());
+	context->stack.pop_back();
+	context->stack.push_back(result);
+#else
+	throw StutskException(ET_ERROR, "Unix domain sockets are not available on this platform");
+#endif
+}
+
+void BuiltIns::_f_socket_send_handle(Context* context) {
+    /* arguments: <T_HANDLE connection> <T_HANDLE socket> socket_send_handle
+	   returnvalue: 
+	   description: Sends `connection`, a socket, over the Unix domain socket `socket` to another 
+	     process, which receives it with socket_recv_handle.
+	   notes: The sender still has its own copy of the connection and should usually close it
+	     with socket_close. Data that has already been read into the sender's buffer is not sent
+		 along. Not available on Windows.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(token1);
+	if (token1.tokenType != T_HANDLE || token1.data.asHandle.size != sizeof(BufferedSocket))
+		throw StutskException(ET_ERROR, "Token is not a socket");
+
+#ifdef __unix__
+	int handed = ((BufferedSocket*)token1.data.asHandle.ptr)->native_handle();
+
+	// The descriptor travels as ancillary data of a single byte
+	char byte = 0;
+	iovec vector = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+
+	msghdr message = msghdr();
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(header), &handed, sizeof(int));
+
+	socket->wait(context->interpreter, true);
+	for (;;) {
+		if (::sendmsg(socket->native_handle(), &message, MSG_NOSIGNAL) >= 0)
+			break;
+		else if (errno == EAGAIN)
+			waitAgain(context->interpreter, socket, true);
+		else if (errno != EINTR)
+			throw StutskException(ET_ERROR, strerror(errno));
+	}
+#else
+	throw StutskException(ET_ERROR, "Unix domain sockets are not available on this platform");
+#endif
+}
+
+void BuiltIns::_f_socket_recv_handle(Context* context) {
+    /* arguments: <T_HANDLE socket> socket_recv_handle
+	   returnvalue: <T_HANDLE>
+	   description: Receives a socket sent with socket_send_handle over the Unix domain socket
+	     `socket`.
+	   notes: Handles and ordinary data should not be mixed on one socket, as reading the data
+	     may consume the byte a handle is sent with, and with it the handle. Not available on 
+		 Windows.
+	*/
+	BufferedSocket* socket = popSocket(context);
+
+#ifdef __unix__
+	if (socket->buffered() > 0)
+		throw StutskException(ET_ERROR, "Socket has unread data");
+
+	char byte;
+	iovec vector = { &byte, 1 };
+	char control[CMSG_SPACE(sizeof(int))];
+
+	msghdr message = msghdr();
+	message.msg_iov = &vector;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+#ifdef MSG_CMSG_CLOEXEC
+	const int flags = MSG_CMSG_CLOEXEC;
+#else
+	const int flags = 0;
+#endif
+
+	socket->wait(context->interpreter, false);
+	ssize_t result;
+	for (;;) {
+		result = ::recvmsg(socket->native_handle(), &message, flags);
+		if (result >= 0)
+			break;
+		else if (errno == EAGAIN)
+			waitAgain(context->interpreter, socket, false);
+		else if (errno != EINTR)
+			throw StutskException(ET_ERROR, strerror(errno));
+	}
+
+	// Collects every descriptor received, so that none leaks if the message is not as expected
+	std::vector<int> fds;
+	for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL; 
+		header = CMSG_NXTHDR(&message, header)) 
+	{
+		if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+			fds.push_back(fd);
+		}
+	}
+
+	if (result == 0 || (message.msg_flags & MSG_CTRUNC) || fds.size() != 1) {
+		for (size_t i = 0; i < fds.size(); ++i)
+			::close(fds[i]);
+		if (result == 0)
+			throw StutskException(ET_ERROR, "Connection closed");
+		if (fds.empty() && !(message.msg_flags & MSG_CTRUNC))
+			throw StutskException(ET_ERROR, "No handle was received");
+		throw StutskException(ET_ERROR, "More than one handle was received");
+	}
+
+#ifndef MSG_CMSG_CLOEXEC
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+#endif
+	pushSocket(context, adoptSocket(context->interpreter, fds[0]));
+#else
+	throw StutskException(ET_ERROR, "Unix domain sockets are not available on this platform");
+#endif
+}
+
+// ------------------------------ UDP -------------------------------------- //
+
+namespace {
+	using boost::asio::ip::udp;
+
+	const size_t MAX_DATAGRAM_SIZE = 65536;
+	// Every datagram of udp_recv_many gets a slot this large, enough for a jumbo frame
+	const size_t DATAGRAM_SLOT_SIZE = 9216;
+	const size_t MAX_DATAGRAM_BATCH = 256;
+	// The most datagrams sendmmsg accepts in one call (UIO_MAXIOV)
+	const size_t MAX_SEND_BATCH = 1024;
+
+	/* UdpSocket - a datagram socket, with the receive buffer kept between calls. A socket from
+	     udp_open is opened by the first udp_send, for the protocol of its destination. */
+	class UdpSocket : public udp::socket {
+	public:
+		explicit UdpSocket(boost::asio::io_service& io_service) : udp::socket(io_service) { }
+
+		vector<char> buffer;
+	};
+
+	UdpSocket* popUdpSocket(Context* context)
+	{
+		Token token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token);
+		if (token.tokenType != T_HANDLE)
+			throw StutskException(ET_ERROR, "Token not a handle");
+		return (UdpSocket*)token.data.asHandle.ptr;
+	}
+
+	void pushUdpSocket(Context* context, UdpSocket* socket)
+	{
+		Token outputHandle(T_HANDLE);
+		outputHandle.data.asHandle.ptr = (void*)socket;
+		outputHandle.data.asHandle.size = sizeof(UdpSocket);
+		context->stack.push_back(outputHandle);
+	}
+
+	/* Pops the host and the port of a destination, resolved through the DNS cache. The address
+	     must be of the same family as an open socket; otherwise IPv4 is preferred. */
+	udp::endpoint popDestination(Context* context, UdpSocket* socket)
+	{
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		vector<tcp::endpoint> endpoints = connectionPool(context->interpreter).resolve(
+			context->interpreter.io_service, *giveString(token2), *giveString(token1));
+		if (endpoints.empty())
+			throw StutskException(ET_ERROR, "Host not found");
+
+		bool v4 = true;
+		if (socket->is_open()) {
+			boost::system::error_code error;
+			udp::endpoint local = socket->local_endpoint(error);
+			if (error)
+				throw StutskException(ET_ERROR, error.message());
+			v4 = local.protocol() == udp::v4();
+		}
+		for (size_t i = 0; i < endpoints.size(); ++i)
+			if (endpoints[i].address().is_v4() == v4)
+				return udp::endpoint(endpoints[i].address(), endpoints[i].port());
+		if (socket->is_open())
+			throw StutskException(ET_ERROR, "Host has no address of the socket's family");
+		return udp::endpoint(endpoints[0].address(), endpoints[0].port());
+	}
+
+	void openFor(UdpSocket* socket, const udp::endpoint& destination)
+	{
+		if (socket->is_open())
+			return;
+		boost::system::error_code error;
+		socket->open(destination.protocol(), error);
+		if (error)
+			throw StutskException(ET_ERROR, error.message());
+	}
+
+	void waitDatagram(Interpreter& interpreter, UdpSocket* socket, bool write)
+	{
+		if (interpreter.scheduler.limited() && 
+			!interpreter.scheduler.waitReady(socket->native_handle(), write)) {
+				interpreter.scheduler.checkDeadline();
+		}
+	}
+}
+
+void BuiltIns::_f_udp_open(Context* context) {
+    /* arguments: udp_open
+	   returnvalue: <T_HANDLE> 
+	   description: Returns a UDP socket for sending datagrams with udp_send and udp_send_many.
+	   notes: Replies to the datagrams sent can be received once something has been sent.
+	*/
+	pushUdpSocket(context, new UdpSocket(context->interpreter.io_service));
+}
+
+void BuiltIns::_f_udp_bind(Context* context) {
+    /* arguments: <T_INTEGER port> udp_bind
+	   returnvalue: <T_HANDLE> 
+	   description: Returns a UDP socket receiving datagrams sent to `port`.
+	   notes: 
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	std::unique_ptr<UdpSocket> socket(new UdpSocket(context->interpreter.io_service));
+	boost::system::error_code error;
+	socket->open(udp::v4(), error);
+	if (!error)
+		socket->bind(udp::endpoint(udp::v4(), (unsigned short)giveInteger(token1)), error);
+	if (error)
+		throw StutskException(ET_ERROR, error.message());
+	pushUdpSocket(context, socket.release());
+}
+
+void BuiltIns::_f_udp_send(Context* context) {
+    /* arguments: <T_STRING data> <T_STRING host> <T_STRING port> <T_HANDLE socket> udp_send
+	   returnvalue: 
+	   description: Sends `data` as a datagram to `host` on port `port`.
+	   notes: Resolved addresses are cached (see socket_pool_options).
+	*/
+	UdpSocket* socket = popUdpSocket(context);
+	udp::endpoint destination = popDestination(context, socket);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	openFor(socket, destination);
+	StringPtr data = giveString(token1);
+	waitDatagram(context->interpreter, socket, true);
+	boost::system::error_code error;
+	socket->send_to(boost::asio::buffer(*data), destination, 0, error);
+	if (error)
+		throw StutskException(ET_ERROR, error.message());
+}
+
+void BuiltIns::_f_udp_send_many(Context* context) {
+    /* arguments: <T_ARRAY datagrams> <T_STRING host> <T_STRING port> <T_HANDLE socket> udp_send_many
+	   returnvalue: 
+	   description: Sends each string of `datagrams` as a datagram to `host` on port `port`.
+	   notes: On Linux, up to 1024 datagrams are sent with one system call (sendmmsg).
+	*/
+	UdpSocket* socket = popUdpSocket(context);
+	udp::endpoint destination = popDestination(context, socket);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(token1);
+	if (token1.tokenType != T_ARRAY)
+		throw StutskException(ET_ERROR, "Token is not an array");
+
+	openFor(socket, destination);
+	TokenList& list = *token1.asTokenList;
+	vector<StringPtr> datagrams(list.size());
+	for (size_t i = 0; i < list.size(); ++i)
+		datagrams[i] = giveString(list[i]);
+
+#ifdef __linux__
+	vector<iovec> vectors(std::min(datagrams.size(), MAX_SEND_BATCH));
+	vector<mmsghdr> messages(vectors.size());
+	for (size_t sent = 0; sent < datagrams.size(); ) {
+		size_t count = std::min(datagrams.size() - sent, MAX_SEND_BATCH);
+		for (size_t i = 0; i < count; ++i) {
+			StringPtr& datagram = datagrams[sent + i];
+			vectors[i].iov_base = (void*)datagram->data();
+			vectors[i].iov_len = datagram->size();
+			messages[i] = mmsghdr();
+			messages[i].msg_hdr.msg_name = destination.data();
+			messages[i].msg_hdr.msg_namelen = destination.size();
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		waitDatagram(context->interpreter, socket, true);
+		int result = sendmmsg(socket->native_handle(), &messages[0], (unsigned int)count, 0);
+		if (result > 0)
+			sent += result;
+		// Asynchronous operations leave the descriptor non-blocking
+		else if (errno == EAGAIN)
+			context->interpreter.scheduler.waitReady(socket->native_handle(), true);
+		else if (errno != EINTR)
+			throw StutskException(ET_ERROR, strerror(errno));
+	}
+#else
+	boost::system::error_code error;
+	for (size_t i = 0; i < datagrams.size(); ++i) {
+		waitDatagram(context->interpreter, socket, true);
+		socket->send_to(boost::asio::buffer(*datagrams[i]), destination, 0, error);
+		if (error)
+			throw StutskException(ET_ERROR, error.message());
+	}
+#endif
+}
+
+void BuiltIns::_f_udp_recv(Context* context) {
+    /* arguments: <T_HANDLE socket> udp_recv
+	   returnvalue: <T_ARRAY>
+	   description: Waits for a datagram and returns an array of its data, the address of the 
+	     sender and the port it was sent from. 
+	   notes: The address and port can be passed to udp_send to reply.
+	*/
+	UdpSocket* socket = popUdpSocket(context);
+	if (!socket->is_open())
+		throw StutskException(ET_ERROR, "Socket has neither been bound nor used to send");
+
+	socket->buffer.resize(MAX_DATAGRAM_SIZE);
+	waitDatagram(context->interpreter, socket, false);
+	udp::endpoint sender;
+	boost::system::error_code error;
+	size_t length = socket->receive_from(boost::asio::buffer(socket->buffer), sender, 0, error);
+	if (error)
+		throw StutskException(ET_ERROR, error.message());
+
+	Token result(T_ARRAY);
+	result.asTokenList = TokenListPtr(new TokenList());
+	Token data(T_STRING);
+	data.asString = StringPtr(new string(&socket->buffer[0], length));
+	result.asTokenList->push_back(data);
+	Token address(T_STRING);
+	address.asString = StringPtr(new string(sender.address().to_string()));
+	result.asTokenList->push_back(address);
+	stringstream port;
+	port << sender.port();
+	Token portToken(T_STRING);
+	portToken.asString = StringPtr(new string(port.str()));
+	result.asTokenList->push_back(portToken);
+	context->stack.push_back(result);
+}
+
+void BuiltIns::_f_udp_recv_many(Context* context) {
+    /* arguments: <T_INTEGER count> <T_HANDLE socket> udp_recv_many
+	   returnvalue: <T_ARRAY>
+	   description: Waits for a datagram and returns an array of its data and that of up to
+	     `count` - 1 more datagrams that have already arrived.
+	   notes: On Linux, they are received with one system call (recvmmsg). At most 256 
+	     datagrams are returned at once, and datagrams longer than 9216 bytes are truncated -
+		 use udp_recv if either matters, or if the senders are needed.
+	*/
+	UdpSocket* socket = popUdpSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger requested = giveInteger(token1);
+	if (requested < 1)
+		throw StutskException(ET_ERROR, "Number must be positive");
+	if (!socket->is_open())
+		throw StutskException(ET_ERROR, "Socket has neither been bound nor used to send");
+
+	size_t count = std::min((size_t)requested, MAX_DATAGRAM_BATCH);
+	socket->buffer.resize(std::max(count * DATAGRAM_SLOT_SIZE, socket->buffer.size()));
+
+	Token result(T_ARRAY);
+	result.asTokenList = TokenListPtr(new TokenList());
+
+#ifdef __linux__
+	vector<iovec> vectors(count);
+	vector<mmsghdr> messages(count);
+	for (size_t i = 0; i < count; ++i) {
+		vectors[i].iov_base = &socket->buffer[i * DATAGRAM_SLOT_SIZE];
+		vectors[i].iov_len = DATAGRAM_SLOT_SIZE;
+		messages[i] = mmsghdr();
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int received;
+	for (;;) {
+		waitDatagram(context->interpreter, socket, false);
+		// Waits for the first datagram only and takes whatever else is there
+		received = recvmmsg(socket->native_handle(), &messages[0], (unsigned int)count, MSG_WAITFORONE, NULL);
+		if (received >= 0)
+			break;
+		else if (errno == EAGAIN)
+			context->interpreter.scheduler.waitReady(socket->native_handle(), false);
+		else if (errno != EINTR)
+			throw StutskException(ET_ERROR, strerror(errno));
+	}
+
+	for (int i = 0; i < received; ++i) {
+		Token data(T_STRING);
+		data.asString = StringPtr(new string((const char*)vectors[i].iov_base, 
+			std::min<size_t>(messages[i].msg_len, DATAGRAM_SLOT_SIZE)));
+		result.asTokenList->push_back(data);
+	}
+#else
+	boost::system::error_code error;
+	waitDatagram(context->interpreter, socket, false);
+	do {
+		size_t length = socket->receive(boost::asio::buffer(socket->buffer), 0, error);
+		if (error)
+			throw StutskException(ET_ERROR, error.message());
+		Token data(T_STRING);
+		data.asString = StringPtr(new string(&socket->buffer[0], length));
+		result.asTokenList->push_back(data);
+	} while (result.asTokenList->size() < count && socket->available(error) > 0);
+#endif
+
+	context->stack.push_back(result);
+}
+
+void BuiltIns::_f_udp_close(Context* context) {
+    /* arguments: <T_HANDLE socket> udp_close
+	   returnvalue: 
+	   description: Closes a UDP socket.
+	   notes: 
+	*/
+	UdpSocket* socket = popUdpSocket(context);
+	boost::system::error_code ignored;
+	socket->close(ignored);
+	delete socket;
+}
+
+// --------------------------- HTTP CLIENT --------------------------------- //
+
+namespace {
+	const size_t HTTP_MAX_HEAD_SIZE = 64 * 1024;
+	const size_t HTTP_READ_SIZE = 64 * 1024;
+
+	struct HttpUrl {
+		string host;
+		string port;
+		string target;
+	};
+
+	// Splits an http:// URL into the host, the port (80 if it is not given) and the request target
+	HttpUrl parseUrl(const string& url)
+	{
+		const string scheme = "http://";
+		if (!boost::algorithm::istarts_with(url, scheme))
+			throw StutskException(ET_ERROR, "Only http:// URLs are supported");
+
+		size_t end = url.find_first_of("/?#", scheme.size());
+		string authority = url.substr(scheme.size(), end == string::npos ? string::npos : end - scheme.size());
+
+		HttpUrl result;
+		result.target = end == string::npos ? "/" : url.substr(end);
+		result.target = result.target.substr(0, result.target.find('#'));
+		if (result.target.empty() || result.target[0] != '/')
+			result.target = "/" + result.target;
+
+		if (authority.find('@') != string::npos)
+			throw StutskException(ET_ERROR, "User information in URLs is not supported");
+
+		size_t colon;
+		if (!authority.empty() && authority[0] == '[') {
+			// An IPv6 address
+			size_t close = authority.find(']');
+			if (close == string::npos)
+				throw StutskException(ET_ERROR, "Invalid URL");
+			result.host = authority.substr(1, close - 1);
+			colon = close + 1 < authority.size() && authority[close + 1] == ':' ? close + 1 : string::npos;
+		}
+		else {
+			colon = authority.rfind(':');
+			result.host = authority.substr(0, colon);
+		}
+		result.port = colon == string::npos || colon + 1 == authority.size() ? "80" : authority.substr(colon + 1);
+
+		if (result.host.empty())
+			throw StutskException(ET_ERROR, "Invalid URL");
+		return result;
+	}
+
+	struct HttpResponseHead {
+		string version;
+		int status;
+		string reason;
+		vector<std::pair<string, string> > headers;
+
+		// The values of all the headers called `name`, joined with commas
+		string header(const string& name) const
+		{
+			string value;
+			for (size_t i = 0; i < headers.size(); ++i)
+				if (headers[i].first == name)
+					value += (value.empty() ? "" : ", ") + headers[i].second;
+			return value;
+		}
+	};
+
+	/* Reads a line of the response head, tolerating bare LF line endings. `size` counts what has
+	     been read of the head so far, so that a peer that never ends it is cut off. */
+	bool readHeadLine(Interpreter& interpreter, BufferedSocket* socket, string& line, size_t& size)
+	{
+		line.clear();
+		if (!socket->readUntil(interpreter, "\n", line))
+			return false;
+		size += line.size() + 1;
+		if (size > HTTP_MAX_HEAD_SIZE)
+			throw StutskException(ET_ERROR, "Response head too large");
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.resize(line.size() - 1);
+		return true;
+	}
+
+	/* Reads the status line and the headers (with lowercase names) of a response. Returns false
+	     if the connection was closed before the response started. */
+	bool readResponseHead(Interpreter& interpreter, BufferedSocket* socket, HttpResponseHead& head)
+	{
+		string line;
+		size_t size = 0;
+		if (!readHeadLine(interpreter, socket, line, size))
+			return false;
+
+		size_t space = line.find(' ');
+		if (line.compare(0, 5, "HTTP/") != 0 || space == string::npos || line.size() < space + 4)
+			throw StutskException(ET_ERROR, "Invalid HTTP response");
+		head.version = line.substr(0, space);
+		head.status = atoi(line.substr(space + 1, 3).c_str());
+		head.reason = line.size() > space + 5 ? line.substr(space + 5) : "";
+		head.headers.clear();
+
+		for (;;) {
+			if (!readHeadLine(interpreter, socket, line, size))
+				throw StutskException(ET_ERROR, "Connection closed in the middle of the response");
+			if (line.empty())
+				return true;
+
+			// Obsolete line folding continues the previous header
+			if ((line[0] == ' ' || line[0] == '\t') && !head.headers.empty()) {
+				head.headers.back().second += " " + boost::algorithm::trim_copy(line);
+				continue;
+			}
+
+			size_t colon = line.find(':');
+			if (colon == string::npos || colon == 0)
+				throw StutskException(ET_ERROR, "Invalid HTTP response header");
+			head.headers.push_back(std::make_pair(boost::algorithm::to_lower_copy(line.substr(0, colon)),
+				boost::algorithm::trim_copy(line.substr(colon + 1))));
+		}
+	}
+
+	/* HttpBody - the body of a response to http_request, decoded as it is read from the
+	     connection. The connection goes back to the pool once the body has been read to the end,
+		 and is closed if it is abandoned before that. */
+	class HttpBody {
+	public:
+		enum Framing { NO_BODY, CONTENT_LENGTH, CHUNKED, UNTIL_CLOSE };
+
+		HttpBody(BufferedSocket* socket, Framing framing, stutskInteger length, bool reusable) :
+			socket_(socket), framing_(framing), remaining_(length), reusable_(reusable),
+			finished_(framing == NO_BODY || (framing == CONTENT_LENGTH && length == 0)) { }
+
+		~HttpBody()
+		{
+			if (socket_ != NULL)
+				closeSocket(socket_);
+		}
+
+		/* Appends up to `limit` characters of the body to `output`. Returns false at the end of
+		     the body, at which point the connection is released. */
+		bool read(Interpreter& interpreter, string& output, size_t limit)
+		{
+			if (!finished_ && framing_ == CHUNKED && remaining_ == 0)
+				startChunk(interpreter);
+			if (finished_) {
+				release(interpreter);
+				return false;
+			}
+
+			if (!socket_->fill(interpreter)) {
+				if (framing_ != UNTIL_CLOSE)
+					throw StutskException(ET_ERROR, "Connection closed in the middle of the response");
+				finished_ = true;
+				release(interpreter);
+				return false;
+			}
+
+			size_t before = output.size();
+			if (framing_ == UNTIL_CLOSE)
+				socket_->take(output, limit);
+			else {
+				socket_->take(output, (size_t)std::min<stutskInteger>(remaining_, limit));
+				remaining_ -= output.size() - before;
+				if (remaining_ == 0) {
+					if (framing_ == CHUNKED)
+						endChunk(interpreter);
+					else
+						finished_ = true;
+				}
+			}
+			return true;
+		}
+
+		// Gives the connection back to the pool if the body has been read, closes it otherwise
+		void release(Interpreter& interpreter)
+		{
+			if (socket_ == NULL)
+				return;
+			if (finished_ && reusable_)
+				connectionPool(interpreter).release(socket_);
+			else
+				closeSocket(socket_);
+			socket_ = NULL;
+		}
+
+	private:
+		void startChunk(Interpreter& interpreter)
+		{
+			string line;
+			size_t size = 0;
+			if (!readHeadLine(interpreter, socket_, line, size))
+				throw StutskException(ET_ERROR, "Connection closed in the middle of the response");
+
+			// Chunk extensions after the size are ignored
+			char* end;
+			remaining_ = (stutskInteger)strtoull(line.c_str(), &end, 16);
+			if (end == line.c_str() || remaining_ < 0)
+				throw StutskException(ET_ERROR, "Invalid chunk size");
+
+			if (remaining_ == 0) {
+				// The last chunk is followed by optional trailers, which are discarded
+				do {
+					if (!readHeadLine(interpreter, socket_, line, size))
+						throw StutskException(ET_ERROR, "Connection closed in the middle of the response");
+				} while (!line.empty());
+				finished_ = true;
+			}
+		}
+
+		void endChunk(Interpreter& interpreter)
+		{
+			string line;
+			size_t size = 0;
+			if (!readHeadLine(interpreter, socket_, line, size) || !line.empty())
+				throw StutskException(ET_ERROR, "Invalid chunked encoding");
+		}
+
+		BufferedSocket* socket_;
+		Framing framing_;
+		stutskInteger remaining_;
+		bool reusable_;
+		bool finished_;
+	};
+
+	HttpBody* popHttpBody(Context* context)
+	{
+		Token token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token);
+		if (token.tokenType != T_HANDLE || token.data.asHandle.size != sizeof(HttpBody))
+			throw StutskException(ET_ERROR, "Token not an HTTP response body");
+		return (HttpBody*)token.data.asHandle.ptr;
+	}
+
+	bool idempotent(const string& method)
+	{
+		return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" ||
+			method == "OPTIONS" || method == "TRACE";
+	}
+
+	// Whether `error` means the peer closed or reset the connection
+	bool connectionLost(const boost::system::error_code& error)
+	{
+		return error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
+			error == boost::asio::error::broken_pipe || error == boost::asio::error::connection_aborted;
+	}
+}
+
+void BuiltIns::_f_http_request(Context* context) {
+    /* arguments: <T_DICTIONARY request> http_request
+	   returnvalue: <T_DICTIONARY response>
+	   description: Sends an HTTP/1.1 request and returns the response as a dictionary with
+	     "status", "reason", "version", "headers" (with lowercase names) and "body". The request
+		 has a "url" (http://host[:port]/path?query) and optionally a "method" (GET, or POST if
+		 there is a body), "headers" (a dictionary, array values are sent as repeated headers),
+		 "body", "timeout" (for connecting and for each read and write, in milliseconds) and
+		 "stream".
+	   notes:
+	     Connections are kept open and reused for later requests to the same host and port,
+		 through the connection pool of socket_pool_get. A request whose reused connection the
+		 server has closed or reset before any of the response arrived is retried on a new one,
+		 unless the method is POST or PATCH. Timeouts and invalid responses are not retried.
+		 If "stream" is true, the response has a "stream" handle instead of the body, which is
+		 read with http_body_read. Chunked bodies are decoded in both cases.
+		 Only plain http:// is supported.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(token1);
+	if (token1.tokenType != T_DICTIONARY)
+		throw StutskException(ET_ERROR, "Token is not a dictionary.");
+	TokenDictionary& request = *token1.asDictionary;
+
+	Token* value = request.find(stringToken("url"));
+	if (value == NULL)
+		throw StutskException(ET_ERROR, "Request has no url");
+	HttpUrl url = parseUrl(*giveString(*value));
+
+	string body;
+	bool hasBody = false;
+	if ((value = request.find(stringToken("body"))) != NULL) {
+		body = *giveString(*value);
+		hasBody = true;
+	}
+
+	string method = hasBody ? "POST" : "GET";
+	if ((value = request.find(stringToken("method"))) != NULL)
+		method = boost::algorithm::to_upper_copy(*giveString(*value));
+
+	stutskInteger timeout = -1;
+	if ((value = request.find(stringToken("timeout"))) != NULL)
+		timeout = std::max<stutskInteger>(giveInteger(*value), -1);
+
+	bool stream = false;
+	if ((value = request.find(stringToken("stream"))) != NULL)
+		stream = giveBool(*value);
+
+	std::ostringstream head;
+	head << method << " " << url.target << " HTTP/1.1\r\n";
+
+	bool hasHost = false, hasLength = false, closing = false;
+	if ((value = request.find(stringToken("headers"))) != NULL) {
+		recurseVariables(*value);
+		if (value->tokenType != T_DICTIONARY)
+			throw StutskException(ET_ERROR, "Request headers are not a dictionary");
+
+		for (TokenDictionary::const_iterator it = value->asDictionary->begin();
+			it != value->asDictionary->end(); ++it) {
+				string name = it->key.toString();
+				hasHost = hasHost || boost::algorithm::iequals(name, "host");
+				hasLength = hasLength || boost::algorithm::iequals(name, "content-length") ||
+					boost::algorithm::iequals(name, "transfer-encoding");
+
+				vector<string> values;
+				if (it->value.tokenType == T_ARRAY)
+					for (TokenList::const_iterator element = it->value.asTokenList->begin();
+						element != it->value.asTokenList->end(); ++element)
+							values.push_back(*giveString(*element));
+				else
+					values.push_back(*giveString(it->value));
+
+				for (size_t i = 0; i < values.size(); ++i) {
+					if (boost::algorithm::iequals(name, "connection") &&
+						boost::algorithm::icontains(values[i], "close"))
+						closing = true;
+					head << name << ": " << values[i] << "\r\n";
+				}
+		}
+	}
+
+	if (!hasHost) {
+		head << "Host: " << (url.host.find(':') != string::npos ? "[" + url.host + "]" : url.host);
+		if (url.port != "80")
+			head << ":" << url.port;
+		head << "\r\n";
+	}
+	if (!hasLength && (hasBody || method == "POST" || method == "PUT" || method == "PATCH"))
+		head << "Content-Length: " << body.size() << "\r\n";
+	head << "\r\n";
+
+	// Small bodies go out with the head, so that the request takes a single write
+	string message = head.str();
+	if (body.size() < SOCKET_BUFFER_SIZE) {
+		message += body;
+		body.clear();
+	}
+
+	Interpreter& interpreter = context->interpreter;
+	ConnectionPool& pool = connectionPool(interpreter);
+	string key = url.host + ":" + url.port;
+
+	BufferedSocket* socket;
+	HttpResponseHead response;
+	for (;;) {
+		socket = pool.take(key);
+		bool reused = socket != NULL;
+		if (!reused) {
+			socket = openSocket(interpreter, url.host, url.port, timeout >= 0 ? timeout : pool.connectTimeout);
+			socket->poolKey = key;
+			boost::system::error_code ignored;
+			socket->set_option(tcp::no_delay(true), ignored);
+		}
+		socket->timeout = timeout;
+		socket->lastError = boost::system::error_code();
+		response = HttpResponseHead();
+
+		bool started, lost = false;
+		try {
+			socket->writeAll(interpreter, message.data(), message.size());
+			if (!body.empty())
+				socket->writeAll(interpreter, body.data(), body.size());
+			started = readResponseHead(interpreter, socket, response);
+
+			// Interim responses (such as 100 Continue) are followed by the real one
+			while (started && response.status >= 100 && response.status < 200 && response.status != 101)
+				started = readResponseHead(interpreter, socket, response);
+		}
+		/* Only a reused connection that the server had closed or reset before any of the
+		     response arrived is retried. Timeouts and invalid responses are not, as the server
+			 may have processed the request. */
+		catch (const StutskException&) {
+			lost = reused && idempotent(method) && response.version.empty() && 
+				connectionLost(socket->lastError);
+			closeSocket(socket);
+			if (!lost)
+				throw;
+		}
+		catch (const boost::system::system_error&) {
+			closeSocket(socket);
+			throw;
+		}
+		if (lost) {
+			interpreter.scheduler.checkDeadline();
+			continue;
+		}
+
+		if (started)
+			break;
+		closeSocket(socket);
+		if (!reused || !idempotent(method))
+			throw StutskException(ET_ERROR, "Connection closed before the response");
+	}
+
+	bool reusable = !closing && response.status != 101;
+	string connection = response.header("connection");
+	if (response.version == "HTTP/1.0")
+		reusable = reusable && boost::algorithm::icontains(connection, "keep-alive");
+	else
+		reusable = reusable && !boost::algorithm::icontains(connection, "close");
+
+	HttpBody::Framing framing = HttpBody::UNTIL_CLOSE;
+	stutskInteger length = 0;
+	string transferEncoding = response.header("transfer-encoding");
+	string contentLength = response.header("content-length");
+	if (method == "HEAD" || response.status == 204 || response.status == 304 ||
+		response.status == 101)
+		framing = HttpBody::NO_BODY;
+	else if (boost::algorithm::iends_with(boost::algorithm::trim_copy(transferEncoding), "chunked"))
+		framing = HttpBody::CHUNKED;
+	else if (!contentLength.empty()) {
+		char* end;
+		length = (stutskInteger)strtoll(contentLength.c_str(), &end, 10);
+		if (end == contentLength.c_str() || length < 0) {
+			closeSocket(socket);
+			throw StutskException(ET_ERROR, "Invalid Content-Length");
+		}
+		framing = HttpBody::CONTENT_LENGTH;
+	}
+	if (framing == HttpBody::UNTIL_CLOSE)
+		reusable = false;
+
+	std::unique_ptr<HttpBody> responseBody(new HttpBody(socket, framing, length, reusable));
+
+	Token result(T_DICTIONARY);
+	result.asDictionary = TokenDictionaryPtr(new TokenDictionary());
+	TokenDictionary& dictionary = *result.asDictionary;
+
+	dictionary[stringToken("status")] = Token(T_INTEGER);
+	dictionary[stringToken("status")].data.asInteger = response.status;
+	dictionary[stringToken("reason")] = stringToken(response.reason);
+	dictionary[stringToken("version")] = stringToken(response.version);
+
+	dictionary[stringToken("headers")] = headerDictionary(response.headers);
+
+	if (stream) {
+		Token handle(T_HANDLE);
+		handle.data.asHandle.ptr = (void*)responseBody.release();
+		handle.data.asHandle.size = sizeof(HttpBody);
+		dictionary[stringToken("stream")] = handle;
+	}
+	else {
+		Token content(T_STRING);
+		content.asString = StringPtr(new string());
+		if (framing == HttpBody::CONTENT_LENGTH)
+			content.asString->reserve((size_t)length);
+		while (responseBody->read(interpreter, *content.asString, HTTP_READ_SIZE))
+			;
+		dictionary[stringToken("body")] = content;
+	}
+
+	context->stack.push_back(result);
+}
+
+void BuiltIns::_f_http_body_read(Context* context) {
+    /* arguments: <T_INTEGER count> <T_HANDLE stream> http_body_read
+	   returnvalue: <T_STRING>
+	   description: Reads up to `count` characters of a response body streamed by http_request,
+	     returning as soon as some are available. Returns an empty string at the end of the body.
+	   notes: The connection is given back to the pool once the end has been reached. The
+	     handle must still be closed with http_body_close.
+	*/
+	HttpBody* body = popHttpBody(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger count = giveInteger(token1);
+	if (count < 1)
+		throw StutskException(ET_ERROR, "Number must be positive");
+
+	Token result(T_STRING);
+	result.asString = StringPtr(new string());
+	body->read(context->interpreter, *result.asString, (size_t)count);
+	context->stack.push_back(result);
+}
+
+void BuiltIns::_f_http_body_close(Context* context) {
+    /* arguments: <T_HANDLE stream> http_body_close
+	   returnvalue:
+	   description: Closes a response body streamed by http_request.
+	   notes: If the body has not been read to the end, its connection is closed rather than
+	     given back to the pool.
+	*/
+	HttpBody* body = popHttpBody(context);
+	body->release(context->interpreter);
+	delete body;
+}
+
+// ------------------------- PRE-FORKING SERVER ---------------------------- //
+
+#ifdef FORK_CAPABLE
+namespace {
+	// A worker that fails sooner than this after it was started is restarted only then
+	const stutskInteger PREFORK_RESTART_DELAY = 1000;
+
+	struct PreforkWorker {
+		pid_t pid;
+		bool finished;
+		boost::chrono::steady_clock::time_point started;
+	};
+
+	tcp::acceptor* preforkListen(Interpreter& interpreter, unsigned short port, bool reusePort)
+	{
+		std::unique_ptr<tcp::acceptor> acceptor(new tcp::acceptor(interpreter.io_service));
+		tcp::endpoint endpoint(tcp::v4(), port);
+		acceptor->open(endpoint.protocol());
+		acceptor->set_option(tcp::acceptor::reuse_address(true));
+		if (reusePort) {
+			int enable = 1;
+			if (setsockopt(acceptor->native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0)
+				throw StutskException(ET_SYSTEM, "Cannot set SO_REUSEPORT");
+		}
+		acceptor->bind(endpoint);
+		acceptor->listen();
+		return acceptor.release();
+	}
+
+	/* Whether the process has threads other than the calling one. Signals are only blocked for
+	     the calling thread, so any other thread could take those meant for the supervisor. */
+	bool otherThreadsRunning()
+	{
+#ifdef __linux__
+		DIR* tasks = opendir("/proc/self/task");
+		if (tasks == NULL)
+			return false;
+		size_t count = 0;
+		while (dirent* entry = readdir(tasks))
+			if (entry->d_name[0] != '.')
+				++count;
+		closedir(tasks);
+		return count > 1;
+#else
+		return false;
+#endif
+	}
+
+	/* Runs `worker` in the forked child with its index and the acceptor on the stack. A worker
+	     that throws exits with a failure status, so that the supervisor starts it again. */
+	void runPreforkWorker(Context* context, const TokenList& worker, size_t index,
+		tcp::acceptor* acceptor, unsigned short port, const sigset_t& mask)
+	{
+		// A process group of its own keeps the terminal's SIGINT from reaching the worker
+		// besides the one forwarded by the supervisor
+		setpgid(0, 0);
+		pthread_sigmask(SIG_SETMASK, &mask, NULL);
+		context->interpreter.io_service.notify_fork(boost::asio::io_service::fork_child);
+
+		int status = EXIT_SUCCESS;
+		try {
+			if (acceptor == NULL)
+				acceptor = preforkListen(context->interpreter, port, true);
+
+			pushInteger(context, (stutskInteger)index);
+			Token handle(T_HANDLE);
+			handle.data.asHandle.ptr = (void*)acceptor;
+			handle.data.asHandle.size = sizeof(tcp::acceptor);
+			context->stack.push_back(handle);
+
+			context->run(worker, "socket_listen_prefork");
+		}
+		catch (const StutskException& e) {
+			cerr << e.getFormattedMessage();
+			status = EXIT_FAILURE;
+		}
+		catch (const std::exception& e) {
+			cerr << e.what() << "\n";
+			status = EXIT_FAILURE;
+		}
+
+		cout.flush();
+		fflush(stdout);
+		_exit(status);
+	}
+
+	// Signals the workers that are still running and waits for them to exit
+	void stopWorkers(vector<PreforkWorker>& workers, int signal)
+	{
+		for (size_t i = 0; i < workers.size(); ++i)
+			if (workers[i].pid > 0)
+				kill(workers[i].pid, signal);
+		for (size_t i = 0; i < workers.size(); ++i)
+			if (workers[i].pid > 0) {
+				int status;
+				while (waitpid(workers[i].pid, &status, 0) < 0 && errno == EINTR);
+				workers[i].pid = 0;
+			}
+	}
+}
+#endif
+
+void BuiltIns::_f_socket_listen_prefork(Context* context) {
+    /* arguments: <T_CODEBLOCK worker> <T_INTEGER port | T_DICTIONARY options> socket_listen_prefork
+	   returnvalue:
+	   description: Starts listening on TCP port `port` and runs `worker` in several forked
+	     processes that accept connections from the same socket, with the index of the worker
+		 and the acceptor on the stack. Returns once all the workers have finished.
+	   notes:
+	     Options are "port", "workers" (default one per CPU, see --threads) and "reuse_port",
+		 with which every worker listens on a socket of its own with SO_REUSEPORT, so that the
+		 kernel spreads the connections evenly among them. Pass the acceptor to http_serve as
+		 "listener" to serve HTTP from every worker.
+		 Workers that throw or are killed by a signal are started again, at most once a second.
+		 SIGHUP, SIGUSR1 and SIGUSR2 are forwarded to the workers. SIGTERM and SIGINT are
+		 forwarded as well, after which the workers are not restarted, and once they have all
+		 exited the program is halted. The workers run in process groups of their own, so that
+		 only the supervisor gets the signals of the terminal.
+		 No other threads may be running (e.g. started by spawn), as they could take the signals
+		 meant for the supervisor. Only available on POSIX platforms.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+#ifdef FORK_CAPABLE
+	recurseVariables(token2);
+	if (token2.tokenType != T_CODEBLOCK)
+		throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+	unsigned short port;
+	unsigned int count = workerThreads;
+	bool reusePort = false;
+
+	recurseVariables(token1);
+	if (token1.tokenType == T_DICTIONARY) {
+		Token* value = token1.asDictionary->find(stringToken("port"));
+		if (value == NULL)
+			throw StutskException(ET_ERROR, "Port not given");
+		port = (unsigned short)giveInteger(*value);
+
+		if ((value = token1.asDictionary->find(stringToken("workers"))) != NULL && giveInteger(*value) > 0)
+			count = (unsigned int)giveInteger(*value);
+		if ((value = token1.asDictionary->find(stringToken("reuse_port"))) != NULL)
+			reusePort = giveBool(*value);
+	}
+	else
+		port = (unsigned short)giveInteger(token1);
+
+	// The worker pool of the parallel array functions is idle here, and is started again on demand
+	context->interpreter.workerPool.reset();
+	if (otherThreadsRunning())
+		throw StutskException(ET_ERROR, "socket_listen_prefork cannot be used while other threads are running");
+
+	Interpreter& interpreter = context->interpreter;
+	TokenList worker(*token2.asTokenList);
+
+	// With reuse_port the workers open their own sockets, one here would take its share too
+	std::unique_ptr<tcp::acceptor> acceptor;
+	if (!reusePort)
+		acceptor.reset(preforkListen(interpreter, port, false));
+
+	// The signals are taken with sigtimedwait rather than by handlers, the workers unblock them
+	sigset_t handled, previous;
+	sigemptyset(&handled);
+	const int signals[] = { SIGCHLD, SIGTERM, SIGINT, SIGHUP, SIGUSR1, SIGUSR2 };
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+		sigaddset(&handled, signals[i]);
+	pthread_sigmask(SIG_BLOCK, &handled, &previous);
+
+	typedef boost::chrono::steady_clock Clock;
+	vector<PreforkWorker> workers(count);
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].pid = 0;
+		workers[i].finished = false;
+	}
+
+	bool stopping = false;
+	for (;;) {
+		Clock::time_point now = Clock::now();
+		stutskInteger wait = -1;
+		size_t running = 0;
+
+		for (size_t i = 0; i < workers.size(); ++i) {
+			if (workers[i].pid == 0 && !workers[i].finished && !stopping) {
+				stutskInteger delay = PREFORK_RESTART_DELAY - (stutskInteger)boost::chrono::duration_cast<
+					boost::chrono::milliseconds>(now - workers[i].started).count();
+				if (workers[i].started != Clock::time_point() && delay > 0) {
+					wait = wait < 0 ? delay : std::min(wait, delay);
+					continue;
+				}
+
+				// Otherwise buffered output would be written by the workers as well
+				cout.flush();
+				fflush(stdout);
+
+				interpreter.io_service.notify_fork(boost::asio::io_service::fork_prepare);
+				pid_t pid = fork();
+				if (pid == 0)
+					runPreforkWorker(context, worker, i, acceptor.get(), port, previous);
+				interpreter.io_service.notify_fork(boost::asio::io_service::fork_parent);
+
+				if (pid < 0) {
+					stopWorkers(workers, SIGTERM);
+					pthread_sigmask(SIG_SETMASK, &previous, NULL);
+					throw StutskException(ET_SYSTEM, "Cannot fork");
+				}
+				workers[i].pid = pid;
+				workers[i].started = now;
+			}
+			if (workers[i].pid > 0)
+				++running;
+		}
+
+		if (running == 0 && (wait < 0 || stopping))
+			break;
+
+		siginfo_t info;
+		int signal;
+		if (wait < 0)
+			signal = sigwaitinfo(&handled, &info);
+		else {
+			timespec timeout = { (time_t)(wait / 1000), (long)(wait % 1000) * 1000000 };
+			signal = sigtimedwait(&handled, &info, &timeout);
+		}
+		if (signal < 0)
+			continue;
+
+		if (signal != SIGCHLD) {
+			for (size_t i = 0; i < workers.size(); ++i)
+				if (workers[i].pid > 0)
+					kill(workers[i].pid, signal);
+			if (signal == SIGTERM || signal == SIGINT)
+				stopping = true;
+			continue;
+		}
+
+		// Only the workers are reaped, other children belong to exec and fork
+		for (size_t i = 0; i < workers.size(); ++i) {
+			int status;
+			if (workers[i].pid <= 0 || waitpid(workers[i].pid, &status, WNOHANG) != workers[i].pid)
+				continue;
+			workers[i].pid = 0;
+			workers[i].finished = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	if (stopping)
+		interpreter.exitVar = OP_HALT;
+#else
+	throw StutskException(ET_ERROR, "fork() is not available on non-POSIX operating systems");
+#endif
+}
+
+// ---------------------------- POLLING ------------------------------------ //
+
+#ifdef __linux__
+namespace {
+	enum { POLL_READ = 1, POLL_WRITE = 2 };
+
+	// Exec handles have no descriptor of their own to wait for, so they are checked this often
+	const int EXEC_POLL_INTERVAL = 10;
+
+	struct PolledHandle {
+		Token handle;
+		int interest;
+		// -1 for exec handles, whose pipes are read by a thread of the exec library
+		int fd;
+		exec_stream_t* exec;
+		bool ready;
+	};
+
+	int pollInterest(Token token)
+	{
+		string flags = *giveString(token);
+		int interest = 0;
+		for (size_t i = 0; i < flags.size(); ++i) {
+			if (flags[i] == 'r')
+				interest |= POLL_READ;
+			else if (flags[i] == 'w')
+				interest |= POLL_WRITE;
+			else
+				throw StutskException(ET_ERROR, "Interest must consist of \"r\" and \"w\"");
+		}
+		if (interest == 0)
+			throw StutskException(ET_ERROR, "Interest must consist of \"r\" and \"w\"");
+		return interest;
+	}
+
+	/* Finds the descriptor behind a handle. Handles carry no type, only the size of what they
+	     point to, which is distinct for the kinds of handles that can be polled. Data that is
+		 already buffered in user space makes a handle readable right away. */
+	void describeHandle(PolledHandle& polled)
+	{
+		Token& handle = polled.handle;
+		if (handle.tokenType != T_HANDLE)
+			throw StutskException(ET_ERROR, "Token is not a handle");
+
+		polled.fd = -1;
+		polled.exec = NULL;
+		polled.ready = false;
+
+		if (handle.data.asHandle.size == sizeof(BufferedSocket)) {
+			BufferedSocket* socket = (BufferedSocket*)handle.data.asHandle.ptr;
+			// A socket closed by the peer is reported, so that the script notices
+			if (!socket->is_open() || ((polled.interest & POLL_READ) && socket->buffered() > 0))
+				polled.ready = true;
+			else
+				polled.fd = socket->native_handle();
+		}
+		else if (handle.data.asHandle.size == sizeof(tcp::acceptor))
+			polled.fd = ((tcp::acceptor*)handle.data.asHandle.ptr)->native_handle();
+		else if (handle.data.asHandle.size == sizeof(UdpSocket))
+			polled.fd = ((UdpSocket*)handle.data.asHandle.ptr)->native_handle();
+		else if (handle.data.asHandle.size == sizeof(FILE)) {
+			FILE* file = (FILE*)handle.data.asHandle.ptr;
+			polled.fd = fileno(file);
+#ifdef __GLIBC__
+			if ((polled.interest & POLL_READ) && file->_IO_read_ptr < file->_IO_read_end)
+				polled.ready = true;
+#endif
+		}
+		else if (handle.data.asHandle.size == sizeof(exec_stream_t))
+			polled.exec = (exec_stream_t*)handle.data.asHandle.ptr;
+		else
+			throw StutskException(ET_ERROR, "Handle cannot be polled");
+	}
+
+	class EpollDescriptor : boost::noncopyable {
+	public:
+		EpollDescriptor() : fd(epoll_create1(EPOLL_CLOEXEC))
+		{
+			if (fd < 0)
+				throw StutskException(ET_ERROR, strerror(errno));
+		}
+		~EpollDescriptor() { ::close(fd); }
+
+		const int fd;
+	};
+}
+#endif
+
+void BuiltIns::_f_poll_handles(Context* context) {
+    /* arguments: <T_ARRAY handles> <T_STRING interest> <T_INTEGER milliseconds> poll_handles
+	   arguments: <T_ARRAY handles> <T_ARRAY interests> <T_INTEGER milliseconds> poll_handles
+	   returnvalue: <T_ARRAY>
+	   description: Waits until at least one of `handles` is ready, or `milliseconds` have passed,
+	     and returns the handles that are ready. Interest is "r" for reading, "w" for writing or
+		 "rw" for either, and is given either for all handles or for each one separately.
+		 Sockets, listening sockets, UDP sockets, file handles and exec handles can be polled.
+	   notes: A negative timeout waits indefinitely and 0 only checks the handles. A closed socket
+	     is always ready and so are regular files. Exec handles are buffered by a thread of their
+		 own and are checked every 10 milliseconds. Only available on Linux.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token3 = stack_back_safe(context);
+	context->stack.pop_back();
+
+#ifdef __linux__
+	typedef boost::chrono::steady_clock Clock;
+
+	stutskInteger timeout = giveInteger(token1);
+
+	recurseVariables(token3);
+	if (token3.tokenType != T_ARRAY)
+		throw StutskException(ET_ERROR, "Token is not an array");
+
+	recurseVariables(token2);
+	if (token2.tokenType == T_ARRAY && token2.asTokenList->size() != token3.asTokenList->size())
+		throw StutskException(ET_ERROR, "Every handle needs its interest");
+
+	vector<PolledHandle> handles(token3.asTokenList->size());
+	for (size_t i = 0; i < handles.size(); ++i) {
+		handles[i].handle = (*token3.asTokenList)[i];
+		recurseVariables(handles[i].handle);
+		handles[i].interest = pollInterest(token2.tokenType == T_ARRAY ? (*token2.asTokenList)[i] : token2);
+		describeHandle(handles[i]);
+	}
+
+	// A descriptor can only be registered once, even if it appears several times in the list
+	map<int, vector<size_t> > descriptors;
+	bool hasExec = false;
+	for (size_t i = 0; i < handles.size(); ++i) {
+		if (handles[i].fd >= 0 && !handles[i].ready)
+			descriptors[handles[i].fd].push_back(i);
+		hasExec = hasExec || handles[i].exec != NULL;
+	}
+
+	EpollDescriptor epoll;
+	for (map<int, vector<size_t> >::iterator it = descriptors.begin(); it != descriptors.end(); ++it) {
+		epoll_event event = epoll_event();
+		event.data.fd = it->first;
+		for (size_t i = 0; i < it->second.size(); ++i) {
+			int interest = handles[it->second[i]].interest;
+			event.events |= ((interest & POLL_READ) ? EPOLLIN | EPOLLRDHUP : 0) | 
+				((interest & POLL_WRITE) ? EPOLLOUT : 0);
+		}
+
+		if (epoll_ctl(epoll.fd, EPOLL_CTL_ADD, it->first, &event) < 0) {
+			// Regular files do not support epoll, but never have to be waited for
+			if (errno != EPERM)
+				throw StutskException(ET_ERROR, strerror(errno));
+			for (size_t i = 0; i < it->second.size(); ++i)
+				handles[it->second[i]].ready = true;
+		}
+	}
+
+	Clock::time_point deadline = Clock::now() + boost::chrono::milliseconds(std::max<stutskInteger>(timeout, 0));
+	vector<epoll_event> events(std::max<size_t>(descriptors.size(), 1));
+	for (;;) {
+		bool found = false;
+		for (size_t i = 0; i < handles.size(); ++i) {
+			PolledHandle& polled = handles[i];
+			if (polled.exec != NULL && !polled.ready)
+				polled.ready = ((polled.interest & POLL_READ) && polled.exec->ready(exec_stream_t::s_out)) ||
+					((polled.interest & POLL_WRITE) && polled.exec->ready(exec_stream_t::s_in));
+			found = found || polled.ready;
+		}
+
+		if (!found && timeout != 0) {
+			stutskInteger wait = timeout < 0 ? -1 : std::max<stutskInteger>(0,
+				boost::chrono::ceil<boost::chrono::milliseconds>(deadline - Clock::now()).count());
+			if (hasExec && (wait < 0 || wait > EXEC_POLL_INTERVAL))
+				wait = EXEC_POLL_INTERVAL;
+
+			// The epoll descriptor is readable when any of the handles is ready, so waiting for it
+			// lets green threads run and respects with_deadline
+			if (!context->interpreter.scheduler.waitReady(epoll.fd, false, wait))
+				context->interpreter.scheduler.checkDeadline();
+		}
+
+		int count = epoll_wait(epoll.fd, &events[0], (int)events.size(), 0);
+		if (count < 0 && errno != EINTR)
+			throw StutskException(ET_ERROR, strerror(errno));
+
+		for (int i = 0; i < count; ++i) {
+			const vector<size_t>& indices = descriptors[events[i].data.fd];
+			for (size_t j = 0; j < indices.size(); ++j) {
+				PolledHandle& polled = handles[indices[j]];
+				uint32_t wanted = EPOLLERR | EPOLLHUP |
+					((polled.interest & POLL_READ) ? EPOLLIN | EPOLLRDHUP : 0) | 
+					((polled.interest & POLL_WRITE) ? EPOLLOUT : 0);
+				if (events[i].events & wanted) {
+					polled.ready = true;
+					found = true;
+				}
+			}
+		}
+
+		if (found || timeout == 0 || (timeout > 0 && Clock::now() >= deadline))
+			break;
+	}
+
+	Token result(T_ARRAY);
+	result.asTokenList = TokenListPtr(new TokenList());
+	for (size_t i = 0; i < handles.size(); ++i)
+		if (handles[i].ready)
+			result.asTokenList->push_back(handles[i].handle);
+	context->stack.push_back(result);
+#else
+	throw StutskException(ET_ERROR, "poll_handles is not available on this platform");
+#endif
+}
+
+// ------------------------- ASYNCHRONOUS I/O ------------------------------ //
+
+namespace {
+	using boost::asio::ip::tcp;
+
+	// The handle of a socket or an acceptor given as the topmost argument
+	template<class T>
+	T* popHandle(Context* context)
+	{
+		Token token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token);
+		if (token.tokenType != T_HANDLE)
+			throw StutskException(ET_ERROR, "Token not a handle");
+		return (T*)token.data.asHandle.ptr;
+	}
+
+	TokenListPtr popCallback(Context* context)
+	{
+		Token token = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token);
+		if (token.tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not a codeblock");
+		return token.asTokenList;
+	}
+
+	Token handleToken(void* handle, stutskInteger size)
+	{
+		Token token(T_HANDLE);
+		token.data.asHandle.ptr = handle;
+		token.data.asHandle.size = size;
+		return token;
+	}
+
+	Token errorMessage(const boost::system::error_code& error)
+	{
+		Token message(T_STRING);
+		message.asString = StringPtr(new string(error ? error.message() : ""));
+		return message;
+	}
+
+	/* runCallback - runs a callback of an asynchronous operation in a new context under the one
+	     event_loop_run was called from. Anything the callback leaves on the stack is discarded. */
+	void runCallback(Interpreter* interpreter, const TokenListPtr& callback, 
+		const Token* arguments, size_t count)
+	{
+		Context* parent = interpreter->eventLoopContext;
+		TokenStack::size_type depth = parent->stack.size();
+
+		parent->stack.insert(parent->stack.end(), arguments, arguments + count);
+
+		Context callbackContext(*callback, parent);
+		callbackContext.functionName = "<callback>";
+		callbackContext.run(*callback, "callback");
+
+		if (parent->stack.size() > depth)
+			parent->stack.resize(depth);
+
+		if (interpreter->exitVar == OP_HALT)
+			interpreter->io_service.stop();
+		else
+			interpreter->exitVar = OP_INVALID;
+	}
+
+	// Callbacks get the handle the operation was started on first, as codeblocks have no closures
+	void acceptCompleted(Interpreter* interpreter, TokenListPtr callback, tcp::acceptor* acceptor,
+		BufferedSocket* socket, const boost::system::error_code& error)
+	{
+		Token arguments[3];
+		arguments[0] = handleToken(acceptor, sizeof(tcp::acceptor));
+		if (error)
+			delete socket;
+		else
+			arguments[1] = handleToken(socket, sizeof(BufferedSocket));
+		arguments[2] = errorMessage(error);
+
+		runCallback(interpreter, callback, arguments, 3);
+	}
+
+	void readCompleted(Interpreter* interpreter, TokenListPtr callback, BufferedSocket* socket,
+		boost::shared_ptr<vector<char> > buffer, const boost::system::error_code& error, 
+		size_t bytesRead)
+	{
+		Token arguments[3];
+		arguments[0] = handleToken(socket, sizeof(BufferedSocket));
+		arguments[1] = Token(T_STRING);
+		arguments[1].asString = StringPtr(new string(buffer->begin(), buffer->begin() + bytesRead));
+
+		// Like socket_read, end of file closes the socket and is not an error
+		if (error == boost::asio::error::eof) {
+			boost::system::error_code ignored;
+			socket->close(ignored);
+			arguments[2] = errorMessage(boost::system::error_code());
+		}
+		else
+			arguments[2] = errorMessage(error);
+
+		runCallback(interpreter, callback, arguments, 3);
+	}
+
+	// The data is only bound to keep it alive until the write completes
+	void writeCompleted(Interpreter* interpreter, TokenListPtr callback, BufferedSocket* socket,
+		StringPtr /* data */, const boost::system::error_code& error, size_t)
+	{
+		Token arguments[2];
+		arguments[0] = handleToken(socket, sizeof(BufferedSocket));
+		arguments[1] = errorMessage(error);
+
+		runCallback(interpreter, callback, arguments, 2);
+	}
+
+	// The timer is bound to keep it alive until it expires, cancelled timers run no callback
+	void timerExpired(Interpreter* interpreter, TokenListPtr callback, 
+		boost::shared_ptr<boost::asio::steady_timer> /* timer */, const boost::system::error_code& error)
+	{
+		if (error == boost::asio::error::operation_aborted)
+			return;
+		runCallback(interpreter, callback, NULL, 0);
+	}
+}
+
+void BuiltIns::_f_socket_accept_async(Context* context) {
+    /* arguments: <T_CODEBLOCK callback> <T_HANDLE acceptor> socket_accept_async
+	   returnvalue: 
+	   description: Starts waiting for an incoming connection without blocking. When a client
+	     connects, `callback` is called from event_loop_run with the acceptor, the new socket
+		 and an error message (an empty string on success) on the stack.
+	   notes: Only one connection is accepted - call socket_accept_async again from the callback
+	     to accept the next one.
+	*/
+	tcp::acceptor* acceptor = popHandle<tcp::acceptor>(context);
+	TokenListPtr callback = popCallback(context);
+
+	BufferedSocket* socket = new BufferedSocket(context->interpreter.io_service);
+	acceptor->async_accept(*socket, boost::bind(&acceptCompleted, &context->interpreter, 
+		callback, acceptor, socket, boost::asio::placeholders::error));
+}
+
+void BuiltIns::_f_socket_read_async(Context* context) {
+    /* arguments: <T_CODEBLOCK callback> <T_INTEGER count> <T_HANDLE socket> socket_read_async
+	   returnvalue: 
+	   description: Starts reading up to `count` characters from a network socket without 
+	     blocking. Once some data arrives, `callback` is called from event_loop_run with the
+		 socket, the data and an error message (an empty string on success) on the stack.
+	   notes: When the peer closes the connection, the socket is closed and the callback 
+	     receives an empty string, like with socket_read.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	TokenListPtr callback = popCallback(context);
+
+	stutskInteger count = giveInteger(token1);
+	if (count < 0)
+		throw StutskException(ET_ERROR, "Number must not be negative");
+
+	boost::shared_ptr<vector<char> > buffer(new vector<char>((size_t)count));
+
+	// Data already received by the blocking reads is delivered first
+	if (socket->buffered() > 0 && !buffer->empty()) {
+		size_t bytesRead = socket->take(&(*buffer)[0], buffer->size());
+		context->interpreter.io_service.post(boost::bind(&readCompleted, &context->interpreter,
+			callback, socket, buffer, boost::system::error_code(), bytesRead));
+		return;
+	}
+
+	socket->async_read_some(boost::asio::buffer(*buffer), boost::bind(&readCompleted, 
+		&context->interpreter, callback, socket, buffer, boost::asio::placeholders::error,
+		boost::asio::placeholders::bytes_transferred));
+}
+
+void BuiltIns::_f_socket_write_async(Context* context) {
+    /* arguments: <T_CODEBLOCK callback> <T_STRING data> <T_HANDLE socket> socket_write_async
+	   returnvalue: 
+	   description: Starts writing `data` to a network socket without blocking. Once all of it
+	     has been written, `callback` is called from event_loop_run with the socket and an
+		 error message (an empty string on success) on the stack.
+	   notes: Do not start another write on the same socket before the callback is called.
+	*/
+	BufferedSocket* socket = popSocket(context);
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	TokenListPtr callback = popCallback(context);
+
+	StringPtr data(new string(*giveString(token1)));
+	boost::asio::async_write(*socket, boost::asio::buffer(*data), boost::bind(&writeCompleted,
+		&context->interpreter, callback, socket, data, boost::asio::placeholders::error,
+		boost::asio::placeholders::bytes_transferred));
+}
+
+void BuiltIns::_f_timer_after(Context* context) {
+    /* arguments: <T_CODEBLOCK callback> <T_INTEGER milliseconds> timer_after
+	   returnvalue: 
+	   description: Calls `callback` from event_loop_run after `milliseconds` milliseconds.
+	   notes: 
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	TokenListPtr callback = popCallback(context);
+
+	boost::shared_ptr<boost::asio::steady_timer> timer(
+		new boost::asio::steady_timer(context->interpreter.io_service));
+	timer->expires_from_now(boost::asio::chrono::milliseconds(giveInteger(token1)));
+	timer->async_wait(boost::bind(&timerExpired, &context->interpreter, callback, timer,
+		boost::asio::placeholders::error));
+}
+
+void BuiltIns::_f_event_loop_run(Context* context) {
+    /* arguments: event_loop_run
+	   returnvalue: 
+	   description: Runs the event loop, calling the callbacks of asynchronous operations as they
+	     complete, until there are no more pending operations or timers.
+	   notes: Callbacks run in a new context, like lambda. Anything they leave on the stack is 
+	     discarded. Calling halt from a callback stops the event loop.
+	*/
+	Interpreter& interpreter = context->interpreter;
+	Context* previousContext = interpreter.eventLoopContext;
+	interpreter.eventLoopContext = context;
+
+	try {
+		interpreter.io_service.run();
+	}
+	catch (...) {
+		// Pending operations are kept, so the loop can be run again after the error is handled
+		interpreter.eventLoopContext = previousContext;
+		interpreter.io_service.reset();
+		throw;
+	}
+
+	interpreter.eventLoopContext = previousContext;
+	interpreter.io_service.reset();
+}
@@ -147,24 +147,24 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 
 	switch (oper) {
 	case OP_ASSIG:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Variable
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Value
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Variable
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Value
 		setVariable(token1, token2); 
 		break;
 	case OP_ASSIG_REF:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Variable
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Value
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Variable
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Value
 		setVariable(token1, token2, true); 
 		break;
 	case OP_FUNC:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Name
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Name
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 		recurseVariables(token2);
 		if (token2.tokenType != T_CODEBLOCK) {
 			throw StutskException(ET_ERROR, "Token is not a codeblock");
@@ -176,13 +176,14 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Cannot override an operator");
 			if (functionName.substr(0,10) == "__builtin_")
 				throw StutskException(ET_ERROR, "Cannot override an internal function");
-			userFunctions[functionName] = *token2.asTokenList;
+			context->interpreter.userFunctions[functionName] = *token2.asTokenList;
+			++context->interpreter.functionsGeneration;
 		}
 
 		break;
 	case OP_UNSET:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
 		if (token1.tokenType == T_VARIABLE) {
 			struct Token::_un_TokenData::_un_VariableData *var = & token1.data.asVariable;
 			TokenMap::iterator iter = var->context->variables.find(var->name);
@@ -190,25 +191,27 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				var->context->variables.erase(iter);
 		}
 		else {
-			UserFunctionsMap::iterator iter = userFunctions.find(*giveString(token1));
-			if (iter != userFunctions.end())
-				userFunctions.erase(iter);
+			UserFunctionsMap::iterator iter = context->interpreter.userFunctions.find(*giveString(token1));
+			if (iter != context->interpreter.userFunctions.end()) {
+				context->interpreter.userFunctions.erase(iter);
+				++context->interpreter.functionsGeneration;
+			}
 		}
 		break;
 	case OP_DEREF:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
 		if (token1.tokenType != T_VARIABLE) {
 			throw StutskException(ET_ERROR, "Token is not a variable");
 		}
 		else {
 			recurseVariables(token1, true);
-			stutskStack.push_back(copy_token(token1));
+			context->stack.push_back(copy_token(token1));
 		}
 		break;
 	case OP_PLUSPLUS:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Name
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Name
 		if (token1.tokenType == T_VARIABLE) {
 			switch (giveGCD(token1, f1, i1, s1)) {
 			case NT_INVALID:
@@ -233,17 +236,17 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 			case NT_STRING:
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
-				pushInteger(++i1);
+				pushInteger(context, ++i1);
 				break;
 			case NT_FLOAT:
-				pushFloat(++f1);
+				pushFloat(context, ++f1);
 				break;
 			}
 		}
 		break;
 	case OP_MINMIN:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Name
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Name
 		if (token1.tokenType == T_VARIABLE) {
 			switch (giveGCD(token1, f1, i1, s1)) {
 			case NT_INVALID:
@@ -268,19 +271,19 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 			case NT_STRING:
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
-				pushInteger(--i1);
+				pushInteger(context, --i1);
 				break;
 			case NT_FLOAT:
-				pushFloat(--f1);
+				pushFloat(context, --f1);
 				break;
 			}
 		}
 		break;
 	case OP_PLUS:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -293,26 +296,26 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				i1 += i2;
-				pushInteger(i1);
+				pushInteger(context, i1);
 				break;
 			case NT_FLOAT:
 				f2 += i1;
-				pushFloat(f2);
+				pushFloat(context, f2);
 				break;
 			}
 			break;
 		case NT_FLOAT:
 			f1 += giveFloat(token2);
-			pushFloat(f1);
+			pushFloat(context, f1);
 			break;
 		}
 
 		break;
 	case OP_MINUS:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -325,26 +328,26 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				i2 -= i1;
-				pushInteger(i2);
+				pushInteger(context, i2);
 				break;
 			case NT_FLOAT:
 				f2 -= i1;
-				pushFloat(f2);
+				pushFloat(context, f2);
 				break;
 			}
 			break;
 		case NT_FLOAT:
 			f2 = giveFloat(token2) - f1;
-			pushFloat(f2);
+			pushFloat(context, f2);
 			break;
 		}
 
 		break;
 	case OP_MULTIP:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -357,25 +360,25 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				i1 *= i2;
-				pushInteger(i1);
+				pushInteger(context, i1);
 				break;
 			case NT_FLOAT:
 				f2 *= i1;
-				pushFloat(f2);
+				pushFloat(context, f2);
 				break;
 			}
 			break;
 		case NT_FLOAT:
 			f1 *= giveFloat(token2);
-			pushFloat(f1);
+			pushFloat(context, f1);
 			break;
 		}
 		break;
 	case OP_DIV:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -390,11 +393,11 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				f1 = (stutskFloat)i2 / (stutskFloat)i1;
-				pushFloat(f1);
+				pushFloat(context, f1);
 				break;
 			case NT_FLOAT:
 				f2 /= (stutskFloat)i1;
-				pushFloat(f2);
+				pushFloat(context, f2);
 				break;
 			}
 			break;
@@ -402,15 +405,15 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 			if (f1 == 0.)
 				throw StutskException(ET_ERROR, "Division by zero");
 			f2 = giveFloat(token2) / f1;
-			pushFloat(f2);
+			pushFloat(context, f2);
 			break;
 		}
 		break;
 	case OP_DIVINT:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -423,25 +426,25 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				i1 = (stutskInteger)i2 / i1;
-				pushInteger(i1);
+				pushInteger(context, i1);
 				break;
 			case NT_FLOAT:
 				i2 = (stutskInteger)f2 / i1;
-				pushInteger(i2);
+				pushInteger(context, i2);
 				break;
 			}
 			break;
 		case NT_FLOAT:
 			i2 = giveInteger(token2) / (stutskInteger)f1;
-			pushInteger(i2);
+			pushInteger(context, i2);
 			break;
 		}
 		break;
 	case OP_MOD:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
 		switch (giveGCD(token1, f1, i1, s1)) {
 		case NT_STRING:
@@ -454,78 +457,80 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				throw StutskException(ET_ERROR, "Token is not a numeric type");
 			case NT_INTEGER:
 				i1 = (stutskInteger)i2 % i1;
-				pushInteger(i1);
+				pushInteger(context, i1);
 				break;
 			case NT_FLOAT:
 				i2 = (stutskInteger)f2 % i1;
-				pushInteger(i2);
+				pushInteger(context, i2);
 				break;
 			}
 			break;
 		case NT_FLOAT:
 			i2 = giveInteger(token2) % (stutskInteger)f1;
-			pushInteger(i2);
+			pushInteger(context, i2);
 			break;
 		}
 		break;
 	case OP_LESSTHAN:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(tokenNumericCompare(token1, token2) == CN_SMALLER);
+		pushBool(context, tokenNumericCompare(token1, token2) == CN_SMALLER);
 		break;
 	case OP_MORETHAN:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(tokenNumericCompare(token1, token2) == CN_LARGER);
+		pushBool(context, tokenNumericCompare(token1, token2) == CN_LARGER);
 		break;
 	case OP_LESSTHAN_EQ:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(tokenNumericCompare(token1, token2) != CN_LARGER);
+		pushBool(context, tokenNumericCompare(token1, token2) != CN_LARGER);
 		break;
 	case OP_MORETHAN_EQ:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(tokenNumericCompare(token1, token2) != CN_SMALLER);
+		pushBool(context, tokenNumericCompare(token1, token2) != CN_SMALLER);
 		break;
 	case OP_EQ:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(tokenEqual(token1, token2));	
+		pushBool(context, tokenEqual(token1, token2));	
 		break;
 	case OP_SAME:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
-		pushBool(tokenSame(token1, token2));
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
+		recurseVariables(token1);
+		recurseVariables(token2);
+		pushBool(context, tokenSame(token1, token2));
 		break;
 	case OP_NOTEQ:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
 
-		pushBool(!tokenEqual(token1, token2));	
+		pushBool(context, !tokenEqual(token1, token2));	
 		break;
 	case OP_GLOBAL:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Variable
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Variable
 		if (token1.tokenType != T_VARIABLE) {
 			throw StutskException(ET_ERROR, "Token is not a variable");
 		}
@@ -534,8 +539,8 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		break;
 	case OP_AUTO:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Variable
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Variable
 		if (token1.tokenType != T_VARIABLE) {
 			throw StutskException(ET_ERROR, "Token is not a variable");
 		}
@@ -544,8 +549,8 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		break;
 	case OP_STATIC:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Variable
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Variable
 		if (token1.tokenType != T_VARIABLE) {
 			throw StutskException(ET_ERROR, "Token is not a variable");
 		}
@@ -554,8 +559,8 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		break;
 	case OP_FOREVER:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 		recurseVariables(token1);
 		if (token1.tokenType != T_CODEBLOCK) {
 			throw StutskException(ET_ERROR, "Token is not a codeblock");
@@ -563,20 +568,20 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		else {
 			while (true) {
 				context->run(*token1.asTokenList, "forever");
-				if (exitVar == OP_CONTINUE)
-					exitVar = OP_INVALID;
-				if (exitVar != OP_INVALID)
+				if (context->interpreter.exitVar == OP_CONTINUE)
+					context->interpreter.exitVar = OP_INVALID;
+				if (context->interpreter.exitVar != OP_INVALID)
 					break;
 			}
-			if (exitVar == OP_BREAK)
-				exitVar = OP_INVALID;
+			if (context->interpreter.exitVar == OP_BREAK)
+				context->interpreter.exitVar = OP_INVALID;
 		}
 		break;
 	case OP_FOREACH:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token1);
 		if (token1.tokenType != T_CODEBLOCK)
@@ -586,31 +591,44 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		if (token2.tokenType == T_ARRAY) {
 			for (TokenList::const_iterator it = token2.asTokenList->begin();
 				it != token2.asTokenList->end(); ++it) {
-					stutskStack.push_back(*it);
+					context->stack.push_back(*it);
 					stringstream ss;
 					ss << "foreach [" << 
 						std::distance(token2.asTokenList->cbegin(), it) << "]";
 					context->run(*token1.asTokenList, ss.str());
-					if (exitVar == OP_CONTINUE)
-						exitVar = OP_INVALID;
-					if (exitVar != OP_INVALID)
+					if (context->interpreter.exitVar == OP_CONTINUE)
+						context->interpreter.exitVar = OP_INVALID;
+					if (context->interpreter.exitVar != OP_INVALID)
 						break;
 			}
 		}
 		else
 			if (token2.tokenType == T_DICTIONARY) {
-				for (TokenMap::const_iterator it = token2.asDictionary->begin();
+				for (TokenDictionary::const_iterator it = token2.asDictionary->begin();
 					it != token2.asDictionary->end(); ++it) {
-						stutskStack.push_back(it->second);
-						StringPtr f = pushString();
-						*f =  it->first;
+						context->stack.push_back(it->value);
+						context->stack.push_back(it->key.toToken());
+
+						stringstream ss;
+						ss << "foreach [" << it->key.toString() << "]";
+						context->run(*token1.asTokenList, ss.str());
+						if (context->interpreter.exitVar == OP_CONTINUE)
+							context->interpreter.exitVar = OP_INVALID;
+						if (context->interpreter.exitVar != OP_INVALID)
+							break;
+				}
+			}
+			else if (token2.tokenType == T_SET) {
+				for (TokenSet::const_iterator it = token2.asSet->begin();
+					it != token2.asSet->end(); ++it) {
+						context->stack.push_back(it->key.toToken());
 
 						stringstream ss;
-						ss << "foreach [" << it->first << "]";
+						ss << "foreach [" << it->key.toString() << "]";
 						context->run(*token1.asTokenList, ss.str());
-						if (exitVar == OP_CONTINUE)
-							exitVar = OP_INVALID;
-						if (exitVar != OP_INVALID)
+						if (context->interpreter.exitVar == OP_CONTINUE)
+							context->interpreter.exitVar = OP_INVALID;
+						if (context->interpreter.exitVar != OP_INVALID)
 							break;
 				}
 			}
@@ -618,27 +636,27 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 			{
 				StringPtr s1_ptr = giveString(token2);
 				for (int i = 0; i < (signed)s1_ptr->length(); i++) {
-					*pushString() = (*s1_ptr)[i];
+					*pushString(context) = (*s1_ptr)[i];
 					stringstream ss;
 					ss << "foreach [" << i << "]";
 					context->run(*token1.asTokenList, ss.str());
-					if (exitVar == OP_CONTINUE)
-						exitVar = OP_INVALID;
-					if (exitVar != OP_INVALID)
+					if (context->interpreter.exitVar == OP_CONTINUE)
+						context->interpreter.exitVar = OP_INVALID;
+					if (context->interpreter.exitVar != OP_INVALID)
 						break;
 				}
 			}
 
-			if (exitVar == OP_BREAK)
-				exitVar = OP_INVALID;
+			if (context->interpreter.exitVar == OP_BREAK)
+				context->interpreter.exitVar = OP_INVALID;
 			break;
 
 	case OP_REPEAT:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		i1 = giveInteger(token2);
 		recurseVariables(token1);
@@ -651,21 +669,21 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				stringstream ss;
 				ss << "repeat [" << i1 << "]";
 				context->run(*token1.asTokenList, ss.str());
-				if (exitVar == OP_CONTINUE)
-					exitVar = OP_INVALID;
-				if (exitVar != OP_INVALID)
+				if (context->interpreter.exitVar == OP_CONTINUE)
+					context->interpreter.exitVar = OP_INVALID;
+				if (context->interpreter.exitVar != OP_INVALID)
 					break;
 				i1--;
 			}
-			if (exitVar == OP_BREAK)
-				exitVar = OP_INVALID;
+			if (context->interpreter.exitVar == OP_BREAK)
+				context->interpreter.exitVar = OP_INVALID;
 		}
 		break;
 	case OP_TRY:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 		recurseVariables(token1);
 		recurseVariables(token2);
 		if ((token2.tokenType != T_CODEBLOCK) ||
@@ -677,59 +695,59 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 				context->run(*token2.asTokenList, "try");
 			}
 			catch (StutskException &e) {
-				*pushString() = e.getMessage();
-				pushInteger(e.getLineNumber());
-				*pushString() = e.getFileName();
+				*pushString(context) = e.getMessage();
+				pushInteger(context, e.getLineNumber());
+				*pushString(context) = e.getFileName();
 
 				context->run(*token1.asTokenList, "try");
 			}
 			catch (std::exception &e) {
-				*pushString() = e.what();
-				pushInteger(errorToken.lineNum);
-				*pushString() = ParseContext::get_by_id(errorToken.context_id).FileName;
+				*pushString(context) = e.what();
+				pushInteger(context, context->interpreter.errorToken.lineNum);
+				*pushString(context) = context->interpreter.parseContext(context->interpreter.errorToken.context_id).FileName;
 
 				context->run(*token1.asTokenList, "try");
 			}
 		}
 		break;
 	case OP_POWER:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 		f1 = pow(giveFloat(token2), giveFloat(token1));
-		pushFloat(f1);
+		pushFloat(context, f1);
 
 		break;
 	case OP_THROW:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Error name
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Error name
 		throw StutskException(ET_CUSTOM, *giveString(token1));
 		break;
 	case OP_NOT:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		pushBool(!giveBool(token1));
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		pushBool(context, !giveBool(token1));
 		break;
 	case OP_AND:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
-		pushBool(giveBool(token1) && giveBool(token2));
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
+		pushBool(context, giveBool(token1) && giveBool(token2));
 		break;
 	case OP_OR:
-		token1 = stack_back_safe();
-		stutskStack.pop_back();
-		token2 = stack_back_safe();
-		stutskStack.pop_back();
-		pushBool(giveBool(token1) || giveBool(token2));
+		token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		token2 = stack_back_safe(context);
+		context->stack.pop_back();
+		pushBool(context, giveBool(token1) || giveBool(token2));
 		break;
 	case OP_IF:
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token2);
 
@@ -743,12 +761,12 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		break;
 	case OP_IFELSE:
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token3 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token3 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token2);
 		recurseVariables(token3);
@@ -767,20 +785,20 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		break;
 	case OP_TERNARY:
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token3 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token3 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
-		stutskStack.push_back((giveBool(token1) ? token3 : token2));
+		context->stack.push_back((giveBool(token1) ? token3 : token2));
 		break;
 	case OP_CONCAT:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		// Be careful NOT to recurse variable here because we wouldn't want
 		// to overwrite the saved value.
@@ -788,19 +806,19 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		if (token2.tokenType == T_STRING) // Performance optimization
 		{
 			token2.asString->append(*giveString(token1));
-			stutskStack.push_back(token2);
+			context->stack.push_back(token2);
 		}
 		else
 			// Should be fast enough ...	
-			*pushString() = *giveString(token2) + 
+			*pushString(context) = *giveString(token2) + 
 			*giveString(token1);
 
 		break;
 	case OP_SWITCH:
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token2);
 
@@ -834,13 +852,13 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 	case OP_CONTINUE:
 	case OP_HALT:
 	case OP_EXIT:
-		exitVar = oper;
+		context->interpreter.exitVar = oper;
 		break;
 	case OP_ARRAY:
-		token1 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
-		token2 = stack_back_safe();
-		stutskStack.pop_back(); // Codeblock
+		token1 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
+		token2 = stack_back_safe(context);
+		context->stack.pop_back(); // Codeblock
 
 		recurseVariables(token1);
 
@@ -852,7 +870,7 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 			}
 			else
 				token2.index.push_back(giveInteger(token1));
-			stutskStack.push_back(token2);
+			context->stack.push_back(token2);
 		}
 		else if (token2.tokenType == T_ARRAY) {
 			if (token1.tokenType == T_ARRAY) {
@@ -867,14 +885,14 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 						else
 							throw StutskException(ET_ERROR, "Array index overflow");
 				}
-				stutskStack.push_back(token2);
+				context->stack.push_back(token2);
 			}
 			else {
 				i1 = giveInteger(token1);
 				if (i1 < 0)
 					throw StutskException(ET_ERROR, "Array index underflow");
 				if ((signed)token2.asTokenList->size() >= i1 + 1) {
-					stutskStack.push_back((*token2.asTokenList)[i1]);
+					context->stack.push_back((*token2.asTokenList)[i1]);
 				}
 				else
 					throw StutskException(ET_ERROR, "Array index overflow");
@@ -882,11 +900,11 @@ void Operators::doOperator(Context *context, OperatorType oper) {
 		}
 		else {
 			i1 = giveInteger(token1);
-			StringPtr s1_ptr = giveString(token2);
+			StringRef s1(token2);
 			if (i1 < 0)
 				throw StutskException(ET_ERROR, "String index underflow");
-			if ((signed)s1_ptr->length() >= i1 + 1) {
-				*pushString() = (*s1_ptr)[i1];
+			if ((signed)s1.size >= i1 + 1) {
+				*pushString(context) = s1.data[i1];
 			}
 			else
 				throw StutskException(ET_ERROR, "String index overflow");
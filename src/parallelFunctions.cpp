@@ -0,0 +1,965 @@
+/*
+parallelFunctions.cpp - Stutsk functions that run code on several threads are implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <builtinFunctions.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <iostream>
+#include <list>
+
+#ifdef FORK_CAPABLE
+#include <unistd.h>
+#endif
+
+/* WorkerPool - the worker threads of the parallel array functions, started on the first job
+     of an interpreter and kept for the following ones. Every worker runs in an Interpreter of
+	 its own, created from the caller's on its first job. Before each later job, it copies the
+	 user functions again only if they have been changed since (see functionsGeneration), and
+	 of the parse contexts only those that have been added. The calling thread takes part in
+	 every job as worker 0, so the pool starts one thread fewer than it has workers. */
+class WorkerPool : boost::noncopyable {
+public:
+	typedef boost::function<void (size_t)> Task;
+
+	WorkerPool(Interpreter& parent, size_t size);
+	~WorkerPool();
+
+	size_t size() const { return workers_.size(); }
+#ifdef FORK_CAPABLE
+	pid_t owner() const { return owner_; }
+#endif
+
+	// Runs `task` with the index of each of the first `count` workers and waits for all of them
+	void run(const Task& task, size_t count);
+	// Returns the interpreter of `worker`, brought up to date with the caller's
+	Interpreter& prepare(size_t worker);
+
+private:
+	struct Worker {
+		boost::scoped_ptr<Interpreter> interpreter;
+		unsigned long parentGeneration; // of the caller's functions when they were copied
+		unsigned long ownGeneration;    // of the worker's functions right after that
+		size_t parseContexts;           // how many of the caller's parse contexts it has
+	};
+
+	Interpreter& parent_;
+	vector<boost::shared_ptr<Worker> > workers_;
+	vector<boost::shared_ptr<boost::thread> > threads_;
+#ifdef FORK_CAPABLE
+	pid_t owner_;
+#endif
+
+	boost::mutex mutex_;
+	boost::condition_variable wake_;
+	boost::condition_variable done_;
+	const Task* task_;
+	size_t count_;
+	size_t remaining_;
+	unsigned long jobs_;
+	bool stopping_;
+
+	void loop(size_t worker);
+	void stop();
+};
+
+WorkerPool::WorkerPool(Interpreter& parent, size_t size) : parent_(parent), task_(NULL),
+	count_(0), remaining_(0), jobs_(0), stopping_(false)
+{
+#ifdef FORK_CAPABLE
+	owner_ = getpid();
+#endif
+	for (size_t worker = 0; worker < size; ++worker)
+		workers_.push_back(boost::shared_ptr<Worker>(new Worker()));
+
+	try {
+		for (size_t worker = 1; worker < size; ++worker)
+			threads_.push_back(boost::shared_ptr<boost::thread>(
+				new boost::thread(boost::bind(&WorkerPool::loop, this, worker))));
+	}
+	catch (...) {
+		stop();
+		throw;
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::stop()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	for (size_t i = 0; i < threads_.size(); ++i)
+		threads_[i]->join();
+}
+
+void WorkerPool::loop(size_t worker)
+{
+	unsigned long seen = 0;
+	boost::unique_lock<boost::mutex> lock(mutex_);
+	for (;;) {
+		while (!stopping_ && jobs_ == seen)
+			wake_.wait(lock);
+		if (stopping_)
+			return;
+		seen = jobs_;
+		if (worker >= count_)
+			continue;
+
+		const Task* task = task_;
+		lock.unlock();
+		(*task)(worker);
+		lock.lock();
+		if (--remaining_ == 0)
+			done_.notify_all();
+	}
+}
+
+void WorkerPool::run(const Task& task, size_t count)
+{
+	count = std::max<size_t>(1, std::min(count, workers_.size()));
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		task_ = &task;
+		count_ = count;
+		remaining_ = count - 1;
+		++jobs_;
+	}
+	wake_.notify_all();
+
+	task(0);
+
+	boost::unique_lock<boost::mutex> lock(mutex_);
+	while (remaining_ > 0)
+		done_.wait(lock);
+	task_ = NULL;
+}
+
+/* Runs on the worker's thread while the caller waits for the job, so the caller's interpreter
+     does not change in the meantime. */
+Interpreter& WorkerPool::prepare(size_t worker)
+{
+	Worker& state = *workers_[worker];
+	if (!state.interpreter) {
+		state.interpreter.reset(new Interpreter(parent_));
+		state.parentGeneration = parent_.functionsGeneration;
+	}
+	else {
+		Interpreter& interpreter = *state.interpreter;
+
+		// Parse contexts are only ever appended. Those the previous job added itself (with eval
+		// or include) are dropped, as the ones the caller added since take their ids.
+		interpreter.parseContexts.resize(state.parseContexts);
+		for (size_t id = state.parseContexts; id < parent_.parseContexts.size(); ++id)
+			interpreter.parseContexts.push_back(parent_.parseContexts[id]);
+
+		// Functions the previous job defined itself are discarded as well
+		if (state.parentGeneration != parent_.functionsGeneration ||
+			state.ownGeneration != interpreter.functionsGeneration) {
+				interpreter.userFunctions = parent_.userFunctions;
+				++interpreter.functionsGeneration;
+				state.parentGeneration = parent_.functionsGeneration;
+		}
+
+		interpreter.stack.clear();
+		interpreter.exitVar = OP_INVALID;
+	}
+
+	state.ownGeneration = state.interpreter->functionsGeneration;
+	state.parseContexts = state.interpreter->parseContexts.size();
+	return *state.interpreter;
+}
+
+namespace BuiltIns {
+
+	namespace {
+		// Number of chunks dealt to each worker, so that idle workers have something to steal
+		const size_t CHUNKS_PER_WORKER = 8;
+
+		enum ParallelMode { PM_MAP, PM_FILTER, PM_REDUCE };
+
+		/* In a forked child the threads of a pool do not exist, and they may have held its mutex
+		     or waited on its condition variables, so a pool inherited through fork is left alone
+			 rather than destroyed. */
+		void destroyWorkerPool(WorkerPool* pool)
+		{
+#ifdef FORK_CAPABLE
+			if (pool->owner() != getpid())
+				return;
+#endif
+			delete pool;
+		}
+
+		WorkerPool& workerPool(Interpreter& interpreter)
+		{
+#ifdef FORK_CAPABLE
+			if (interpreter.workerPool && interpreter.workerPool->owner() != getpid())
+				interpreter.workerPool.reset();
+#endif
+			if (!interpreter.workerPool)
+				interpreter.workerPool.reset(new WorkerPool(interpreter, std::max(1u, workerThreads)),
+					destroyWorkerPool);
+			return *interpreter.workerPool;
+		}
+
+		/* ParallelJob - applies a codeblock to the elements of an array on the worker pool of the
+		     caller's interpreter. The array is split into chunks which are dealt round-robin to
+			 per-worker queues. Workers take chunks from the front of their own queue and, once it
+			 is empty, steal from the back of the others'.
+			 Every worker runs in its own Interpreter with a copy of the user functions (and the parse
+			 contexts, for error messages), so the codeblock can call functions but cannot see the
+			 variables or the stack of the caller. */
+		class ParallelJob {
+		public:
+			ParallelJob(Context* context, const TokenList& items, const TokenList& codeblock,
+				ParallelMode mode);
+
+			void run();
+
+			TokenList results;      // PM_MAP: one per item, PM_REDUCE: one per chunk
+			vector<char> selected;  // PM_FILTER: one per item
+
+		private:
+			struct WorkQueue {
+				boost::mutex mutex;
+				deque<size_t> chunks;
+			};
+
+			Context* context_;
+			WorkerPool& pool_;
+			const TokenList& items_;
+			const TokenList& codeblock_;
+			ParallelMode mode_;
+
+			vector<size_t> bounds_;
+			vector<boost::shared_ptr<WorkQueue> > queues_;
+
+			boost::mutex errorMutex_;
+			bool failed_;
+			StutskException error_;
+			size_t errorParseContext_;
+
+			void work(size_t worker);
+			bool takeChunk(size_t worker, size_t& chunk);
+			void runChunk(Context& workerContext, size_t chunk);
+			Token apply(Context& workerContext);
+			void fail(const StutskException& e);
+			bool failed();
+		};
+
+		ParallelJob::ParallelJob(Context* context, const TokenList& items, const TokenList& codeblock,
+			ParallelMode mode) : context_(context), pool_(workerPool(context->interpreter)),
+			items_(items), codeblock_(codeblock), mode_(mode), failed_(false), error_(ET_ERROR, ""),
+			errorParseContext_(0)
+		{
+			size_t workers = pool_.size();
+			size_t chunks = std::min(items.size(), workers * CHUNKS_PER_WORKER);
+			workers = std::min(workers, chunks);
+
+			bounds_.resize(chunks + 1);
+			for (size_t chunk = 0; chunk <= chunks; ++chunk)
+				bounds_[chunk] = items.size() * chunk / chunks;
+
+			for (size_t worker = 0; worker < workers; ++worker)
+				queues_.push_back(boost::shared_ptr<WorkQueue>(new WorkQueue()));
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+				queues_[chunk % workers]->chunks.push_back(chunk);
+
+			switch (mode) {
+			case PM_MAP: results.resize(items.size()); break;
+			case PM_FILTER: selected.resize(items.size()); break;
+			case PM_REDUCE: results.resize(chunks); break;
+			}
+		}
+
+		void ParallelJob::run()
+		{
+			pool_.run(boost::bind(&ParallelJob::work, this, _1), queues_.size());
+
+			if (failed_) {
+				// Relocate the error to the caller's copy of the parse context it refers to
+				if (error_.hasLocation())
+					error_.setLocation(error_.getLineNumber(),
+						errorParseContext_ < context_->interpreter.parseContexts.size() ?
+						&context_->interpreter.parseContext(errorParseContext_) : NULL);
+				throw error_;
+			}
+		}
+
+		void ParallelJob::work(size_t worker)
+		{
+			try {
+				Interpreter& interpreter = pool_.prepare(worker);
+				Context workerContext(codeblock_, interpreter);
+				workerContext.functionName = "<parallel worker>";
+				interpreter.mainContext = &workerContext;
+
+				try {
+					size_t chunk;
+					while (!failed() && takeChunk(worker, chunk))
+						runChunk(workerContext, chunk);
+				}
+				catch (...) {
+					interpreter.mainContext = NULL;
+					throw;
+				}
+				interpreter.mainContext = NULL;
+			}
+			catch (const StutskException& e) {
+				fail(e);
+			}
+			catch (const std::exception& e) {
+				fail(StutskException(ET_SYSTEM, e.what()));
+			}
+		}
+
+		bool ParallelJob::takeChunk(size_t worker, size_t& chunk)
+		{
+			for (size_t i = 0; i < queues_.size(); ++i) {
+				WorkQueue& queue = *queues_[(worker + i) % queues_.size()];
+				boost::mutex::scoped_lock lock(queue.mutex);
+				if (queue.chunks.empty())
+					continue;
+				if (i == 0) {
+					chunk = queue.chunks.front();
+					queue.chunks.pop_front();
+				}
+				else {
+					chunk = queue.chunks.back();
+					queue.chunks.pop_back();
+				}
+				return true;
+			}
+			return false;
+		}
+
+		void ParallelJob::runChunk(Context& workerContext, size_t chunk)
+		{
+			TokenStack& stack = workerContext.stack;
+
+			for (size_t i = bounds_[chunk]; i < bounds_[chunk + 1]; ++i) {
+				// Items are copied, so that workers never modify the caller's strings and arrays
+				Token item = copy_token(items_[i]);
+
+				switch (mode_) {
+				case PM_MAP:
+					stack.push_back(item);
+					results[i] = apply(workerContext);
+					break;
+				case PM_FILTER:
+					stack.push_back(item);
+					selected[i] = giveBool(apply(workerContext));
+					break;
+				case PM_REDUCE:
+					if (i == bounds_[chunk])
+						results[chunk] = item;
+					else {
+						stack.push_back(results[chunk]);
+						stack.push_back(item);
+						results[chunk] = apply(workerContext);
+					}
+					break;
+				}
+			}
+		}
+
+		// Runs the codeblock on the arguments on the worker's stack and returns its result
+		Token ParallelJob::apply(Context& workerContext)
+		{
+			Interpreter& interpreter = workerContext.interpreter;
+
+			Context callContext(codeblock_, &workerContext);
+			callContext.functionName = "<anonymous function>";
+			callContext.run(codeblock_, "parallel");
+
+			if (interpreter.exitVar == OP_EXIT)
+				interpreter.exitVar = OP_INVALID;
+			else if (interpreter.exitVar != OP_INVALID)
+				throw StutskException(ET_ERROR, "Cannot break out of a parallel codeblock");
+
+			Token result = stack_back_safe(&workerContext);
+			recurseVariables(result);
+			interpreter.stack.clear();
+			return result;
+		}
+
+		void ParallelJob::fail(const StutskException& e)
+		{
+			boost::mutex::scoped_lock lock(errorMutex_);
+			if (failed_)
+				return;
+			failed_ = true;
+			error_ = e;
+			if (e.hasLocation())
+				errorParseContext_ = e.getParseContext()->id();
+		}
+
+		bool ParallelJob::failed()
+		{
+			boost::mutex::scoped_lock lock(errorMutex_);
+			return failed_;
+		}
+
+		// Pops the codeblock and the array arguments common to all parallel array functions
+		void popParallelArguments(Context* context, Token& array, Token& codeblock)
+		{
+			codeblock = stack_back_safe(context);
+			context->stack.pop_back();
+			array = stack_back_safe(context);
+			context->stack.pop_back();
+
+			recurseVariables(codeblock);
+			if (codeblock.tokenType != T_CODEBLOCK)
+				throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+			recurseVariables(array);
+			if (array.tokenType != T_ARRAY)
+				throw StutskException(ET_ERROR, "Token is not an array");
+
+			// Variables are dereferenced here, as workers must not touch the caller's contexts
+			for (TokenList::const_iterator it = array.asTokenList->begin(); it != array.asTokenList->end(); ++it)
+				if (it->tokenType == T_VARIABLE) {
+					TokenListPtr items(new TokenList(*array.asTokenList));
+					for (TokenList::iterator item = items->begin(); item != items->end(); ++item)
+						recurseVariables(*item);
+					array.asTokenList = items;
+					break;
+				}
+		}
+	}
+
+	void _f_array_parallel_map(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> <T_CODEBLOCK func> array_parallel_map
+		   returnvalue: <T_ARRAY>
+		   description: Returns a new array with `func` applied to every element of `array1`, like
+		     array_perform, but with the elements processed on several threads (see --threads).
+			 `func` should take one argument and return one argument.
+		   notes: `func` runs in a separate interpreter - it can call user-defined functions,
+		     but cannot access the variables of the caller, and it has its own stack. Elements are
+			 passed as copies, but dictionaries and sets are shared, so `func` must not modify them.
+			 The threads and their interpreters are started by the first call and kept for later ones.
+		*/
+		Token array, codeblock;
+		popParallelArguments(context, array, codeblock);
+
+		Token newArray(T_ARRAY);
+		newArray.asTokenList = TokenListPtr(new TokenList());
+
+		if (!array.asTokenList->empty()) {
+			ParallelJob job(context, *array.asTokenList, *codeblock.asTokenList, PM_MAP);
+			job.run();
+			newArray.asTokenList->swap(job.results);
+		}
+
+		context->stack.push_back(newArray);
+	}
+
+	void _f_array_parallel_filter(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> <T_CODEBLOCK func> array_parallel_filter
+		   returnvalue: <T_ARRAY>
+		   description: Returns a new array with the elements of `array1` for which `func`
+		     returns TRUE, in their original order. `func` is evaluated on several threads.
+		   notes: See array_parallel_map.
+		*/
+		Token array, codeblock;
+		popParallelArguments(context, array, codeblock);
+
+		Token newArray(T_ARRAY);
+		newArray.asTokenList = TokenListPtr(new TokenList());
+
+		if (!array.asTokenList->empty()) {
+			ParallelJob job(context, *array.asTokenList, *codeblock.asTokenList, PM_FILTER);
+			job.run();
+			for (size_t i = 0; i < job.selected.size(); ++i)
+				if (job.selected[i])
+					newArray.asTokenList->push_back((*array.asTokenList)[i]);
+		}
+
+		context->stack.push_back(newArray);
+	}
+
+	void _f_array_parallel_reduce(Context* context)
+	{
+		/* arguments: <T_ARRAY array1> <T_CODEBLOCK func> array_parallel_reduce
+		   returnvalue: <result>
+		   description: Combines the elements of `array1` into a single value with `func`, which
+		     takes two arguments (the accumulated value and the next element) and returns one.
+			 Chunks of the array are reduced on several threads and their results are then
+			 combined in order, so `func` must be associative, like addition or concatenation.
+		   notes: The array must not be empty. See also array_parallel_map.
+		*/
+		Token array, codeblock;
+		popParallelArguments(context, array, codeblock);
+
+		if (array.asTokenList->empty())
+			throw StutskException(ET_ERROR, "Cannot reduce an empty array");
+
+		ParallelJob job(context, *array.asTokenList, *codeblock.asTokenList, PM_REDUCE);
+		job.run();
+
+		Token result = job.results.front();
+		for (TokenList::iterator it = job.results.begin() + 1; it != job.results.end(); ++it) {
+			context->stack.push_back(result);
+			context->stack.push_back(*it);
+
+			Context callContext(*codeblock.asTokenList, context);
+			callContext.functionName = "<anonymous function>";
+			callContext.run(*codeblock.asTokenList, "array_parallel_reduce");
+			if (context->interpreter.exitVar == OP_EXIT)
+				context->interpreter.exitVar = OP_INVALID;
+
+			result = stack_back_safe(context);
+			context->stack.pop_back();
+			recurseVariables(result);
+		}
+
+		context->stack.push_back(result);
+	}
+
+	namespace {
+		/* transferToken - prepares a token to be handed over to another interpreter. Strings,
+		     arrays and sets that are only referenced by `token` are handed over as they are, shared
+			 ones are copied, so that the two interpreters never share mutable objects. Dictionaries
+			 are always copied, as their values have to be transferred too. Variables are replaced
+			 by their values. */
+		void transferToken(Token& token)
+		{
+			recurseVariables(token);
+
+			switch (token.tokenType) {
+			case T_STRING:
+				if (!token.asString.unique())
+					token.asString = StringPtr(new string(*token.asString));
+				break;
+			case T_ARRAY:
+				if (!token.asTokenList.unique())
+					token.asTokenList = TokenListPtr(new TokenList(*token.asTokenList));
+				for (TokenList::iterator it = token.asTokenList->begin(); it != token.asTokenList->end(); ++it)
+					transferToken(*it);
+				break;
+			case T_DICTIONARY: {
+				TokenDictionaryPtr dictionary(new TokenDictionary());
+				dictionary->reserve(token.asDictionary->size());
+				for (TokenDictionary::const_iterator it = token.asDictionary->begin();
+					it != token.asDictionary->end(); ++it) {
+						Token value = it->value;
+						transferToken(value);
+						(*dictionary)[it->key] = value;
+				}
+				token.asDictionary = dictionary;
+				} break;
+			case T_SET:
+				if (!token.asSet.unique())
+					token.asSet = TokenSetPtr(new TokenSet(*token.asSet));
+				break;
+			default: ;
+			}
+		}
+
+		/* Channel - a bounded multi-producer multi-consumer queue of tokens. The queue is a lock-free
+		     ring buffer in which every cell carries a sequence number that tells whether the cell is
+			 ready to be written or read in the current lap around the buffer. The mutex and the
+			 condition variable are only used to put threads to sleep while the channel is full
+			 (or empty) and are not touched at all when nobody is sleeping. */
+		class Channel : boost::noncopyable {
+		public:
+			explicit Channel(size_t capacity);
+
+			bool trySend(Token& value);
+			void send(Token& value);
+			bool tryReceive(Token& value);
+			bool receive(Token& value);
+			void close();
+
+		private:
+			struct Cell {
+				boost::atomic<size_t> sequence;
+				Token value;
+			};
+
+			boost::scoped_array<Cell> cells_;
+			size_t mask_;
+			boost::atomic<size_t> sendPosition_;
+			boost::atomic<size_t> receivePosition_;
+			boost::atomic<bool> closed_;
+
+			boost::atomic<int> sleepers_;
+			boost::mutex mutex_;
+			boost::condition_variable changed_;
+
+			bool push(Token& value);
+			bool pop(Token& value);
+			void wakeSleepers();
+		};
+
+		Channel::Channel(size_t capacity) : mask_(1), sendPosition_(0), receivePosition_(0),
+			closed_(false), sleepers_(0)
+		{
+			// The capacity is rounded up to a power of two, so that positions can be masked
+			while (mask_ + 1 < capacity)
+				mask_ = (mask_ << 1) | 1;
+
+			cells_.reset(new Cell[mask_ + 1]);
+			for (size_t i = 0; i <= mask_; ++i)
+				cells_[i].sequence.store(i, boost::memory_order_relaxed);
+		}
+
+		bool Channel::push(Token& value)
+		{
+			size_t position = sendPosition_.load(boost::memory_order_relaxed);
+			for (;;) {
+				Cell& cell = cells_[position & mask_];
+				size_t sequence = cell.sequence.load(boost::memory_order_acquire);
+				ptrdiff_t lap = (ptrdiff_t)(sequence - position);
+
+				if (lap == 0) {
+					if (sendPosition_.compare_exchange_weak(position, position + 1,
+						boost::memory_order_relaxed)) {
+							std::swap(cell.value, value);
+							cell.sequence.store(position + 1, boost::memory_order_release);
+							return true;
+					}
+				}
+				else if (lap < 0)
+					return false; // The cell has not been read since the previous lap - full
+				else
+					position = sendPosition_.load(boost::memory_order_relaxed);
+			}
+		}
+
+		bool Channel::pop(Token& value)
+		{
+			size_t position = receivePosition_.load(boost::memory_order_relaxed);
+			for (;;) {
+				Cell& cell = cells_[position & mask_];
+				size_t sequence = cell.sequence.load(boost::memory_order_acquire);
+				ptrdiff_t lap = (ptrdiff_t)(sequence - (position + 1));
+
+				if (lap == 0) {
+					if (receivePosition_.compare_exchange_weak(position, position + 1,
+						boost::memory_order_relaxed)) {
+							value = Token();
+							std::swap(cell.value, value);
+							cell.sequence.store(position + mask_ + 1, boost::memory_order_release);
+							return true;
+					}
+				}
+				else if (lap < 0)
+					return false; // The cell has not been written in this lap yet - empty
+				else
+					position = receivePosition_.load(boost::memory_order_relaxed);
+			}
+		}
+
+		void Channel::wakeSleepers()
+		{
+			// Pairs with the fence in send/receive, so either the sleeper sees our change or we see it
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			if (sleepers_.load(boost::memory_order_relaxed) > 0) {
+				boost::lock_guard<boost::mutex> lock(mutex_);
+				changed_.notify_all();
+			}
+		}
+
+		bool Channel::trySend(Token& value)
+		{
+			if (closed_)
+				throw StutskException(ET_ERROR, "Channel is closed");
+			if (!push(value))
+				return false;
+			wakeSleepers();
+			return true;
+		}
+
+		void Channel::send(Token& value)
+		{
+			if (trySend(value))
+				return;
+
+			bool sent = false;
+			{
+				boost::unique_lock<boost::mutex> lock(mutex_);
+				++sleepers_;
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+				while (!closed_ && !(sent = push(value)))
+					changed_.wait(lock);
+				--sleepers_;
+			}
+
+			if (!sent)
+				throw StutskException(ET_ERROR, "Channel is closed");
+			wakeSleepers();
+		}
+
+		bool Channel::tryReceive(Token& value)
+		{
+			if (!pop(value))
+				return false;
+			wakeSleepers();
+			return true;
+		}
+
+		bool Channel::receive(Token& value)
+		{
+			if (tryReceive(value))
+				return true;
+
+			bool received = false;
+			{
+				boost::unique_lock<boost::mutex> lock(mutex_);
+				++sleepers_;
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+				for (;;) {
+					if ((received = pop(value)))
+						break;
+					if (closed_) {
+						// Values sent before the channel was closed are still delivered
+						received = pop(value);
+						break;
+					}
+					changed_.wait(lock);
+				}
+				--sleepers_;
+			}
+
+			if (received)
+				wakeSleepers();
+			return received;
+		}
+
+		void Channel::close()
+		{
+			closed_ = true;
+			boost::lock_guard<boost::mutex> lock(mutex_);
+			changed_.notify_all();
+		}
+
+		Channel* popChannel(Context* context)
+		{
+			Token token = stack_back_safe(context);
+			context->stack.pop_back();
+
+			recurseVariables(token);
+			if (token.tokenType != T_HANDLE)
+				throw StutskException(ET_ERROR, "Token is not a handle");
+			if (token.data.asHandle.size != sizeof(Channel))
+				throw StutskException(ET_ERROR, "Invalid channel handle");
+
+			return static_cast<Channel*>(token.data.asHandle.ptr);
+		}
+
+		// Workers started by spawn, joined before the interpreter exits
+		boost::mutex spawnedMutex;
+		list<boost::shared_ptr<boost::thread> > spawnedWorkers;
+
+		// Channels are shared by raw handles, so they are only freed once all the workers are gone
+		boost::mutex channelsMutex;
+		vector<boost::shared_ptr<Channel> > channels;
+
+		void runSpawned(boost::shared_ptr<Interpreter> interpreter, TokenListPtr arguments, 
+			TokenListPtr codeblock)
+		{
+			try {
+				interpreter->stack.insert(interpreter->stack.end(), arguments->begin(), arguments->end());
+				arguments.reset();
+				interpreter->execute(*codeblock);
+			}
+			catch (const StutskException& e) {
+				cerr << e.getFormattedMessage();
+			}
+			catch (const std::exception& e) {
+				cerr << e.what() << "\n";
+			}
+		}
+	}
+
+	void joinSpawnedWorkers(bool closeChannels)
+	{
+		// Otherwise workers that wait for the main program would never finish
+		if (closeChannels) {
+			boost::mutex::scoped_lock lock(channelsMutex);
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->close();
+		}
+
+		for (;;) {
+			boost::shared_ptr<boost::thread> worker;
+			{
+				boost::mutex::scoped_lock lock(spawnedMutex);
+				if (spawnedWorkers.empty())
+					break;
+				worker = spawnedWorkers.front();
+				spawnedWorkers.pop_front();
+			}
+			worker->join();
+		}
+
+		boost::mutex::scoped_lock lock(channelsMutex);
+		channels.clear();
+	}
+
+	void _f_spawn(Context* context)
+	{
+		/* arguments: <T_ARRAY arguments> <T_CODEBLOCK func> spawn
+		   returnvalue: 
+		   description: Runs `func` in a new interpreter on a separate thread, with the elements
+		     of `arguments` on its stack. The new interpreter starts with the user-defined functions
+			 of the current one, but shares no variables with it - use channels to communicate.
+		   notes: Arguments are transferred like values sent over a channel. The program does not
+		     exit until all spawned workers have finished. If it stops because of an error, all the
+			 channels are closed first, so that workers waiting on them can finish. Errors in a worker
+			 are printed, but do not stop the rest of the program.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		recurseVariables(token1);
+		if (token1.tokenType != T_CODEBLOCK)
+			throw StutskException(ET_ERROR, "Token is not a codeblock");
+
+		recurseVariables(token2);
+		if (token2.tokenType != T_ARRAY)
+			throw StutskException(ET_ERROR, "Token is not an array");
+		transferToken(token2);
+
+		boost::shared_ptr<Interpreter> interpreter(new Interpreter(context->interpreter));
+		boost::shared_ptr<boost::thread> worker(new boost::thread(
+			boost::bind(&runSpawned, interpreter, token2.asTokenList, token1.asTokenList)));
+
+		boost::mutex::scoped_lock lock(spawnedMutex);
+		// Workers that have finished are released here rather than when the program exits
+		for (list<boost::shared_ptr<boost::thread> >::iterator it = spawnedWorkers.begin(); it != spawnedWorkers.end(); )
+			if ((*it)->try_join_for(boost::chrono::milliseconds(0)))
+				it = spawnedWorkers.erase(it);
+			else
+				++it;
+		spawnedWorkers.push_back(worker);
+	}
+
+	void _f_channel_new(Context* context)
+	{
+		/* arguments: <T_INTEGER capacity> channel_new
+		   returnvalue: <T_HANDLE channel>
+		   description: Creates a channel that can hold up to `capacity` values. Channels can
+		     be used by any number of senders and receivers in different interpreters (see spawn).
+		   notes: The capacity is rounded up to a power of two. Channels are only freed when the
+		     program exits, so they should be created up front rather than per message.
+		*/
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		stutskInteger capacity = giveInteger(token1);
+		if (capacity < 1)
+			throw StutskException(ET_ERROR, "Channel capacity must be positive");
+
+		boost::shared_ptr<Channel> channel(new Channel((size_t)capacity));
+		{
+			boost::mutex::scoped_lock lock(channelsMutex);
+			channels.push_back(channel);
+		}
+
+		Token newHandle(T_HANDLE);
+		newHandle.data.asHandle.ptr = channel.get();
+		newHandle.data.asHandle.size = sizeof(Channel);
+		context->stack.push_back(newHandle);
+	}
+
+	void _f_channel_send(Context* context)
+	{
+		/* arguments: <value> <T_HANDLE channel> channel_send
+		   returnvalue: 
+		   description: Sends `value` over `channel`, waiting while the channel is full.
+		   notes: Strings, arrays and sets are handed over to the receiver without copying unless
+		     they are still referenced elsewhere (e.g. by a variable), in which case they are copied.
+			 Dictionaries are always copied. Sending over a closed channel is an error.
+		*/
+		Channel* channel = popChannel(context);
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		transferToken(token1);
+		channel->send(token1);
+	}
+
+	void _f_channel_recv(Context* context)
+	{
+		/* arguments: <T_HANDLE channel> channel_recv
+		   returnvalue: <value> TRUE
+		   returnvalue: FALSE
+		   description: Receives a value from `channel`, waiting while the channel is empty.
+		     Returns FALSE once the channel is closed and all values sent to it are received.
+		   notes: 
+		*/
+		Channel* channel = popChannel(context);
+		Token value;
+
+		if (channel->receive(value)) {
+			context->stack.push_back(value);
+			pushBool(context, true);
+		}
+		else
+			pushBool(context, false);
+	}
+
+	void _f_channel_try_recv(Context* context)
+	{
+		/* arguments: <T_HANDLE channel> channel_try_recv
+		   returnvalue: <value> TRUE
+		   returnvalue: FALSE
+		   description: Receives a value from `channel` if one is available, otherwise returns
+		     FALSE immediately.
+		   notes: 
+		*/
+		Channel* channel = popChannel(context);
+		Token value;
+
+		if (channel->tryReceive(value)) {
+			context->stack.push_back(value);
+			pushBool(context, true);
+		}
+		else
+			pushBool(context, false);
+	}
+
+	void _f_channel_close(Context* context)
+	{
+		/* arguments: <T_HANDLE channel> channel_close
+		   returnvalue: 
+		   description: Closes `channel`. Values already sent can still be received, further
+		     sends fail and receivers are woken up once the channel is drained.
+		   notes: 
+		*/
+		popChannel(context)->close();
+	}
+
+}
@@ -0,0 +1,197 @@
+/*
+setFunctions.cpp - Set Stutsk functions built into the interpreter are implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <builtinFunctions.h>
+
+namespace {
+	void pushSet(Context* context, const TokenSetPtr& set)
+	{
+		Token newSet(T_SET);
+		newSet.asSet = set;
+		context->stack.push_back(newSet);
+	}
+}
+
+void BuiltIns::_f_set_new(Context* context) {
+	/* arguments: set_new
+	   returnvalue: <T_SET> 
+	   description: Creates a new empty set.
+	   notes: Sets have reference semantics like dictionaries. Two sets are `==` if they have the
+	     same members.
+	*/
+	pushSet(context, TokenSetPtr(new TokenSet()));
+}
+
+void BuiltIns::_f_set_add(Context* context) {
+	/* arguments: <value> <T_SET set> set_add
+	   returnvalue: <T_BOOL> 
+	   description: Adds `value` to set `set`. Returns true if it was not already a member.
+	   notes: Membership follows `==`, so 1, 1.0, "1" and TRUE are the same member.
+	     All NaNs are the same member, even though NaN is not `==` to itself.
+	*/
+	Token set_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set_token);
+
+	if (set_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	pushBool(context, set_token.asSet->insert(value_token));
+}
+
+void BuiltIns::_f_set_has(Context* context) {
+	/* arguments: <value> <T_SET set> set_has
+	   returnvalue: <T_BOOL> 
+	   description: Returns true if `value` is a member of set `set`.
+	   notes: 
+	*/
+	Token set_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set_token);
+
+	if (set_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	pushBool(context, set_token.asSet->contains(value_token));
+}
+
+void BuiltIns::_f_set_remove(Context* context) {
+	/* arguments: <value> <T_SET set> set_remove
+	   returnvalue: <T_BOOL> 
+	   description: Removes `value` from set `set`. Returns true if it was a member.
+	   notes: 
+	*/
+	Token set_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token value_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set_token);
+
+	if (set_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	pushBool(context, set_token.asSet->erase(value_token));
+}
+
+void BuiltIns::_f_set_union(Context* context) {
+	/* arguments: <T_SET set1> <T_SET set2> set_union
+	   returnvalue: <T_SET> 
+	   description: Returns a new set with members of both `set1` and `set2`.
+	   notes: 
+	*/
+	Token set2_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token set1_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set1_token);
+	recurseVariables(set2_token);
+
+	if (set1_token.tokenType != T_SET || set2_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	const TokenSet& set1 = *set1_token.asSet;
+	const TokenSet& set2 = *set2_token.asSet;
+
+	TokenSetPtr result(new TokenSet());
+	result->reserve(set1.size() + set2.size());
+
+	for (TokenSet::const_iterator it = set1.begin(); it != set1.end(); ++it)
+		result->insert(it->key);
+	for (TokenSet::const_iterator it = set2.begin(); it != set2.end(); ++it)
+		result->insert(it->key);
+
+	pushSet(context, result);
+}
+
+void BuiltIns::_f_set_intersect(Context* context) {
+	/* arguments: <T_SET set1> <T_SET set2> set_intersect
+	   returnvalue: <T_SET> 
+	   description: Returns a new set with members that are in both `set1` and `set2`.
+	   notes: Members are returned in the order of `set1`.
+	*/
+	Token set2_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token set1_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set1_token);
+	recurseVariables(set2_token);
+
+	if (set1_token.tokenType != T_SET || set2_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	const TokenSet& set1 = *set1_token.asSet;
+	TokenSet& set2 = *set2_token.asSet;
+
+	TokenSetPtr result(new TokenSet());
+
+	for (TokenSet::const_iterator it = set1.begin(); it != set1.end(); ++it)
+		if (set2.contains(it->key))
+			result->insert(it->key);
+
+	pushSet(context, result);
+}
+
+void BuiltIns::_f_set_difference(Context* context) {
+	/* arguments: <T_SET set1> <T_SET set2> set_difference
+	   returnvalue: <T_SET> 
+	   description: Returns a new set with members of `set1` that are not in `set2`.
+	   notes: 
+	*/
+	Token set2_token = stack_back_safe(context);
+	context->stack.pop_back();
+	Token set1_token = stack_back_safe(context);
+	context->stack.pop_back();
+
+	recurseVariables(set1_token);
+	recurseVariables(set2_token);
+
+	if (set1_token.tokenType != T_SET || set2_token.tokenType != T_SET)
+	{
+		throw StutskException(ET_ERROR, "Token is not a set.");
+	}
+
+	const TokenSet& set1 = *set1_token.asSet;
+	TokenSet& set2 = *set2_token.asSet;
+
+	TokenSetPtr result(new TokenSet());
+
+	for (TokenSet::const_iterator it = set1.begin(); it != set1.end(); ++it)
+		if (!set2.contains(it->key))
+			result->insert(it->key);
+
+	pushSet(context, result);
+}
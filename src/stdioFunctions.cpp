@@ -34,7 +34,7 @@ void BuiltIns::_f_commandline(Context* context) {
 		parameter.asString = StringPtr(new string(*iter));
 		parameters.asTokenList->push_back(parameter);
 	}
-	stutskStack.push_back(parameters);
+	context->stack.push_back(parameters);
 }
 
 void BuiltIns::_f_print(Context* context) {
@@ -43,9 +43,10 @@ void BuiltIns::_f_print(Context* context) {
 	   description: Prints text to standard output.
 	   notes: 
 	*/
-	Token tokenToPrint = stack_back_safe();
-	cout << *giveString(tokenToPrint);
-	stutskStack.pop_back();
+	Token tokenToPrint = stack_back_safe(context);
+	StringRef text(tokenToPrint);
+	cout.write(text.data, text.size);
+	context->stack.pop_back();
 }
 
 void BuiltIns::_f_error(Context* context) {
@@ -54,18 +55,23 @@ void BuiltIns::_f_error(Context* context) {
 	   description: Prints text to standard error.
 	   notes: 
 	*/
-	Token tokenToPrint = stack_back_safe();
+	Token tokenToPrint = stack_back_safe(context);
 	cerr << *giveString(tokenToPrint);
-	stutskStack.pop_back();
+	context->stack.pop_back();
 }
 
 void BuiltIns::_f_readline(Context* context) {
 	/* arguments: readline
 	   returnvalue: <T_STRING text>
 	   description: Reads a line from standard input.
-	   notes: 
+	   notes: Other green threads run until input is available, but not while the rest of a
+	     partially received line is awaited. The same goes for the deadline of with_deadline.
 	*/
-	getline(cin, *pushString());
+	if (context->interpreter.scheduler.limited() && cin.rdbuf()->in_avail() <= 0 &&
+		!context->interpreter.scheduler.waitReady(0, false)) {
+			context->interpreter.scheduler.checkDeadline();
+	}
+	getline(cin, *pushString(context));
 }
 
 void BuiltIns::_f_read(Context* context) {
@@ -74,8 +80,8 @@ void BuiltIns::_f_read(Context* context) {
 	   description: Reads count characters from standard input.
 	   notes: 
 	*/
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	stutskInteger length = giveInteger(token2);
 	auto_ptr<char> buf = auto_ptr<char>(new char[length]);
@@ -88,7 +94,7 @@ void BuiltIns::_f_read(Context* context) {
 
 	Token newString(T_STRING);
 	newString.asString = StringPtr(new string(buf.get(), cin.gcount()));
-	stutskStack.push_back(newString);
+	context->stack.push_back(newString);
 }
 
 
@@ -108,7 +114,7 @@ void BuiltIns::_f_readchar(Context* context) {
 	Token newString(T_STRING);
 	// Returns either "<char>" or ""
 	newString.asString = StringPtr(new string (&buf, cin.gcount()));
-	stutskStack.push_back(newString);
+	context->stack.push_back(newString);
 }
 
 void BuiltIns::_f_eof(Context* context) {
@@ -117,5 +123,5 @@ void BuiltIns::_f_eof(Context* context) {
 	   description: Returns true if standard input pipe is closed.
 	   notes: 
 	*/
-	pushBool(cin.eof());
+	pushBool(context, cin.eof());
 }
\ No newline at end of file
@@ -26,30 +26,43 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cryptopp/base64.h>
 
 
-void BuiltIns::_f_ord(Context* Context)
+void BuiltIns::_f_ord(Context* context)
 {   
 	/* arguments: <T_STRING char> ord
 	   returnvalue: <T_INTEGER>
 	   description: Returns the integer representation of the character (0-255).
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 	string chr = *giveString(token1);
 	stutskInteger number = static_cast<stutskInteger>(chr[0]);
-	pushInteger(number);
+	pushInteger(context, number);
 }
 
-void BuiltIns::_f_chr(Context* Context)
+void BuiltIns::_f_chr(Context* context)
 {
 	/* arguments: <T_INTEGER value> chr
 	   returnvalue: <T_STRING>
 	   description: Returns the character representation of the integer (\0 - \255).
 	   notes: 
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back(); 
-	*pushString() = static_cast<char>(giveInteger(token1));
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back(); 
+	*pushString(context) = static_cast<char>(giveInteger(token1));
+}
+
+namespace {
+	// Finds `needle` in `haystack` like string::find, for characters that need not be in a string
+	const char* findBytes(const char* haystack, size_t length, const char* needle, size_t needleLength)
+	{
+#ifdef __GLIBC__
+		return (const char*)memmem(haystack, length, needle, needleLength);
+#else
+		const char* found = std::search(haystack, haystack + length, needle, needle + needleLength);
+		return found == haystack + length && needleLength > 0 ? NULL : found;
+#endif
+	}
 }
 
 void BuiltIns::_f_pos(Context* context) {
@@ -59,18 +72,18 @@ void BuiltIns::_f_pos(Context* context) {
 	     is not found.
 	   notes: 
 	*/
-	Token tString = stack_back_safe();
-	stutskStack.pop_back();
-	Token tSubString = stack_back_safe();
-	stutskStack.pop_back();
+	Token tString = stack_back_safe(context);
+	context->stack.pop_back();
+	Token tSubString = stack_back_safe(context);
+	context->stack.pop_back();
 
-	StringPtr haystack = giveString(tString);
-	StringPtr needle = giveString(tSubString);
+	StringRef haystack(tString);
+	StringRef needle(tSubString);
 
-	size_t pos = haystack->find(*needle);
+	const char* found = findBytes(haystack.data, haystack.size, needle.data, needle.size);
 
-	if (pos == string::npos) pushInteger(-1);
-	else pushInteger(pos);
+	if (found == NULL) pushInteger(context, -1);
+	else pushInteger(context, found - haystack.data);
 }
 
 void BuiltIns::_f_trim(Context* context) {
@@ -79,8 +92,8 @@ void BuiltIns::_f_trim(Context* context) {
 	   description: Trims the string of leading and trailing spaces.
 	   notes: 
 	*/
-	Token token = stack_back_safe();
-	stutskStack.pop_back();
+	Token token = stack_back_safe(context);
+	context->stack.pop_back();
 	StringPtr str = giveString(token);
 	stutskInteger start=0, end=str->length()-1, i;
 	for (i=0; i<(signed)str->length(); i++)
@@ -93,59 +106,59 @@ void BuiltIns::_f_trim(Context* context) {
 			end--;
 		else 
 			break;
-	*pushString() = str->substr(start, end-start+1);
+	*pushString(context) = str->substr(start, end-start+1);
 }
 
-void BuiltIns::_f_uppercase(Context* Context)
+void BuiltIns::_f_uppercase(Context* context)
 {
 	/* arguments: <T_STRING str> uppercase
 	   returnvalue: <T_STRING>
 	   description: Converts the string to uppercase.
 	   notes: ASCII only.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string str = *giveString(token1);
 	boost::to_upper(str);
-	*pushString() = str;
+	*pushString(context) = str;
 }
 
-void BuiltIns::_f_lowercase(Context* Context)
+void BuiltIns::_f_lowercase(Context* context)
 {
 	/* arguments: <T_STRING str> lowercase
 	   returnvalue: <T_STRING>
 	   description: Converts the string to lowercase.
 	   notes: ASCII only.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string str = *giveString(token1);
 	boost::to_lower(str);
-	*pushString() = str;
+	*pushString(context) = str;
 }
 
-void BuiltIns::_f_regex_validate(Context* Context)
+void BuiltIns::_f_regex_validate(Context* context)
 {
 	/* arguments: <T_STRING str> <T_STRING regex> regex_validate
 	   returnvalue: <T_BOOL>
 	   description: Returns true if `str` matches the regular expression `regex`.
 	   notes: See boost:regex for syntax and caveats.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string regexp = *giveString(token1);
-	StringPtr hay =  giveString(token2);
+	StringRef hay(token2);
 
 	boost::regex e(regexp);
-	pushBool(regex_match(*hay, e));
+	pushBool(context, regex_match(hay.data, hay.data + hay.size, e));
 }
 
-void BuiltIns::_f_regex_replace(Context* Context)
+void BuiltIns::_f_regex_replace(Context* context)
 {
 	/* arguments: <T_STRING str> <T_STRING regex> <T_STRING replace> regex_validate
 	   returnvalue: <T_STRING>
@@ -154,23 +167,24 @@ void BuiltIns::_f_regex_replace(Context* Context)
 	   notes: Replaces all occurences, the whole string does not have to match. See 
 	     boost:regex for syntax and caveats.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token3 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token3 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string regex_orig = *giveString(token2);
 	string regex_rep = *giveString(token1);
 		
-	StringPtr hay = giveString(token3);
+	StringRef hay(token3);
 
 	boost::regex e(regex_orig);
-	*pushString() = boost::regex_replace(*hay, e, regex_rep);
+	StringPtr result = pushString(context);
+	boost::regex_replace(std::back_inserter(*result), hay.data, hay.data + hay.size, e, regex_rep);
 }
 
-void BuiltIns::_f_regex_match(Context* Context)
+void BuiltIns::_f_regex_match(Context* context)
 {
 	/* arguments: <T_STRING str> <T_STRING regex> regex_match
 	   returnvalue: <T_ARRAY> [ ( <T_STRING> <T_STRING> ... ) ]
@@ -178,20 +192,20 @@ void BuiltIns::_f_regex_match(Context* Context)
 	     expression `regex` on string `str` or an empty array if the string does not match.
 	   notes: See boost:regex for syntax and caveats.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string regexp = *giveString(token1);
-	StringPtr hay =  giveString(token2);
+	StringRef hay(token2);
 
 	boost::regex e(regexp);
-	boost::smatch what;
+	boost::cmatch what;
 
 	TokenListPtr matches = TokenListPtr(new TokenList());
 	
-	if (regex_match(*hay, what, e)) // e ni validno, potem vrnemo prazno polje
+	if (regex_match(hay.data, hay.data + hay.size, what, e)) // e ni validno, potem vrnemo prazno polje
 	{		
 		Token match(T_STRING);
 		for (unsigned i=1;i<what.size();i++)
@@ -203,10 +217,10 @@ void BuiltIns::_f_regex_match(Context* Context)
 
 	Token addToken(T_ARRAY);
 	addToken.asTokenList = matches;
-	stutskStack.push_back(addToken);
+	context->stack.push_back(addToken);
 }
 
-void BuiltIns::_f_regex_match_all(Context* Context)
+void BuiltIns::_f_regex_match_all(Context* context)
 {
 	/* arguments: <T_STRING str> <T_STRING regex> regex_match_all
 	   returnvalue: <T_ARRAY> [ ( <T_STRING> <T_STRING> ... ) ]
@@ -214,23 +228,23 @@ void BuiltIns::_f_regex_match_all(Context* Context)
 	     expression `regex` on string `str` or an empty array if the string does not match.
 	   notes: See boost:regex for syntax and caveats.
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string regexp = *giveString(token1);
-	StringPtr hay =  giveString(token2);
+	StringRef hay(token2);
 
 	boost::regex e(regexp);
 
 	TokenListPtr all_matches = TokenListPtr(new TokenList());
 	
-   std::string::const_iterator start, end; 
-   start = hay->begin(); 
-   end = hay->end(); 
+   const char *start, *end; 
+   start = hay.data; 
+   end = hay.data + hay.size; 
 
-   boost::match_results<std::string::const_iterator> what;
+   boost::cmatch what;
    boost::match_flag_type flags = boost::match_default; 
 
    while(regex_search(start, end, what, e, flags)) 
@@ -250,10 +264,10 @@ void BuiltIns::_f_regex_match_all(Context* Context)
 
 	Token addToken(T_ARRAY);
 	addToken.asTokenList = all_matches;
-	stutskStack.push_back(addToken);
+	context->stack.push_back(addToken);
 }
 
-void BuiltIns::_f_crc32(Context* Context)
+void BuiltIns::_f_crc32(Context* context)
 {
     /* arguments: <T_STRING str> crc32
 	   returnvalue: <T_STRING>
@@ -261,20 +275,21 @@ void BuiltIns::_f_crc32(Context* Context)
 	   notes: 
 	*/
 	CryptoPP::CRC32 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_md5(Context* Context)
+void BuiltIns::_f_md5(Context* context)
 {
     /* arguments: <T_STRING str> md5
 	   returnvalue: <T_STRING>
@@ -282,20 +297,21 @@ void BuiltIns::_f_md5(Context* Context)
 	   notes: MD5 is considered broken for cryptographic use.
 	*/
 	CryptoPP::MD5 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_sha1(Context* Context)
+void BuiltIns::_f_sha1(Context* context)
 {
     /* arguments: <T_STRING str> sha1
 	   returnvalue: <T_STRING>
@@ -303,20 +319,21 @@ void BuiltIns::_f_sha1(Context* Context)
 	   notes: MD5 is considered broken for cryptographic use.
 	*/
 	CryptoPP::SHA1 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_sha224(Context* Context)
+void BuiltIns::_f_sha224(Context* context)
 {
     /* arguments: <T_STRING str> sha224
 	   returnvalue: <T_STRING>
@@ -324,20 +341,21 @@ void BuiltIns::_f_sha224(Context* Context)
 	   notes:
 	*/
 	CryptoPP::SHA224 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_sha256(Context* Context)
+void BuiltIns::_f_sha256(Context* context)
 {
     /* arguments: <T_STRING str> sha256
 	   returnvalue: <T_STRING>
@@ -345,20 +363,21 @@ void BuiltIns::_f_sha256(Context* Context)
 	   notes:
 	*/
 	CryptoPP::SHA256 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_sha384(Context* Context)
+void BuiltIns::_f_sha384(Context* context)
 {
     /* arguments: <T_STRING str> sha384
 	   returnvalue: <T_STRING>
@@ -366,20 +385,21 @@ void BuiltIns::_f_sha384(Context* Context)
 	   notes:
 	*/
 	CryptoPP::SHA384 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_sha512(Context* Context)
+void BuiltIns::_f_sha512(Context* context)
 {
     /* arguments: <T_STRING str> sha512
 	   returnvalue: <T_STRING>
@@ -387,68 +407,71 @@ void BuiltIns::_f_sha512(Context* Context)
 	   notes:
 	*/
 	CryptoPP::SHA512 hash;
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;	
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
       new CryptoPP::HashFilter(hash,
 	    new CryptoPP::HexEncoder(
            new CryptoPP::StringSink(result), false)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_base64_encode(Context* Context)
+void BuiltIns::_f_base64_encode(Context* context)
 {
     /* arguments: <T_STRING str> base64_encode
 	   returnvalue: <T_STRING>
 	   description: Encodes `str` with base-64 algorithm.
 	   notes:
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
 		new CryptoPP::Base64Encoder(
          new CryptoPP::StringSink(result)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_base64_decode(Context* Context)
+void BuiltIns::_f_base64_decode(Context* context)
 {
     /* arguments: <T_STRING str> base64_decode
 	   returnvalue: <T_STRING>
 	   description: Decodes `str` with base-64 algorithm.
 	   notes:
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string result;
 
-	CryptoPP::StringSource foo(*giveString(token1), true,
+	StringRef input(token1);
+	CryptoPP::StringSource foo((const unsigned char*)input.data, input.size, true,
 		new CryptoPP::Base64Decoder(
          new CryptoPP::StringSink(result)));
 
-	*pushString() = result;
+	*pushString(context) = result;
 }
 
-void BuiltIns::_f_explode(Context* Context)
+void BuiltIns::_f_explode(Context* context)
 {
     /* arguments: <T_STRING str> <T_STRING delimiter> explode
 	   returnvalue: <T_ARRAY> [ ( <T_STRING> <T_STRING> ... ) ] 
 	   description: Delimits `str` with `delimiter` and returns the array of subbstrings.
 	   notes:
 	*/
-	Token token1 = stack_back_safe();
-	stutskStack.pop_back();
-	Token token2 = stack_back_safe();
-	stutskStack.pop_back();
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
 
 	string text = *giveString(token2);
 	string separator = *giveString(token1);
@@ -474,5 +497,5 @@ void BuiltIns::_f_explode(Context* Context)
 
 	Token addToken(T_ARRAY);
 	addToken.asTokenList = matches;
-	stutskStack.push_back(addToken);
+	context->stack.push_back(addToken);
 }
\ No newline at end of file
@@ -0,0 +1,581 @@
+/*
+tokenDictionary.cpp - the hash tables that back Stutsk dictionaries and sets are implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stutskInterpreter.h>
+#include <functional>
+#include <cmath>
+#include <limits>
+
+namespace {
+	// Slot markers. Any other value in the slot table is an index into the entry vector.
+	const size_t SLOT_EMPTY = (size_t)-1;
+	const size_t SLOT_DELETED = (size_t)-2;
+
+	const size_t MIN_CAPACITY = 8;
+
+	// Smallest power of two that holds `count` entries below the 3/4 load factor
+	size_t capacityFor(size_t count)
+	{
+		size_t capacity = MIN_CAPACITY;
+		while (capacity * 3 < count * 4)
+			capacity <<= 1;
+		return capacity;
+	}
+
+	// Finalizer of the SplitMix64 generator, so that sequential integer keys spread evenly
+	inline size_t mixInteger(unsigned long long x)
+	{
+		x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return (size_t)x;
+	}
+
+	/* parseCanonicalInteger - succeeds only if `input` is exactly what toString would produce
+	     for some integer (no leading zeros, no '+', no whitespace), so that "01" stays a string
+		 key distinct from 1, as it always was. */
+	bool parseCanonicalInteger(const string& input, stutskInteger& value)
+	{
+		size_t length = input.size(), i = 0;
+		bool negative = false;
+
+		if (length > 0 && input[0] == '-') {
+			negative = true;
+			i = 1;
+		}
+		if (i == length || length - i > 19)
+			return false;
+		if (input[i] == '0' && (length - i > 1 || negative))
+			return false;
+
+		unsigned long long magnitude = 0;
+		for (; i < length; ++i) {
+			if (input[i] < '0' || input[i] > '9')
+				return false;
+			magnitude = magnitude * 10 + (input[i] - '0');
+		}
+
+		// 19 digits always fit in an unsigned long long, but not necessarily in a signed one
+		if (magnitude > (negative ? 9223372036854775808ULL : 9223372036854775807ULL))
+			return false;
+
+		value = negative ? (stutskInteger)(0 - magnitude) : (stutskInteger)magnitude;
+		return true;
+	}
+}
+
+/* HashKeyRef - a canonicalized key used for probing. It only points to the key string, so
+     looking up a string key does not copy it. */
+struct HashKeyRef {
+	DictionaryKey::KeyType type;
+	stutskInteger asInteger;
+	stutskFloat asFloat;
+	const string* asString;
+	StringPtr holder; // keeps strings converted from other types alive
+	size_t hash;
+
+	void setInteger(DictionaryKey::KeyType keyType, stutskInteger value)
+	{
+		type = keyType;
+		asInteger = value;
+		asString = NULL;
+		hash = mixInteger(value) ^ (keyType == DictionaryKey::KT_BOOL ? 0x5bd1e995 : 0);
+	}
+
+	// NaNs are all the same key, so that a set holds at most one of them
+	void setFloat(stutskFloat value)
+	{
+		type = DictionaryKey::KT_FLOAT;
+		asString = NULL;
+		if (value != value) {
+			asFloat = std::numeric_limits<stutskFloat>::quiet_NaN();
+			hash = 0x7ff80000;
+			return;
+		}
+		asFloat = value;
+		hash = std::hash<stutskFloat>()(value);
+	}
+
+	void setString(const string& value)
+	{
+		type = DictionaryKey::KT_STRING;
+		asString = &value;
+		hash = std::hash<string>()(value);
+	}
+
+	void setKey(const DictionaryKey& key)
+	{
+		switch (key.type) {
+		case DictionaryKey::KT_STRING: setString(key.asString); break;
+		case DictionaryKey::KT_FLOAT:  setFloat(key.asFloat); break;
+		default:                       setInteger(key.type, key.asInteger);
+		}
+	}
+
+	/* setDictionaryKey - canonicalizes a dictionary key. Everything apart from integers and booleans
+	     is addressed by its textual representation, as it always was. */
+	void setDictionaryKey(const Token& token)
+	{
+		switch (token.tokenType) {
+		case T_INTEGER:
+			setInteger(DictionaryKey::KT_INTEGER, token.data.asInteger);
+			break;
+		case T_BOOL:
+			setInteger(DictionaryKey::KT_BOOL, token.data.asBool ? 1 : 0);
+			break;
+		case T_VARIABLE: {
+			Token value = token;
+			recurseVariables(value);
+			setDictionaryKey(value);
+			break; }
+		default:
+			holder = giveString(token);
+			if (parseCanonicalInteger(*holder, asInteger))
+				setInteger(DictionaryKey::KT_INTEGER, asInteger);
+			else if (*holder == "TRUE" || *holder == "FALSE")
+				setInteger(DictionaryKey::KT_BOOL, *holder == "TRUE" ? 1 : 0);
+			else
+				setString(*holder);
+		}
+	}
+
+	/* setSetKey - canonicalizes a set member following tokenEqual. Numbers (including numeric
+	     strings and booleans) are keyed by value, integral values always as integers. */
+	void setSetKey(const Token& token)
+	{
+		stutskFloat floatV;
+		switch (token.tokenType) {
+		case T_INTEGER:
+			setInteger(DictionaryKey::KT_INTEGER, token.data.asInteger);
+			return;
+		case T_BOOL:
+			setInteger(DictionaryKey::KT_INTEGER, token.data.asBool ? 1 : 0);
+			return;
+		case T_FLOAT:
+			floatV = token.data.asFloat;
+			break;
+		case T_STRING:
+			if (fromString(*token.asString, asInteger)) {
+				setInteger(DictionaryKey::KT_INTEGER, asInteger);
+				return;
+			}
+			if (!fromString(*token.asString, floatV)) {
+				holder = token.asString;
+				setString(*holder);
+				return;
+			}
+			break;
+		case T_STRING_VIEW: {
+			Token value(T_STRING);
+			value.asString = giveString(token);
+			setSetKey(value);
+			return; }
+		case T_VARIABLE: {
+			Token value = token;
+			recurseVariables(value);
+			setSetKey(value);
+			return; }
+		default:
+			throw StutskException(ET_ERROR, "Token cannot be a member of a set");
+		}
+
+		// 2^63 is exactly representable, so the range check is exact
+		if (floatV == std::floor(floatV) && floatV >= -9223372036854775808.0L && floatV < 9223372036854775808.0L)
+			setInteger(DictionaryKey::KT_INTEGER, (stutskInteger) floatV);
+		else
+			setFloat(floatV);
+	}
+
+	bool matches(const DictionaryKey& key) const
+	{
+		if (key.type != type)
+			return false;
+		switch (type) {
+		case DictionaryKey::KT_STRING: return key.asString == *asString;
+		case DictionaryKey::KT_FLOAT:  return key.asFloat == asFloat || (key.asFloat != key.asFloat && asFloat != asFloat);
+		default:                       return key.asInteger == asInteger;
+		}
+	}
+
+	void store(DictionaryKey& key) const
+	{
+		key.type = type;
+		switch (type) {
+		case DictionaryKey::KT_STRING: key.asString = *asString; break;
+		case DictionaryKey::KT_FLOAT:  key.asFloat = asFloat; break;
+		default:                       key.asInteger = asInteger;
+		}
+	}
+};
+
+Token DictionaryKey::toToken() const
+{
+	Token token;
+	switch (type) {
+	case KT_INTEGER:
+		token.tokenType = T_INTEGER;
+		token.data.asInteger = asInteger;
+		break;
+	case KT_BOOL:
+		token.tokenType = T_BOOL;
+		token.data.asBool = asInteger != 0;
+		break;
+	case KT_FLOAT:
+		token.tokenType = T_FLOAT;
+		token.data.asFloat = asFloat;
+		break;
+	default:
+		token.tokenType = T_STRING;
+		token.asString = StringPtr(new string(asString));
+	}
+	return token;
+}
+
+string DictionaryKey::toString() const
+{
+	string result;
+	switch (type) {
+	case KT_INTEGER:
+		::toString(asInteger, result);
+		return result;
+	case KT_BOOL:
+		return asInteger ? "TRUE" : "FALSE";
+	case KT_FLOAT:
+		::toString(asFloat, result);
+		return result;
+	default:
+		return asString;
+	}
+}
+
+/* OrderedHashTable::findSlot - returns the slot that references `key` or SLOT_EMPTY if the key
+     is not in the table. Linear probing always terminates, as the table is never full. */
+template <class EntryType>
+size_t OrderedHashTable<EntryType>::findSlot(const HashKeyRef& key) const
+{
+	if (slots_.empty())
+		return SLOT_EMPTY;
+
+	size_t mask = slots_.size() - 1;
+	for (size_t i = key.hash & mask; ; i = (i + 1) & mask) {
+		size_t index = slots_[i];
+		if (index == SLOT_EMPTY)
+			return SLOT_EMPTY;
+		if (index != SLOT_DELETED && entries_[index].hash == key.hash && key.matches(entries_[index].key))
+			return i;
+	}
+}
+
+/* OrderedHashTable::rebuild - drops deleted entries and reindexes live ones into a slot table of
+     `capacity` slots (power of two) using cached hashes. */
+template <class EntryType>
+void OrderedHashTable<EntryType>::rebuild(size_t capacity)
+{
+	if (size_ != entries_.size()) {
+		vector<Entry> live;
+		live.reserve(size_);
+		for (typename vector<Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+			if (!it->deleted)
+				live.push_back(std::move(*it));
+		entries_.swap(live);
+	}
+
+	slots_.assign(capacity, SLOT_EMPTY);
+	size_t mask = capacity - 1;
+	for (size_t index = 0; index < entries_.size(); ++index) {
+		size_t i = entries_[index].hash & mask;
+		while (slots_[i] != SLOT_EMPTY)
+			i = (i + 1) & mask;
+		slots_[i] = index;
+	}
+	used_ = entries_.size();
+}
+
+template <class EntryType>
+EntryType* OrderedHashTable<EntryType>::findEntry(const HashKeyRef& key)
+{
+	size_t slot = findSlot(key);
+	if (slot == SLOT_EMPTY)
+		return NULL;
+	return &entries_[slots_[slot]];
+}
+
+/* OrderedHashTable::insert - returns the entry for `key`, appending a new one at the end of the
+     insertion order if it is not present. */
+template <class EntryType>
+EntryType& OrderedHashTable<EntryType>::insert(const HashKeyRef& key, bool& inserted)
+{
+	size_t slot = findSlot(key);
+	inserted = (slot == SLOT_EMPTY);
+	if (!inserted)
+		return entries_[slots_[slot]];
+
+	if ((used_ + 1) * 4 > slots_.size() * 3)
+		rebuild(capacityFor(2 * (size_ + 1)));
+
+	// The key is not present, so the first tombstone on the probe sequence can be reused
+	size_t mask = slots_.size() - 1;
+	size_t i = key.hash & mask;
+	while (slots_[i] != SLOT_EMPTY && slots_[i] != SLOT_DELETED)
+		i = (i + 1) & mask;
+	if (slots_[i] == SLOT_EMPTY)
+		++used_;
+	slots_[i] = entries_.size();
+
+	entries_.push_back(Entry());
+	Entry& entry = entries_.back();
+	entry.hash = key.hash;
+	entry.deleted = false;
+	key.store(entry.key);
+	++size_;
+
+	return entry;
+}
+
+/* OrderedHashTable::erase - removes `key` from the table. The entry is only marked as deleted
+     (and its contents released), it is reclaimed the next time the table is rebuilt. */
+template <class EntryType>
+bool OrderedHashTable<EntryType>::erase(const HashKeyRef& key)
+{
+	size_t slot = findSlot(key);
+	if (slot == SLOT_EMPTY)
+		return false;
+
+	Entry& entry = entries_[slots_[slot]];
+	entry = Entry();
+	entry.deleted = true;
+	slots_[slot] = SLOT_DELETED;
+	--size_;
+
+	if (size_ == 0) {
+		entries_.clear();
+		slots_.assign(slots_.size(), SLOT_EMPTY);
+		used_ = 0;
+	}
+	return true;
+}
+
+template <class EntryType>
+void OrderedHashTable<EntryType>::reserve(size_t count)
+{
+	size_t capacity = capacityFor(count);
+	if (capacity > slots_.size())
+		rebuild(capacity);
+	entries_.reserve(count);
+}
+
+template class OrderedHashTable<DictionaryEntry>;
+template class OrderedHashTable<SetEntry>;
+
+Token* TokenDictionary::find(const Token& key)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Entry* entry = findEntry(ref);
+	return entry == NULL ? NULL : &entry->value;
+}
+
+Token& TokenDictionary::operator[](const Token& key)
+{
+	HashKeyRef ref;
+	bool inserted;
+	ref.setDictionaryKey(key);
+	return OrderedHashTable<DictionaryEntry>::insert(ref, inserted).value;
+}
+
+Token& TokenDictionary::operator[](const DictionaryKey& key)
+{
+	HashKeyRef ref;
+	bool inserted;
+	ref.setKey(key);
+	return OrderedHashTable<DictionaryEntry>::insert(ref, inserted).value;
+}
+
+bool TokenDictionary::erase(const Token& key)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	return OrderedHashTable<DictionaryEntry>::erase(ref);
+}
+
+bool TokenSet::contains(const Token& value)
+{
+	HashKeyRef ref;
+	ref.setSetKey(value);
+	return findEntry(ref) != NULL;
+}
+
+bool TokenSet::contains(const DictionaryKey& value)
+{
+	HashKeyRef ref;
+	ref.setKey(value);
+	return findEntry(ref) != NULL;
+}
+
+bool TokenSet::insert(const Token& value)
+{
+	HashKeyRef ref;
+	bool inserted;
+	ref.setSetKey(value);
+	OrderedHashTable<SetEntry>::insert(ref, inserted);
+	return inserted;
+}
+
+bool TokenSet::insert(const DictionaryKey& value)
+{
+	HashKeyRef ref;
+	bool inserted;
+	ref.setKey(value);
+	OrderedHashTable<SetEntry>::insert(ref, inserted);
+	return inserted;
+}
+
+bool TokenSet::erase(const Token& value)
+{
+	HashKeyRef ref;
+	ref.setSetKey(value);
+	return OrderedHashTable<SetEntry>::erase(ref);
+}
+
+namespace {
+	// Integers are added unsigned, so overflow wraps around instead of being undefined
+	Token addNumbers(const Token& value1, const Token& value2)
+	{
+		if (value1.tokenType == T_INTEGER && value2.tokenType == T_INTEGER) {
+			Token sum(T_INTEGER);
+			sum.data.asInteger = (stutskInteger)((unsigned long long)value1.data.asInteger +
+				(unsigned long long)value2.data.asInteger);
+			return sum;
+		}
+
+		Token sum(T_FLOAT);
+		sum.data.asFloat = giveFloat(value1) + giveFloat(value2);
+		return sum;
+	}
+}
+
+SharedDictionary::Shard& SharedDictionary::shardFor(const HashKeyRef& key)
+{
+	// The top bits pick the shard, the bottom ones the slot within it
+	return shards_[key.hash >> (sizeof(size_t) * 8 - SHARD_BITS)];
+}
+
+bool SharedDictionary::get(const Token& key, Token& value)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Shard& shard = shardFor(ref);
+	{
+		boost::mutex::scoped_lock lock(shard.mutex);
+		DictionaryEntry* entry = shard.dictionary.findEntry(ref);
+		if (entry == NULL)
+			return false;
+		value = entry->value;
+	}
+	// Stored values are never modified in place, so they can be copied outside the lock
+	value = copy_token(value);
+	return true;
+}
+
+void SharedDictionary::set(const Token& key, const Token& value)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Token stored = copy_token(value);
+	Shard& shard = shardFor(ref);
+
+	boost::mutex::scoped_lock lock(shard.mutex);
+	bool inserted;
+	shard.dictionary.insert(ref, inserted).value = stored;
+}
+
+bool SharedDictionary::erase(const Token& key)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Shard& shard = shardFor(ref);
+
+	boost::mutex::scoped_lock lock(shard.mutex);
+	return shard.dictionary.OrderedHashTable<DictionaryEntry>::erase(ref);
+}
+
+Token SharedDictionary::increment(const Token& key, const Token& delta)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Shard& shard = shardFor(ref);
+
+	boost::mutex::scoped_lock lock(shard.mutex);
+	DictionaryEntry* entry = shard.dictionary.findEntry(ref);
+
+	Token zero(T_INTEGER);
+	zero.data.asInteger = 0;
+	Token sum = addNumbers(entry == NULL ? zero : entry->value, delta);
+
+	if (entry == NULL) {
+		bool inserted;
+		entry = &shard.dictionary.insert(ref, inserted);
+	}
+	entry->value = sum;
+	return sum;
+}
+
+bool SharedDictionary::compareAndSet(const Token& key, const Token& expected, const Token& value)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Token stored = copy_token(value);
+	Shard& shard = shardFor(ref);
+
+	boost::mutex::scoped_lock lock(shard.mutex);
+	DictionaryEntry* entry = shard.dictionary.findEntry(ref);
+	if (entry == NULL || !tokenEqual(entry->value, expected))
+		return false;
+	entry->value = stored;
+	return true;
+}
+
+Token SharedDictionary::getOrInsert(const Token& key, const Token& value)
+{
+	HashKeyRef ref;
+	ref.setDictionaryKey(key);
+	Token stored = copy_token(value);
+	Shard& shard = shardFor(ref);
+	{
+		boost::mutex::scoped_lock lock(shard.mutex);
+		bool inserted;
+		DictionaryEntry& entry = shard.dictionary.insert(ref, inserted);
+		if (inserted)
+			entry.value = stored;
+		else
+			stored = entry.value;
+	}
+	return copy_token(stored);
+}
+
+TokenDictionaryPtr SharedDictionary::snapshot()
+{
+	TokenDictionaryPtr result(new TokenDictionary());
+	for (size_t i = 0; i < (1 << SHARD_BITS); ++i) {
+		boost::mutex::scoped_lock lock(shards_[i].mutex);
+		for (TokenDictionary::const_iterator it = shards_[i].dictionary.begin();
+			it != shards_[i].dictionary.end(); ++it)
+			(*result)[it->key] = copy_token(it->value);
+	}
+	return result;
+}
@@ -0,0 +1,816 @@
+/*
+vectorFunctions.cpp - Vectorized numeric array Stutsk functions built into the interpreter are implemented here
+Coded by Tibor Djurica Potpara and Maj Smerkol
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <builtinFunctions.h>
+#include <algorithm>
+#include <limits>
+
+// SSE2 is the baseline on x86-64, AVX2 kernels are compiled with a function-level target
+// attribute and selected at runtime, so the binary still runs on older CPUs.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define STUTSK_X86_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#define AVX2_KERNEL __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+	/* NumericVector - contents of a T_ARRAY unpacked into a contiguous buffer, so that the
+	     kernels never touch Tokens. Arrays of integers (and booleans) stay integral, everything
+		 else is widened to double. */
+	struct NumericVector {
+		bool isInteger;
+		vector<stutskInteger> integers;
+		vector<double> floats;
+
+		size_t size() const { return isInteger ? integers.size() : floats.size(); }
+
+		void widen()
+		{
+			if (!isInteger) return;
+			floats.assign(integers.begin(), integers.end());
+			vector<stutskInteger>().swap(integers);
+			isInteger = false;
+		}
+	};
+
+	void unpackArray(Token token, NumericVector& result)
+	{
+		recurseVariables(token);
+
+		if (token.tokenType != T_ARRAY)
+			throw StutskException(ET_ERROR, "Token is not an array");
+
+		result.isInteger = true;
+		result.integers.clear();
+		result.floats.clear();
+		result.integers.reserve(token.asTokenList->size());
+
+		stutskInteger i1; stutskFloat f1; string s1;
+
+		for (TokenList::const_iterator it = token.asTokenList->begin();
+			it != token.asTokenList->end(); ++it)
+		{
+			GCDType type;
+			// Common types are handled inline, giveGCD is only needed for strings and references
+			switch (it->tokenType) {
+			case T_INTEGER: i1 = it->data.asInteger; type = NT_INTEGER; break;
+			case T_FLOAT:   f1 = it->data.asFloat;   type = NT_FLOAT;   break;
+			case T_BOOL:    i1 = it->data.asBool;    type = NT_INTEGER; break;
+			default:        type = giveGCD(*it, f1, i1, s1);
+			}
+
+			switch (type) {
+			case NT_INTEGER:
+				if (result.isInteger)
+					result.integers.push_back(i1);
+				else
+					result.floats.push_back(static_cast<double>(i1));
+				break;
+			case NT_FLOAT:
+				if (result.isInteger) {
+					result.widen();
+					result.floats.reserve(token.asTokenList->size());
+				}
+				result.floats.push_back(static_cast<double>(f1));
+				break;
+			default:
+				throw StutskException(ET_ERROR, "Token is not a numeric type");
+			}
+		}
+	}
+
+	void pushNumericVector(Context* context, const NumericVector& vec)
+	{
+		Token newArray(T_ARRAY);
+		newArray.asTokenList = TokenListPtr(new TokenList(vec.size()));
+
+		TokenList::iterator it = newArray.asTokenList->begin();
+		if (vec.isInteger)
+			for (size_t i = 0; i < vec.size(); ++i, ++it) {
+				it->tokenType = T_INTEGER;
+				it->data.asInteger = vec.integers[i];
+			}
+		else
+			for (size_t i = 0; i < vec.size(); ++i, ++it) {
+				it->tokenType = T_FLOAT;
+				it->data.asFloat = vec.floats[i];
+			}
+
+		context->stack.push_back(newArray);
+	}
+
+	// ------------------------- SCALAR KERNELS ------------------------------- //
+
+	// Integer arithmetic is done unsigned, so overflow wraps around instead of being undefined
+
+	stutskInteger sumIntegerScalar(const stutskInteger* a, size_t n)
+	{
+		unsigned long long s = 0;
+		for (size_t i = 0; i < n; ++i) s += a[i];
+		return s;
+	}
+
+	double sumFloatScalar(const double* a, size_t n)
+	{
+		double s = 0;
+		for (size_t i = 0; i < n; ++i) s += a[i];
+		return s;
+	}
+
+	void minMaxIntegerScalar(const stutskInteger* a, size_t n, stutskInteger& mn, stutskInteger& mx)
+	{
+		mn = mx = a[0];
+		for (size_t i = 1; i < n; ++i) {
+			if (a[i] < mn) mn = a[i];
+			if (a[i] > mx) mx = a[i];
+		}
+	}
+
+	// A NaN anywhere makes both the minimum and the maximum NaN, in every kernel
+
+	void minMaxFloatScalar(const double* a, size_t n, double& mn, double& mx)
+	{
+		mn = mx = a[0];
+		for (size_t i = 0; i < n; ++i) {
+			if (a[i] != a[i]) {
+				mn = mx = std::numeric_limits<double>::quiet_NaN();
+				return;
+			}
+			if (a[i] < mn) mn = a[i];
+			if (a[i] > mx) mx = a[i];
+		}
+	}
+
+	stutskInteger dotIntegerScalar(const stutskInteger* a, const stutskInteger* b, size_t n)
+	{
+		unsigned long long s = 0;
+		for (size_t i = 0; i < n; ++i)
+			s += (unsigned long long)a[i] * (unsigned long long)b[i];
+		return s;
+	}
+
+	double dotFloatScalar(const double* a, const double* b, size_t n)
+	{
+		double s = 0;
+		for (size_t i = 0; i < n; ++i) s += a[i] * b[i];
+		return s;
+	}
+
+	void addIntegerScalar(const stutskInteger* a, const stutskInteger* b, stutskInteger* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			r[i] = (unsigned long long)a[i] + (unsigned long long)b[i];
+	}
+
+	void mulIntegerScalar(const stutskInteger* a, const stutskInteger* b, stutskInteger* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			r[i] = (unsigned long long)a[i] * (unsigned long long)b[i];
+	}
+
+	void addFloatScalar(const double* a, const double* b, double* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) r[i] = a[i] + b[i];
+	}
+
+	void mulFloatScalar(const double* a, const double* b, double* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) r[i] = a[i] * b[i];
+	}
+
+	void scaleFloatScalar(const double* a, double f, double* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) r[i] = a[i] * f;
+	}
+
+	// Comparison kernels write -1, 0 or 1 for every element, depending on whether it is
+	// smaller, equal or larger than the value it is compared to, or UNORDERED if either is NaN.
+
+	const signed char UNORDERED = 2;
+
+	void compareIntegerScalar(const stutskInteger* a, stutskInteger v, signed char* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) r[i] = (a[i] > v) - (a[i] < v);
+	}
+
+	void compareFloatScalar(const double* a, double v, signed char* r, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			r[i] = (a[i] != a[i] || v != v) ? UNORDERED : (a[i] > v) - (a[i] < v);
+	}
+
+#ifdef STUTSK_X86_SIMD
+	// ------------------------- SSE2 KERNELS --------------------------------- //
+
+	stutskInteger sumIntegerSSE2(const stutskInteger* a, size_t n)
+	{
+		__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i*)(a + i)));
+			acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i*)(a + i + 2)));
+		}
+		stutskInteger lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+		return (unsigned long long)lanes[0] + lanes[1] + sumIntegerScalar(a + i, n - i);
+	}
+
+	double sumFloatSSE2(const double* a, size_t n)
+	{
+		__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+			acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+		return lanes[0] + lanes[1] + sumFloatScalar(a + i, n - i);
+	}
+
+	void minMaxFloatSSE2(const double* a, size_t n, double& mn, double& mx)
+	{
+		if (n < 2) { minMaxFloatScalar(a, n, mn, mx); return; }
+		__m128d vmin = _mm_loadu_pd(a), vmax = vmin;
+		__m128d nan = _mm_cmpunord_pd(vmin, vmin);
+		size_t i = 2;
+		for (; i + 2 <= n; i += 2) {
+			__m128d v = _mm_loadu_pd(a + i);
+			vmin = _mm_min_pd(vmin, v);
+			vmax = _mm_max_pd(vmax, v);
+			nan = _mm_or_pd(nan, _mm_cmpunord_pd(v, v));
+		}
+		if (_mm_movemask_pd(nan) != 0) {
+			mn = mx = std::numeric_limits<double>::quiet_NaN();
+			return;
+		}
+		double lmin[2], lmax[2];
+		_mm_storeu_pd(lmin, vmin);
+		_mm_storeu_pd(lmax, vmax);
+		mn = std::min(lmin[0], lmin[1]);
+		mx = std::max(lmax[0], lmax[1]);
+		if (i < n) {
+			double tmn, tmx;
+			minMaxFloatScalar(a + i, n - i, tmn, tmx);
+			if (tmn != tmn)
+				mn = mx = tmn;
+			else {
+				mn = std::min(mn, tmn);
+				mx = std::max(mx, tmx);
+			}
+		}
+	}
+
+	double dotFloatSSE2(const double* a, const double* b, size_t n)
+	{
+		__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+			acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+		return lanes[0] + lanes[1] + dotFloatScalar(a + i, b + i, n - i);
+	}
+
+	void addIntegerSSE2(const stutskInteger* a, const stutskInteger* b, stutskInteger* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+			_mm_storeu_si128((__m128i*)(r + i), _mm_add_epi64(
+				_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+		addIntegerScalar(a + i, b + i, r + i, n - i);
+	}
+
+	void addFloatSSE2(const double* a, const double* b, double* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+			_mm_storeu_pd(r + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		addFloatScalar(a + i, b + i, r + i, n - i);
+	}
+
+	void mulFloatSSE2(const double* a, const double* b, double* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+			_mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		mulFloatScalar(a + i, b + i, r + i, n - i);
+	}
+
+	void scaleFloatSSE2(const double* a, double f, double* r, size_t n)
+	{
+		__m128d vf = _mm_set1_pd(f);
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+			_mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), vf));
+		scaleFloatScalar(a + i, f, r + i, n - i);
+	}
+
+	void compareFloatSSE2(const double* a, double v, signed char* r, size_t n)
+	{
+		__m128d vv = _mm_set1_pd(v);
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2) {
+			__m128d x = _mm_loadu_pd(a + i);
+			// All-ones masks are -1, so (x > v) - (x < v) gives the negated sign
+			__m128i sign = _mm_sub_epi64(_mm_castpd_si128(_mm_cmpgt_pd(x, vv)),
+				_mm_castpd_si128(_mm_cmplt_pd(x, vv)));
+			stutskInteger lanes[2];
+			_mm_storeu_si128((__m128i*)lanes, sign);
+			int unordered = _mm_movemask_pd(_mm_cmpunord_pd(x, vv));
+			r[i] = (unordered & 1) ? UNORDERED : (signed char)-lanes[0];
+			r[i + 1] = (unordered & 2) ? UNORDERED : (signed char)-lanes[1];
+		}
+		compareFloatScalar(a + i, v, r + i, n - i);
+	}
+
+	// ------------------------- AVX2 KERNELS --------------------------------- //
+
+	AVX2_KERNEL stutskInteger sumIntegerAVX2(const stutskInteger* a, size_t n)
+	{
+		__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i*)(a + i)));
+			acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i*)(a + i + 4)));
+		}
+		stutskInteger lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+		return (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+			sumIntegerScalar(a + i, n - i);
+	}
+
+	AVX2_KERNEL double sumFloatAVX2(const double* a, size_t n)
+	{
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+			acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumFloatScalar(a + i, n - i);
+	}
+
+	AVX2_KERNEL void minMaxIntegerAVX2(const stutskInteger* a, size_t n,
+		stutskInteger& mn, stutskInteger& mx)
+	{
+		if (n < 4) { minMaxIntegerScalar(a, n, mn, mx); return; }
+		__m256i vmin = _mm256_loadu_si256((const __m256i*)a), vmax = vmin;
+		size_t i = 4;
+		for (; i + 4 <= n; i += 4) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+			vmin = _mm256_blendv_epi8(vmin, v, _mm256_cmpgt_epi64(vmin, v));
+			vmax = _mm256_blendv_epi8(vmax, v, _mm256_cmpgt_epi64(v, vmax));
+		}
+		stutskInteger lmin[4], lmax[4];
+		_mm256_storeu_si256((__m256i*)lmin, vmin);
+		_mm256_storeu_si256((__m256i*)lmax, vmax);
+		mn = *std::min_element(lmin, lmin + 4);
+		mx = *std::max_element(lmax, lmax + 4);
+		for (; i < n; ++i) {
+			if (a[i] < mn) mn = a[i];
+			if (a[i] > mx) mx = a[i];
+		}
+	}
+
+	AVX2_KERNEL void minMaxFloatAVX2(const double* a, size_t n, double& mn, double& mx)
+	{
+		if (n < 4) { minMaxFloatScalar(a, n, mn, mx); return; }
+		__m256d vmin = _mm256_loadu_pd(a), vmax = vmin;
+		__m256d nan = _mm256_cmp_pd(vmin, vmin, _CMP_UNORD_Q);
+		size_t i = 4;
+		for (; i + 4 <= n; i += 4) {
+			__m256d v = _mm256_loadu_pd(a + i);
+			vmin = _mm256_min_pd(vmin, v);
+			vmax = _mm256_max_pd(vmax, v);
+			nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+		}
+		if (_mm256_movemask_pd(nan) != 0) {
+			mn = mx = std::numeric_limits<double>::quiet_NaN();
+			return;
+		}
+		double lmin[4], lmax[4];
+		_mm256_storeu_pd(lmin, vmin);
+		_mm256_storeu_pd(lmax, vmax);
+		mn = *std::min_element(lmin, lmin + 4);
+		mx = *std::max_element(lmax, lmax + 4);
+		if (i < n) {
+			double tmn, tmx;
+			minMaxFloatScalar(a + i, n - i, tmn, tmx);
+			if (tmn != tmn)
+				mn = mx = tmn;
+			else {
+				mn = std::min(mn, tmn);
+				mx = std::max(mx, tmx);
+			}
+		}
+	}
+
+	AVX2_KERNEL double dotFloatAVX2(const double* a, const double* b, size_t n)
+	{
+		__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+			acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotFloatScalar(a + i, b + i, n - i);
+	}
+
+	AVX2_KERNEL void addIntegerAVX2(const stutskInteger* a, const stutskInteger* b,
+		stutskInteger* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_si256((__m256i*)(r + i), _mm256_add_epi64(
+				_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+		addIntegerScalar(a + i, b + i, r + i, n - i);
+	}
+
+	AVX2_KERNEL void addFloatAVX2(const double* a, const double* b, double* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		addFloatScalar(a + i, b + i, r + i, n - i);
+	}
+
+	AVX2_KERNEL void mulFloatAVX2(const double* a, const double* b, double* r, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		mulFloatScalar(a + i, b + i, r + i, n - i);
+	}
+
+	AVX2_KERNEL void scaleFloatAVX2(const double* a, double f, double* r, size_t n)
+	{
+		__m256d vf = _mm256_set1_pd(f);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), vf));
+		scaleFloatScalar(a + i, f, r + i, n - i);
+	}
+
+	AVX2_KERNEL void compareIntegerAVX2(const stutskInteger* a, stutskInteger v, signed char* r, size_t n)
+	{
+		__m256i vv = _mm256_set1_epi64x(v);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i sign = _mm256_sub_epi64(_mm256_cmpgt_epi64(x, vv), _mm256_cmpgt_epi64(vv, x));
+			stutskInteger lanes[4];
+			_mm256_storeu_si256((__m256i*)lanes, sign);
+			for (int j = 0; j < 4; ++j) r[i + j] = (signed char)-lanes[j];
+		}
+		compareIntegerScalar(a + i, v, r + i, n - i);
+	}
+
+	AVX2_KERNEL void compareFloatAVX2(const double* a, double v, signed char* r, size_t n)
+	{
+		__m256d vv = _mm256_set1_pd(v);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256d x = _mm256_loadu_pd(a + i);
+			__m256i sign = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_cmp_pd(x, vv, _CMP_GT_OQ)),
+				_mm256_castpd_si256(_mm256_cmp_pd(x, vv, _CMP_LT_OQ)));
+			stutskInteger lanes[4];
+			_mm256_storeu_si256((__m256i*)lanes, sign);
+			int unordered = _mm256_movemask_pd(_mm256_cmp_pd(x, vv, _CMP_UNORD_Q));
+			for (int j = 0; j < 4; ++j)
+				r[i + j] = (unordered & (1 << j)) ? UNORDERED : (signed char)-lanes[j];
+		}
+		compareFloatScalar(a + i, v, r + i, n - i);
+	}
+#endif
+
+	// ------------------------- DISPATCH ------------------------------------- //
+
+	struct VectorKernels {
+		stutskInteger (*sumInteger)(const stutskInteger*, size_t);
+		double (*sumFloat)(const double*, size_t);
+		void (*minMaxInteger)(const stutskInteger*, size_t, stutskInteger&, stutskInteger&);
+		void (*minMaxFloat)(const double*, size_t, double&, double&);
+		stutskInteger (*dotInteger)(const stutskInteger*, const stutskInteger*, size_t);
+		double (*dotFloat)(const double*, const double*, size_t);
+		void (*addInteger)(const stutskInteger*, const stutskInteger*, stutskInteger*, size_t);
+		void (*mulInteger)(const stutskInteger*, const stutskInteger*, stutskInteger*, size_t);
+		void (*addFloat)(const double*, const double*, double*, size_t);
+		void (*mulFloat)(const double*, const double*, double*, size_t);
+		void (*scaleFloat)(const double*, double, double*, size_t);
+		void (*compareInteger)(const stutskInteger*, stutskInteger, signed char*, size_t);
+		void (*compareFloat)(const double*, double, signed char*, size_t);
+	};
+
+	VectorKernels selectKernels()
+	{
+		VectorKernels k = {
+			sumIntegerScalar, sumFloatScalar, minMaxIntegerScalar, minMaxFloatScalar,
+			dotIntegerScalar, dotFloatScalar, addIntegerScalar, mulIntegerScalar,
+			addFloatScalar, mulFloatScalar, scaleFloatScalar,
+			compareIntegerScalar, compareFloatScalar
+		};
+#ifdef STUTSK_X86_SIMD
+		// There are no 64-bit integer multiplications or comparisons in SSE2
+		k.sumInteger = sumIntegerSSE2;
+		k.sumFloat = sumFloatSSE2;
+		k.minMaxFloat = minMaxFloatSSE2;
+		k.dotFloat = dotFloatSSE2;
+		k.addInteger = addIntegerSSE2;
+		k.addFloat = addFloatSSE2;
+		k.mulFloat = mulFloatSSE2;
+		k.scaleFloat = scaleFloatSSE2;
+		k.compareFloat = compareFloatSSE2;
+
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			k.sumInteger = sumIntegerAVX2;
+			k.sumFloat = sumFloatAVX2;
+			k.minMaxInteger = minMaxIntegerAVX2;
+			k.minMaxFloat = minMaxFloatAVX2;
+			k.dotFloat = dotFloatAVX2;
+			k.addInteger = addIntegerAVX2;
+			k.addFloat = addFloatAVX2;
+			k.mulFloat = mulFloatAVX2;
+			k.scaleFloat = scaleFloatAVX2;
+			k.compareInteger = compareIntegerAVX2;
+			k.compareFloat = compareFloatAVX2;
+		}
+#endif
+		return k;
+	}
+
+	const VectorKernels& kernels()
+	{
+		static const VectorKernels selected = selectKernels();
+		return selected;
+	}
+
+	void checkLengths(const NumericVector& a, const NumericVector& b)
+	{
+		if (a.size() != b.size())
+			throw StutskException(ET_ERROR, "Arrays are not of equal length");
+	}
+
+	void elementwise(Context* context, bool multiply)
+	{
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+		Token token2 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		NumericVector a, b, result;
+		unpackArray(token2, a);
+		unpackArray(token1, b);
+		checkLengths(a, b);
+
+		if (!a.isInteger || !b.isInteger) {
+			a.widen(); b.widen();
+			result.isInteger = false;
+			result.floats.resize(a.size());
+			(multiply ? kernels().mulFloat : kernels().addFloat)
+				(a.floats.data(), b.floats.data(), result.floats.data(), a.size());
+		}
+		else {
+			result.isInteger = true;
+			result.integers.resize(a.size());
+			(multiply ? kernels().mulInteger : kernels().addInteger)
+				(a.integers.data(), b.integers.data(), result.integers.data(), a.size());
+		}
+
+		pushNumericVector(context, result);
+	}
+
+	void minMax(Context* context, bool maximum)
+	{
+		Token token1 = stack_back_safe(context);
+		context->stack.pop_back();
+
+		NumericVector a;
+		unpackArray(token1, a);
+
+		if (a.size() == 0)
+			throw StutskException(ET_ERROR, "Array is empty.");
+
+		if (a.isInteger) {
+			stutskInteger mn, mx;
+			kernels().minMaxInteger(a.integers.data(), a.size(), mn, mx);
+			pushInteger(context, maximum ? mx : mn);
+		}
+		else {
+			double mn, mx;
+			kernels().minMaxFloat(a.floats.data(), a.size(), mn, mx);
+			pushFloat(context, maximum ? mx : mn);
+		}
+	}
+}
+
+void BuiltIns::_f_array_sum(Context* context) {
+	/* arguments: <T_ARRAY values> array_sum
+	   returnvalue: <T_INTEGER>
+	   returnvalue: <T_FLOAT>
+	   description: Returns the sum of all elements of `values`.
+	   notes: Result is an integer if all the elements are integers. Floating point arrays are
+	     summed in double precision.
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	NumericVector a;
+	unpackArray(token1, a);
+
+	if (a.isInteger)
+		pushInteger(context, kernels().sumInteger(a.integers.data(), a.size()));
+	else
+		pushFloat(context, kernels().sumFloat(a.floats.data(), a.size()));
+}
+
+void BuiltIns::_f_array_min(Context* context) {
+	/* arguments: <T_ARRAY values> array_min
+	   returnvalue: <T_INTEGER>
+	   returnvalue: <T_FLOAT>
+	   description: Returns the lowest numerical value in `values`.
+	   notes: Unlike `min`, it returns the value converted to a number, not the element itself.
+	     The result is NaN if any of the elements is NaN.
+	*/
+	minMax(context, false);
+}
+
+void BuiltIns::_f_array_max(Context* context) {
+	/* arguments: <T_ARRAY values> array_max
+	   returnvalue: <T_INTEGER>
+	   returnvalue: <T_FLOAT>
+	   description: Returns the highest numerical value in `values`.
+	   notes: Unlike `max`, it returns the value converted to a number, not the element itself.
+	     The result is NaN if any of the elements is NaN.
+	*/
+	minMax(context, true);
+}
+
+void BuiltIns::_f_array_dot(Context* context) {
+	/* arguments: <T_ARRAY a> <T_ARRAY b> array_dot
+	   returnvalue: <T_INTEGER>
+	   returnvalue: <T_FLOAT>
+	   description: Returns the dot product of two arrays of equal length.
+	   notes:
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	NumericVector a, b;
+	unpackArray(token2, a);
+	unpackArray(token1, b);
+	checkLengths(a, b);
+
+	if (a.isInteger && b.isInteger)
+		pushInteger(context, kernels().dotInteger(a.integers.data(), b.integers.data(), a.size()));
+	else {
+		a.widen(); b.widen();
+		pushFloat(context, kernels().dotFloat(a.floats.data(), b.floats.data(), a.size()));
+	}
+}
+
+void BuiltIns::_f_array_add(Context* context) {
+	/* arguments: <T_ARRAY a> <T_ARRAY b> array_add
+	   returnvalue: <T_ARRAY>
+	   description: Returns a new array with element-wise sums of `a` and `b`.
+	   notes: Arrays must be of equal length.
+	*/
+	elementwise(context, false);
+}
+
+void BuiltIns::_f_array_mul(Context* context) {
+	/* arguments: <T_ARRAY a> <T_ARRAY b> array_mul
+	   returnvalue: <T_ARRAY>
+	   description: Returns a new array with element-wise products of `a` and `b`.
+	   notes: Arrays must be of equal length.
+	*/
+	elementwise(context, true);
+}
+
+void BuiltIns::_f_array_scale(Context* context) {
+	/* arguments: <T_ARRAY values> <factor> array_scale
+	   returnvalue: <T_ARRAY>
+	   description: Returns a new array with every element of `values` multiplied by `factor`.
+	   notes:
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	stutskInteger i1; stutskFloat f1; string s1;
+	GCDType factorType = giveGCD(token1, f1, i1, s1);
+	if (factorType != NT_INTEGER && factorType != NT_FLOAT)
+		throw StutskException(ET_ERROR, "Token is not a numeric type");
+
+	NumericVector a, result;
+	unpackArray(token2, a);
+
+	if (a.isInteger && factorType == NT_INTEGER) {
+		result.isInteger = true;
+		result.integers.resize(a.size());
+		for (size_t i = 0; i < a.size(); ++i)
+			result.integers[i] = (unsigned long long)a.integers[i] * (unsigned long long)i1;
+	}
+	else {
+		a.widen();
+		result.isInteger = false;
+		result.floats.resize(a.size());
+		kernels().scaleFloat(a.floats.data(),
+			static_cast<double>(factorType == NT_INTEGER ? i1 : f1), result.floats.data(), a.size());
+	}
+
+	pushNumericVector(context, result);
+}
+
+void BuiltIns::_f_array_mask(Context* context) {
+	/* arguments: <T_ARRAY values> <value> <T_STRING operator> array_mask
+	   returnvalue: <T_ARRAY> [ ( <T_BOOL> <T_BOOL> ... ) ]
+	   description: Compares every element of `values` with `value` using a comparison `operator`
+	     (one of "<", ">", "<=", ">=", "==", "!=") and returns an array of results.
+	   notes: `( 1 5 3 ) 2 ">" array_mask` returns `( FALSE TRUE TRUE )`. Comparisons with NaN are
+	     false, except for "!=".
+	*/
+	Token token1 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token2 = stack_back_safe(context);
+	context->stack.pop_back();
+	Token token3 = stack_back_safe(context);
+	context->stack.pop_back();
+
+	OperatorType oper;
+	if (!Operators::readOperator(*giveString(token1), oper))
+		throw StutskException(ET_ERROR, "Invalid comparison operator");
+
+	switch (oper) {
+	case OP_LESSTHAN: case OP_MORETHAN: case OP_LESSTHAN_EQ:
+	case OP_MORETHAN_EQ: case OP_EQ: case OP_NOTEQ:
+		break;
+	default:
+		throw StutskException(ET_ERROR, "Invalid comparison operator");
+	}
+
+	stutskInteger i1; stutskFloat f1; string s1;
+	GCDType valueType = giveGCD(token2, f1, i1, s1);
+	if (valueType != NT_INTEGER && valueType != NT_FLOAT)
+		throw StutskException(ET_ERROR, "Token is not a numeric type");
+
+	NumericVector a;
+	unpackArray(token3, a);
+
+	vector<signed char> signs(a.size());
+	if (a.isInteger && valueType == NT_INTEGER)
+		kernels().compareInteger(a.integers.data(), i1, signs.data(), a.size());
+	else {
+		a.widen();
+		kernels().compareFloat(a.floats.data(),
+			static_cast<double>(valueType == NT_INTEGER ? i1 : f1), signs.data(), a.size());
+	}
+
+	Token newArray(T_ARRAY);
+	newArray.asTokenList = TokenListPtr(new TokenList(a.size(), Token(T_BOOL)));
+
+	TokenList::iterator it = newArray.asTokenList->begin();
+	for (size_t i = 0; i < signs.size(); ++i, ++it) {
+		if (signs[i] == UNORDERED) {
+			it->data.asBool = oper == OP_NOTEQ;
+			continue;
+		}
+		switch (oper) {
+		case OP_LESSTHAN:     it->data.asBool = signs[i] < 0;  break;
+		case OP_MORETHAN:     it->data.asBool = signs[i] > 0;  break;
+		case OP_LESSTHAN_EQ:  it->data.asBool = signs[i] <= 0; break;
+		case OP_MORETHAN_EQ:  it->data.asBool = signs[i] >= 0; break;
+		case OP_EQ:           it->data.asBool = signs[i] == 0; break;
+		default:              it->data.asBool = signs[i] != 0; break;
+		}
+	}
+
+	context->stack.push_back(newArray);
+}